@@ -0,0 +1,861 @@
+/**
+ * @headerfile ConcurrentVanEmdeBoasTree.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief A vEB-tree that can be shared between threads without a global lock
+ */
+
+#ifndef CONCURRENTVANEMDEBOASTREE_H
+#define CONCURRENTVANEMDEBOASTREE_H
+
+#include <atomic>      // For atomic
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t, ptrdiff_t
+#include <functional>  // For hash
+#include <cstdint>     // For uint32_t, uint64_t
+#include <new>         // For placement new, operator new
+#include <stdexcept>   // For out_of_range
+#include <thread>      // For this_thread, thread::id
+#include <type_traits> // For is_integral, is_unsigned
+#include "VanEmdeBoasBits.h"
+
+/**
+ * Policies for how a ConcurrentVanEmdeBoasTree keeps the summaries of its
+ * nodes in step with their clusters.
+ *
+ * LockedSummaries keeps a count of the keys in each cluster and updates the
+ * summary under a spin lock for that cluster whenever the count moves to or
+ * from zero.  The summaries then never leave out a cluster holding a key,
+ * but every insertion and deletion writes to one count per level, and
+ * writers to keys in the same top-level cluster all write to the same one.
+ *
+ * LockFreeSummaries keeps no counts and takes no locks.  A writer only
+ * writes to the bitvector word holding its key, and to the summaries only
+ * when it fills an empty cluster or empties a full one, so writers to keys
+ * in different bitvectors share nothing but summary words they mostly just
+ * read, and scale with the number of cores.  An erase that empties a
+ * cluster clears its summary bit and then looks at the cluster again,
+ * setting the bit back if a key has turned up; an insert sets its key's
+ * bit and then sets the summary bit if it finds it clear.  Since each
+ * writes one word and then reads the other, at least one of them sees the
+ * other's work, and the summary is right again once both are done.  In
+ * between, it may briefly leave out a cluster that has just had a key
+ * inserted.
+ */
+struct LockedSummaries {
+  static const bool kLockFree = false;
+};
+struct LockFreeSummaries {
+  static const bool kLockFree = true;
+};
+
+/**
+ * A class representing a vEB-tree of unsigned integers that any number of
+ * threads can query and update at once.
+ *
+ * The tree is laid out much like a VanEmdeBoasTree with DenseClusters: each
+ * node splits its keys into upper and lower halves, keeps a flat array of
+ * pointers to its clusters along with a summary tree of which clusters are
+ * in use, and once the keys get down to LeafBits bits they're stored in a
+ * plain bitvector.  It differs in two ways.  First, nodes don't hold their
+ * min and max, since keeping those lazily means moving keys between levels
+ * on every insertion, which no reader could follow safely; every key lives
+ * in a bitvector at the bottom.  Second, a cluster, once allocated, stays
+ * allocated until the tree is cleared or destroyed, so a reader never
+ * follows a pointer into freed memory.  The price is that insertion and
+ * deletion touch the summary as well as the cluster at each level, and
+ * that the tree's memory use is its high-water mark.  As with
+ * DenseClusters, each node has room for every possible cluster, so the
+ * universe is limited to 32 bits.
+ *
+ * Readers (contains, successor, predecessor, first, and last) take no locks
+ * and never wait for another thread: they only ever load from atomics, and
+ * each finishes in a bounded number of steps.  Writers set and clear the
+ * bits at the bottom of the tree with atomic fetch_or and fetch_and, and
+ * only the writers that move a cluster between empty and nonempty touch the
+ * summary.  How they do so is up to the Summaries policy.  By default
+ * (LockedSummaries), each cluster has a count of the keys in it plus any
+ * insertions into it still in progress, and the writers that move the
+ * count to or from zero update the summary while holding a spin lock for
+ * that cluster (the top bit of its count), re-reading the count so that
+ * racing writers settle on the right answer.  With LockFreeSummaries,
+ * there are no counts or locks, at the price of weaker guarantees for the
+ * readers; see above.
+ *
+ * Consistency works out as follows:
+ *
+ *   - A key is in the tree exactly when its bit is set.  insert, erase, and
+ *     contains each take effect at the single atomic operation on that bit,
+ *     so they are linearizable.
+ *
+ *   - With LockedSummaries, an inserting writer makes sure that its cluster
+ *     is in the summary of every level above before it sets the key's bit,
+ *     and a cluster only leaves a summary once its count, which covers
+ *     every key still in it, has dropped to zero.  So a summary may briefly
+ *     list a cluster that's empty, which readers skip over, but never
+ *     leaves out one holding a key.
+ *
+ *   - successor, predecessor, first, and last therefore return a key that
+ *     was in the tree when the reader looked at it, and never miss a key
+ *     that was in the tree for the whole call.  They're linearizable as long
+ *     as no key between the argument and the answer is inserted or erased
+ *     during the call; if one is, the answer is as if the reader had looked
+ *     at each key at a different moment, in order.
+ *
+ *   - With LockFreeSummaries, they still only return keys that were in the
+ *     tree, but may also miss a key whose insertion is still in progress,
+ *     or one inserted into a cluster while another thread's erase was
+ *     emptying it, until that erase finishes.  Once writers stop, the tree
+ *     answers exactly.
+ *
+ *   - size is exact whenever no insertion or deletion is in progress.  It
+ *     adds up several counters, so it's slower than the other queries.
+ *     clear, and of course the destructor, must not run alongside anything
+ *     else.
+ */
+template <typename Key = unsigned short,
+          size_t UniverseBits = sizeof(Key) * CHAR_BIT,
+          typename Summaries = LockedSummaries,
+          size_t LeafBits = 8>
+class ConcurrentVanEmdeBoasTree {
+  static_assert(std::is_integral<Key>::value && std::is_unsigned<Key>::value,
+                "ConcurrentVanEmdeBoasTree keys must be unsigned integers.");
+  static_assert(UniverseBits > 0 && UniverseBits <= sizeof(Key) * CHAR_BIT,
+                "ConcurrentVanEmdeBoasTree universe must fit in the key type.");
+  static_assert(UniverseBits <= 32,
+                "ConcurrentVanEmdeBoasTree stores clusters densely, so its "
+                "universe can be at most 32 bits.");
+  static_assert(LeafBits > 0 && LeafBits <= 12,
+                "ConcurrentVanEmdeBoasTree leaves must be 1 to 12 bits wide.");
+public:
+  /**
+   * Typedefs: key_type, value_type
+   * --------------------------------------------------------------------------
+   * Type aliases matching those of the standard ordered sets.
+   */
+  typedef Key key_type;
+  typedef Key value_type;
+
+  /**
+   * Constructor: ConcurrentVanEmdeBoasTree();
+   * Usage: ConcurrentVanEmdeBoasTree<uint32_t> tree;
+   * --------------------------------------------------------------------------
+   * Constructs a new, empty tree.
+   */
+  ConcurrentVanEmdeBoasTree();
+
+  /**
+   * Destructor: ~ConcurrentVanEmdeBoasTree();
+   * Usage: (implicit)
+   * --------------------------------------------------------------------------
+   * Destroys the tree, freeing all memory allocated.  No other thread may be
+   * using the tree.
+   */
+  ~ConcurrentVanEmdeBoasTree();
+
+  /* Since readers may be anywhere in the tree at any time, the tree can be
+   * neither copied nor moved.
+   */
+  ConcurrentVanEmdeBoasTree(const ConcurrentVanEmdeBoasTree&) = delete;
+  ConcurrentVanEmdeBoasTree& operator= (const ConcurrentVanEmdeBoasTree&) = delete;
+
+  /**
+   * bool insert(Key value);
+   * bool erase(Key value);
+   * Usage: tree.insert(137);  tree.erase(137);
+   * --------------------------------------------------------------------------
+   * Inserts or erases the specified value, returning whether the tree
+   * changed.  May be called from any number of threads at once.  insert
+   * throws std::out_of_range if the value lies outside the universe of the
+   * tree; erase just returns false.
+   */
+  bool insert(Key value);
+  bool erase(Key value);
+
+  /**
+   * bool contains(Key value) const;
+   * Usage: if (tree.contains(137)) { ... }
+   * --------------------------------------------------------------------------
+   * Returns whether the specified value is in the tree.
+   */
+  bool contains(Key value) const;
+
+  /**
+   * bool predecessor(Key value, Key& result) const;
+   * bool successor(Key value, Key& result) const;
+   * Usage: Key next;
+   *        if (tree.successor(137, next)) { ... }
+   * --------------------------------------------------------------------------
+   * predecessor finds the largest element of the tree strictly less than the
+   * specified value, and successor finds the smallest element strictly
+   * greater.  Each returns whether there is one and, if so, writes it into
+   * result.  See the class comment for what they promise while the tree is
+   * being changed.
+   */
+  bool predecessor(Key value, Key& result) const;
+  bool successor(Key value, Key& result) const;
+
+  /**
+   * bool first(Key& result) const;
+   * bool last(Key& result) const;
+   * Usage: Key smallest;
+   *        if (tree.first(smallest)) { ... }
+   * --------------------------------------------------------------------------
+   * Find the smallest or largest element of the tree, returning whether the
+   * tree has any elements and, if so, writing the element into result.
+   */
+  bool first(Key& result) const;
+  bool last(Key& result) const;
+
+  /**
+   * size_t size() const;
+   * bool empty() const;
+   * Usage: while (!tree.empty()) { ... }
+   * --------------------------------------------------------------------------
+   * Return the number of elements in the tree and whether it has none.
+   * size is exact only while no insertion or deletion is in progress, while
+   * empty checks for a first element and so is always up to date.
+   */
+  size_t size() const;
+  bool empty() const;
+
+  /**
+   * void clear();
+   * Usage: tree.clear();
+   * --------------------------------------------------------------------------
+   * Removes every element from the tree and frees its clusters.  Unlike
+   * everything else here, this must not be called while any other thread is
+   * using the tree.
+   */
+  void clear();
+
+private:
+  /* A node is a pointer to its summary, which is always allocated, followed
+   * by its table of 2^(upper half of bits) atomic pointers to clusters and,
+   * with LockedSummaries, then by an atomic count for each cluster.  The
+   * counts are ClusterCounts; see below.  Bitvectors are arrays of atomic
+   * words.
+   */
+  struct Node {
+    void* mSummary;
+  };
+  typedef std::atomic<void*>    ClusterPointer;
+  typedef std::atomic<uint32_t> ClusterCount;
+  typedef std::atomic<uint64_t> Word;
+
+  /* The top bit of a cluster's count is its lock; the rest is the number of
+   * keys in the cluster plus the number of insertions into it in progress.
+   * A cluster has at most 2^16 keys, so the two never collide.
+   */
+  static const uint32_t kLocked = uint32_t(1) << 31;
+
+  /* The number of keys in the tree is spread over several counters, each on
+   * its own cache line, with each thread adding to one picked by its id, so
+   * that writers on different threads don't all fight over one counter.  A
+   * single counter may go negative when one thread erases what another
+   * inserted, but they always add up to the size.
+   */
+  static const size_t kNumSizeStripes = 16;
+  static const size_t kCacheLineBytes = 64;
+  struct SizeStripe {
+    std::atomic<ptrdiff_t> mCount;
+    char mPadding[kCacheLineBytes - sizeof(std::atomic<ptrdiff_t>)];
+  };
+
+  /* The root of the tree, which is always allocated, and the number of keys
+   * in it.
+   */
+  void* mRoot;
+  SizeStripe mSize[kNumSizeStripes];
+
+  /* Helper function to find the calling thread's size counter. */
+  std::atomic<ptrdiff_t>& sizeStripe();
+
+  /* Compile-time split of a NumBits-bit tree into the number of bits in its
+   * clusters and in its summary.  As in VanEmdeBoasTree, a bitvector splits
+   * into itself, so that the recursive helpers' copies of the node code
+   * for bitvector sizes, which never run, don't recurse any further.
+   */
+  template <size_t NumBits> struct Split {
+    static const size_t kLow  = NumBits <= LeafBits? NumBits : NumBits / 2;
+    static const size_t kHigh = NumBits <= LeafBits? NumBits : NumBits - NumBits / 2;
+  };
+
+  /* Helper functions to split a value of a NumBits-bit tree into the index
+   * of its cluster and its value within that cluster, and to put them back
+   * together.
+   */
+  template <size_t NumBits> static Key upperBits(Key value);
+  template <size_t NumBits> static Key lowerBits(Key value);
+  template <size_t NumBits> static Key compose(Key upper, Key lower);
+
+  /* Helper function to report whether a value is in the universe. */
+  static bool inUniverse(Key value);
+
+  /* Helper functions to find the pieces of a node of a NumBits-bit tree and
+   * how many bytes it takes up in all.
+   */
+  template <size_t NumBits> static size_t nodeBytes();
+  static ClusterPointer* clusters(Node* node);
+  template <size_t NumBits> static ClusterCount* counts(Node* node);
+
+  /* Helper functions to allocate an empty NumBits-bit tree, which is a
+   * cleared bitvector or a node with an empty summary and no clusters, and
+   * to free one along with everything under it.
+   */
+  template <size_t NumBits> static void* createTree();
+  template <size_t NumBits> static void destroyTree(void* root);
+
+  /* Helper function to find the cluster with the specified index in a node,
+   * allocating it if there isn't one yet.  If two threads race to allocate
+   * the same cluster, the loser frees its copy and uses the winner's.
+   */
+  template <size_t NumBits> static void* installCluster(Node* node, Key index);
+
+  /* Helper functions for writers to a NumBits-bit tree.  recInsert and
+   * recErase return whether the tree changed.  syncSummary makes the summary
+   * agree with the count of the cluster with the specified index, holding
+   * that cluster's lock while it does, and releaseCount takes one off that
+   * count, syncing the summary if that might have emptied the cluster.
+   */
+  template <size_t NumBits> static bool recInsert(Key value, void* root);
+  template <size_t NumBits> static bool recErase(Key value, void* root);
+  template <size_t NumBits> static void syncSummary(Node* node, Key index);
+  template <size_t NumBits> static void releaseCount(Node* node, Key index);
+
+  /* Helper function for writers with LockFreeSummaries to report whether a
+   * NumBits-bit tree looks empty.  A node looks empty when its summary does,
+   * so a cluster the summary lists for a moment too long keeps the node
+   * looking full, which is safe.
+   */
+  template <size_t NumBits> static bool recEmpty(void* root);
+
+  /* Helper functions for readers of a NumBits-bit tree.  Each returns
+   * whether the value it looks for exists and, if so, writes it into result.
+   */
+  template <size_t NumBits> static bool recContains(Key value, void* root);
+  template <size_t NumBits> static bool recFirst(void* root, Key& result);
+  template <size_t NumBits> static bool recLast(void* root, Key& result);
+  template <size_t NumBits>
+  static bool recSuccessor(Key value, void* root, Key& result);
+  template <size_t NumBits>
+  static bool recPredecessor(Key value, void* root, Key& result);
+
+  /* Helper functions for the readers to find the smallest value in the
+   * clusters of a node, starting at the cluster with the specified index and
+   * working up through the summary, or the largest value working down.  A
+   * cluster the summary lists may turn out to be empty if its last key was
+   * just erased, in which case we move on to the next.
+   */
+  template <size_t NumBits>
+  static bool firstFrom(Node* node, Key index, Key& result);
+  template <size_t NumBits>
+  static bool lastFrom(Node* node, Key index, Key& result);
+};
+
+/**** Implementation of ConcurrentVanEmdeBoasTree ****/
+
+/* The tree always has a root, so that no thread ever has to install one. */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::ConcurrentVanEmdeBoasTree()
+  : mRoot(createTree<UniverseBits>()) {
+  for (size_t i = 0; i < kNumSizeStripes; ++i)
+    mSize[i].mCount.store(0, std::memory_order_relaxed);
+}
+
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::~ConcurrentVanEmdeBoasTree() {
+  destroyTree<UniverseBits>(mRoot);
+}
+
+/* The writers do their work recursively and then account for it in the
+ * size, which is why the size can lag behind while they run.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::insert(Key value) {
+  if (!inUniverse(value))
+    throw std::out_of_range("ConcurrentVanEmdeBoasTree::insert: value outside universe.");
+
+  if (!recInsert<UniverseBits>(value, mRoot)) return false;
+  sizeStripe().fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::erase(Key value) {
+  if (!inUniverse(value) || !recErase<UniverseBits>(value, mRoot)) return false;
+  sizeStripe().fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+/* The readers clip their arguments to the universe and recurse.  Values
+ * beyond the universe have no successor, and their predecessor is the
+ * largest value in the tree.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::contains(Key value) const {
+  return inUniverse(value) && recContains<UniverseBits>(value, mRoot);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::successor(Key value,
+                                                                                  Key& result) const {
+  return inUniverse(value) && recSuccessor<UniverseBits>(value, mRoot, result);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::predecessor(Key value,
+                                                                                    Key& result) const {
+  if (!inUniverse(value)) return last(result);
+  return recPredecessor<UniverseBits>(value, mRoot, result);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::first(Key& result) const {
+  return recFirst<UniverseBits>(mRoot, result);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::last(Key& result) const {
+  return recLast<UniverseBits>(mRoot, result);
+}
+
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+size_t ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::size() const {
+  ptrdiff_t result = 0;
+  for (size_t i = 0; i < kNumSizeStripes; ++i)
+    result += mSize[i].mCount.load(std::memory_order_relaxed);
+  return size_t(result);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::empty() const {
+  Key ignored;
+  return !first(ignored);
+}
+
+/* Clearing builds a fresh root before freeing the old tree, so that the
+ * tree is left intact if the allocation fails.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+void ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::clear() {
+  void* root = createTree<UniverseBits>();
+  destroyTree<UniverseBits>(mRoot);
+  mRoot = root;
+  for (size_t i = 0; i < kNumSizeStripes; ++i)
+    mSize[i].mCount.store(0, std::memory_order_relaxed);
+}
+
+/**** Implementation of private helper functions ****/
+
+/* Each thread hashes its id once and remembers the result. */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+std::atomic<ptrdiff_t>& ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::sizeStripe() {
+  static thread_local const size_t stripe =
+    std::hash<std::thread::id>()(std::this_thread::get_id()) % kNumSizeStripes;
+  return mSize[stripe].mCount;
+}
+
+/* Values handed to a NumBits-bit tree never have bits above NumBits set, so
+ * the upper bits are just a shift away.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+Key ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::upperBits(Key value) {
+  return static_cast<Key>(value >> Split<NumBits>::kLow);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+Key ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::lowerBits(Key value) {
+  return static_cast<Key>(value & ((Key(1) << Split<NumBits>::kLow) - 1));
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+Key ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::compose(Key upper, Key lower) {
+  return static_cast<Key>((upper << Split<NumBits>::kLow) | lower);
+}
+
+/* As in VanEmdeBoasTree, the full-width case is checked separately, since
+ * shifting by the width of the type is undefined.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::inUniverse(Key value) {
+  if (UniverseBits == sizeof(Key) * CHAR_BIT) return true;
+  return (value >> (UniverseBits % (sizeof(Key) * CHAR_BIT))) == 0;
+}
+
+/* The cluster pointers are word-aligned right after the Node struct, and the
+ * counts, if any, need less alignment than the pointers before them.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+size_t ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::nodeBytes() {
+  return sizeof(Node) + (size_t(1) << Split<NumBits>::kHigh) *
+                        (sizeof(ClusterPointer) +
+                         (Summaries::kLockFree? 0 : sizeof(ClusterCount)));
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+typename ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::ClusterPointer*
+ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::clusters(Node* node) {
+  return reinterpret_cast<ClusterPointer*>(node + 1);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+typename ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::ClusterCount*
+ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::counts(Node* node) {
+  return reinterpret_cast<ClusterCount*>(clusters(node) +
+                                         (size_t(1) << Split<NumBits>::kHigh));
+}
+
+/* A new tree is a bitvector of cleared words, or a node with a fresh
+ * summary and every cluster missing.  The summary is built first so that,
+ * if allocating the node fails, there's just the summary to clean up.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+void* ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::createTree() {
+  if (NumBits <= LeafBits) {
+    const size_t numWords = VanEmdeBoasBits::numWords(NumBits);
+    Word* words = static_cast<Word*>(::operator new(numWords * sizeof(Word)));
+    for (size_t i = 0; i < numWords; ++i)
+      new (&words[i]) Word(0);
+    return words;
+  }
+
+  void* summary = createTree<Split<NumBits>::kHigh>();
+  Node* node;
+  try {
+    node = static_cast<Node*>(::operator new(nodeBytes<NumBits>()));
+  } catch (...) {
+    destroyTree<Split<NumBits>::kHigh>(summary);
+    throw;
+  }
+
+  node->mSummary = summary;
+  for (size_t i = 0; i < (size_t(1) << Split<NumBits>::kHigh); ++i) {
+    new (&clusters(node)[i]) ClusterPointer(NULL);
+    if (!Summaries::kLockFree) new (&counts<NumBits>(node)[i]) ClusterCount(0);
+  }
+  return node;
+}
+
+/* The atomics are trivially destructible, so freeing a tree just means
+ * freeing its memory, clusters and summary first.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+void ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::destroyTree(void* root) {
+  if (NumBits > LeafBits) {
+    Node* node = static_cast<Node*>(root);
+    for (size_t i = 0; i < (size_t(1) << Split<NumBits>::kHigh); ++i) {
+      void* cluster = clusters(node)[i].load(std::memory_order_relaxed);
+      if (cluster != NULL) destroyTree<Split<NumBits>::kLow>(cluster);
+    }
+    destroyTree<Split<NumBits>::kHigh>(node->mSummary);
+  }
+  ::operator delete(root);
+}
+
+/* Clusters are installed with a compare-and-swap from NULL, which only one
+ * thread can win.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+void* ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::installCluster(Node* node,
+                                                                                        Key index) {
+  void* cluster = createTree<Split<NumBits>::kLow>();
+  void* expected = NULL;
+  if (clusters(node)[index].compare_exchange_strong(expected, cluster))
+    return cluster;
+
+  destroyTree<Split<NumBits>::kLow>(cluster);
+  return expected;
+}
+
+/* Inserting into a bitvector sets the bit and reports whether it was clear.
+ * With LockedSummaries, inserting into a node announces the insertion in
+ * the cluster's count, makes sure the summary lists the cluster, and only
+ * then inserts into the cluster, so that a reader that can see the new key
+ * can also find it.  With LockFreeSummaries, it inserts into the cluster
+ * first and then checks the summary, which is what lets a racing erase
+ * that has just cleared the summary bit either see the key or be seen.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::recInsert(Key value, void* root) {
+  if (NumBits <= LeafBits) {
+    const uint64_t bit = uint64_t(1) << (value % VanEmdeBoasBits::kWordBits);
+    Word& word = static_cast<Word*>(root)[value / VanEmdeBoasBits::kWordBits];
+    return (word.fetch_or(bit) & bit) == 0;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  const Key index = upperBits<NumBits>(value);
+  void* cluster = clusters(node)[index].load();
+  if (cluster == NULL) cluster = installCluster<NumBits>(node, index);
+
+  if (Summaries::kLockFree) {
+    if (!recInsert<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster))
+      return false;
+    if (!recContains<Split<NumBits>::kHigh>(index, node->mSummary))
+      recInsert<Split<NumBits>::kHigh>(index, node->mSummary);
+    return true;
+  }
+
+  /* If the cluster's lock was free when we added ourselves to its count,
+   * then whoever takes the lock next will see our insertion and leave the
+   * cluster in the summary.  In that case, if the summary already lists the
+   * cluster, it will go on doing so until we're done.  Otherwise we have to
+   * take the lock and fix the summary ourselves.
+   */
+  const uint32_t count = counts<NumBits>(node)[index].fetch_add(1);
+  if ((count & kLocked) != 0 ||
+      !recContains<Split<NumBits>::kHigh>(index, node->mSummary))
+    syncSummary<NumBits>(node, index);
+
+  if (recInsert<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster))
+    return true;
+
+  /* The value was already there, so take back the announcement. */
+  releaseCount<NumBits>(node, index);
+  return false;
+}
+
+/* Erasing works the other way around: clear the bit, and then, if that
+ * emptied the cluster, take it out of the summary.  With LockFreeSummaries,
+ * we then look at the cluster again in case a key went into it meanwhile,
+ * and if one did, put the cluster back.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::recErase(Key value, void* root) {
+  if (NumBits <= LeafBits) {
+    const uint64_t bit = uint64_t(1) << (value % VanEmdeBoasBits::kWordBits);
+    Word& word = static_cast<Word*>(root)[value / VanEmdeBoasBits::kWordBits];
+    return (word.fetch_and(~bit) & bit) != 0;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  const Key index = upperBits<NumBits>(value);
+  void* cluster = clusters(node)[index].load();
+  if (cluster == NULL ||
+      !recErase<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster))
+    return false;
+
+  if (Summaries::kLockFree) {
+    if (recEmpty<Split<NumBits>::kLow>(cluster)) {
+      recErase<Split<NumBits>::kHigh>(index, node->mSummary);
+      if (!recEmpty<Split<NumBits>::kLow>(cluster))
+        recInsert<Split<NumBits>::kHigh>(index, node->mSummary);
+    }
+    return true;
+  }
+
+  releaseCount<NumBits>(node, index);
+  return true;
+}
+
+/* Under the cluster's lock, the count can still go up and down, but every
+ * writer that moves it to or from zero will wait for the lock and sync the
+ * summary again afterwards.  So whatever we see here, the summary ends up
+ * agreeing with the count once the last of those writers is done.  Both
+ * the insertion and the deletion are no-ops if the summary already agrees.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+void ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::syncSummary(Node* node,
+                                                                                    Key index) {
+  ClusterCount& count = counts<NumBits>(node)[index];
+  while ((count.fetch_or(kLocked) & kLocked) != 0)
+    std::this_thread::yield();
+
+  if ((count.load() & ~kLocked) != 0)
+    recInsert<Split<NumBits>::kHigh>(index, node->mSummary);
+  else
+    recErase<Split<NumBits>::kHigh>(index, node->mSummary);
+
+  count.fetch_and(~kLocked);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+void ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::releaseCount(Node* node,
+                                                                                     Key index) {
+  const uint32_t count = counts<NumBits>(node)[index].fetch_sub(1);
+  if ((count & ~kLocked) == 1) syncSummary<NumBits>(node, index);
+}
+
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::recEmpty(void* root) {
+  if (NumBits <= LeafBits) {
+    const Word* words = static_cast<Word*>(root);
+    for (size_t i = 0; i < VanEmdeBoasBits::numWords(NumBits); ++i)
+      if (words[i].load() != 0) return false;
+    return true;
+  }
+  return recEmpty<Split<NumBits>::kHigh>(static_cast<Node*>(root)->mSummary);
+}
+
+/* Lookups just follow the value down to its bit. */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::recContains(Key value, void* root) {
+  if (NumBits <= LeafBits) {
+    const Word& word = static_cast<Word*>(root)[value / VanEmdeBoasBits::kWordBits];
+    return (word.load() >> (value % VanEmdeBoasBits::kWordBits)) & 1;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  void* cluster = clusters(node)[upperBits<NumBits>(value)].load();
+  return cluster != NULL &&
+         recContains<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster);
+}
+
+/* The smallest value in a bitvector is its lowest set bit.  In a node, it's
+ * the smallest value of the first cluster the summary lists that still has
+ * anything in it.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::recFirst(void* root, Key& result) {
+  if (NumBits <= LeafBits) {
+    const Word* words = static_cast<Word*>(root);
+    for (size_t i = 0; i < VanEmdeBoasBits::numWords(NumBits); ++i) {
+      const uint64_t bits = words[i].load();
+      if (bits != 0) {
+        result = Key(i * VanEmdeBoasBits::kWordBits +
+                     VanEmdeBoasBits::lowestSetBit(bits));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  Key index;
+  return recFirst<Split<NumBits>::kHigh>(node->mSummary, index) &&
+         firstFrom<NumBits>(node, index, result);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::recLast(void* root, Key& result) {
+  if (NumBits <= LeafBits) {
+    const Word* words = static_cast<Word*>(root);
+    for (size_t i = VanEmdeBoasBits::numWords(NumBits); i-- > 0; ) {
+      const uint64_t bits = words[i].load();
+      if (bits != 0) {
+        result = Key(i * VanEmdeBoasBits::kWordBits +
+                     VanEmdeBoasBits::highestSetBit(bits));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  Key index;
+  return recLast<Split<NumBits>::kHigh>(node->mSummary, index) &&
+         lastFrom<NumBits>(node, index, result);
+}
+
+/* The successor of a value in a bitvector is the next set bit after it.  In
+ * a node, it's the successor within the value's own cluster if there is
+ * one, and otherwise the smallest value in the clusters after that.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::recSuccessor(Key value, void* root,
+                                                                                     Key& result) {
+  if (NumBits <= LeafBits) {
+    const size_t from = size_t(value) + 1;
+    if (from >= (size_t(1) << NumBits)) return false;
+
+    const Word* words = static_cast<Word*>(root);
+    size_t i = from / VanEmdeBoasBits::kWordBits;
+    uint64_t bits = words[i].load() &
+                    (~uint64_t(0) << (from % VanEmdeBoasBits::kWordBits));
+    while (bits == 0) {
+      if (++i == VanEmdeBoasBits::numWords(NumBits)) return false;
+      bits = words[i].load();
+    }
+    result = Key(i * VanEmdeBoasBits::kWordBits +
+                 VanEmdeBoasBits::lowestSetBit(bits));
+    return true;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  Key index = upperBits<NumBits>(value);
+  void* cluster = clusters(node)[index].load();
+  Key lower;
+  if (cluster != NULL &&
+      recSuccessor<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster, lower)) {
+    result = compose<NumBits>(index, lower);
+    return true;
+  }
+
+  return recSuccessor<Split<NumBits>::kHigh>(index, node->mSummary, index) &&
+         firstFrom<NumBits>(node, index, result);
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::recPredecessor(Key value, void* root,
+                                                                                       Key& result) {
+  if (NumBits <= LeafBits) {
+    if (value == 0) return false;
+    const size_t to = size_t(value) - 1;
+
+    const Word* words = static_cast<Word*>(root);
+    size_t i = to / VanEmdeBoasBits::kWordBits;
+    uint64_t bits = words[i].load() &
+                    (~uint64_t(0) >> (VanEmdeBoasBits::kWordBits - 1 -
+                                      to % VanEmdeBoasBits::kWordBits));
+    while (bits == 0) {
+      if (i-- == 0) return false;
+      bits = words[i].load();
+    }
+    result = Key(i * VanEmdeBoasBits::kWordBits +
+                 VanEmdeBoasBits::highestSetBit(bits));
+    return true;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  Key index = upperBits<NumBits>(value);
+  void* cluster = clusters(node)[index].load();
+  Key lower;
+  if (cluster != NULL &&
+      recPredecessor<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster, lower)) {
+    result = compose<NumBits>(index, lower);
+    return true;
+  }
+
+  return recPredecessor<Split<NumBits>::kHigh>(index, node->mSummary, index) &&
+         lastFrom<NumBits>(node, index, result);
+}
+
+/* Each step of these loops moves on to a later (or earlier) cluster, so they
+ * take at most one step per cluster, however the tree changes meanwhile.
+ */
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::firstFrom(Node* node, Key index,
+                                                                                  Key& result) {
+  do {
+    void* cluster = clusters(node)[index].load();
+    Key lower;
+    if (cluster != NULL && recFirst<Split<NumBits>::kLow>(cluster, lower)) {
+      result = compose<NumBits>(index, lower);
+      return true;
+    }
+  } while (recSuccessor<Split<NumBits>::kHigh>(index, node->mSummary, index));
+  return false;
+}
+template <typename Key, size_t UniverseBits, typename Summaries, size_t LeafBits>
+template <size_t NumBits>
+bool ConcurrentVanEmdeBoasTree<Key, UniverseBits, Summaries, LeafBits>::lastFrom(Node* node, Key index,
+                                                                                 Key& result) {
+  do {
+    void* cluster = clusters(node)[index].load();
+    Key lower;
+    if (cluster != NULL && recLast<Split<NumBits>::kLow>(cluster, lower)) {
+      result = compose<NumBits>(index, lower);
+      return true;
+    }
+  } while (recPredecessor<Split<NumBits>::kHigh>(index, node->mSummary, index));
+  return false;
+}
+
+#endif // CONCURRENTVANEMDEBOASTREE_H
@@ -0,0 +1,305 @@
+/**
+ * @headerfile FrozenVanEmdeBoasTree.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief A compact, read-only vEB-tree for sets that have stopped changing
+ */
+
+#ifndef FROZENVANEMDEBOASTREE_H
+#define FROZENVANEMDEBOASTREE_H
+
+#include <algorithm>   // For binary_search, lower_bound, upper_bound
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t
+#include <cstdint>     // For uint64_t
+#include <type_traits> // For is_integral, is_unsigned
+#include <utility>     // For move
+#include <vector>      // For vector
+#include "VanEmdeBoasFile.h"
+
+/**
+ * A class representing a read-only vEB-tree of unsigned integers, laid out
+ * in one contiguous buffer in the format of VanEmdeBoasFile.h.  Only the
+ * 256-bit blocks with something in them are stored, each with a running
+ * count in place of any pointers, so a set costs about 40 bytes per run of
+ * 256 values that has any values in it, rather than a node per cluster
+ * plus the unused slots of every cluster table.  Queries go down one block
+ * per eight bits of the universe.
+ *
+ * That pays off when values cluster: 10,000 64-bit keys three apart take
+ * about 5KB.  Values spread thinly over a wide universe each need a block
+ * of their own on most levels, though, which for random 64-bit keys comes
+ * to some 240 bytes a key, more than a tree with HashedClusters holds.  So
+ * whenever a sorted array of the values would be smaller than the blocks,
+ * the tree keeps that instead, and queries bisect it; 10,000 random 32-bit
+ * keys then take 40KB, where a VanEmdeBoasTree with dense tables holds some
+ * 21MB (see VanEmdeBoasTree::memory_usage to compare).  Neither form saves
+ * anything over a tree of 16-bit keys holding more than a couple of
+ * thousand values, whose bitvectors are already as dense as the blocks;
+ * freezing one of those only makes it read-only.
+ *
+ * The usual way to get one is VanEmdeBoasTree::freeze.  The blocks are the
+ * same structure MappedVanEmdeBoasTree queries straight out of a saved file,
+ * except that the tree owns its buffer and so can be copied and moved.
+ * Since nothing is ever written, any number of threads may query the same
+ * tree at once.
+ */
+template <typename Key = unsigned short,
+          size_t UniverseBits = sizeof(Key) * CHAR_BIT>
+class FrozenVanEmdeBoasTree {
+  static_assert(std::is_integral<Key>::value && std::is_unsigned<Key>::value,
+                "FrozenVanEmdeBoasTree keys must be unsigned integers.");
+  static_assert(UniverseBits > 0 && UniverseBits <= sizeof(Key) * CHAR_BIT,
+                "FrozenVanEmdeBoasTree universe must fit in the key type.");
+public:
+  /* Standard container typedefs. */
+  typedef Key         key_type;
+  typedef Key         value_type;
+  typedef std::size_t size_type;
+
+  /**
+   * Constructors: FrozenVanEmdeBoasTree();
+   *               FrozenVanEmdeBoasTree(InputIterator begin, InputIterator end);
+   * Usage: FrozenVanEmdeBoasTree<uint32_t> frozen = tree.freeze();
+   * --------------------------------------------------------------------------
+   * Make a tree that's empty, or that holds the values in [begin, end),
+   * which must be distinct, in increasing order, and inside the universe.
+   */
+  FrozenVanEmdeBoasTree();
+  template <typename InputIterator>
+  FrozenVanEmdeBoasTree(InputIterator begin, InputIterator end);
+
+  /**
+   * Copy and move functions.
+   * Usage: FrozenVanEmdeBoasTree<uint32_t> copy = frozen;
+   * --------------------------------------------------------------------------
+   * Copying copies the buffer; moving hands it over, leaving the source
+   * empty.
+   */
+  FrozenVanEmdeBoasTree(const FrozenVanEmdeBoasTree& other);
+  FrozenVanEmdeBoasTree(FrozenVanEmdeBoasTree&& other) noexcept;
+  FrozenVanEmdeBoasTree& operator= (FrozenVanEmdeBoasTree other) noexcept;
+
+  /**
+   * bool contains(Key value) const;
+   * Usage: if (frozen.contains(137)) { ... }
+   * --------------------------------------------------------------------------
+   * Returns whether the specified value is in the tree.
+   */
+  bool contains(Key value) const;
+
+  /**
+   * bool predecessor(Key value, Key& result) const;
+   * bool successor(Key value, Key& result) const;
+   * Usage: Key next;
+   *        if (frozen.successor(137, next)) { ... }
+   * --------------------------------------------------------------------------
+   * predecessor finds the largest element of the tree strictly less than the
+   * specified value, and successor finds the smallest element strictly
+   * greater.  Each returns whether there is one and, if so, writes it into
+   * result.
+   */
+  bool predecessor(Key value, Key& result) const;
+  bool successor(Key value, Key& result) const;
+
+  /**
+   * bool first(Key& result) const;
+   * bool last(Key& result) const;
+   * Usage: Key smallest;
+   *        if (frozen.first(smallest)) { ... }
+   * --------------------------------------------------------------------------
+   * Find the smallest or largest element of the tree, returning whether the
+   * tree has any elements and, if so, writing the element into result.
+   */
+  bool first(Key& result) const;
+  bool last(Key& result) const;
+
+  /**
+   * template <typename Function> void for_each(Function fn) const;
+   * Usage: frozen.for_each([&](Key value) { ... });
+   * --------------------------------------------------------------------------
+   * Calls fn on every element of the tree in increasing order.
+   */
+  template <typename Function> void for_each(Function fn) const;
+
+  /**
+   * size_t size() const;
+   * bool empty() const;
+   * Usage: if (!frozen.empty()) { ... }
+   * --------------------------------------------------------------------------
+   * Return the number of elements in the tree and whether it has none.
+   */
+  size_t size() const;
+  bool empty() const;
+
+  /**
+   * size_t memory_usage() const;
+   * Usage: std::cout << frozen.memory_usage() << " bytes" << std::endl;
+   * --------------------------------------------------------------------------
+   * Returns the number of bytes the tree holds on the heap.
+   */
+  size_t memory_usage() const;
+
+private:
+  /* The saved tree and a view of it, or, if they'd be smaller, the sorted
+   * values with mWords left empty.
+   */
+  std::vector<uint64_t> mWords;
+  VanEmdeBoasFile::View mView;
+  std::vector<Key> mKeys;
+
+  /* Helper function to point the view at the buffer. */
+  void makeView();
+};
+
+/**** Implementation of FrozenVanEmdeBoasTree ****/
+
+/* An empty tree is still a buffer holding a header, so that every tree has
+ * a valid view.
+ */
+template <typename Key, size_t UniverseBits>
+FrozenVanEmdeBoasTree<Key, UniverseBits>::FrozenVanEmdeBoasTree()
+  : mWords(VanEmdeBoasFile::encode(UniverseBits, static_cast<const Key*>(NULL),
+                                   static_cast<const Key*>(NULL))) {
+  makeView();
+}
+
+/* The values are gathered first, since the iterators may only go over them
+ * once and both forms are built from them.
+ */
+template <typename Key, size_t UniverseBits>
+template <typename InputIterator>
+FrozenVanEmdeBoasTree<Key, UniverseBits>::FrozenVanEmdeBoasTree(InputIterator begin,
+                                                                InputIterator end)
+  : mKeys(begin, end) {
+  mWords = VanEmdeBoasFile::encode(UniverseBits, mKeys.begin(), mKeys.end());
+  if (!mKeys.empty() &&
+      mKeys.size() * sizeof(Key) < mWords.size() * sizeof(uint64_t)) {
+    mKeys.shrink_to_fit();
+    std::vector<uint64_t>().swap(mWords);
+    return;
+  }
+  std::vector<Key>().swap(mKeys);
+  mWords.shrink_to_fit();
+  makeView();
+}
+
+/* The view points into the buffer, so a copy needs a view of its own. */
+template <typename Key, size_t UniverseBits>
+FrozenVanEmdeBoasTree<Key, UniverseBits>::FrozenVanEmdeBoasTree(const FrozenVanEmdeBoasTree& other)
+  : mWords(other.mWords), mKeys(other.mKeys) {
+  makeView();
+}
+
+/* Moving the buffer leaves its words where they were, so the view still
+ * points at them.  The source gets an empty tree back.
+ */
+template <typename Key, size_t UniverseBits>
+FrozenVanEmdeBoasTree<Key, UniverseBits>::FrozenVanEmdeBoasTree(FrozenVanEmdeBoasTree&& other) noexcept
+  : mWords(std::move(other.mWords)), mView(other.mView), mKeys(std::move(other.mKeys)) {
+  other.mView = VanEmdeBoasFile::View();
+}
+
+/* Assignment is done by copy-and-swap.  Swapping the buffers leaves their
+ * words in place, so the argument's view comes along as it is.
+ */
+template <typename Key, size_t UniverseBits>
+FrozenVanEmdeBoasTree<Key, UniverseBits>&
+FrozenVanEmdeBoasTree<Key, UniverseBits>::operator= (FrozenVanEmdeBoasTree other) noexcept {
+  mWords.swap(other.mWords);
+  mView = other.mView;
+  mKeys.swap(other.mKeys);
+  return *this;
+}
+
+/* A tree that's been moved from, or that keeps sorted values, has no
+ * buffer at all, and its copies get an empty view too.
+ */
+template <typename Key, size_t UniverseBits>
+void FrozenVanEmdeBoasTree<Key, UniverseBits>::makeView() {
+  if (mWords.empty()) return;
+  mView = VanEmdeBoasFile::View(mWords.data(), mWords.size() * sizeof(uint64_t),
+                                UniverseBits);
+}
+
+/* Each query bisects the sorted values if there are any, and otherwise
+ * asks the view, which is empty if the tree is.
+ */
+template <typename Key, size_t UniverseBits>
+bool FrozenVanEmdeBoasTree<Key, UniverseBits>::contains(Key value) const {
+  if (!mKeys.empty()) return std::binary_search(mKeys.begin(), mKeys.end(), value);
+  return mView.contains(value);
+}
+template <typename Key, size_t UniverseBits>
+bool FrozenVanEmdeBoasTree<Key, UniverseBits>::predecessor(Key value, Key& result) const {
+  if (!mKeys.empty()) {
+    typename std::vector<Key>::const_iterator itr =
+      std::lower_bound(mKeys.begin(), mKeys.end(), value);
+    if (itr == mKeys.begin()) return false;
+    result = *--itr;
+    return true;
+  }
+  uint64_t found;
+  if (!mView.predecessor(value, found)) return false;
+  result = Key(found);
+  return true;
+}
+template <typename Key, size_t UniverseBits>
+bool FrozenVanEmdeBoasTree<Key, UniverseBits>::successor(Key value, Key& result) const {
+  if (!mKeys.empty()) {
+    typename std::vector<Key>::const_iterator itr =
+      std::upper_bound(mKeys.begin(), mKeys.end(), value);
+    if (itr == mKeys.end()) return false;
+    result = *itr;
+    return true;
+  }
+  uint64_t found;
+  if (!mView.successor(value, found)) return false;
+  result = Key(found);
+  return true;
+}
+template <typename Key, size_t UniverseBits>
+bool FrozenVanEmdeBoasTree<Key, UniverseBits>::first(Key& result) const {
+  if (!mKeys.empty()) {
+    result = mKeys.front();
+    return true;
+  }
+  uint64_t found;
+  if (!mView.first(found)) return false;
+  result = Key(found);
+  return true;
+}
+template <typename Key, size_t UniverseBits>
+bool FrozenVanEmdeBoasTree<Key, UniverseBits>::last(Key& result) const {
+  if (!mKeys.empty()) {
+    result = mKeys.back();
+    return true;
+  }
+  uint64_t found;
+  if (!mView.last(found)) return false;
+  result = Key(found);
+  return true;
+}
+
+template <typename Key, size_t UniverseBits>
+template <typename Function>
+void FrozenVanEmdeBoasTree<Key, UniverseBits>::for_each(Function fn) const {
+  for (size_t i = 0; i < mKeys.size(); ++i) fn(mKeys[i]);
+  mView.forEach([&](uint64_t value) { fn(Key(value)); });
+}
+
+template <typename Key, size_t UniverseBits>
+size_t FrozenVanEmdeBoasTree<Key, UniverseBits>::size() const {
+  return mKeys.empty()? size_t(mView.size()) : mKeys.size();
+}
+template <typename Key, size_t UniverseBits>
+bool FrozenVanEmdeBoasTree<Key, UniverseBits>::empty() const {
+  return mKeys.empty() && mView.size() == 0;
+}
+
+template <typename Key, size_t UniverseBits>
+size_t FrozenVanEmdeBoasTree<Key, UniverseBits>::memory_usage() const {
+  return mWords.capacity() * sizeof(uint64_t) + mKeys.capacity() * sizeof(Key);
+}
+
+#endif // FROZENVANEMDEBOASTREE_H
@@ -0,0 +1,221 @@
+/**
+ * @headerfile MappedVanEmdeBoasTree.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief A read-only vEB-tree answered straight from a saved file
+ */
+
+#ifndef MAPPEDVANEMDEBOASTREE_H
+#define MAPPEDVANEMDEBOASTREE_H
+
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t
+#include <cstdint>     // For uint64_t
+#include <stdexcept>   // For runtime_error
+#include <string>      // For string
+#include <type_traits> // For is_integral, is_unsigned
+#include "VanEmdeBoasFile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>     // For open
+#include <sys/mman.h>  // For mmap, munmap
+#include <sys/stat.h>  // For fstat
+#include <unistd.h>    // For close
+#define VANEMDEBOAS_HAS_MMAP 1
+#endif
+
+/**
+ * A class representing a read-only vEB-tree of unsigned integers saved by
+ * VanEmdeBoasTree::save, queried in place rather than loaded.
+ *
+ * Opening a file maps it into memory and checks its header, which takes
+ * the same time however many elements the file holds; nothing is read
+ * until a query touches it, and then only the pages on the query's path.
+ * Each query goes down one 256-bit block per eight bits of the universe,
+ * which is four blocks for 32-bit keys; see VanEmdeBoasFile.h for the
+ * format.  The tree can also be pointed at a saved tree that's already in
+ * memory.  Since nothing is ever written, any number of threads may query
+ * the same tree at once.
+ */
+template <typename Key = unsigned short,
+          size_t UniverseBits = sizeof(Key) * CHAR_BIT>
+class MappedVanEmdeBoasTree {
+  static_assert(std::is_integral<Key>::value && std::is_unsigned<Key>::value,
+                "MappedVanEmdeBoasTree keys must be unsigned integers.");
+  static_assert(UniverseBits > 0 && UniverseBits <= sizeof(Key) * CHAR_BIT,
+                "MappedVanEmdeBoasTree universe must fit in the key type.");
+public:
+  /* Standard container typedefs. */
+  typedef Key         key_type;
+  typedef Key         value_type;
+  typedef std::size_t size_type;
+
+  /**
+   * Constructors: explicit MappedVanEmdeBoasTree(const std::string& path);
+   *               MappedVanEmdeBoasTree(const void* data, size_t bytes);
+   * Usage: MappedVanEmdeBoasTree<uint32_t> tree("keys.veb");
+   * --------------------------------------------------------------------------
+   * Make a tree of the one saved in the given file, which is mapped into
+   * memory for as long as the tree lives, or in the given bytes, which must
+   * be aligned to eight bytes and outlive the tree.  Throws
+   * std::runtime_error if the file can't be mapped or doesn't hold a tree
+   * over this universe.  Mapping files is only available on POSIX systems.
+   */
+#ifdef VANEMDEBOAS_HAS_MMAP
+  explicit MappedVanEmdeBoasTree(const std::string& path);
+#endif
+  MappedVanEmdeBoasTree(const void* data, size_t bytes);
+
+  /**
+   * Destructor: ~MappedVanEmdeBoasTree();
+   * Usage: (implicit)
+   * --------------------------------------------------------------------------
+   * Unmaps the file, if the tree mapped one.
+   */
+  ~MappedVanEmdeBoasTree();
+
+  /**
+   * bool contains(Key value) const;
+   * Usage: if (tree.contains(137)) { ... }
+   * --------------------------------------------------------------------------
+   * Returns whether the specified value is in the tree.
+   */
+  bool contains(Key value) const;
+
+  /**
+   * bool predecessor(Key value, Key& result) const;
+   * bool successor(Key value, Key& result) const;
+   * Usage: Key next;
+   *        if (tree.successor(137, next)) { ... }
+   * --------------------------------------------------------------------------
+   * predecessor finds the largest element of the tree strictly less than the
+   * specified value, and successor finds the smallest element strictly
+   * greater.  Each returns whether there is one and, if so, writes it into
+   * result.
+   */
+  bool predecessor(Key value, Key& result) const;
+  bool successor(Key value, Key& result) const;
+
+  /**
+   * bool first(Key& result) const;
+   * bool last(Key& result) const;
+   * Usage: Key smallest;
+   *        if (tree.first(smallest)) { ... }
+   * --------------------------------------------------------------------------
+   * Find the smallest or largest element of the tree, returning whether the
+   * tree has any elements and, if so, writing the element into result.
+   */
+  bool first(Key& result) const;
+  bool last(Key& result) const;
+
+  /**
+   * size_t size() const;
+   * bool empty() const;
+   * Usage: if (!tree.empty()) { ... }
+   * --------------------------------------------------------------------------
+   * Return the number of elements in the tree and whether it has none.
+   */
+  size_t size() const;
+  bool empty() const;
+
+private:
+  /* The mapping, if the tree made one, and the view of the saved tree. */
+  void* mMapping;
+  size_t mMappingBytes;
+  VanEmdeBoasFile::View mView;
+
+  /* Mappings can't be shared, so the tree can't be copied. */
+  MappedVanEmdeBoasTree(const MappedVanEmdeBoasTree&) = delete;
+  MappedVanEmdeBoasTree& operator= (const MappedVanEmdeBoasTree&) = delete;
+};
+
+/**** Implementation of MappedVanEmdeBoasTree ****/
+
+/* The file is mapped read-only and private, and closed again right away,
+ * since the mapping keeps it open.  An empty file can't be mapped, but
+ * isn't a saved tree either.
+ */
+#ifdef VANEMDEBOAS_HAS_MMAP
+template <typename Key, size_t UniverseBits>
+MappedVanEmdeBoasTree<Key, UniverseBits>::MappedVanEmdeBoasTree(const std::string& path)
+  : mMapping(NULL), mMappingBytes(0) {
+  const int file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    throw std::runtime_error("MappedVanEmdeBoasTree: can't open " + path + ".");
+
+  struct stat status;
+  if (::fstat(file, &status) != 0 || status.st_size <= 0) {
+    ::close(file);
+    throw std::runtime_error("MappedVanEmdeBoasTree: can't read " + path + ".");
+  }
+
+  mMappingBytes = size_t(status.st_size);
+  void* mapping = ::mmap(NULL, mMappingBytes, PROT_READ, MAP_PRIVATE, file, 0);
+  ::close(file);
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error("MappedVanEmdeBoasTree: can't map " + path + ".");
+
+  try {
+    mView = VanEmdeBoasFile::View(mapping, mMappingBytes, UniverseBits);
+  } catch (...) {
+    ::munmap(mapping, mMappingBytes);
+    throw;
+  }
+  mMapping = mapping;
+}
+#endif
+
+template <typename Key, size_t UniverseBits>
+MappedVanEmdeBoasTree<Key, UniverseBits>::MappedVanEmdeBoasTree(const void* data, size_t bytes)
+  : mMapping(NULL), mMappingBytes(0), mView(data, bytes, UniverseBits) {}
+
+template <typename Key, size_t UniverseBits>
+MappedVanEmdeBoasTree<Key, UniverseBits>::~MappedVanEmdeBoasTree() {
+#ifdef VANEMDEBOAS_HAS_MMAP
+  if (mMapping != NULL) ::munmap(mMapping, mMappingBytes);
+#endif
+}
+
+template <typename Key, size_t UniverseBits>
+bool MappedVanEmdeBoasTree<Key, UniverseBits>::contains(Key value) const {
+  return mView.contains(value);
+}
+template <typename Key, size_t UniverseBits>
+bool MappedVanEmdeBoasTree<Key, UniverseBits>::predecessor(Key value, Key& result) const {
+  uint64_t found;
+  if (!mView.predecessor(value, found)) return false;
+  result = Key(found);
+  return true;
+}
+template <typename Key, size_t UniverseBits>
+bool MappedVanEmdeBoasTree<Key, UniverseBits>::successor(Key value, Key& result) const {
+  uint64_t found;
+  if (!mView.successor(value, found)) return false;
+  result = Key(found);
+  return true;
+}
+template <typename Key, size_t UniverseBits>
+bool MappedVanEmdeBoasTree<Key, UniverseBits>::first(Key& result) const {
+  uint64_t found;
+  if (!mView.first(found)) return false;
+  result = Key(found);
+  return true;
+}
+template <typename Key, size_t UniverseBits>
+bool MappedVanEmdeBoasTree<Key, UniverseBits>::last(Key& result) const {
+  uint64_t found;
+  if (!mView.last(found)) return false;
+  result = Key(found);
+  return true;
+}
+
+template <typename Key, size_t UniverseBits>
+size_t MappedVanEmdeBoasTree<Key, UniverseBits>::size() const {
+  return size_t(mView.size());
+}
+template <typename Key, size_t UniverseBits>
+bool MappedVanEmdeBoasTree<Key, UniverseBits>::empty() const {
+  return mView.size() == 0;
+}
+
+#endif // MAPPEDVANEMDEBOASTREE_H
@@ -0,0 +1,728 @@
+/**
+ * @headerfile PersistentVanEmdeBoasTree.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief A vEB-tree whose copies share structure until they're written to
+ */
+
+#ifndef PERSISTENTVANEMDEBOASTREE_H
+#define PERSISTENTVANEMDEBOASTREE_H
+
+#include <algorithm>   // For fill
+#include <atomic>      // For atomic
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t
+#include <cstdint>     // For uint64_t
+#include <cstring>     // For memcpy
+#include <new>         // For placement new, operator new
+#include <stdexcept>   // For out_of_range
+#include <type_traits> // For is_integral, is_unsigned
+#include <utility>     // For swap
+#include "VanEmdeBoasBits.h"
+
+/**
+ * A class representing a vEB-tree of unsigned integers that can be copied in
+ * constant time, so that taking a snapshot of it costs nothing up front.
+ *
+ * A copy shares every node with the tree it was copied from.  Each node
+ * keeps a count of how many parents (or trees, for a root) point at it, and
+ * a write only changes nodes whose count is one.  Any shared node on the way
+ * down to the value being written is copied first, with the copy pointing at
+ * the same children as the original, so a write copies just the nodes on its
+ * path that it's the first to touch since the last snapshot.  When a tree
+ * or a copied node lets go of a node, the node's count goes down, and nodes
+ * no longer used by anything are freed then and there.  Memory and time
+ * therefore grow with the number of nodes written since a snapshot, each
+ * costing its node's fan-out, rather than with the number of keys in the
+ * tree.
+ *
+ * The tree is laid out much like a VanEmdeBoasTree with DenseClusters: each
+ * node splits its keys into upper and lower halves, keeps a flat table of
+ * its clusters along with a summary tree of which clusters are in use, and
+ * once the keys get down to LeafBits bits they're stored in a plain
+ * bitvector.  Unlike VanEmdeBoasTree, nodes don't keep their min and max
+ * apart from their clusters, since then almost every write would move a key
+ * between levels and copy far more than its own path.  The price is that
+ * successor and predecessor take O(log U) steps rather than O(log log U),
+ * which for the at most three levels of a 32-bit tree hardly matters.  Note
+ * that each node has room for every possible cluster, so the first write
+ * after a snapshot of a tree with a wide universe copies a sizable root: a
+ * 32-bit tree's root holds 2^16 cluster pointers.
+ *
+ * The counts are atomic, so a snapshot may be handed to other threads and
+ * read, copied, and destroyed there while the original goes on being
+ * written.  As with any other container, a single tree object still must not
+ * be written and used by different threads at once.
+ */
+template <typename Key = unsigned short,
+          size_t UniverseBits = sizeof(Key) * CHAR_BIT,
+          size_t LeafBits = 8>
+class PersistentVanEmdeBoasTree {
+  static_assert(std::is_integral<Key>::value && std::is_unsigned<Key>::value,
+                "PersistentVanEmdeBoasTree keys must be unsigned integers.");
+  static_assert(UniverseBits > 0 && UniverseBits <= sizeof(Key) * CHAR_BIT,
+                "PersistentVanEmdeBoasTree universe must fit in the key type.");
+  static_assert(UniverseBits <= 32,
+                "PersistentVanEmdeBoasTree stores clusters densely, so its "
+                "universe can be at most 32 bits.");
+  static_assert(LeafBits > 0 && LeafBits <= 12,
+                "PersistentVanEmdeBoasTree leaves must be 1 to 12 bits wide.");
+public:
+  /* Standard container typedefs. */
+  typedef Key         key_type;
+  typedef Key         value_type;
+  typedef std::size_t size_type;
+
+  /**
+   * Constructor: PersistentVanEmdeBoasTree();
+   * Usage: PersistentVanEmdeBoasTree<uint32_t> tree;
+   * --------------------------------------------------------------------------
+   * Constructs a new, empty tree.
+   */
+  PersistentVanEmdeBoasTree();
+
+  /**
+   * Destructor: ~PersistentVanEmdeBoasTree();
+   * Usage: (implicit)
+   * --------------------------------------------------------------------------
+   * Lets go of the tree's nodes, freeing any that no other tree shares.
+   */
+  ~PersistentVanEmdeBoasTree();
+
+  /**
+   * Copy functions: PersistentVanEmdeBoasTree(const PersistentVanEmdeBoasTree& other);
+   *                 PersistentVanEmdeBoasTree& operator= (const PersistentVanEmdeBoasTree& other);
+   * PersistentVanEmdeBoasTree snapshot() const;
+   * Usage: PersistentVanEmdeBoasTree<uint32_t> view = tree.snapshot();
+   * --------------------------------------------------------------------------
+   * Make this tree, or a new one, hold the same values as another tree, in
+   * constant time.  The two share their nodes until one of them is written
+   * to.  snapshot is just a more descriptive way to make a copy.
+   */
+  PersistentVanEmdeBoasTree(const PersistentVanEmdeBoasTree& other);
+  PersistentVanEmdeBoasTree& operator= (const PersistentVanEmdeBoasTree& other);
+  PersistentVanEmdeBoasTree snapshot() const;
+
+  /**
+   * Move functions: PersistentVanEmdeBoasTree(PersistentVanEmdeBoasTree&& other) noexcept;
+   *                 PersistentVanEmdeBoasTree& operator= (PersistentVanEmdeBoasTree&& other) noexcept;
+   * Usage: PersistentVanEmdeBoasTree<> one = std::move(two);
+   * --------------------------------------------------------------------------
+   * Make this tree hold the contents of another by taking over its nodes.
+   * The other tree is left empty.
+   */
+  PersistentVanEmdeBoasTree(PersistentVanEmdeBoasTree&& other) noexcept;
+  PersistentVanEmdeBoasTree& operator= (PersistentVanEmdeBoasTree&& other) noexcept;
+
+  /**
+   * bool insert(Key value);
+   * bool erase(Key value);
+   * Usage: tree.insert(137);  tree.erase(137);
+   * --------------------------------------------------------------------------
+   * Inserts or erases the specified value, returning whether the tree
+   * changed.  Only a write that changes the tree copies any nodes.  insert
+   * throws std::out_of_range if the value lies outside the universe of the
+   * tree; erase just returns false.
+   */
+  bool insert(Key value);
+  bool erase(Key value);
+
+  /**
+   * bool contains(Key value) const;
+   * Usage: if (tree.contains(137)) { ... }
+   * --------------------------------------------------------------------------
+   * Returns whether the specified value is in the tree.
+   */
+  bool contains(Key value) const;
+
+  /**
+   * bool predecessor(Key value, Key& result) const;
+   * bool successor(Key value, Key& result) const;
+   * Usage: Key next;
+   *        if (tree.successor(137, next)) { ... }
+   * --------------------------------------------------------------------------
+   * predecessor finds the largest element of the tree strictly less than the
+   * specified value, and successor finds the smallest element strictly
+   * greater.  Each returns whether there is one and, if so, writes it into
+   * result.
+   */
+  bool predecessor(Key value, Key& result) const;
+  bool successor(Key value, Key& result) const;
+
+  /**
+   * bool first(Key& result) const;
+   * bool last(Key& result) const;
+   * Usage: Key smallest;
+   *        if (tree.first(smallest)) { ... }
+   * --------------------------------------------------------------------------
+   * Find the smallest or largest element of the tree, returning whether the
+   * tree has any elements and, if so, writing the element into result.
+   */
+  bool first(Key& result) const;
+  bool last(Key& result) const;
+
+  /**
+   * size_t size() const;
+   * bool empty() const;
+   * Usage: while (!tree.empty()) { ... }
+   * --------------------------------------------------------------------------
+   * Return the number of elements in the tree and whether it has none.
+   */
+  size_t size() const;
+  bool empty() const;
+
+  /**
+   * void clear();
+   * void swap(PersistentVanEmdeBoasTree& other);
+   * Usage: tree.clear();  tree.swap(otherTree);
+   * --------------------------------------------------------------------------
+   * clear removes every element from the tree, and swap exchanges the
+   * contents of two trees, both in constant time.
+   */
+  void clear();
+  void swap(PersistentVanEmdeBoasTree& other);
+
+private:
+  /* Every tree starts with a count of the parents and trees pointing at it.
+   * A bitvector is this header followed by its words.  A node is the header
+   * and a pointer to its summary, which is always allocated, followed by its
+   * table of 2^(upper half of bits) pointers to clusters.  Empty clusters
+   * are NULL and are freed as soon as they empty out.
+   */
+  struct Header {
+    std::atomic<size_t> mRefs;
+  };
+  struct Node {
+    Header mHeader;
+    void* mSummary;
+  };
+
+  /* The root of the tree, or NULL if the tree is empty, and the number of
+   * keys in it.
+   */
+  void* mRoot;
+  size_t mSize;
+
+  /* Compile-time split of a NumBits-bit tree into the number of bits in its
+   * clusters and in its summary.  As in VanEmdeBoasTree, a bitvector splits
+   * into itself, so that the recursive helpers' copies of the node code
+   * for bitvector sizes, which never run, don't recurse any further.
+   */
+  template <size_t NumBits> struct Split {
+    static const size_t kLow  = NumBits <= LeafBits? NumBits : NumBits / 2;
+    static const size_t kHigh = NumBits <= LeafBits? NumBits : NumBits - NumBits / 2;
+  };
+
+  /* Helper functions to split a value of a NumBits-bit tree into the index
+   * of its cluster and its value within that cluster, and to put them back
+   * together.
+   */
+  template <size_t NumBits> static Key upperBits(Key value);
+  template <size_t NumBits> static Key lowerBits(Key value);
+  template <size_t NumBits> static Key compose(Key upper, Key lower);
+
+  /* Helper function to report whether a value is in the universe. */
+  static bool inUniverse(Key value);
+
+  /* Helper functions to find the pieces of a tree of NumBits bits and how
+   * many bytes it takes up in all.
+   */
+  template <size_t NumBits> static size_t treeBytes();
+  static Header& header(void* root);
+  static uint64_t* words(void* root);
+  static void** clusters(Node* node);
+
+  /* Helper functions to allocate an empty tree of NumBits bits, whose count
+   * starts at one; to take another reference to a tree; and to let go of
+   * one, freeing the tree and letting go of everything it points at if that
+   * was the last.
+   */
+  template <size_t NumBits> static void* createTree();
+  static void retain(void* root);
+  template <size_t NumBits> static void release(void* root);
+
+  /* Helper function to make sure the tree of NumBits bits at root belongs to
+   * nothing else, copying it if it's shared.  The caller must own whatever
+   * holds root, so that a count of one really means no one else can reach
+   * the tree.
+   */
+  template <size_t NumBits> static void makeUnique(void*& root);
+
+  /* Helper function to call fn on each cluster of a node of NumBits bits.
+   * It goes by the summary rather than the whole table, which for a wide
+   * universe is mostly empty.
+   */
+  template <size_t NumBits, typename Function>
+  static void forEachCluster(Node* node, Function fn);
+
+  /* Helper functions to insert a value known to be missing from, or erase a
+   * value known to be present in, a tree of NumBits bits, copying whatever
+   * shared nodes they need to change.
+   */
+  template <size_t NumBits> static void recInsert(Key value, void*& root);
+  template <size_t NumBits> static void recErase(Key value, void*& root);
+
+  /* Helper function to report whether a tree of NumBits bits is empty.  A
+   * node is empty when its summary is.
+   */
+  template <size_t NumBits> static bool recEmpty(void* root);
+
+  /* Helper functions for the queries on a nonempty tree of NumBits bits.
+   * Each returns whether the value it looks for exists and, if so, writes
+   * it into result.
+   */
+  template <size_t NumBits> static bool recContains(Key value, void* root);
+  template <size_t NumBits> static Key recFirst(void* root);
+  template <size_t NumBits> static Key recLast(void* root);
+  template <size_t NumBits>
+  static bool recSuccessor(Key value, void* root, Key& result);
+  template <size_t NumBits>
+  static bool recPredecessor(Key value, void* root, Key& result);
+};
+
+/**** Implementation of PersistentVanEmdeBoasTree ****/
+
+/* An empty tree has no nodes at all. */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::PersistentVanEmdeBoasTree()
+  : mRoot(NULL), mSize(0) {}
+
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::~PersistentVanEmdeBoasTree() {
+  release<UniverseBits>(mRoot);
+}
+
+/* Copying just takes another reference to the root. */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::PersistentVanEmdeBoasTree(const PersistentVanEmdeBoasTree& other)
+  : mRoot(other.mRoot), mSize(other.mSize) {
+  retain(mRoot);
+}
+
+/* Assignment operator implemented using copy-and-swap. */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>&
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::operator= (const PersistentVanEmdeBoasTree& other) {
+  PersistentVanEmdeBoasTree copy(other);
+  swap(copy);
+  return *this;
+}
+
+/* A snapshot is just a copy, sharing the root until either tree writes. */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::snapshot() const {
+  return *this;
+}
+
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::PersistentVanEmdeBoasTree(PersistentVanEmdeBoasTree&& other) noexcept
+  : mRoot(other.mRoot), mSize(other.mSize) {
+  other.mRoot = NULL;
+  other.mSize = 0;
+}
+
+/* Move assignment swaps the other tree into a temporary and then with us,
+ * so that our old contents are let go of when the temporary goes away.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>&
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::operator= (PersistentVanEmdeBoasTree&& other) noexcept {
+  PersistentVanEmdeBoasTree moved(std::move(other));
+  swap(moved);
+  return *this;
+}
+
+/* Writes check that they'll change something before going down the tree,
+ * so that a write that changes nothing copies nothing.  The root is made
+ * when the first value goes in and let go of when the last one comes out.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::insert(Key value) {
+  if (!inUniverse(value))
+    throw std::out_of_range("PersistentVanEmdeBoasTree::insert: value outside universe.");
+  if (contains(value)) return false;
+
+  if (mRoot == NULL) mRoot = createTree<UniverseBits>();
+  recInsert<UniverseBits>(value, mRoot);
+  ++mSize;
+  return true;
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::erase(Key value) {
+  if (!contains(value)) return false;
+
+  if (--mSize == 0) {
+    clear();
+  } else {
+    recErase<UniverseBits>(value, mRoot);
+  }
+  return true;
+}
+
+/* The queries clip their arguments to the universe and recurse.  Values
+ * beyond the universe have no successor, and their predecessor is the
+ * largest value in the tree.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::contains(Key value) const {
+  return mRoot != NULL && inUniverse(value) &&
+         recContains<UniverseBits>(value, mRoot);
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::successor(Key value,
+                                                                       Key& result) const {
+  return mRoot != NULL && inUniverse(value) &&
+         recSuccessor<UniverseBits>(value, mRoot, result);
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::predecessor(Key value,
+                                                                         Key& result) const {
+  if (mRoot == NULL) return false;
+  if (!inUniverse(value)) return last(result);
+  return recPredecessor<UniverseBits>(value, mRoot, result);
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::first(Key& result) const {
+  if (mRoot == NULL) return false;
+  result = recFirst<UniverseBits>(mRoot);
+  return true;
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::last(Key& result) const {
+  if (mRoot == NULL) return false;
+  result = recLast<UniverseBits>(mRoot);
+  return true;
+}
+
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+size_t PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::size() const {
+  return mSize;
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::empty() const {
+  return mSize == 0;
+}
+
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+void PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::clear() {
+  release<UniverseBits>(mRoot);
+  mRoot = NULL;
+  mSize = 0;
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+void PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::swap(PersistentVanEmdeBoasTree& other) {
+  std::swap(mRoot, other.mRoot);
+  std::swap(mSize, other.mSize);
+}
+
+/**** Implementation of private helper functions ****/
+
+/* Values handed to a NumBits-bit tree never have bits above NumBits set, so
+ * the upper bits are just a shift away.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+Key PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::upperBits(Key value) {
+  return static_cast<Key>(value >> Split<NumBits>::kLow);
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+Key PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::lowerBits(Key value) {
+  return static_cast<Key>(value & ((Key(1) << Split<NumBits>::kLow) - 1));
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+Key PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::compose(Key upper, Key lower) {
+  return static_cast<Key>((upper << Split<NumBits>::kLow) | lower);
+}
+
+/* As in VanEmdeBoasTree, the full-width case is checked separately, since
+ * shifting by the width of the type is undefined.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::inUniverse(Key value) {
+  if (UniverseBits == sizeof(Key) * CHAR_BIT) return true;
+  return (value >> (UniverseBits % (sizeof(Key) * CHAR_BIT))) == 0;
+}
+
+/* The words of a bitvector and the table of a node both start right after
+ * the fixed part, which is a multiple of eight bytes.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+size_t PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::treeBytes() {
+  if (NumBits <= LeafBits)
+    return sizeof(Header) + VanEmdeBoasBits::numWords(NumBits) * sizeof(uint64_t);
+  return sizeof(Node) + (size_t(1) << Split<NumBits>::kHigh) * sizeof(void*);
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+typename PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::Header&
+PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::header(void* root) {
+  return *static_cast<Header*>(root);
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+uint64_t* PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::words(void* root) {
+  return reinterpret_cast<uint64_t*>(static_cast<Header*>(root) + 1);
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+void** PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::clusters(Node* node) {
+  return reinterpret_cast<void**>(node + 1);
+}
+
+/* A new node gets a fresh summary, which is built first so that, if
+ * allocating the node fails, there's just the summary to clean up.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+void* PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::createTree() {
+  if (NumBits <= LeafBits) {
+    void* result = ::operator new(treeBytes<NumBits>());
+    new (&header(result).mRefs) std::atomic<size_t>(1);
+    std::memset(words(result), 0, VanEmdeBoasBits::numWords(NumBits) * sizeof(uint64_t));
+    return result;
+  }
+
+  void* summary = createTree<Split<NumBits>::kHigh>();
+  Node* node;
+  try {
+    node = static_cast<Node*>(::operator new(treeBytes<NumBits>()));
+  } catch (...) {
+    release<Split<NumBits>::kHigh>(summary);
+    throw;
+  }
+
+  new (&node->mHeader.mRefs) std::atomic<size_t>(1);
+  node->mSummary = summary;
+  std::fill(clusters(node), clusters(node) + (size_t(1) << Split<NumBits>::kHigh),
+            static_cast<void*>(NULL));
+  return node;
+}
+
+/* Counts follow the usual rules for reference counts shared across
+ * threads: taking a reference needs no ordering, but letting go of one must
+ * publish this thread's use of the tree to whichever thread frees it.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+void PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::retain(void* root) {
+  if (root != NULL) header(root).mRefs.fetch_add(1, std::memory_order_relaxed);
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+void PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::release(void* root) {
+  if (root == NULL ||
+      header(root).mRefs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+
+  if (NumBits > LeafBits) {
+    Node* node = static_cast<Node*>(root);
+    forEachCluster<NumBits>(node, [](void* cluster) {
+      release<Split<NumBits>::kLow>(cluster);
+    });
+    release<Split<NumBits>::kHigh>(node->mSummary);
+  }
+  ::operator delete(root);
+}
+
+/* A copy of a node points at the same summary and clusters as the original,
+ * so each of those gains a parent.  The original loses one, namely
+ * whatever held root, which now holds the copy.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+void PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::makeUnique(void*& root) {
+  if (header(root).mRefs.load(std::memory_order_acquire) == 1) return;
+
+  /* Other threads may be changing the original's count as we copy, so only
+   * what follows the header is copied over.
+   */
+  void* copy = ::operator new(treeBytes<NumBits>());
+  new (&header(copy).mRefs) std::atomic<size_t>(1);
+  std::memcpy(static_cast<char*>(copy) + sizeof(Header),
+              static_cast<char*>(root) + sizeof(Header),
+              treeBytes<NumBits>() - sizeof(Header));
+
+  if (NumBits > LeafBits) {
+    Node* node = static_cast<Node*>(copy);
+    retain(node->mSummary);
+    forEachCluster<NumBits>(node, retain);
+  }
+
+  release<NumBits>(root);
+  root = copy;
+}
+
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits, typename Function>
+void PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::forEachCluster(Node* node,
+                                                                            Function fn) {
+  if (recEmpty<Split<NumBits>::kHigh>(node->mSummary)) return;
+
+  Key index = recFirst<Split<NumBits>::kHigh>(node->mSummary);
+  do {
+    fn(clusters(node)[index]);
+  } while (recSuccessor<Split<NumBits>::kHigh>(index, node->mSummary, index));
+}
+
+/* Inserting goes down the tree making each node on the way our own, and
+ * adds a cluster to the summary when it's made.  The cluster only goes into
+ * the table once the summary lists it, since the table's clusters are found
+ * through the summary when they're copied or freed.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+void PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::recInsert(Key value, void*& root) {
+  makeUnique<NumBits>(root);
+  if (NumBits <= LeafBits) {
+    VanEmdeBoasBits::set(words(root), value);
+    return;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  const Key index = upperBits<NumBits>(value);
+  void*& cluster = clusters(node)[index];
+  if (cluster == NULL) {
+    void* created = createTree<Split<NumBits>::kLow>();
+    try {
+      recInsert<Split<NumBits>::kHigh>(index, node->mSummary);
+    } catch (...) {
+      release<Split<NumBits>::kLow>(created);
+      throw;
+    }
+    cluster = created;
+  }
+  recInsert<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster);
+}
+
+/* Erasing does the same, and lets go of a cluster, and takes it out of the
+ * summary, once it's empty.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+void PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::recErase(Key value, void*& root) {
+  makeUnique<NumBits>(root);
+  if (NumBits <= LeafBits) {
+    VanEmdeBoasBits::clear(words(root), value);
+    return;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  const Key index = upperBits<NumBits>(value);
+  void*& cluster = clusters(node)[index];
+  recErase<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster);
+  if (recEmpty<Split<NumBits>::kLow>(cluster)) {
+    release<Split<NumBits>::kLow>(cluster);
+    cluster = NULL;
+    recErase<Split<NumBits>::kHigh>(index, node->mSummary);
+  }
+}
+
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::recEmpty(void* root) {
+  if (NumBits <= LeafBits)
+    return VanEmdeBoasBits::none(words(root), VanEmdeBoasBits::numWords(NumBits));
+  return recEmpty<Split<NumBits>::kHigh>(static_cast<Node*>(root)->mSummary);
+}
+
+/* Lookups just follow the value down to its bit. */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::recContains(Key value, void* root) {
+  if (NumBits <= LeafBits) return VanEmdeBoasBits::test(words(root), value);
+
+  void* cluster = clusters(static_cast<Node*>(root))[upperBits<NumBits>(value)];
+  return cluster != NULL &&
+         recContains<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster);
+}
+
+/* The smallest value in a node is the smallest value of the first cluster
+ * in its summary.  Empty clusters are always freed, so that cluster can't
+ * be empty.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+Key PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::recFirst(void* root) {
+  if (NumBits <= LeafBits) {
+    size_t result = 0;
+    VanEmdeBoasBits::findFirst(words(root), VanEmdeBoasBits::numWords(NumBits), 0, result);
+    return Key(result);
+  }
+
+  Node* node = static_cast<Node*>(root);
+  const Key index = recFirst<Split<NumBits>::kHigh>(node->mSummary);
+  return compose<NumBits>(index, recFirst<Split<NumBits>::kLow>(clusters(node)[index]));
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+Key PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::recLast(void* root) {
+  if (NumBits <= LeafBits) {
+    size_t result = 0;
+    VanEmdeBoasBits::findLast(words(root), (size_t(1) << NumBits) - 1, result);
+    return Key(result);
+  }
+
+  Node* node = static_cast<Node*>(root);
+  const Key index = recLast<Split<NumBits>::kHigh>(node->mSummary);
+  return compose<NumBits>(index, recLast<Split<NumBits>::kLow>(clusters(node)[index]));
+}
+
+/* The successor of a value in a node is its successor within its own
+ * cluster if there is one, and otherwise the smallest value of the next
+ * cluster in the summary.
+ */
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::recSuccessor(Key value, void* root,
+                                                                          Key& result) {
+  if (NumBits <= LeafBits) {
+    size_t next;
+    if (!VanEmdeBoasBits::findFirst(words(root), VanEmdeBoasBits::numWords(NumBits),
+                                    size_t(value) + 1, next))
+      return false;
+    result = Key(next);
+    return true;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  Key index = upperBits<NumBits>(value);
+  void* cluster = clusters(node)[index];
+  Key lower;
+  if (cluster != NULL &&
+      recSuccessor<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster, lower)) {
+    result = compose<NumBits>(index, lower);
+    return true;
+  }
+
+  if (!recSuccessor<Split<NumBits>::kHigh>(index, node->mSummary, index)) return false;
+  result = compose<NumBits>(index, recFirst<Split<NumBits>::kLow>(clusters(node)[index]));
+  return true;
+}
+template <typename Key, size_t UniverseBits, size_t LeafBits>
+template <size_t NumBits>
+bool PersistentVanEmdeBoasTree<Key, UniverseBits, LeafBits>::recPredecessor(Key value, void* root,
+                                                                            Key& result) {
+  if (NumBits <= LeafBits) {
+    size_t prev;
+    if (value == 0 || !VanEmdeBoasBits::findLast(words(root), size_t(value) - 1, prev))
+      return false;
+    result = Key(prev);
+    return true;
+  }
+
+  Node* node = static_cast<Node*>(root);
+  Key index = upperBits<NumBits>(value);
+  void* cluster = clusters(node)[index];
+  Key lower;
+  if (cluster != NULL &&
+      recPredecessor<Split<NumBits>::kLow>(lowerBits<NumBits>(value), cluster, lower)) {
+    result = compose<NumBits>(index, lower);
+    return true;
+  }
+
+  if (!recPredecessor<Split<NumBits>::kHigh>(index, node->mSummary, index)) return false;
+  result = compose<NumBits>(index, recLast<Split<NumBits>::kLow>(clusters(node)[index]));
+  return true;
+}
+
+#endif // PERSISTENTVANEMDEBOASTREE_H
@@ -0,0 +1,497 @@
+/**
+ * @headerfile ShardedVanEmdeBoasTree.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief A vEB-tree split by its top bits into independently locked shards
+ */
+
+#ifndef SHARDEDVANEMDEBOASTREE_H
+#define SHARDEDVANEMDEBOASTREE_H
+
+#include <atomic>      // For atomic
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t
+#include <cstdint>     // For uint64_t
+#include <memory>      // For unique_ptr
+#include <mutex>       // For mutex, lock_guard
+#include <stdexcept>   // For out_of_range
+#include <type_traits> // For conditional
+#include "VanEmdeBoasBits.h"
+#include "VanEmdeBoasTree.h"
+
+/**
+ * A class representing a set of unsigned integers that's split by the top
+ * ShardBits bits of each key into 2^ShardBits independent VanEmdeBoasTrees,
+ * called shards, each with its own lock, so that threads working on keys in
+ * different shards never wait for each other or touch each other's memory.
+ *
+ * Each shard is allocated by the first thread to insert into it (or to call
+ * prepare_shard for it), and the tree's memory is allocated by whichever
+ * thread inserts the keys that need it.  Under the first-touch placement
+ * that Linux and most other systems use by default, a shard that's mostly
+ * written by threads pinned to one NUMA node therefore lives in that node's
+ * memory.  Threads can ask which shard a key is in with shard_of, so a
+ * program that hands out keys by their top bits can keep each thread to
+ * shards on its own node.
+ *
+ * Alongside the shards, the tree keeps a bitvector of which shards have any
+ * keys, so that successor, predecessor, first, and last can skip empty
+ * shards without locking them.  Shards are locked one at a time, so these
+ * see each shard as it was at a different moment: they return a key that
+ * was in the tree when its shard was looked at, and never miss one that was
+ * in the tree for the whole call.  insert, erase, and contains lock just the
+ * key's shard and are linearizable.  Unlike VanEmdeBoasTree, the tree has no
+ * iterators, since they couldn't stay valid while other threads write; use
+ * first and successor to walk it instead.
+ *
+ * Shards take their Clusters policy and LeafBits from the template
+ * parameters, over a universe ShardBits bits narrower than the tree's.
+ */
+template <typename Key = unsigned short,
+          size_t UniverseBits = sizeof(Key) * CHAR_BIT,
+          size_t ShardBits = 4,
+          typename Clusters = typename std::conditional<(UniverseBits - ShardBits > 32),
+                                                        HashedClusters,
+                                                        DenseClusters>::type,
+          size_t LeafBits = 8>
+class ShardedVanEmdeBoasTree {
+  static_assert(UniverseBits > 0 && UniverseBits <= sizeof(Key) * CHAR_BIT,
+                "ShardedVanEmdeBoasTree universe must fit in the key type.");
+  static_assert(ShardBits > 0 && ShardBits < UniverseBits && ShardBits <= 16,
+                "ShardedVanEmdeBoasTree must have 1 to 16 bits of shards, and "
+                "fewer bits of shards than of universe.");
+public:
+  /* Standard container typedefs, plus the type of each shard. */
+  typedef Key         key_type;
+  typedef Key         value_type;
+  typedef std::size_t size_type;
+  typedef VanEmdeBoasTree<Key, UniverseBits - ShardBits, Clusters, LeafBits> shard_type;
+
+  /* The number of shards. */
+  static const size_t kNumShards = size_t(1) << ShardBits;
+
+  /**
+   * Constructor: ShardedVanEmdeBoasTree();
+   * Usage: ShardedVanEmdeBoasTree<uint32_t, 32, 6> tree;
+   * --------------------------------------------------------------------------
+   * Constructs a new, empty tree.  No shards are allocated until they're
+   * needed.
+   */
+  ShardedVanEmdeBoasTree();
+
+  /**
+   * Destructor: ~ShardedVanEmdeBoasTree();
+   * Usage: (implicit)
+   * --------------------------------------------------------------------------
+   * Destroys the tree and all its shards.  No other thread may be using the
+   * tree.
+   */
+  ~ShardedVanEmdeBoasTree();
+
+  /* Since other threads may be using the tree, it can be neither copied nor
+   * moved.
+   */
+  ShardedVanEmdeBoasTree(const ShardedVanEmdeBoasTree&) = delete;
+  ShardedVanEmdeBoasTree& operator= (const ShardedVanEmdeBoasTree&) = delete;
+
+  /**
+   * static size_t shard_of(Key value);
+   * void prepare_shard(size_t index);
+   * Usage: tree.prepare_shard(tree.shard_of(firstKeyForThisThread));
+   * --------------------------------------------------------------------------
+   * shard_of returns the index of the shard that holds the specified value,
+   * which must lie in the universe of the tree.  prepare_shard allocates the
+   * shard with the specified index, if it hasn't been already, from the
+   * calling thread, so that a thread pinned to a NUMA node can place the
+   * shards it owns on that node before any other thread writes to them.  It
+   * throws std::out_of_range if there's no shard with that index.
+   */
+  static size_t shard_of(Key value);
+  void prepare_shard(size_t index);
+
+  /**
+   * bool insert(Key value);
+   * bool erase(Key value);
+   * Usage: tree.insert(137);  tree.erase(137);
+   * --------------------------------------------------------------------------
+   * Inserts or erases the specified value, returning whether the tree
+   * changed.  insert throws std::out_of_range if the value lies outside the
+   * universe of the tree; erase just returns false.
+   */
+  bool insert(Key value);
+  bool erase(Key value);
+
+  /**
+   * bool contains(Key value) const;
+   * Usage: if (tree.contains(137)) { ... }
+   * --------------------------------------------------------------------------
+   * Returns whether the specified value is in the tree.
+   */
+  bool contains(Key value) const;
+
+  /**
+   * bool predecessor(Key value, Key& result) const;
+   * bool successor(Key value, Key& result) const;
+   * Usage: Key next;
+   *        if (tree.successor(137, next)) { ... }
+   * --------------------------------------------------------------------------
+   * predecessor finds the largest element of the tree strictly less than the
+   * specified value, and successor finds the smallest element strictly
+   * greater.  Each returns whether there is one and, if so, writes it into
+   * result.
+   */
+  bool predecessor(Key value, Key& result) const;
+  bool successor(Key value, Key& result) const;
+
+  /**
+   * bool first(Key& result) const;
+   * bool last(Key& result) const;
+   * Usage: Key smallest;
+   *        if (tree.first(smallest)) { ... }
+   * --------------------------------------------------------------------------
+   * Find the smallest or largest element of the tree, returning whether the
+   * tree has any elements and, if so, writing the element into result.
+   */
+  bool first(Key& result) const;
+  bool last(Key& result) const;
+
+  /**
+   * size_t size() const;
+   * bool empty() const;
+   * Usage: while (!tree.empty()) { ... }
+   * --------------------------------------------------------------------------
+   * Return the number of elements in the tree and whether it has none.  Both
+   * are exact while no other thread is inserting or erasing.
+   */
+  size_t size() const;
+  bool empty() const;
+
+  /**
+   * void clear();
+   * Usage: tree.clear();
+   * --------------------------------------------------------------------------
+   * Removes every element from the tree, one shard at a time.  The shards
+   * themselves stay allocated where they are.
+   */
+  void clear();
+
+private:
+  /* A shard is a tree with a lock and a count of its keys, which can be read
+   * without taking the lock.
+   */
+  struct Shard {
+    std::mutex mMutex;
+    shard_type mTree;
+    std::atomic<size_t> mSize;
+
+    Shard() : mSize(0) {}
+  };
+
+  /* The number of bits below the shard index in each key. */
+  static const size_t kShardUniverseBits = UniverseBits - ShardBits;
+
+  /* Pointers to the shards, NULL until each is needed, and the bitvector of
+   * which shards have keys.  A shard's bit is only changed while holding its
+   * lock.
+   */
+  std::unique_ptr<std::atomic<Shard*>[]> mShards;
+  std::unique_ptr<std::atomic<uint64_t>[]> mNonempty;
+
+  /* Helper functions to split a value into its shard index and its value
+   * within the shard, and to put them back together.
+   */
+  static Key lowerBits(Key value);
+  static Key compose(size_t index, Key lower);
+
+  /* Helper function to report whether a value is in the universe. */
+  static bool inUniverse(Key value);
+
+  /* Helper function to find the shard with the specified index, allocating
+   * it if there isn't one yet.  If two threads race to allocate the same
+   * shard, the loser frees its copy and uses the winner's.
+   */
+  Shard& findOrCreateShard(size_t index);
+
+  /* Helper function to set or clear a shard's bit in mNonempty. */
+  void markShard(size_t index, bool nonempty);
+
+  /* Helper functions to find the first shard at or after index from, or the
+   * last one at or before index to, whose bit is set in mNonempty.  Each
+   * returns whether there is one and, if so, writes its index into result.
+   */
+  bool nextNonempty(size_t from, size_t& result) const;
+  bool prevNonempty(size_t to, size_t& result) const;
+
+  /* Helper functions to find the smallest value in the shards from the one
+   * with the specified index upward, or the largest from it downward.  A
+   * shard whose bit is set may turn out to be empty if its last key was
+   * just erased, in which case we move on to the next.
+   */
+  bool firstFrom(size_t index, Key& result) const;
+  bool lastFrom(size_t index, Key& result) const;
+};
+
+/**** Implementation of ShardedVanEmdeBoasTree ****/
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::ShardedVanEmdeBoasTree()
+  : mShards(new std::atomic<Shard*>[kNumShards]),
+    mNonempty(new std::atomic<uint64_t>[VanEmdeBoasBits::numWords(ShardBits)]) {
+  for (size_t i = 0; i < kNumShards; ++i)
+    mShards[i].store(NULL, std::memory_order_relaxed);
+  for (size_t i = 0; i < VanEmdeBoasBits::numWords(ShardBits); ++i)
+    mNonempty[i].store(0, std::memory_order_relaxed);
+}
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::~ShardedVanEmdeBoasTree() {
+  for (size_t i = 0; i < kNumShards; ++i)
+    delete mShards[i].load(std::memory_order_relaxed);
+}
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+size_t ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::shard_of(Key value) {
+  return size_t(value >> kShardUniverseBits);
+}
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+void ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::prepare_shard(size_t index) {
+  if (index >= kNumShards)
+    throw std::out_of_range("ShardedVanEmdeBoasTree::prepare_shard: no such shard.");
+  findOrCreateShard(index);
+}
+
+/* Writers keep the shard's bit in step with whether it has keys, under its
+ * lock.  Setting the bit after inserting is safe, since no reader could
+ * find the key before insert returns anyway.
+ */
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::insert(Key value) {
+  if (!inUniverse(value))
+    throw std::out_of_range("ShardedVanEmdeBoasTree::insert: value outside universe.");
+
+  const size_t index = shard_of(value);
+  Shard& shard = findOrCreateShard(index);
+  std::lock_guard<std::mutex> lock(shard.mMutex);
+  if (!shard.mTree.insert(lowerBits(value)).second) return false;
+
+  if (shard.mSize.fetch_add(1, std::memory_order_relaxed) == 0)
+    markShard(index, true);
+  return true;
+}
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::erase(Key value) {
+  if (!inUniverse(value)) return false;
+
+  const size_t index = shard_of(value);
+  Shard* shard = mShards[index].load();
+  if (shard == NULL) return false;
+
+  std::lock_guard<std::mutex> lock(shard->mMutex);
+  if (!shard->mTree.erase(lowerBits(value))) return false;
+
+  if (shard->mSize.fetch_sub(1, std::memory_order_relaxed) == 1)
+    markShard(index, false);
+  return true;
+}
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::contains(Key value) const {
+  if (!inUniverse(value)) return false;
+
+  Shard* shard = mShards[shard_of(value)].load();
+  if (shard == NULL) return false;
+
+  std::lock_guard<std::mutex> lock(shard->mMutex);
+  return shard->mTree.find(lowerBits(value)) != shard->mTree.end();
+}
+
+/* The successor of a value is its successor within its own shard if there
+ * is one, and otherwise the smallest value in the shards after that.
+ * Values beyond the universe have no successor, and their predecessor is
+ * the largest value in the tree.
+ */
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::successor(Key value,
+                                                                                        Key& result) const {
+  if (!inUniverse(value)) return false;
+
+  const size_t index = shard_of(value);
+  if (Shard* shard = mShards[index].load()) {
+    std::lock_guard<std::mutex> lock(shard->mMutex);
+    typename shard_type::const_iterator next = shard->mTree.successor(lowerBits(value));
+    if (next != shard->mTree.end()) {
+      result = compose(index, *next);
+      return true;
+    }
+  }
+  return index + 1 < kNumShards && firstFrom(index + 1, result);
+}
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::predecessor(Key value,
+                                                                                          Key& result) const {
+  if (!inUniverse(value)) return last(result);
+
+  const size_t index = shard_of(value);
+  if (Shard* shard = mShards[index].load()) {
+    std::lock_guard<std::mutex> lock(shard->mMutex);
+    typename shard_type::const_iterator prev = shard->mTree.predecessor(lowerBits(value));
+    if (prev != shard->mTree.end()) {
+      result = compose(index, *prev);
+      return true;
+    }
+  }
+  return index > 0 && lastFrom(index - 1, result);
+}
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::first(Key& result) const {
+  return firstFrom(0, result);
+}
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::last(Key& result) const {
+  return lastFrom(kNumShards - 1, result);
+}
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+size_t ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::size() const {
+  size_t result = 0;
+  for (size_t i = 0; i < kNumShards; ++i)
+    if (Shard* shard = mShards[i].load())
+      result += shard->mSize.load(std::memory_order_relaxed);
+  return result;
+}
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::empty() const {
+  size_t ignored;
+  return !nextNonempty(0, ignored);
+}
+
+/* Each shard's tree is swapped out for an empty one under its lock, and
+ * freed after the lock is released.
+ */
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+void ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::clear() {
+  for (size_t i = 0; i < kNumShards; ++i) {
+    Shard* shard = mShards[i].load();
+    if (shard == NULL) continue;
+
+    shard_type old;
+    {
+      std::lock_guard<std::mutex> lock(shard->mMutex);
+      old.swap(shard->mTree);
+      shard->mSize.store(0, std::memory_order_relaxed);
+      markShard(i, false);
+    }
+  }
+}
+
+/**** Implementation of private helper functions ****/
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+Key ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::lowerBits(Key value) {
+  return static_cast<Key>(value & ((Key(1) << kShardUniverseBits) - 1));
+}
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+Key ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::compose(size_t index,
+                                                                                     Key lower) {
+  return static_cast<Key>((Key(index) << kShardUniverseBits) | lower);
+}
+
+/* As in VanEmdeBoasTree, the full-width case is checked separately, since
+ * shifting by the width of the type is undefined.
+ */
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::inUniverse(Key value) {
+  if (UniverseBits == sizeof(Key) * CHAR_BIT) return true;
+  return (value >> (UniverseBits % (sizeof(Key) * CHAR_BIT))) == 0;
+}
+
+/* Shards are installed with a compare-and-swap from NULL, which only one
+ * thread can win.
+ */
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+typename ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::Shard&
+ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::findOrCreateShard(size_t index) {
+  Shard* shard = mShards[index].load();
+  if (shard != NULL) return *shard;
+
+  std::unique_ptr<Shard> fresh(new Shard);
+  if (mShards[index].compare_exchange_strong(shard, fresh.get()))
+    return *fresh.release();
+  return *shard;
+}
+
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+void ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::markShard(size_t index,
+                                                                                        bool nonempty) {
+  const uint64_t bit = uint64_t(1) << (index % VanEmdeBoasBits::kWordBits);
+  if (nonempty)
+    mNonempty[index / VanEmdeBoasBits::kWordBits].fetch_or(bit);
+  else
+    mNonempty[index / VanEmdeBoasBits::kWordBits].fetch_and(~bit);
+}
+
+/* The bitvector of shards is scanned a word at a time, as in
+ * VanEmdeBoasBits::findFirst and findLast, but with atomic loads.
+ */
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::nextNonempty(size_t from,
+                                                                                           size_t& result) const {
+  size_t word = from / VanEmdeBoasBits::kWordBits;
+  uint64_t bits = mNonempty[word].load() &
+                  (~uint64_t(0) << (from % VanEmdeBoasBits::kWordBits));
+  while (bits == 0) {
+    if (++word == VanEmdeBoasBits::numWords(ShardBits)) return false;
+    bits = mNonempty[word].load();
+  }
+  result = word * VanEmdeBoasBits::kWordBits + VanEmdeBoasBits::lowestSetBit(bits);
+  return true;
+}
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::prevNonempty(size_t to,
+                                                                                           size_t& result) const {
+  size_t word = to / VanEmdeBoasBits::kWordBits;
+  uint64_t bits = mNonempty[word].load() &
+                  (~uint64_t(0) >> (VanEmdeBoasBits::kWordBits - 1 - to % VanEmdeBoasBits::kWordBits));
+  while (bits == 0) {
+    if (word-- == 0) return false;
+    bits = mNonempty[word].load();
+  }
+  result = word * VanEmdeBoasBits::kWordBits + VanEmdeBoasBits::highestSetBit(bits);
+  return true;
+}
+
+/* Each step of these loops moves on to a later (or earlier) shard, so they
+ * lock each shard at most once.
+ */
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::firstFrom(size_t index,
+                                                                                        Key& result) const {
+  for (; nextNonempty(index, index); ++index) {
+    Shard* shard = mShards[index].load();
+    std::lock_guard<std::mutex> lock(shard->mMutex);
+    if (!shard->mTree.empty()) {
+      result = compose(index, *shard->mTree.begin());
+      return true;
+    }
+    if (index + 1 == kNumShards) break;
+  }
+  return false;
+}
+template <typename Key, size_t UniverseBits, size_t ShardBits, typename Clusters, size_t LeafBits>
+bool ShardedVanEmdeBoasTree<Key, UniverseBits, ShardBits, Clusters, LeafBits>::lastFrom(size_t index,
+                                                                                       Key& result) const {
+  for (; prevNonempty(index, index); --index) {
+    Shard* shard = mShards[index].load();
+    std::lock_guard<std::mutex> lock(shard->mMutex);
+    if (!shard->mTree.empty()) {
+      result = compose(index, *shard->mTree.rbegin());
+      return true;
+    }
+    if (index == 0) break;
+  }
+  return false;
+}
+
+#endif // SHARDEDVANEMDEBOASTREE_H
@@ -0,0 +1,227 @@
+/**
+ * @headerfile VanEmdeBoasBits.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Bit-scanning primitives for the bitvectors in VanEmdeBoasTree.h
+ */
+
+#ifndef VANEMDEBOASBITS_H
+#define VANEMDEBOASBITS_H
+
+#include <cstddef> // For size_t
+#include <cstdint> // For uint64_t
+#include "VanEmdeBoasKernels.h"
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h> // For _BitScanForward64, _BitScanReverse64, __popcnt64
+#endif
+
+/**
+ * Once a vEB-tree gets small enough, it's stored as a plain bitvector rather
+ * than as a node with clusters.  A bitvector over numBits bits is an array of
+ * 64-bit words holding 2^numBits bits, with bit i of the vector stored as bit
+ * (i % 64) of word (i / 64).  The functions in this namespace find set bits
+ * in such arrays a whole word at a time, using the processor's count-leading-
+ * and trailing-zeros instructions where the compiler exposes them.  Runs of
+ * whole words long enough to be worth it go to the vectorized kernels in
+ * VanEmdeBoasKernels.h instead.
+ */
+namespace VanEmdeBoasBits {
+  /* The number of bits in a word. */
+  const size_t kWordBits = 64;
+
+  /* The index of the lowest or highest set bit in a nonzero word. */
+  inline size_t lowestSetBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return size_t(__builtin_ctzll(word));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    size_t index = 0;
+    while ((word & 1) == 0) {
+      word >>= 1;
+      ++index;
+    }
+    return index;
+#endif
+  }
+  inline size_t highestSetBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return kWordBits - 1 - size_t(__builtin_clzll(word));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, word);
+    return index;
+#else
+    size_t index = 0;
+    while (word >>= 1) ++index;
+    return index;
+#endif
+  }
+
+  /* The number of set bits in a word. */
+  inline size_t popCount(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return size_t(__builtin_popcountll(word));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return size_t(__popcnt64(word));
+#else
+    size_t count = 0;
+    for (; word != 0; word &= word - 1) ++count;
+    return count;
+#endif
+  }
+
+  /* The number of words in a bitvector over numBits bits.  Vectors of up to
+   * six bits still take up a whole word.
+   */
+  inline size_t numWords(size_t numBits) {
+    return numBits <= 6? 1 : size_t(1) << (numBits - 6);
+  }
+
+  /* Functions to find the first nonzero word from index from up to index
+   * to, exclusive, returning to if there is none, or the last nonzero word
+   * from index to down to index from, inclusive, returning one more than its
+   * index, or from if there is none.  Long runs go to the kernels.
+   */
+  inline size_t firstNonzeroWord(const uint64_t* words, size_t from, size_t to) {
+    if (to - from >= VanEmdeBoasKernels::kMinWords)
+      return from + VanEmdeBoasKernels::active().firstNonzero(words + from, to - from);
+    while (from < to && words[from] == 0) ++from;
+    return from;
+  }
+  inline size_t lastNonzeroWord(const uint64_t* words, size_t from, size_t to) {
+    if (to - from >= VanEmdeBoasKernels::kMinWords)
+      return from + VanEmdeBoasKernels::active().lastNonzero(words + from, to - from);
+    while (to > from && words[to - 1] == 0) --to;
+    return to;
+  }
+
+  /* Functions to test, set, and clear a single bit. */
+  inline bool test(const uint64_t* words, size_t index) {
+    return (words[index / kWordBits] >> (index % kWordBits)) & 1;
+  }
+  inline void set(uint64_t* words, size_t index) {
+    words[index / kWordBits] |= uint64_t(1) << (index % kWordBits);
+  }
+  inline void clear(uint64_t* words, size_t index) {
+    words[index / kWordBits] &= ~(uint64_t(1) << (index % kWordBits));
+  }
+
+  /* Reports whether no bits in a bitvector of the given length are set. */
+  inline bool none(const uint64_t* words, size_t numWords) {
+    return firstNonzeroWord(words, 0, numWords) == numWords;
+  }
+
+  /* Functions to find the first set bit at or after index from, or the last
+   * set bit at or before index to, in a bitvector of the given length.  Each
+   * returns whether there is such a bit and, if so, writes its index into
+   * result.  from may be one past the last bit, in which case there's
+   * nothing to find.
+   */
+  inline bool findFirst(const uint64_t* words, size_t numWords, size_t from,
+                        size_t& result) {
+    size_t word = from / kWordBits;
+    if (word >= numWords) return false;
+
+    /* Mask off the bits below from in the first word, then move on to
+     * whole words.
+     */
+    uint64_t bits = words[word] & (~uint64_t(0) << (from % kWordBits));
+    if (bits == 0) {
+      word = firstNonzeroWord(words, word + 1, numWords);
+      if (word == numWords) return false;
+      bits = words[word];
+    }
+
+    result = word * kWordBits + lowestSetBit(bits);
+    return true;
+  }
+  inline bool findLast(const uint64_t* words, size_t to, size_t& result) {
+    size_t word = to / kWordBits;
+
+    /* Mask off the bits above to in the first word, then move on to whole
+     * words.
+     */
+    uint64_t bits = words[word] &
+                    (~uint64_t(0) >> (kWordBits - 1 - to % kWordBits));
+    if (bits == 0) {
+      word = lastNonzeroWord(words, 0, word);
+      if (word-- == 0) return false;
+      bits = words[word];
+    }
+
+    result = word * kWordBits + highestSetBit(bits);
+    return true;
+  }
+
+  /* Function to visit the set bits from index from to index to, inclusive,
+   * a word at a time.  For each word with any of those bits set, invokes
+   * fn(first, bits), where first is the index of the word's lowest bit and
+   * bits is the word with the bits outside the range masked off.
+   */
+  template <typename Function>
+  inline void forEachWord(const uint64_t* words, size_t from, size_t to,
+                          Function fn) {
+    const size_t last = to / kWordBits;
+    for (size_t word = from / kWordBits; word <= last; ++word) {
+      uint64_t bits = words[word];
+      if (word == from / kWordBits) bits &= ~uint64_t(0) << (from % kWordBits);
+      if (word == last) bits &= ~uint64_t(0) >> (kWordBits - 1 - to % kWordBits);
+      if (bits != 0) {
+        fn(word * kWordBits, bits);
+      } else if (last - word > VanEmdeBoasKernels::kMinWords && words[word + 1] == 0) {
+        /* Skip a long run of zeros in one go; the last word is left for
+         * the loop to mask.
+         */
+        word = firstNonzeroWord(words, word + 2, last) - 1;
+      }
+    }
+  }
+
+  /* Function to clear every bit from index 0 to index to, inclusive. */
+  inline void clearThrough(uint64_t* words, size_t to) {
+    for (size_t word = 0; word < to / kWordBits; ++word)
+      words[word] = 0;
+    words[to / kWordBits] &= ~(~uint64_t(0) >> (kWordBits - 1 - to % kWordBits));
+  }
+
+  /* Function to count the set bits below index to.  to may be one past the
+   * last bit, in which case this counts every bit in the vector.
+   */
+  inline size_t countBelow(const uint64_t* words, size_t to) {
+    size_t count;
+    if (to / kWordBits >= VanEmdeBoasKernels::kMinCountWords) {
+      count = VanEmdeBoasKernels::active().popCount(words, to / kWordBits);
+    } else {
+      count = 0;
+      for (size_t word = 0; word < to / kWordBits; ++word)
+        count += popCount(words[word]);
+    }
+
+    if (to % kWordBits != 0)
+      count += popCount(words[to / kWordBits] &
+                        ~(~uint64_t(0) << (to % kWordBits)));
+    return count;
+  }
+
+  /* Function to find the index of the set bit with k set bits below it.  The
+   * bitvector must have more than k bits set.
+   */
+  inline size_t select(const uint64_t* words, size_t k) {
+    size_t word = 0;
+    for (size_t count; (count = popCount(words[word])) <= k; ++word)
+      k -= count;
+
+    /* Clear the k lowest bits of the word holding the answer; what's left
+     * at the bottom is the bit we're after.
+     */
+    uint64_t bits = words[word];
+    for (; k != 0; --k) bits &= bits - 1;
+    return word * kWordBits + lowestSetBit(bits);
+  }
+}
+
+#endif // VANEMDEBOASBITS_H
@@ -0,0 +1,828 @@
+/**
+ * @headerfile VanEmdeBoasClusters.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Cluster storage policies for VanEmdeBoasTree.h
+ */
+
+#ifndef VANEMDEBOASCLUSTERS_H
+#define VANEMDEBOASCLUSTERS_H
+
+#include <cstddef>   // For size_t
+#include <cstdint>   // For uint64_t, int32_t, INT32_MAX
+#include <cstring>   // For memcpy
+#include <algorithm> // For count, fill, swap
+#include <memory>    // For allocator_traits
+#include <new>       // For operator new, bad_alloc
+#include <stdexcept> // For length_error
+#include <type_traits> // For is_same
+
+/**
+ * Each node of a vEB-tree over numBits bits owns 2^(numBits - numBits / 2)
+ * clusters, each of which is a smaller vEB-tree, and looks them up by the
+ * upper bits of a key.  The classes in this file are the policies that
+ * decide how a node stores the pointers to those clusters.  They're selected
+ * at compile time through the Clusters parameter of VanEmdeBoasTree.
+ *
+ * Each policy exposes three types and two flags.  Pointer is the type used to
+ * store a pointer to a cluster or summary inside a node; it must be
+ * assignable from and convertible to void*.  Storage is the object, owned by
+ * the tree, that holds the root and allocates every node and bitvector; see
+ * HeapStorage below for its interface.  Table is embedded as the very last
+ * member of a node and has the following interface:
+ *
+ *   static size_t extraSize(size_t indexBits);
+ *     How many bytes the node must be overallocated by to hold a table for
+ *     2^indexBits clusters.
+ *
+ *   void init(size_t indexBits);
+ *   void destroy(size_t indexBits);
+ *     Set up an empty table and free whatever the table itself allocated.
+ *     Neither touches the clusters.
+ *
+ *   void reserve(size_t indexBits, size_t count);
+ *     Called on an empty table that's about to have count clusters stored
+ *     into it, so it can make room for all of them at once.
+ *
+ *   void* get(size_t index) const;
+ *     Returns the cluster with the given index, or NULL if it's empty.
+ *
+ *   Pointer& slot(size_t index);
+ *     Returns a reference to the pointer for the given cluster, making room
+ *     for it if needed.  The caller must store a non-NULL pointer into it
+ *     before touching the table again.
+ *
+ *   void release(size_t index);
+ *     Called after the pointer for a cluster has been reset to NULL, so the
+ *     table can reclaim any space used to hold it.
+ *
+ *   template <typename Function> void forEach(size_t indexBits, Function fn) const;
+ *     Invokes fn(index, cluster) on each nonempty cluster.
+ *
+ *   size_t outsideBytes(size_t indexBits) const;
+ *   size_t unusedBytes(size_t indexBits) const;
+ *     How many bytes the table has allocated apart from the node, and how
+ *     many of its bytes, wherever they live, are slots holding no cluster.
+ *     These are only used to report how much memory the tree takes.
+ *
+ * Finally, kStoresBounds says whether each node should also keep the min and
+ * max of every one of its clusters, along with a bitmap of which clusters
+ * are nonempty, in space of its own just past the table; see
+ * BoundedClusters.  The tree lays these out and keeps them up to date, since
+ * only it knows the key type.  Likewise, kStoresCounts says whether each node
+ * should keep the number of keys in every one of its clusters; see
+ * CountedClusters.
+ *
+ * Since empty clusters are never allocated, a NULL pointer always means
+ * "nothing here," and the policies can use that as their notion of a free
+ * slot.
+ */
+
+/**
+ * Class: HeapStorage
+ * ----------------------------------------------------------------------------
+ * The Storage used by DenseClusters and HashedClusters.  Every node and
+ * bitvector is its own allocation from the global heap, and the tree
+ * clones and destroys itself node by node.
+ */
+class HeapStorage {
+public:
+  /* Whether the storage is allocated up front with enough room for every
+   * node the tree could ever need.  Such storage is copied and freed as a
+   * whole, so the tree doesn't need to walk its nodes to clone or destroy
+   * them.
+   */
+  static const bool kPreallocated = false;
+
+  /* Whether nodes may be allocated and freed from several threads at once,
+   * which lets the tree build, clone, and destroy large trees in parallel.
+   */
+  static const bool kConcurrent = true;
+
+  /* Heap storage needs no up-front capacity. */
+  explicit HeapStorage(size_t = 0) : mRoot(NULL) {}
+
+  /* Copying heap storage yields empty storage; the tree clones the nodes
+   * into it itself.
+   */
+  HeapStorage(const HeapStorage&) : mRoot(NULL) {}
+
+  /* Moving heap storage hands over the root, leaving the source empty. */
+  HeapStorage(HeapStorage&& other) noexcept : mRoot(other.mRoot) {
+    other.mRoot = NULL;
+  }
+
+  /* The size of the block handed out for a request of the given size. */
+  static size_t blockSize(size_t bytes) {
+    return bytes;
+  }
+
+  /* The number of bytes set aside up front, whether or not they've been
+   * handed out yet.  Heap storage sets nothing aside.
+   */
+  size_t capacity() const {
+    return 0;
+  }
+
+  void* allocate(size_t bytes) {
+    return ::operator new(bytes);
+  }
+  void deallocate(void* memory, size_t) {
+    ::operator delete(memory);
+  }
+
+  /* The root of the tree, or NULL if the tree is empty. */
+  void*& root() {
+    return mRoot;
+  }
+  void* root() const {
+    return mRoot;
+  }
+
+  void swap(HeapStorage& other) {
+    std::swap(mRoot, other.mRoot);
+  }
+
+private:
+  void* mRoot;
+
+  /* Assignment is done by the tree through copy-and-swap. */
+  HeapStorage& operator= (const HeapStorage&);
+};
+
+/**
+ * Policy: DenseClusters
+ * ----------------------------------------------------------------------------
+ * Stores the clusters as a flat array of 2^indexBits pointers overallocated
+ * past the end of the node.  Looking up a cluster is a single indexed load,
+ * but every node pays for a pointer per possible cluster whether or not it
+ * is in use.  This is the right choice for small universes, and is the
+ * default for universes of up to 32 bits.
+ */
+struct DenseClusters {
+  typedef void*       Pointer;
+  typedef HeapStorage Storage;
+
+  static const bool kStoresBounds = false;
+  static const bool kStoresCounts = false;
+
+  class Table {
+  public:
+    static size_t extraSize(size_t indexBits) {
+      return sizeof(void*) * ((size_t(1) << indexBits) - 1);
+    }
+
+    void init(size_t indexBits) {
+      std::fill(mSlots, mSlots + (size_t(1) << indexBits),
+                static_cast<void*>(NULL));
+    }
+    void destroy(size_t) {
+      /* Nothing to do; the array lives inside the node. */
+    }
+    void reserve(size_t, size_t) {
+      /* Nothing to do; there's already a slot for every cluster. */
+    }
+
+    void* get(size_t index) const {
+      return mSlots[index];
+    }
+    Pointer& slot(size_t index) {
+      return mSlots[index];
+    }
+    void release(size_t) {
+      /* Nothing to do; the slot is already NULL. */
+    }
+
+    template <typename Function> void forEach(size_t indexBits,
+                                              Function fn) const {
+      const size_t numSlots = size_t(1) << indexBits;
+      for (size_t i = 0; i < numSlots; ++i)
+        if (mSlots[i] != NULL) fn(i, mSlots[i]);
+    }
+
+    size_t outsideBytes(size_t) const {
+      return 0;
+    }
+    size_t unusedBytes(size_t indexBits) const {
+      const size_t numSlots = size_t(1) << indexBits;
+      return sizeof(void*) * static_cast<size_t>(
+          std::count(mSlots, mSlots + numSlots, static_cast<void*>(NULL)));
+    }
+
+  private:
+    /* An array of one element, representing the first of (possibly) many
+     * pointers to clusters.  This MUST be the last element of the table,
+     * and the table must be the last element of the node!
+     */
+    void* mSlots[1];
+  };
+};
+
+/**
+ * Policy: BoundedClusters
+ * ----------------------------------------------------------------------------
+ * Stores the clusters just as DenseClusters does, but also keeps the min and
+ * max of every cluster, and a bitmap of which clusters are nonempty, in the
+ * node itself, laid out right after the cluster table.  Successor
+ * and predecessor queries spend most of their time asking clusters for their
+ * min or max, and normally each of those questions means following a
+ * pointer to a different cache line; with the bounds stored in the parent,
+ * the answer is usually sitting next to the pointer, and only the one
+ * cluster the query actually descends into is ever touched.  The bitmap
+ * also lets a query find the next nonempty cluster among the neighbouring
+ * ones without going to the summary.
+ *
+ * The price is that each node is about half again as large (more for wide
+ * keys), and every insertion or deletion has to refresh the bounds of the
+ * cluster it changed.
+ */
+struct BoundedClusters {
+  typedef DenseClusters::Pointer Pointer;
+  typedef DenseClusters::Storage Storage;
+  typedef DenseClusters::Table   Table;
+
+  static const bool kStoresBounds = true;
+  static const bool kStoresCounts = false;
+};
+
+/**
+ * Policy: HashedClusters
+ * ----------------------------------------------------------------------------
+ * Stores only the nonempty clusters, in an open-addressing hash table keyed
+ * by cluster index.  This is the "space-efficient vEB-tree" described in the
+ * README: lookups stay expected O(1), so each operation is still expected
+ * O(lg lg U), but the total space used is O(n) in the number of elements
+ * rather than in the size of the universe.  This makes the tree practical
+ * for 64-bit universes, and is the default for universes wider than 32 bits.
+ *
+ * The table uses linear probing with a power-of-two capacity that is kept
+ * between one-eighth and one-half full.  Deletions use backward shifting
+ * rather than tombstones, so a NULL entry always terminates a probe.
+ */
+struct HashedClusters {
+  typedef void*       Pointer;
+  typedef HeapStorage Storage;
+
+  static const bool kStoresBounds = false;
+  static const bool kStoresCounts = false;
+
+  class Table {
+  public:
+    static size_t extraSize(size_t) {
+      return 0;
+    }
+
+    void init(size_t) {
+      mEntries = NULL;
+      mCapacity = 0;
+      mCount = 0;
+      mShift = 0;
+    }
+    void destroy(size_t) {
+      ::operator delete(mEntries);
+    }
+    void reserve(size_t, size_t count) {
+      /* Size the table so that it's no more than half full afterwards. */
+      if (count == 0) return;
+
+      size_t capacity = kMinCapacity;
+      while (capacity < 2 * count) capacity *= 2;
+      rehash(capacity);
+    }
+
+    void* get(size_t index) const {
+      if (mCapacity == 0) return NULL;
+      for (size_t i = home(index); ; i = (i + 1) & (mCapacity - 1)) {
+        if (mEntries[i].mChild == NULL) return NULL;
+        if (mEntries[i].mIndex == index) return mEntries[i].mChild;
+      }
+    }
+
+    Pointer& slot(size_t index) {
+      /* If the cluster is already here, hand it back. */
+      if (mCapacity != 0) {
+        for (size_t i = home(index); ; i = (i + 1) & (mCapacity - 1)) {
+          if (mEntries[i].mChild == NULL) break;
+          if (mEntries[i].mIndex == index) return mEntries[i].mChild;
+        }
+      }
+
+      /* Otherwise, make sure there's room for one more, then claim the first
+       * free entry along its probe sequence.
+       */
+      if (2 * (mCount + 1) > mCapacity)
+        rehash(mCapacity == 0? kMinCapacity : 2 * mCapacity);
+
+      size_t i = home(index);
+      while (mEntries[i].mChild != NULL)
+        i = (i + 1) & (mCapacity - 1);
+
+      ++mCount;
+      mEntries[i].mIndex = index;
+      return mEntries[i].mChild;
+    }
+
+    void release(size_t index) {
+      /* The cluster's pointer has already been cleared, so the first NULL
+       * entry along its probe sequence is the one it occupied.
+       */
+      size_t hole = home(index);
+      while (mEntries[hole].mChild != NULL)
+        hole = (hole + 1) & (mCapacity - 1);
+      --mCount;
+
+      /* Shift back any later entries in the run that would otherwise become
+       * unreachable.  An entry can move into the hole if its home lies
+       * cyclically outside (hole, curr].
+       */
+      for (size_t curr = (hole + 1) & (mCapacity - 1);
+           mEntries[curr].mChild != NULL;
+           curr = (curr + 1) & (mCapacity - 1)) {
+        const size_t want = home(mEntries[curr].mIndex);
+        if (((curr - want) & (mCapacity - 1)) >=
+            ((curr - hole) & (mCapacity - 1))) {
+          mEntries[hole] = mEntries[curr];
+          mEntries[curr].mChild = NULL;
+          hole = curr;
+        }
+      }
+
+      /* Give back memory once the table is mostly empty. */
+      if (mCount == 0) {
+        destroy(0);
+        init(0);
+      } else if (8 * mCount < mCapacity && mCapacity > kMinCapacity) {
+        rehash(mCapacity / 2);
+      }
+    }
+
+    template <typename Function> void forEach(size_t, Function fn) const {
+      for (size_t i = 0; i < mCapacity; ++i)
+        if (mEntries[i].mChild != NULL)
+          fn(mEntries[i].mIndex, mEntries[i].mChild);
+    }
+
+    size_t outsideBytes(size_t) const {
+      return sizeof(Entry) * mCapacity;
+    }
+    size_t unusedBytes(size_t) const {
+      return sizeof(Entry) * (mCapacity - mCount);
+    }
+
+  private:
+    /* A cluster index and the cluster it refers to.  Free entries have a
+     * NULL cluster.
+     */
+    struct Entry {
+      size_t mIndex;
+      void*  mChild;
+    };
+
+    /* The smallest nonzero capacity we'll use. */
+    static const size_t kMinCapacity = 4;
+
+    Entry* mEntries;
+    size_t mCapacity;
+    size_t mCount;
+
+    /* 64 - lg(mCapacity), used to pick the top bits of the hash. */
+    unsigned mShift;
+
+    /* Fibonacci hashing: multiply by 2^64 / phi and keep the top bits, which
+     * scatters runs of consecutive cluster indices across the table.
+     */
+    size_t home(size_t index) const {
+      return static_cast<size_t>(
+          (uint64_t(index) * UINT64_C(0x9E3779B97F4A7C15)) >> mShift);
+    }
+
+    /* Moves every entry into a fresh table of the given capacity. */
+    void rehash(size_t newCapacity) {
+      Entry* oldEntries = mEntries;
+      const size_t oldCapacity = mCapacity;
+
+      mEntries = static_cast<Entry*>(::operator new(sizeof(Entry) * newCapacity));
+      mCapacity = newCapacity;
+      for (size_t i = 0; i < mCapacity; ++i)
+        mEntries[i].mChild = NULL;
+
+      mShift = 64;
+      for (size_t cap = mCapacity; cap > 1; cap >>= 1)
+        --mShift;
+
+      for (size_t i = 0; i < oldCapacity; ++i) {
+        if (oldEntries[i].mChild == NULL) continue;
+
+        size_t j = home(oldEntries[i].mIndex);
+        while (mEntries[j].mChild != NULL)
+          j = (j + 1) & (mCapacity - 1);
+        mEntries[j] = oldEntries[i];
+      }
+
+      ::operator delete(oldEntries);
+    }
+  };
+};
+
+/**
+ * Policy: ArenaClusters
+ * ----------------------------------------------------------------------------
+ * Lays the entire tree out in a single contiguous block of memory.  The block
+ * is allocated when the tree is constructed and is sized to hold every node
+ * the tree could ever need, so it never has to grow; nodes and bitvectors
+ * are carved out of it in the order they're first needed, and freed ones are
+ * recycled from per-size free lists.  Clusters are stored as a dense array,
+ * as with DenseClusters, but each entry is a 32-bit offset from the entry
+ * itself rather than a pointer.  That halves the size of each table, keeps
+ * related nodes close together in memory, and makes the block position-
+ * independent, so copying a tree is a single memcpy and destroying one is a
+ * single free.
+ *
+ * The cost is that as soon as anything is put in the tree, it holds the
+ * whole block, which grows linearly with the universe.  This is meant for
+ * small universes (for a 16-bit tree the block is around 9KB); construction
+ * throws length_error if the block would need more than 2GB.  The block
+ * isn't allocated until it's first needed, so empty trees, including ones
+ * that have been moved from, cost nothing.
+ */
+struct ArenaClusters {
+  static const bool kStoresBounds = false;
+  static const bool kStoresCounts = false;
+
+  /* A pointer stored as a signed offset from its own address, or zero for
+   * NULL.  Because it's relative to where it lives, it stays valid when the
+   * block containing both it and its target is copied elsewhere.  For the
+   * same reason it can't be copied by value on its own.
+   */
+  class Pointer {
+  public:
+    Pointer() {}
+
+    Pointer& operator= (void* target) {
+      mOffset = target == NULL? 0 :
+                static_cast<int32_t>(static_cast<char*>(target) -
+                                     reinterpret_cast<char*>(this));
+      return *this;
+    }
+    operator void* () const {
+      if (mOffset == 0) return NULL;
+      return const_cast<char*>(reinterpret_cast<const char*>(this)) + mOffset;
+    }
+
+  private:
+    int32_t mOffset;
+
+    Pointer(const Pointer&) = delete;
+    Pointer& operator= (const Pointer&) = delete;
+  };
+
+  class Table {
+  public:
+    static size_t extraSize(size_t indexBits) {
+      return sizeof(Pointer) * ((size_t(1) << indexBits) - 1);
+    }
+
+    void init(size_t indexBits) {
+      const size_t numSlots = size_t(1) << indexBits;
+      for (size_t i = 0; i < numSlots; ++i)
+        mSlots[i] = NULL;
+    }
+    void destroy(size_t) {
+      /* Nothing to do; the array lives inside the node. */
+    }
+    void reserve(size_t, size_t) {
+      /* Nothing to do; there's already a slot for every cluster. */
+    }
+
+    void* get(size_t index) const {
+      return mSlots[index];
+    }
+    Pointer& slot(size_t index) {
+      return mSlots[index];
+    }
+    void release(size_t) {
+      /* Nothing to do; the slot is already NULL. */
+    }
+
+    template <typename Function> void forEach(size_t indexBits,
+                                              Function fn) const {
+      const size_t numSlots = size_t(1) << indexBits;
+      for (size_t i = 0; i < numSlots; ++i)
+        if (mSlots[i] != NULL) fn(i, static_cast<void*>(mSlots[i]));
+    }
+
+    size_t outsideBytes(size_t) const {
+      return 0;
+    }
+    size_t unusedBytes(size_t indexBits) const {
+      const size_t numSlots = size_t(1) << indexBits;
+      size_t result = 0;
+      for (size_t i = 0; i < numSlots; ++i)
+        if (mSlots[i] == NULL) result += sizeof(Pointer);
+      return result;
+    }
+
+  private:
+    /* As with DenseClusters, this MUST be the last element of the table,
+     * and the table must be the last element of the node!
+     */
+    Pointer mSlots[1];
+  };
+
+  class Storage {
+  public:
+    static const bool kPreallocated = true;
+    static const bool kConcurrent = false;
+
+    /* Sets up storage for a block with room for the given number of bytes
+     * of nodes, which the tree computes as the size of a completely full
+     * tree.  The block itself is allocated the first time it's needed.
+     */
+    explicit Storage(size_t capacity)
+      : mBlock(NULL), mCapacity(blockSize(sizeof(Header)) + capacity) {
+      if (mCapacity > size_t(INT32_MAX))
+        throw std::length_error("ArenaClusters: universe too large for an arena.");
+    }
+
+    /* Copying the storage copies the part of the block that's in use.  All
+     * of the pointers inside it are relative, so nothing needs fixing up.
+     */
+    Storage(const Storage& other) : mBlock(NULL), mCapacity(other.mCapacity) {
+      if (other.mBlock == NULL) return;
+      mBlock = static_cast<char*>(::operator new(mCapacity));
+      std::memcpy(mBlock, other.mBlock, other.header()->mUsed);
+    }
+
+    /* Moving the storage hands over the block, leaving the source without
+     * one, just as if it had never been used.
+     */
+    Storage(Storage&& other) noexcept
+      : mBlock(other.mBlock), mCapacity(other.mCapacity) {
+      other.mBlock = NULL;
+    }
+
+    ~Storage() {
+      ::operator delete(mBlock);
+    }
+
+    /* Blocks are rounded up to a multiple of eight bytes so that every
+     * node is suitably aligned.
+     */
+    static size_t blockSize(size_t bytes) {
+      return (bytes + 7) & ~size_t(7);
+    }
+
+    /* The whole block counts once it exists, however little of it is in
+     * use.
+     */
+    size_t capacity() const {
+      return mBlock == NULL? 0 : mCapacity;
+    }
+
+    void* allocate(size_t bytes) {
+      Header* header = this->header();
+      bytes = blockSize(bytes);
+
+      /* Reuse a freed block of this size if there is one. */
+      for (size_t i = 0; i < header->mNumClasses; ++i) {
+        if (header->mClassSize[i] == bytes && header->mClassHead[i] != 0) {
+          char* result = mBlock + header->mClassHead[i];
+          std::memcpy(&header->mClassHead[i], result, sizeof(size_t));
+          return result;
+        }
+      }
+
+      /* Otherwise carve a new one off the end.  The capacity is computed to
+       * be enough for a full tree, so running out means something is wrong.
+       */
+      if (header->mUsed + bytes > mCapacity)
+        throw std::bad_alloc();
+      char* result = mBlock + header->mUsed;
+      header->mUsed += bytes;
+      return result;
+    }
+
+    void deallocate(void* memory, size_t bytes) {
+      Header* header = this->header();
+      bytes = blockSize(bytes);
+
+      /* Find the free list for this size, making one if needed. */
+      size_t i = 0;
+      while (i < header->mNumClasses && header->mClassSize[i] != bytes) ++i;
+      if (i == header->mNumClasses) {
+        /* There are only ever a handful of distinct node sizes, one per
+         * level of the tree plus one for bitvectors.  If we somehow see more
+         * than we have room for, just leak the block into the arena; it will
+         * be reclaimed when the arena is.
+         */
+        if (i == kMaxClasses) return;
+        header->mClassSize[i] = bytes;
+        header->mClassHead[i] = 0;
+        ++header->mNumClasses;
+      }
+
+      /* Push the block onto the front of the list, storing the offset of the
+       * next free block in its first bytes.
+       */
+      std::memcpy(memory, &header->mClassHead[i], sizeof(size_t));
+      header->mClassHead[i] = static_cast<char*>(memory) - mBlock;
+    }
+
+    /* The root of the tree, stored in the header of the block.  Without a
+     * block, the tree is empty; asking for the root in order to change it
+     * allocates the block.
+     */
+    Pointer& root() {
+      return header()->mRoot;
+    }
+    void* root() const {
+      if (mBlock == NULL) return NULL;
+      return header()->mRoot;
+    }
+
+    void swap(Storage& other) {
+      std::swap(mBlock, other.mBlock);
+      std::swap(mCapacity, other.mCapacity);
+    }
+
+  private:
+    /* The maximum number of distinct block sizes we track free lists for. */
+    static const size_t kMaxClasses = 16;
+
+    /* Bookkeeping at the front of the block.  Free lists are stored as
+     * offsets from the start of the block, with zero meaning empty.
+     */
+    struct Header {
+      size_t  mUsed;
+      size_t  mNumClasses;
+      size_t  mClassSize[kMaxClasses];
+      size_t  mClassHead[kMaxClasses];
+      Pointer mRoot;
+    };
+
+    char*  mBlock;
+    size_t mCapacity;
+
+    /* Returns the header of the block, which must exist. */
+    const Header* header() const {
+      return reinterpret_cast<const Header*>(mBlock);
+    }
+
+    /* Returns the header of the block, allocating the block if need be. */
+    Header* header() {
+      if (mBlock == NULL) {
+        mBlock = static_cast<char*>(::operator new(mCapacity));
+        Header* header = reinterpret_cast<Header*>(mBlock);
+        header->mUsed = blockSize(sizeof(Header));
+        header->mNumClasses = 0;
+        header->mRoot = NULL;
+      }
+      return reinterpret_cast<Header*>(mBlock);
+    }
+
+    /* Assignment is done by the tree through copy-and-swap. */
+    Storage& operator= (const Storage&);
+  };
+};
+
+/**
+ * Policy: CountedClusters<Base>
+ * ----------------------------------------------------------------------------
+ * Stores the clusters just as Base does, but also keeps the number of keys
+ * in every cluster in the node itself, laid out after the cluster table
+ * (and after the bounds, if Base stores them).  With the counts at hand,
+ * rank and select only have to add up a run of adjacent counts at each
+ * level instead of walking every key, and so take time proportional to the
+ * number of clusters rather than the number of keys.
+ *
+ * The counts array has an entry for every possible cluster whichever table
+ * Base uses.  A node of a 32-bit tree has 2^16 clusters, and one of a wider
+ * tree would need gigabytes of counts, so the tree only accepts
+ * CountedClusters over universes of up to 32 bits.  Even there, wrapping
+ * HashedClusters gives up much of its space savings, since every node
+ * holds 2^16 counts however few clusters it has.  Every insertion or
+ * deletion has to adjust one count per level it passes through.
+ */
+template <typename Base> struct CountedClusters {
+  typedef typename Base::Pointer Pointer;
+  typedef typename Base::Storage Storage;
+  typedef typename Base::Table   Table;
+
+  static const bool kStoresBounds = Base::kStoresBounds;
+  static const bool kStoresCounts = true;
+};
+
+/**
+ * Class: AllocatorStorage<Allocator>
+ * ----------------------------------------------------------------------------
+ * The Storage used by AllocatedClusters.  It works just like HeapStorage,
+ * except that every node and bitvector comes from a copy of the given
+ * allocator, rebound to 64-bit words so that nodes are suitably aligned.
+ * Any standard allocator will do, including a
+ * std::pmr::polymorphic_allocator pointing at a memory resource.  Copies
+ * of the storage, and so copies of the tree, share the allocator.  Since
+ * an allocator needn't be safe to use from several threads, the tree does
+ * all of its allocating on one.
+ */
+template <typename Allocator> class AllocatorStorage {
+public:
+  typedef typename std::allocator_traits<Allocator>::template
+          rebind_alloc<uint64_t> WordAllocator;
+  typedef std::allocator_traits<WordAllocator> Traits;
+
+  static const bool kPreallocated = false;
+  static const bool kConcurrent = false;
+
+  /* Storage drawing on the given allocator.  The tree makes its storage
+   * from a capacity, which is ignored, and so gets a default allocator.
+   */
+  AllocatorStorage(const Allocator& allocator)
+    : mAllocator(allocator), mRoot(NULL) {}
+  explicit AllocatorStorage(size_t = 0) : mRoot(NULL) {}
+
+  /* Copying the storage yields empty storage using the same allocator. */
+  AllocatorStorage(const AllocatorStorage& other)
+    : mAllocator(other.mAllocator), mRoot(NULL) {}
+
+  /* Moving the storage hands over the root, leaving the source empty. */
+  AllocatorStorage(AllocatorStorage&& other) noexcept
+    : mAllocator(other.mAllocator), mRoot(other.mRoot) {
+    other.mRoot = NULL;
+  }
+
+  /* Blocks are handed out in whole words. */
+  static size_t blockSize(size_t bytes) {
+    return (bytes + 7) & ~size_t(7);
+  }
+  size_t capacity() const {
+    return 0;
+  }
+
+  void* allocate(size_t bytes) {
+    return Traits::allocate(mAllocator, blockSize(bytes) / sizeof(uint64_t));
+  }
+  void deallocate(void* memory, size_t bytes) {
+    Traits::deallocate(mAllocator, static_cast<uint64_t*>(memory),
+                       blockSize(bytes) / sizeof(uint64_t));
+  }
+
+  void*& root() {
+    return mRoot;
+  }
+  void* root() const {
+    return mRoot;
+  }
+
+  void swap(AllocatorStorage& other) {
+    const WordAllocator allocator(mAllocator);
+    reseat(mAllocator, other.mAllocator);
+    reseat(other.mAllocator, allocator);
+    std::swap(mRoot, other.mRoot);
+  }
+
+private:
+  WordAllocator mAllocator;
+  void* mRoot;
+
+  /* Not every allocator can be assigned (polymorphic_allocator can't), but
+   * every one can be copied, so allocators are swapped by copying them
+   * back into place.
+   */
+  static void reseat(WordAllocator& target, const WordAllocator& source) {
+    target.~WordAllocator();
+    new (&target) WordAllocator(source);
+  }
+
+  /* Assignment is done by the tree through copy-and-swap. */
+  AllocatorStorage& operator= (const AllocatorStorage&);
+};
+
+/**
+ * Policy: AllocatedClusters<Base, Allocator>
+ * ----------------------------------------------------------------------------
+ * Stores the clusters just as Base does, but allocates every node, leaf,
+ * and summary from the given allocator rather than the global heap; see
+ * AllocatorStorage.  A tree using this policy can be handed its allocator
+ * when it's constructed.  When the allocator draws on a region that's
+ * thrown away as a whole, such as a std::pmr::monotonic_buffer_resource,
+ * VanEmdeBoasTree::release drops the tree without walking it to free each
+ * node.
+ *
+ * Base must keep its tables inside its nodes, as DenseClusters and
+ * BoundedClusters do, since the table has no access to the allocator; a
+ * hash table would still come from the global heap.
+ */
+template <typename Base, typename Allocator> struct AllocatedClusters {
+  static_assert(std::is_same<typename Base::Storage, HeapStorage>::value &&
+                std::is_same<typename Base::Table, DenseClusters::Table>::value,
+                "AllocatedClusters needs clusters stored inside their nodes.");
+
+  typedef typename Base::Pointer      Pointer;
+  typedef AllocatorStorage<Allocator> Storage;
+  typedef typename Base::Table        Table;
+
+  static const bool kStoresBounds = Base::kStoresBounds;
+  static const bool kStoresCounts = Base::kStoresCounts;
+};
+
+#endif // VANEMDEBOASCLUSTERS_H
@@ -0,0 +1,552 @@
+/**
+ * @headerfile VanEmdeBoasFile.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief The on-disk format written by VanEmdeBoasTree::save
+ */
+
+#ifndef VANEMDEBOASFILE_H
+#define VANEMDEBOASFILE_H
+
+#include <algorithm> // For min
+#include <cstddef>   // For size_t
+#include <cstdint>   // For uint32_t, uint64_t
+#include <cstring>   // For memcmp, memcpy, memset
+#include <istream>   // For istream
+#include <ostream>   // For ostream
+#include <stdexcept> // For runtime_error
+#include <vector>    // For vector
+#include "VanEmdeBoasBits.h"
+
+/**
+ * A saved set is a pointer-free bitmap index that can be queried where it
+ * lies, so that a file mapped into memory needs no deserialization.
+ *
+ * The keys are cut into 8-bit digits.  Level 0 holds a 256-bit block for
+ * every run of 256 keys that has any keys in it, in order, with bit i of
+ * the block for run r set if r * 256 + i is in the set.  Level 1 does the
+ * same for the numbers of the runs in level 0, level 2 for those of level
+ * 1, and so on up to a top level of a single block, so a 32-bit set has
+ * four levels.  Alongside its bits, each block stores the number of bits set
+ * in all of the blocks before it on its level.  Since each bit set on one
+ * level stands for a block on the level below, that count is where the
+ * block's first child sits on the level below, and on level 0 it's the rank
+ * of the block's first key.  A lookup therefore goes down one block per
+ * level, counting bits as it goes, and never needs to know where a block
+ * sits in the universe.
+ *
+ * A file is a Header, then the levels from the top down.  Numbers are in
+ * the byte order of the machine that wrote them, which must match the
+ * machine reading them.  Headers are checked, along with the counts at the
+ * end of each level, when a View is made.  A query checks each block
+ * position it follows and each value it finds, and forEach checks the
+ * count of every block it passes, so a corrupt file makes them throw
+ * std::runtime_error rather than read outside the file or return values
+ * outside the universe.
+ */
+namespace VanEmdeBoasFile {
+  /* The number of bits of the key handled by each level. */
+  const size_t kDigitBits = 8;
+
+  /* The number of words in the bitvector of a block. */
+  const size_t kBlockWords = (size_t(1) << kDigitBits) / 64;
+
+  /* The most levels a set can have, for 64-bit keys. */
+  const size_t kMaxLevels = 64 / kDigitBits;
+
+  /* Marks the start of every file, and the version of the format. */
+  const char kMagic[8] = { 'v', 'E', 'B', 't', 'r', 'e', 'e', '\0' };
+  const uint32_t kVersion = 1;
+
+  /* The start of every file. */
+  struct Header {
+    char     mMagic[8];
+    uint32_t mVersion;
+    uint32_t mUniverseBits;
+    uint64_t mSize;
+    uint64_t mNumBlocks[kMaxLevels];
+  };
+
+  /* A block of 256 bits and the number of bits set before it on its level. */
+  struct Block {
+    uint64_t mWords[kBlockWords];
+    uint64_t mRankBefore;
+  };
+
+  /* The number of levels in a set over a universe of the given width. */
+  inline size_t numLevels(size_t universeBits) {
+    return (universeBits + kDigitBits - 1) / kDigitBits;
+  }
+
+  /* The digit of a value at the given level. */
+  inline size_t digit(uint64_t value, size_t level) {
+    return size_t(value >> (level * kDigitBits)) & ((size_t(1) << kDigitBits) - 1);
+  }
+
+  /* The bits of a value above the given level, which for the top level of
+   * a 64-bit set is nothing at all.
+   */
+  inline uint64_t above(uint64_t value, size_t level) {
+    const size_t shift = (level + 1) * kDigitBits;
+    return shift >= 64? 0 : (value >> shift) << shift;
+  }
+
+  /**
+   * Function: encode(size_t universeBits, Iterator begin, Iterator end);
+   * Usage: std::vector<uint64_t> bytes = VanEmdeBoasFile::encode(32, tree.begin(), tree.end());
+   * --------------------------------------------------------------------------
+   * Lays out the values in [begin, end), which must be distinct and in
+   * increasing order, as a set over a universe of the given width, in a
+   * buffer suitably aligned for a View.  The buffer holds exactly what
+   * write would write.
+   */
+  template <typename Iterator>
+  std::vector<uint64_t> encode(size_t universeBits, Iterator begin, Iterator end) {
+    const size_t levels = numLevels(universeBits);
+    std::vector<std::vector<Block> > blocks(levels);
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.mMagic, kMagic, sizeof(kMagic));
+    header.mVersion = kVersion;
+    header.mUniverseBits = uint32_t(universeBits);
+
+    /* Level 0 comes straight from the values.  Each level above then gets a
+     * bit for every block of the level below.
+     */
+    std::vector<uint64_t> runs;
+    for (; begin != end; ++begin) {
+      const uint64_t value = uint64_t(*begin);
+      const uint64_t run = value >> kDigitBits;
+      if (runs.empty() || runs.back() != run) {
+        runs.push_back(run);
+        blocks[0].push_back(Block());
+        std::memset(&blocks[0].back(), 0, sizeof(Block));
+        blocks[0].back().mRankBefore = header.mSize;
+      }
+      VanEmdeBoasBits::set(blocks[0].back().mWords, digit(value, 0));
+      ++header.mSize;
+    }
+    for (size_t level = 1; level < levels; ++level) {
+      std::vector<uint64_t> parents;
+      for (size_t i = 0; i < runs.size(); ++i) {
+        const uint64_t parent = runs[i] >> kDigitBits;
+        if (parents.empty() || parents.back() != parent) {
+          parents.push_back(parent);
+          blocks[level].push_back(Block());
+          std::memset(&blocks[level].back(), 0, sizeof(Block));
+          blocks[level].back().mRankBefore = i;
+        }
+        VanEmdeBoasBits::set(blocks[level].back().mWords,
+                             size_t(runs[i]) & ((size_t(1) << kDigitBits) - 1));
+      }
+      runs.swap(parents);
+    }
+
+    /* Then the header and the levels, top down, go into one buffer. */
+    size_t numBlocks = 0;
+    for (size_t level = 0; level < levels; ++level) {
+      header.mNumBlocks[level] = blocks[level].size();
+      numBlocks += blocks[level].size();
+    }
+    std::vector<uint64_t> result((sizeof(header) + numBlocks * sizeof(Block)) /
+                                 sizeof(uint64_t));
+    char* out = reinterpret_cast<char*>(result.data());
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    for (size_t level = levels; level-- > 0; ) {
+      if (blocks[level].empty()) continue;
+      std::memcpy(out, blocks[level].data(), blocks[level].size() * sizeof(Block));
+      out += blocks[level].size() * sizeof(Block);
+    }
+    return result;
+  }
+
+  /**
+   * Function: write(std::ostream& out, size_t universeBits,
+   *                 Iterator begin, Iterator end);
+   * Usage: VanEmdeBoasFile::write(out, 32, tree.begin(), tree.end());
+   * --------------------------------------------------------------------------
+   * Writes the values in [begin, end), which must be distinct and in
+   * increasing order, as a set over a universe of the given width.  The
+   * set is encoded in memory first, which takes about 40 bytes for every
+   * run of 256 keys that has any keys in it.  Throws std::runtime_error if
+   * the stream fails.
+   */
+  template <typename Iterator>
+  void write(std::ostream& out, size_t universeBits, Iterator begin, Iterator end) {
+    const std::vector<uint64_t> bytes = encode(universeBits, begin, end);
+    out.write(reinterpret_cast<const char*>(bytes.data()),
+              std::streamsize(bytes.size() * sizeof(uint64_t)));
+    if (!out) throw std::runtime_error("VanEmdeBoasFile::write: write failed.");
+  }
+
+  /**
+   * Class: View
+   * --------------------------------------------------------------------------
+   * A set in the format above, queried in place.  A View doesn't own the
+   * bytes it looks at, which must stay put, and be aligned to eight bytes,
+   * for as long as it's used.  Values are passed as 64-bit integers.
+   */
+  class View {
+  public:
+    /**
+     * Constructor: View();
+     *              View(const void* data, size_t bytes, size_t universeBits);
+     * Usage: VanEmdeBoasFile::View view(data, bytes, 32);
+     * ------------------------------------------------------------------------
+     * Makes a view of an empty set, or of the set in the given bytes.  Throws
+     * std::runtime_error if the bytes don't hold a set over a universe of
+     * the given width.  Checking takes time proportional to the number of
+     * levels, not the number of values.
+     */
+    View();
+    View(const void* data, size_t bytes, size_t universeBits);
+
+    /**
+     * bool contains(uint64_t value) const;
+     * bool successor(uint64_t value, uint64_t& result) const;
+     * bool predecessor(uint64_t value, uint64_t& result) const;
+     * bool first(uint64_t& result) const;
+     * bool last(uint64_t& result) const;
+     * uint64_t size() const;
+     * Usage: if (view.successor(137, next)) { ... }
+     * ------------------------------------------------------------------------
+     * Queries on the set.  successor and predecessor look for values
+     * strictly greater or less than the one given.  Each of the functions
+     * taking a result returns whether there's an answer and, if so, writes
+     * it there.  Values outside the universe are never in the set, and come
+     * after everything that is.  The functions that search throw
+     * std::runtime_error if they come across a block that couldn't have
+     * been written by write.
+     */
+    bool contains(uint64_t value) const;
+    bool successor(uint64_t value, uint64_t& result) const;
+    bool predecessor(uint64_t value, uint64_t& result) const;
+    bool first(uint64_t& result) const;
+    bool last(uint64_t& result) const;
+    uint64_t size() const;
+
+    /**
+     * template <typename Function> void forEach(Function fn) const;
+     * Usage: view.forEach([&](uint64_t value) { ... });
+     * ------------------------------------------------------------------------
+     * Calls fn on every value in the set in increasing order, a level at a
+     * time from the top down.  Since that reads every block, it also checks
+     * every block's count, and throws std::runtime_error, possibly after
+     * calling fn on some values, if any is wrong or a value lies outside
+     * the universe.  So a set that forEach gets through is exactly the one
+     * its counts describe.
+     */
+    template <typename Function> void forEach(Function fn) const;
+
+  private:
+    /* The blocks of each level, the number of them, the number of levels
+     * and values, and the largest value in the universe.
+     */
+    const Block* mLevels[kMaxLevels];
+    uint64_t mNumBlocks[kMaxLevels];
+    size_t mNumLevels;
+    uint64_t mSize;
+    uint64_t mUniverseMax;
+
+    /* Helper function to look up the block at pos on the given level,
+     * throwing if the file has no such block.
+     */
+    const Block& block(size_t level, uint64_t pos) const;
+
+    /* Helper function to hand back a value found by a search, throwing if
+     * it's outside the universe.
+     */
+    uint64_t checked(uint64_t value) const;
+
+    /* Helper functions to find the least value at least, or the greatest
+     * value at most, the given one.
+     */
+    bool atLeast(uint64_t value, uint64_t& result) const;
+    bool atMost(uint64_t value, uint64_t& result) const;
+
+    /* Helper functions to finish a search that has picked the bit at the
+     * given digit of the block at pos on the given level, by following the
+     * first or last bits down the levels below.
+     */
+    uint64_t descendFirst(uint64_t value, size_t level, uint64_t pos, size_t bit) const;
+    uint64_t descendLast(uint64_t value, size_t level, uint64_t pos, size_t bit) const;
+  };
+
+  /**
+   * Function: read(std::istream& in);
+   * Usage: std::vector<uint64_t> bytes = VanEmdeBoasFile::read(in);
+   * --------------------------------------------------------------------------
+   * Reads one saved set from the stream into a buffer suitably aligned for
+   * a View, leaving the stream just past it.  Throws std::runtime_error if
+   * the stream ends early or doesn't start with a header.  The buffer grows
+   * as the blocks come in, so a header claiming more blocks than the stream
+   * holds can't make it allocate more than the stream does hold.
+   */
+  inline std::vector<uint64_t> read(std::istream& in) {
+    Header header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.mMagic, kMagic, sizeof(kMagic)) != 0)
+      throw std::runtime_error("VanEmdeBoasFile::read: not a saved set.");
+
+    /* Levels the universe doesn't have must be empty. */
+    if (header.mUniverseBits == 0 || header.mUniverseBits > 64)
+      throw std::runtime_error("VanEmdeBoasFile::read: corrupt header.");
+    uint64_t numBlocks = 0;
+    for (size_t level = 0; level < kMaxLevels; ++level) {
+      if (level >= numLevels(header.mUniverseBits) && header.mNumBlocks[level] != 0)
+        throw std::runtime_error("VanEmdeBoasFile::read: corrupt header.");
+      numBlocks += header.mNumBlocks[level];
+    }
+    if (numBlocks > (uint64_t(1) << 58) / sizeof(Block))
+      throw std::runtime_error("VanEmdeBoasFile::read: corrupt header.");
+
+    const size_t kChunkWords = size_t(1) << 17;
+    const uint64_t numWords = (sizeof(header) + numBlocks * sizeof(Block)) /
+                              sizeof(uint64_t);
+    std::vector<uint64_t> result(sizeof(header) / sizeof(uint64_t));
+    std::memcpy(result.data(), &header, sizeof(header));
+    while (result.size() < numWords) {
+      const size_t done = result.size();
+      const size_t chunk = size_t(std::min<uint64_t>(numWords - done, kChunkWords));
+      result.resize(done + chunk);
+      if (!in.read(reinterpret_cast<char*>(result.data() + done),
+                   std::streamsize(chunk * sizeof(uint64_t))))
+        throw std::runtime_error("VanEmdeBoasFile::read: file is truncated.");
+    }
+    return result;
+  }
+
+  /**** Implementation of View ****/
+
+  inline View::View() : mNumLevels(0), mSize(0), mUniverseMax(0) {
+    std::memset(mLevels, 0, sizeof(mLevels));
+    std::memset(mNumBlocks, 0, sizeof(mNumBlocks));
+  }
+
+  /* Every bit set on a level must match a block on the level below, and
+   * every value on level 0 must be counted in the size, so the count before
+   * the last block of each level plus its own bits must add up.  The top
+   * level has one block, or none if the set is empty.
+   */
+  inline View::View(const void* data, size_t bytes, size_t universeBits) : View() {
+    Header header;
+    if (bytes < sizeof(header))
+      throw std::runtime_error("VanEmdeBoasFile::View: not a saved set.");
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.mMagic, kMagic, sizeof(kMagic)) != 0 ||
+        header.mVersion != kVersion)
+      throw std::runtime_error("VanEmdeBoasFile::View: not a saved set.");
+    if (header.mUniverseBits != universeBits)
+      throw std::runtime_error("VanEmdeBoasFile::View: universe doesn't match.");
+    if (reinterpret_cast<uintptr_t>(data) % sizeof(uint64_t) != 0)
+      throw std::runtime_error("VanEmdeBoasFile::View: data is misaligned.");
+
+    mNumLevels = numLevels(universeBits);
+    mSize = header.mSize;
+    mUniverseMax = universeBits >= 64? ~uint64_t(0) : (uint64_t(1) << universeBits) - 1;
+    const Block* next = reinterpret_cast<const Block*>(static_cast<const char*>(data) +
+                                                       sizeof(header));
+    uint64_t remaining = (bytes - sizeof(header)) / sizeof(Block);
+    for (size_t level = mNumLevels; level-- > 0; ) {
+      mNumBlocks[level] = header.mNumBlocks[level];
+      if (mNumBlocks[level] > remaining)
+        throw std::runtime_error("VanEmdeBoasFile::View: file is truncated.");
+      mLevels[level] = next;
+      next += mNumBlocks[level];
+      remaining -= mNumBlocks[level];
+    }
+
+    if (mNumBlocks[mNumLevels - 1] != (mSize == 0? 0 : 1) ||
+        mSize > (mNumBlocks[0] << kDigitBits))
+      throw std::runtime_error("VanEmdeBoasFile::View: corrupt header.");
+    for (size_t level = 0; level < mNumLevels && mSize != 0; ++level) {
+      const uint64_t below = level == 0? mSize : mNumBlocks[level - 1];
+      const Block& lastBlock = mLevels[level][mNumBlocks[level] - 1];
+      if (mNumBlocks[level] == 0 ||
+          lastBlock.mRankBefore +
+          VanEmdeBoasBits::countBelow(lastBlock.mWords, size_t(1) << kDigitBits) != below)
+        throw std::runtime_error("VanEmdeBoasFile::View: corrupt levels.");
+    }
+  }
+
+  /* Each level's digit picks a bit of the current block, and the bits below
+   * it say which block on the next level down to look at.
+   */
+  inline bool View::contains(uint64_t value) const {
+    if (mSize == 0 || value > mUniverseMax) return false;
+
+    uint64_t pos = 0;
+    for (size_t level = mNumLevels; level-- > 0; ) {
+      const Block& here = block(level, pos);
+      const size_t bit = digit(value, level);
+      if (!VanEmdeBoasBits::test(here.mWords, bit)) return false;
+      pos = here.mRankBefore + VanEmdeBoasBits::countBelow(here.mWords, bit);
+    }
+    return true;
+  }
+
+  inline bool View::successor(uint64_t value, uint64_t& result) const {
+    if (value == ~uint64_t(0)) return false;
+    return atLeast(value + 1, result);
+  }
+  inline bool View::predecessor(uint64_t value, uint64_t& result) const {
+    if (value == 0) return false;
+    return atMost(value - 1, result);
+  }
+  inline bool View::first(uint64_t& result) const {
+    return atLeast(0, result);
+  }
+  inline bool View::last(uint64_t& result) const {
+    return atMost(mUniverseMax, result);
+  }
+  inline uint64_t View::size() const {
+    return mSize;
+  }
+
+  /* A position past the end of its level can only come from a bad count. */
+  inline const Block& View::block(size_t level, uint64_t pos) const {
+    if (pos >= mNumBlocks[level])
+      throw std::runtime_error("VanEmdeBoasFile::View: corrupt levels.");
+    return mLevels[level][pos];
+  }
+  inline uint64_t View::checked(uint64_t value) const {
+    if (value > mUniverseMax)
+      throw std::runtime_error("VanEmdeBoasFile::View: value outside universe.");
+    return value;
+  }
+
+  /* Follows the value down for as long as its digits are there, remembering
+   * the block on each level.  Where it falls off, the answer is the next bit
+   * set in the block it fell off of or, failing that, in the nearest block
+   * above it with a later bit, followed down by first bits.
+   */
+  inline bool View::atLeast(uint64_t value, uint64_t& result) const {
+    if (mSize == 0 || value > mUniverseMax) return false;
+
+    uint64_t path[kMaxLevels];
+    uint64_t pos = 0;
+    size_t level = mNumLevels;
+    while (level-- > 0) {
+      const Block& here = block(level, pos);
+      const size_t bit = digit(value, level);
+      path[level] = pos;
+      if (level == 0 || !VanEmdeBoasBits::test(here.mWords, bit)) break;
+      pos = here.mRankBefore + VanEmdeBoasBits::countBelow(here.mWords, bit);
+    }
+
+    /* The block we fell off of may still have the digit itself, on level 0,
+     * or a later one; the blocks above are only good for later digits.
+     */
+    for (size_t from = digit(value, level); level < mNumLevels; ) {
+      size_t bit;
+      if (VanEmdeBoasBits::findFirst(mLevels[level][path[level]].mWords, kBlockWords,
+                                     from, bit)) {
+        result = checked(descendFirst(value, level, path[level], bit));
+        return true;
+      }
+      if (++level < mNumLevels) from = digit(value, level) + 1;
+    }
+    return false;
+  }
+  inline bool View::atMost(uint64_t value, uint64_t& result) const {
+    if (mSize == 0) return false;
+    value = std::min(value, mUniverseMax);
+
+    uint64_t path[kMaxLevels];
+    uint64_t pos = 0;
+    size_t level = mNumLevels;
+    while (level-- > 0) {
+      const Block& here = block(level, pos);
+      const size_t bit = digit(value, level);
+      path[level] = pos;
+      if (level == 0 || !VanEmdeBoasBits::test(here.mWords, bit)) break;
+      pos = here.mRankBefore + VanEmdeBoasBits::countBelow(here.mWords, bit);
+    }
+
+    /* As above, but a digit of zero leaves nothing earlier in its block. */
+    for (size_t to = digit(value, level); level < mNumLevels; ) {
+      size_t bit;
+      if (to != size_t(-1) &&
+          VanEmdeBoasBits::findLast(mLevels[level][path[level]].mWords, to, bit)) {
+        result = checked(descendLast(value, level, path[level], bit));
+        return true;
+      }
+      if (++level < mNumLevels) to = digit(value, level) - 1;
+    }
+    return false;
+  }
+
+  /* Below the level where the search turned, every digit is the first or
+   * last one set in its block.  The first bit of a block has nothing before
+   * it, so its child is the block's first; the last has all the others.  A
+   * block with no bits at all can only come from a corrupt file.
+   */
+  inline uint64_t View::descendFirst(uint64_t value, size_t level, uint64_t pos,
+                                     size_t bit) const {
+    uint64_t result = above(value, level) | (uint64_t(bit) << (level * kDigitBits));
+    pos = mLevels[level][pos].mRankBefore +
+          VanEmdeBoasBits::countBelow(mLevels[level][pos].mWords, bit);
+    while (level-- > 0) {
+      const Block& here = block(level, pos);
+      if (!VanEmdeBoasBits::findFirst(here.mWords, kBlockWords, 0, bit))
+        throw std::runtime_error("VanEmdeBoasFile::View: corrupt levels.");
+      result |= uint64_t(bit) << (level * kDigitBits);
+      pos = here.mRankBefore;
+    }
+    return result;
+  }
+  inline uint64_t View::descendLast(uint64_t value, size_t level, uint64_t pos,
+                                    size_t bit) const {
+    uint64_t result = above(value, level) | (uint64_t(bit) << (level * kDigitBits));
+    pos = mLevels[level][pos].mRankBefore +
+          VanEmdeBoasBits::countBelow(mLevels[level][pos].mWords, bit);
+    while (level-- > 0) {
+      const Block& here = block(level, pos);
+      if (!VanEmdeBoasBits::findLast(here.mWords, (size_t(1) << kDigitBits) - 1, bit))
+        throw std::runtime_error("VanEmdeBoasFile::View: corrupt levels.");
+      result |= uint64_t(bit) << (level * kDigitBits);
+      pos = here.mRankBefore + VanEmdeBoasBits::countBelow(here.mWords, bit);
+    }
+    return result;
+  }
+
+  /* Works out where each block sits in the universe, a level at a time,
+   * from the bits of its parent; the blocks on level 0 then spell out the
+   * values.  Along the way, every level must have a block for each bit set
+   * on the level above, each block's count must be the number of bits set
+   * before it, and the bits on level 0 must add up to the size.
+   */
+  template <typename Function>
+  void View::forEach(Function fn) const {
+    if (mSize == 0) return;
+
+    std::vector<uint64_t> runs(1, 0);
+    for (size_t level = mNumLevels; level-- > 0; ) {
+      if (runs.size() != mNumBlocks[level])
+        throw std::runtime_error("VanEmdeBoasFile::View: corrupt levels.");
+      std::vector<uint64_t> children;
+      children.reserve(level == 0? 0 : size_t(mNumBlocks[level - 1]));
+      uint64_t count = 0;
+      for (size_t i = 0; i < runs.size(); ++i) {
+        const Block& block = mLevels[level][i];
+        if (block.mRankBefore != count)
+          throw std::runtime_error("VanEmdeBoasFile::View: corrupt levels.");
+        for (size_t word = 0; word < kBlockWords; ++word) {
+          for (uint64_t bits = block.mWords[word]; bits != 0; bits &= bits - 1) {
+            const uint64_t value = (runs[i] << kDigitBits) |
+                                   (word * 64 + VanEmdeBoasBits::lowestSetBit(bits));
+            if (level == 0) fn(checked(value));
+            else            children.push_back(value);
+            ++count;
+          }
+        }
+      }
+      if (level == 0 && count != mSize)
+        throw std::runtime_error("VanEmdeBoasFile::View: corrupt levels.");
+      runs.swap(children);
+    }
+  }
+}
+
+#endif // VANEMDEBOASFILE_H
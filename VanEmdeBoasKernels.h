@@ -0,0 +1,325 @@
+/**
+ * @headerfile VanEmdeBoasKernels.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Vectorized scans over runs of bitvector words, picked at run time
+ */
+
+#ifndef VANEMDEBOASKERNELS_H
+#define VANEMDEBOASKERNELS_H
+
+#include <cstddef> // For size_t
+#include <cstdint> // For uint64_t
+
+/* Define VANEMDEBOAS_NO_SIMD to use only the portable kernels. */
+#if !defined(VANEMDEBOAS_NO_SIMD) && defined(__x86_64__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define VANEMDEBOAS_X86_KERNELS 1
+#include <immintrin.h> // For the AVX2 and AVX-512 intrinsics
+#elif !defined(VANEMDEBOAS_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define VANEMDEBOAS_NEON_KERNELS 1
+#include <arm_neon.h>  // For the NEON intrinsics
+#endif
+
+/**
+ * The bitvectors at the bottom of a vEB-tree with wide leaves run to dozens
+ * of words, and scanning them a word at a time for the next set bit, or
+ * counting their bits, is most of what a query on them costs.  The kernels
+ * in this namespace do those scans several words at a time with whatever
+ * vector instructions the processor has.
+ *
+ * Each kernel works on a run of whole words:
+ *
+ *   size_t firstNonzero(const uint64_t* words, size_t n);
+ *     Returns the index of the first nonzero word of the n, or n if they're
+ *     all zero.
+ *
+ *   size_t lastNonzero(const uint64_t* words, size_t n);
+ *     Returns one more than the index of the last nonzero word of the n, or
+ *     0 if they're all zero.
+ *
+ *   size_t popCount(const uint64_t* words, size_t n);
+ *     Returns the number of set bits in the n words.
+ *
+ * On x86-64, the AVX2 and AVX-512 kernels are compiled with per-function
+ * target attributes rather than with -mavx2, so the library builds for any
+ * x86-64 and picks the best kernels the processor supports the first time
+ * they're used.  Processors without AVX2 get the portable loops, with the
+ * POPCNT instruction if they have it, since without -mpopcnt the compiler
+ * counts bits in software.  On AArch64, NEON is always there, so its
+ * kernels are picked at compile time.  Elsewhere, or with
+ * VANEMDEBOAS_NO_SIMD defined, only the portable kernels are built.
+ *
+ * Calling a kernel goes through a function pointer, which for a handful of
+ * words costs more than the scan, so VanEmdeBoasBits only hands runs of at
+ * least kMinWords words to them.  Counting bits without POPCNT is slow
+ * enough that runs of kMinCountWords words are already worth the call.
+ */
+namespace VanEmdeBoasKernels {
+  /* The shortest runs worth calling a kernel for. */
+  const size_t kMinWords      = 8;
+  const size_t kMinCountWords = 2;
+
+  /* A set of kernels, named for reporting. */
+  struct Kernels {
+    const char* name;
+    size_t (*firstNonzero)(const uint64_t* words, size_t n);
+    size_t (*lastNonzero)(const uint64_t* words, size_t n);
+    size_t (*popCount)(const uint64_t* words, size_t n);
+  };
+
+  /* The portable kernels. */
+  namespace portable {
+    inline size_t firstNonzero(const uint64_t* words, size_t n) {
+      size_t i = 0;
+      while (i < n && words[i] == 0) ++i;
+      return i;
+    }
+    inline size_t lastNonzero(const uint64_t* words, size_t n) {
+      while (n > 0 && words[n - 1] == 0) --n;
+      return n;
+    }
+    inline size_t popCount(const uint64_t* words, size_t n) {
+      size_t count = 0;
+      for (size_t i = 0; i < n; ++i) {
+#if defined(__GNUC__) || defined(__clang__)
+        count += size_t(__builtin_popcountll(words[i]));
+#else
+        for (uint64_t word = words[i]; word != 0; word &= word - 1) ++count;
+#endif
+      }
+      return count;
+    }
+
+    inline const Kernels& kernels() {
+      static const Kernels result = {
+        "portable", &firstNonzero, &lastNonzero, &popCount
+      };
+      return result;
+    }
+  }
+
+#ifdef VANEMDEBOAS_X86_KERNELS
+  /* The portable loops, but counting bits with the POPCNT instruction. */
+  namespace popcnt {
+    __attribute__((target("popcnt")))
+    inline size_t popCount(const uint64_t* words, size_t n) {
+      size_t count = 0;
+      for (size_t i = 0; i < n; ++i) count += size_t(__builtin_popcountll(words[i]));
+      return count;
+    }
+
+    inline const Kernels& kernels() {
+      static const Kernels result = {
+        "popcnt", &portable::firstNonzero, &portable::lastNonzero, &popCount
+      };
+      return result;
+    }
+  }
+
+  /* AVX2 kernels test eight words at a time as two 256-bit vectors, and
+   * count bits by looking up each nibble's count with a byte shuffle and
+   * summing the bytes with vpsadbw, per Mula, Kurz, and Lemire.
+   */
+  namespace avx2 {
+    __attribute__((target("avx2")))
+    inline size_t firstNonzero(const uint64_t* words, size_t n) {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+        const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i + 4));
+        const __m256i both = _mm256_or_si256(lo, hi);
+        if (!_mm256_testz_si256(both, both)) break;
+      }
+      while (i < n && words[i] == 0) ++i;
+      return i;
+    }
+
+    __attribute__((target("avx2")))
+    inline size_t lastNonzero(const uint64_t* words, size_t n) {
+      for (; n >= 8; n -= 8) {
+        const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + n - 8));
+        const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + n - 4));
+        const __m256i both = _mm256_or_si256(lo, hi);
+        if (!_mm256_testz_si256(both, both)) break;
+      }
+      while (n > 0 && words[n - 1] == 0) --n;
+      return n;
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i countBytes(__m256i vector) {
+      const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                             0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+      const __m256i nibbles = _mm256_set1_epi8(0x0F);
+      const __m256i lo = _mm256_and_si256(vector, nibbles);
+      const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(vector, 4), nibbles);
+      return _mm256_add_epi8(_mm256_shuffle_epi8(table, lo),
+                             _mm256_shuffle_epi8(table, hi));
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    inline size_t popCount(const uint64_t* words, size_t n) {
+      __m256i total = _mm256_setzero_si256();
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+        /* Two vectors' byte counts, at most 16 each, fit in a byte. */
+        const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i + 4));
+        const __m256i bytes = _mm256_add_epi8(countBytes(lo), countBytes(hi));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+      }
+
+      size_t count = size_t(_mm256_extract_epi64(total, 0)) +
+                     size_t(_mm256_extract_epi64(total, 1)) +
+                     size_t(_mm256_extract_epi64(total, 2)) +
+                     size_t(_mm256_extract_epi64(total, 3));
+      for (; i < n; ++i) count += size_t(__builtin_popcountll(words[i]));
+      return count;
+    }
+
+    inline const Kernels& kernels() {
+      static const Kernels result = {
+        "avx2", &firstNonzero, &lastNonzero, &popCount
+      };
+      return result;
+    }
+  }
+
+  /* AVX-512 kernels test eight words at a time, and the mask of which are
+   * nonzero says where the first or last one is without a second pass.
+   * They count bits with VPOPCNTQ where the processor has it, and with the
+   * AVX2 kernel otherwise.
+   */
+  namespace avx512 {
+    __attribute__((target("avx512f")))
+    inline size_t firstNonzero(const uint64_t* words, size_t n) {
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+        const __m512i vector = _mm512_loadu_si512(words + i);
+        const __mmask8 nonzero = _mm512_test_epi64_mask(vector, vector);
+        if (nonzero != 0) return i + size_t(__builtin_ctz(nonzero));
+      }
+      while (i < n && words[i] == 0) ++i;
+      return i;
+    }
+
+    __attribute__((target("avx512f")))
+    inline size_t lastNonzero(const uint64_t* words, size_t n) {
+      for (; n >= 8; n -= 8) {
+        const __m512i vector = _mm512_loadu_si512(words + n - 8);
+        const __mmask8 nonzero = _mm512_test_epi64_mask(vector, vector);
+        if (nonzero != 0) return n - size_t(__builtin_clz(unsigned(nonzero)) - 24);
+      }
+      while (n > 0 && words[n - 1] == 0) --n;
+      return n;
+    }
+
+    __attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+    inline size_t popCount(const uint64_t* words, size_t n) {
+      __m512i total = _mm512_setzero_si512();
+      size_t i = 0;
+      for (; i + 8 <= n; i += 8)
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+
+      uint64_t lanes[8];
+      _mm512_storeu_si512(lanes, total);
+      size_t count = 0;
+      for (size_t lane = 0; lane < 8; ++lane) count += size_t(lanes[lane]);
+      for (; i < n; ++i) count += size_t(__builtin_popcountll(words[i]));
+      return count;
+    }
+
+    inline const Kernels& kernels() {
+      static const Kernels result = {
+        "avx512", &firstNonzero, &lastNonzero, &avx2::popCount
+      };
+      return result;
+    }
+    inline const Kernels& kernelsWithPopcnt() {
+      static const Kernels result = {
+        "avx512+vpopcntdq", &firstNonzero, &lastNonzero, &popCount
+      };
+      return result;
+    }
+  }
+
+  /* Picks the best kernels the processor supports. */
+  inline const Kernels& detect() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      if (__builtin_cpu_supports("avx512vpopcntdq"))
+        return avx512::kernelsWithPopcnt();
+      return avx512::kernels();
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+      return avx2::kernels();
+    if (__builtin_cpu_supports("popcnt"))
+      return popcnt::kernels();
+    return portable::kernels();
+  }
+#endif
+
+#ifdef VANEMDEBOAS_NEON_KERNELS
+  /* NEON kernels test four words at a time as two 128-bit vectors, and
+   * count bits a byte at a time with vcnt.
+   */
+  namespace neon {
+    inline size_t firstNonzero(const uint64_t* words, size_t n) {
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4) {
+        const uint64x2_t both = vorrq_u64(vld1q_u64(words + i), vld1q_u64(words + i + 2));
+        if (vmaxvq_u32(vreinterpretq_u32_u64(both)) != 0) break;
+      }
+      while (i < n && words[i] == 0) ++i;
+      return i;
+    }
+    inline size_t lastNonzero(const uint64_t* words, size_t n) {
+      for (; n >= 4; n -= 4) {
+        const uint64x2_t both = vorrq_u64(vld1q_u64(words + n - 4), vld1q_u64(words + n - 2));
+        if (vmaxvq_u32(vreinterpretq_u32_u64(both)) != 0) break;
+      }
+      while (n > 0 && words[n - 1] == 0) --n;
+      return n;
+    }
+    inline size_t popCount(const uint64_t* words, size_t n) {
+      size_t count = 0;
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4) {
+        /* Two vectors' byte counts, at most 16 each, fit in a byte. */
+        const uint8x16_t lo = vcntq_u8(vreinterpretq_u8_u64(vld1q_u64(words + i)));
+        const uint8x16_t hi = vcntq_u8(vreinterpretq_u8_u64(vld1q_u64(words + i + 2)));
+        count += vaddlvq_u8(vaddq_u8(lo, hi));
+      }
+      for (; i < n; ++i) count += size_t(__builtin_popcountll(words[i]));
+      return count;
+    }
+
+    inline const Kernels& kernels() {
+      static const Kernels result = {
+        "neon", &firstNonzero, &lastNonzero, &popCount
+      };
+      return result;
+    }
+  }
+#endif
+
+  /**
+   * const Kernels& active();
+   * Usage: size_t count = VanEmdeBoasKernels::active().popCount(words, n);
+   * --------------------------------------------------------------------------
+   * Returns the kernels in use, picking them the first time it's called.
+   */
+  inline const Kernels& active() {
+#if defined(VANEMDEBOAS_X86_KERNELS)
+    static const Kernels& result = detect();
+    return result;
+#elif defined(VANEMDEBOAS_NEON_KERNELS)
+    return neon::kernels();
+#else
+    return portable::kernels();
+#endif
+  }
+}
+
+#endif // VANEMDEBOASKERNELS_H
@@ -0,0 +1,981 @@
+/**
+ * @headerfile VanEmdeBoasMap.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief A map from integer keys to values, ordered by a vEB-tree
+ */
+
+#ifndef VANEMDEBOASMAP_H
+#define VANEMDEBOASMAP_H
+
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t, ptrdiff_t
+#include <cstdint>     // For uint64_t, UINT64_C
+#include <iterator>    // For iterator, bidirectional_iterator_tag, reverse_iterator
+#include <new>         // For placement new
+#include <stdexcept>   // For out_of_range
+#include <tuple>       // For forward_as_tuple
+#include <type_traits> // For aligned_storage, conditional
+#include <utility>     // For pair, piecewise_construct, forward, move, swap
+#include "VanEmdeBoasBits.h"
+#include "VanEmdeBoasTree.h"
+
+/**
+ * Policies for where a VanEmdeBoasMap keeps its values.  Each is a struct
+ * with a nested class template
+ *
+ *   template <typename Key, typename Value, size_t UniverseBits> class Table;
+ *
+ * holding entries of type std::pair<const Key, Value>, one per key in the
+ * map.  The map keeps its keys in a VanEmdeBoasTree and only ever asks the
+ * table for entries by key, so a table needs:
+ *
+ *   Table(), copy and move constructors, a destructor, and
+ *   void swap(Table& other) noexcept;
+ *     The usual.  Copies copy every entry.
+ *
+ *   Entry* find(Key key) const;
+ *     Returns the entry for the key, or NULL if there isn't one.
+ *
+ *   template <typename... Args> Entry* emplace(Key key, Args&&... args);
+ *     Makes an entry for a key that doesn't have one yet, constructing its
+ *     value from args.  If that throws, the table is unchanged.
+ *
+ *   void erase(Key key);
+ *     Destroys the entry for a key that has one.
+ *
+ *   void clear();
+ *     Destroys every entry and gives back the table's memory.
+ *
+ *   size_t memoryUsage() const;
+ *     Returns the number of bytes the table holds on the heap.
+ */
+
+/**
+ * DenseValues keeps a slot for every key in the universe, allocated when the
+ * first entry goes in, along with a bit per key saying which slots are in
+ * use.  Finding an entry is a single index into the array, and entries never
+ * move once made.  That costs sizeof(Entry) bytes per key of the universe,
+ * so it's the default only for universes of up to 16 bits, and it's limited
+ * to universes of 24 bits.
+ */
+struct DenseValues {
+  template <typename Key, typename Value, size_t UniverseBits> class Table {
+    static_assert(UniverseBits <= 24,
+                  "DenseValues keeps a slot for every key, so its universe "
+                  "can be at most 24 bits.");
+  public:
+    typedef std::pair<const Key, Value> Entry;
+
+    Table() : mSlots(NULL), mUsed(NULL), mCount(0) {}
+    Table(const Table& other) : mSlots(NULL), mUsed(NULL), mCount(0) {
+      if (other.mCount == 0) return;
+      allocate();
+      try {
+        other.forEach([&](Key key, const Entry& entry) {
+          new (&mSlots[key]) Entry(entry);
+          VanEmdeBoasBits::set(mUsed, key);
+          ++mCount;
+        });
+      } catch (...) {
+        clear();
+        throw;
+      }
+    }
+    Table(Table&& other) noexcept : mSlots(NULL), mUsed(NULL), mCount(0) {
+      swap(other);
+    }
+    ~Table() {
+      clear();
+    }
+
+    void swap(Table& other) noexcept {
+      std::swap(mSlots, other.mSlots);
+      std::swap(mUsed, other.mUsed);
+      std::swap(mCount, other.mCount);
+    }
+
+    Entry* find(Key key) const {
+      if (mCount == 0 || uint64_t(key) >= kNumSlots ||
+          !VanEmdeBoasBits::test(mUsed, key))
+        return NULL;
+      return entry(key);
+    }
+
+    template <typename... Args> Entry* emplace(Key key, Args&&... args) {
+      if (mSlots == NULL) allocate();
+      Entry* result = new (&mSlots[key]) Entry(std::piecewise_construct,
+                                               std::forward_as_tuple(key),
+                                               std::forward_as_tuple(std::forward<Args>(args)...));
+      VanEmdeBoasBits::set(mUsed, key);
+      ++mCount;
+      return result;
+    }
+
+    void erase(Key key) {
+      entry(key)->~Entry();
+      VanEmdeBoasBits::clear(mUsed, key);
+      --mCount;
+    }
+
+    void clear() {
+      if (mSlots == NULL) return;
+      forEach([](Key, Entry& entry) { entry.~Entry(); });
+      delete[] mSlots;
+      delete[] mUsed;
+      mSlots = NULL;
+      mUsed = NULL;
+      mCount = 0;
+    }
+
+    size_t memoryUsage() const {
+      if (mSlots == NULL) return 0;
+      return kNumSlots * sizeof(Slot) +
+             VanEmdeBoasBits::numWords(UniverseBits) * sizeof(uint64_t);
+    }
+
+  private:
+    typedef typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type Slot;
+    static const uint64_t kNumSlots = uint64_t(1) << UniverseBits;
+
+    Slot* mSlots;
+    uint64_t* mUsed;
+    size_t mCount;
+
+    Entry* entry(Key key) const {
+      return reinterpret_cast<Entry*>(&mSlots[key]);
+    }
+
+    /* Sets both arrays or, if either allocation throws, neither. */
+    void allocate() {
+      Slot* slots = new Slot[kNumSlots];
+      const size_t numWords = VanEmdeBoasBits::numWords(UniverseBits);
+      try {
+        mUsed = new uint64_t[numWords]();
+      } catch (...) {
+        delete[] slots;
+        throw;
+      }
+      mSlots = slots;
+    }
+
+    /* Calls fn(key, entry) on each entry, a word of the bitmap at a time. */
+    template <typename Function> void forEach(Function fn) const {
+      VanEmdeBoasBits::forEachWord(mUsed, 0, kNumSlots - 1,
+                                   [&](size_t first, uint64_t bits) {
+        for (; bits != 0; bits &= bits - 1) {
+          const Key key = static_cast<Key>(first + VanEmdeBoasBits::lowestSetBit(bits));
+          fn(key, *entry(key));
+        }
+      });
+    }
+  };
+};
+
+/**
+ * HashedValues keeps its entries in one array of slots, indexed by a hash of
+ * the key, so that it takes space in proportion to the number of entries
+ * rather than the size of the universe.  It's the default for universes
+ * wider than 16 bits.  As in HashedClusters, the table uses linear probing
+ * with a power-of-two capacity kept between one-eighth and one-half full,
+ * and deletions shift later entries back rather than leaving tombstones.
+ * That means entries move when the table grows or shrinks, or when an
+ * entry before them in a run is erased.
+ */
+struct HashedValues {
+  template <typename Key, typename Value, size_t UniverseBits> class Table {
+  public:
+    typedef std::pair<const Key, Value> Entry;
+
+    Table() : mSlots(NULL), mUsed(NULL), mCapacity(0), mCount(0), mShift(0) {}
+    Table(const Table& other)
+      : mSlots(NULL), mUsed(NULL), mCapacity(0), mCount(0), mShift(0) {
+      if (other.mCount == 0) return;
+
+      /* Copying each entry into the same slot keeps every probe sequence
+       * intact.
+       */
+      allocate(other.mCapacity);
+      try {
+        for (size_t i = 0; i < mCapacity; ++i) {
+          if (!VanEmdeBoasBits::test(other.mUsed, i)) continue;
+          new (&mSlots[i]) Entry(*other.entry(i));
+          VanEmdeBoasBits::set(mUsed, i);
+          ++mCount;
+        }
+      } catch (...) {
+        clear();
+        throw;
+      }
+    }
+    Table(Table&& other) noexcept
+      : mSlots(NULL), mUsed(NULL), mCapacity(0), mCount(0), mShift(0) {
+      swap(other);
+    }
+    ~Table() {
+      clear();
+    }
+
+    void swap(Table& other) noexcept {
+      std::swap(mSlots, other.mSlots);
+      std::swap(mUsed, other.mUsed);
+      std::swap(mCapacity, other.mCapacity);
+      std::swap(mCount, other.mCount);
+      std::swap(mShift, other.mShift);
+    }
+
+    Entry* find(Key key) const {
+      if (mCount == 0) return NULL;
+      for (size_t i = home(key); VanEmdeBoasBits::test(mUsed, i);
+           i = (i + 1) & (mCapacity - 1))
+        if (entry(i)->first == key) return entry(i);
+      return NULL;
+    }
+
+    /* The value is constructed before the table grows, so that if it
+     * throws, nothing has moved, and destroyed again if growing throws.
+     */
+    template <typename... Args> Entry* emplace(Key key, Args&&... args) {
+      Slot made;
+      Entry* result = new (&made) Entry(std::piecewise_construct,
+                                        std::forward_as_tuple(key),
+                                        std::forward_as_tuple(std::forward<Args>(args)...));
+      if (2 * (mCount + 1) > mCapacity) {
+        try {
+          rehash(mCapacity == 0? kMinCapacity : 2 * mCapacity);
+        } catch (...) {
+          result->~Entry();
+          throw;
+        }
+      }
+
+      size_t i = home(key);
+      while (VanEmdeBoasBits::test(mUsed, i)) i = (i + 1) & (mCapacity - 1);
+      moveEntry(result, i);
+      ++mCount;
+      return entry(i);
+    }
+
+    void erase(Key key) {
+      size_t hole = home(key);
+      while (entry(hole)->first != key) hole = (hole + 1) & (mCapacity - 1);
+      entry(hole)->~Entry();
+      VanEmdeBoasBits::clear(mUsed, hole);
+      --mCount;
+
+      /* Shift back any later entries in the run that would otherwise become
+       * unreachable.  An entry can move into the hole if its home lies
+       * cyclically outside (hole, curr].
+       */
+      for (size_t curr = (hole + 1) & (mCapacity - 1);
+           VanEmdeBoasBits::test(mUsed, curr);
+           curr = (curr + 1) & (mCapacity - 1)) {
+        const size_t want = home(entry(curr)->first);
+        if (((curr - want) & (mCapacity - 1)) >=
+            ((curr - hole) & (mCapacity - 1))) {
+          moveEntry(entry(curr), hole);
+          VanEmdeBoasBits::clear(mUsed, curr);
+          hole = curr;
+        }
+      }
+
+      /* Give back memory once the table is mostly empty. */
+      if (mCount == 0)
+        clear();
+      else if (8 * mCount < mCapacity && mCapacity > kMinCapacity)
+        rehash(mCapacity / 2);
+    }
+
+    void clear() {
+      for (size_t i = 0; i < mCapacity; ++i)
+        if (VanEmdeBoasBits::test(mUsed, i)) entry(i)->~Entry();
+      delete[] mSlots;
+      delete[] mUsed;
+      mSlots = NULL;
+      mUsed = NULL;
+      mCapacity = 0;
+      mCount = 0;
+      mShift = 0;
+    }
+
+    size_t memoryUsage() const {
+      if (mCapacity == 0) return 0;
+      return mCapacity * sizeof(Slot) +
+             VanEmdeBoasBits::numWords(capacityBits()) * sizeof(uint64_t);
+    }
+
+  private:
+    typedef typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type Slot;
+
+    /* The smallest nonzero capacity we'll use. */
+    static const size_t kMinCapacity = 8;
+
+    Slot* mSlots;
+    uint64_t* mUsed;
+    size_t mCapacity;
+    size_t mCount;
+
+    /* 64 - lg(mCapacity), used to pick the top bits of the hash. */
+    unsigned mShift;
+
+    Entry* entry(size_t slot) const {
+      return reinterpret_cast<Entry*>(&mSlots[slot]);
+    }
+
+    /* Fibonacci hashing, as in HashedClusters. */
+    size_t home(Key key) const {
+      return static_cast<size_t>((uint64_t(key) * UINT64_C(0x9E3779B97F4A7C15)) >> mShift);
+    }
+
+    size_t capacityBits() const {
+      return 64 - mShift;
+    }
+
+    /* Points the table at fresh, empty arrays of the given capacity.  The
+     * table is only changed once both are allocated, so if either throws it
+     * still has its old arrays, and nothing leaks.
+     */
+    void allocate(size_t capacity) {
+      unsigned shift = 64;
+      for (size_t cap = capacity; cap > 1; cap >>= 1) --shift;
+      Slot* slots = new Slot[capacity];
+      uint64_t* used;
+      try {
+        used = new uint64_t[VanEmdeBoasBits::numWords(64 - shift)]();
+      } catch (...) {
+        delete[] slots;
+        throw;
+      }
+      mSlots = slots;
+      mUsed = used;
+      mCapacity = capacity;
+      mShift = shift;
+    }
+
+    /* Moves an entry into a free slot, destroying the original. */
+    void moveEntry(Entry* from, size_t slot) {
+      new (&mSlots[slot]) Entry(std::move(*from));
+      from->~Entry();
+      VanEmdeBoasBits::set(mUsed, slot);
+    }
+
+    /* Moves every entry into fresh arrays of the given capacity, which are
+     * allocated first so that if that throws, the table is as it was.
+     */
+    void rehash(size_t newCapacity) {
+      Slot* oldSlots = mSlots;
+      uint64_t* oldUsed = mUsed;
+      const size_t oldCapacity = mCapacity;
+
+      allocate(newCapacity);
+      for (size_t i = 0; i < oldCapacity; ++i) {
+        if (!VanEmdeBoasBits::test(oldUsed, i)) continue;
+
+        Entry* from = reinterpret_cast<Entry*>(&oldSlots[i]);
+        size_t j = home(from->first);
+        while (VanEmdeBoasBits::test(mUsed, j)) j = (j + 1) & (mCapacity - 1);
+        moveEntry(from, j);
+      }
+
+      delete[] oldSlots;
+      delete[] oldUsed;
+    }
+  };
+};
+
+/**
+ * A class representing a map from unsigned integer keys to values of any
+ * type, kept in key order by a vEB-tree.  The keys live in a VanEmdeBoasTree
+ * and the entries, each a std::pair<const Key, Value> as in std::map, live
+ * in a table picked by the Values policy above.  Looking up a key goes
+ * straight to the table without touching the tree, and finding a successor
+ * or predecessor is one trip down the tree, in O(lg lg U), followed by one
+ * lookup in the table, so there's no second structure to keep in step or
+ * search.  Iterators hold the key they're at, so inserting or erasing other
+ * keys leaves them valid.  With DenseValues, references to entries stay
+ * valid until their key is erased; with HashedValues, as in an
+ * unordered_map, any insertion or erasure may move them.
+ */
+template <typename Value,
+          typename Key = unsigned short,
+          size_t UniverseBits = sizeof(Key) * CHAR_BIT,
+          typename Values = typename std::conditional<(UniverseBits <= 16),
+                                                      DenseValues,
+                                                      HashedValues>::type,
+          typename Clusters = typename std::conditional<(UniverseBits > 32),
+                                                        HashedClusters,
+                                                        DenseClusters>::type>
+class VanEmdeBoasMap {
+public:
+  /* Standard container typedefs. */
+  typedef Key                         key_type;
+  typedef Value                       mapped_type;
+  typedef std::pair<const Key, Value> value_type;
+  typedef std::size_t                 size_type;
+
+  /* The tree holding the keys. */
+  typedef VanEmdeBoasTree<Key, UniverseBits, Clusters> key_tree;
+
+  /**
+   * Constructor: VanEmdeBoasMap();
+   * Usage: VanEmdeBoasMap<std::string> map;
+   * --------------------------------------------------------------------------
+   * Constructs a new, empty map.
+   */
+  VanEmdeBoasMap();
+
+  /**
+   * Copy and move functions.
+   * Usage: VanEmdeBoasMap<std::string> copy = map;
+   * --------------------------------------------------------------------------
+   * Copying copies every entry; moving hands them over, leaving the source
+   * empty.
+   */
+  VanEmdeBoasMap(const VanEmdeBoasMap& other);
+  VanEmdeBoasMap(VanEmdeBoasMap&& other) noexcept;
+  VanEmdeBoasMap& operator= (const VanEmdeBoasMap& other);
+  VanEmdeBoasMap& operator= (VanEmdeBoasMap&& other) noexcept;
+
+  /**
+   * Types: iterator, const_iterator
+   * --------------------------------------------------------------------------
+   * Types representing objects that visit the entries of the map in key
+   * order, as references to std::pair<const Key, Value>.
+   */
+  template <typename Entry> class basic_iterator;
+  typedef basic_iterator<value_type>       iterator;
+  typedef basic_iterator<const value_type> const_iterator;
+  typedef std::reverse_iterator<iterator>       reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  /**
+   * iterator begin();
+   * iterator end();
+   * reverse_iterator rbegin();
+   * reverse_iterator rend();
+   * Usage: for (auto& entry : map) { ... }
+   * --------------------------------------------------------------------------
+   * Return ranges of iterators over the entries in increasing or decreasing
+   * order of key, with const versions for const maps.
+   */
+  iterator begin();
+  iterator end();
+  const_iterator begin() const;
+  const_iterator end() const;
+  reverse_iterator rbegin();
+  reverse_iterator rend();
+  const_reverse_iterator rbegin() const;
+  const_reverse_iterator rend() const;
+
+  /**
+   * iterator find(Key key);
+   * bool contains(Key key) const;
+   * Usage: auto itr = map.find(137);
+   *        if (itr != map.end()) itr->second = "found";
+   * --------------------------------------------------------------------------
+   * find returns an iterator to the entry for the key, or end() if there
+   * isn't one, and contains reports whether there is one.  Neither looks at
+   * the tree, just the table of entries.
+   */
+  iterator find(Key key);
+  const_iterator find(Key key) const;
+  bool contains(Key key) const;
+
+  /**
+   * iterator predecessor(Key key);
+   * iterator successor(Key key);
+   * Usage: auto next = map.successor(137);
+   *        if (next != map.end()) cout << next->second << endl;
+   * --------------------------------------------------------------------------
+   * predecessor returns an iterator to the entry with the largest key
+   * strictly less than the given one, and successor to the entry with the
+   * smallest key strictly greater.  Each returns end() if there's no such
+   * entry.
+   */
+  iterator predecessor(Key key);
+  iterator successor(Key key);
+  const_iterator predecessor(Key key) const;
+  const_iterator successor(Key key) const;
+
+  /**
+   * Value& operator[] (Key key);
+   * Value& at(Key key);
+   * Usage: map[137] = "one hundred thirty-seven";
+   * --------------------------------------------------------------------------
+   * Return the value for the key.  operator[] adds an entry with a
+   * value-initialized value if there isn't one, and, like insert, throws
+   * std::out_of_range if the key lies outside the universe.  at throws
+   * std::out_of_range if there's no entry for the key.
+   */
+  Value& operator[] (Key key);
+  Value& at(Key key);
+  const Value& at(Key key) const;
+
+  /**
+   * std::pair<iterator, bool> insert(Key key, const Value& value);
+   * template <typename... Args>
+   * std::pair<iterator, bool> emplace(Key key, Args&&... args);
+   * template <typename V>
+   * std::pair<iterator, bool> insert_or_assign(Key key, V&& value);
+   * Usage: map.insert(137, "hi");  map.emplace(42, 3, 'x');
+   * --------------------------------------------------------------------------
+   * insert and emplace add an entry for the key, with the given value or
+   * one constructed from args, unless there's one already, and
+   * insert_or_assign assigns the value to the existing entry if there is
+   * one.  Each returns an iterator to the key's entry and whether a new one
+   * was added, and throws std::out_of_range if the key lies outside the
+   * universe.
+   */
+  std::pair<iterator, bool> insert(Key key, const Value& value);
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Key key, Args&&... args);
+  template <typename V>
+  std::pair<iterator, bool> insert_or_assign(Key key, V&& value);
+
+  /**
+   * bool erase(Key key);
+   * bool erase(const_iterator where);
+   * Usage: map.erase(137);
+   * --------------------------------------------------------------------------
+   * Remove the entry for the given key, or at the given iterator, returning
+   * whether there was one.
+   */
+  bool erase(Key key);
+  bool erase(const_iterator where);
+
+  /**
+   * template <typename Function> void for_each(Function fn);
+   * Usage: map.for_each([&](Key key, std::string& value) { ... });
+   * --------------------------------------------------------------------------
+   * Calls fn(key, value) on every entry in key order.  This walks the tree
+   * a word of keys at a time, rather than a successor query per entry as
+   * the iterators do.
+   */
+  template <typename Function> void for_each(Function fn);
+  template <typename Function> void for_each(Function fn) const;
+
+  /**
+   * size_t size() const;
+   * bool empty() const;
+   * Usage: while (!map.empty()) { ... }
+   * --------------------------------------------------------------------------
+   * Return the number of entries in the map and whether it has none.
+   */
+  size_t size() const;
+  bool empty() const;
+
+  /**
+   * void clear();
+   * void swap(VanEmdeBoasMap& other);
+   * Usage: map.clear();  map.swap(otherMap);
+   * --------------------------------------------------------------------------
+   * clear removes every entry, and swap exchanges the contents of two maps.
+   */
+  void clear();
+  void swap(VanEmdeBoasMap& other);
+
+  /**
+   * const key_tree& keys() const;
+   * Usage: size_t below = map.keys().count_in_range(0, 136);
+   * --------------------------------------------------------------------------
+   * Returns the tree of keys, for the set queries the map doesn't repeat.
+   */
+  const key_tree& keys() const;
+
+  /**
+   * size_t memory_usage() const;
+   * Usage: std::cout << map.memory_usage() << " bytes" << std::endl;
+   * --------------------------------------------------------------------------
+   * Returns the number of bytes the map holds on the heap, for the tree and
+   * the entries together.
+   */
+  size_t memory_usage() const;
+
+private:
+  typedef typename Values::template Table<Key, Value, UniverseBits> Table;
+
+  /* The keys, and the entries for them. */
+  key_tree mKeys;
+  Table mEntries;
+
+  /* Helper function to report whether a key is in the universe. */
+  static bool inUniverse(Key key);
+
+  /* Helper function to turn an iterator over the keys into one over the
+   * entries.
+   */
+  template <typename Iterator, typename Map>
+  static Iterator wrap(typename key_tree::const_iterator where, Map* owner);
+};
+
+/**
+ * An iterator over the entries of a map, in key order.  Each step is a
+ * successor or predecessor query on the tree, and each dereference a lookup
+ * in the table of entries.
+ */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+template <typename Entry>
+class VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::basic_iterator:
+  public std::iterator<std::bidirectional_iterator_tag, Entry,
+                       std::ptrdiff_t, Entry*, Entry&> {
+public:
+  /* Default constructor creates a garbage iterator. */
+  basic_iterator() : mKey(), mAtEnd(true), mOwner(NULL) {}
+
+  /* An iterator converts to a const_iterator. */
+  basic_iterator(const basic_iterator<value_type>& other)
+    : mKey(other.mKey), mAtEnd(other.mAtEnd), mOwner(other.mOwner) {}
+
+  /* Forwards and backwards motion. */
+  basic_iterator& operator++ () {
+    step(mOwner->mKeys.successor(mKey));
+    return *this;
+  }
+  basic_iterator& operator-- () {
+    /* Stepping back from end() lands on the largest key. */
+    if (mAtEnd) {
+      mKey = *mOwner->mKeys.rbegin();
+      mAtEnd = false;
+    } else {
+      step(mOwner->mKeys.predecessor(mKey));
+    }
+    return *this;
+  }
+  const basic_iterator operator++ (int) {
+    basic_iterator result = *this;
+    ++*this;
+    return result;
+  }
+  const basic_iterator operator-- (int) {
+    basic_iterator result = *this;
+    --*this;
+    return result;
+  }
+
+  /* Dereferencing looks the entry up in the table. */
+  Entry& operator* () const {
+    return *mOwner->mEntries.find(mKey);
+  }
+  Entry* operator-> () const {
+    return mOwner->mEntries.find(mKey);
+  }
+
+  /* Equality and disequality testing.  All iterators past the end of a
+   * given map compare equal.
+   */
+  bool operator== (const basic_iterator& rhs) const {
+    return mOwner == rhs.mOwner && mAtEnd == rhs.mAtEnd &&
+           (mAtEnd || mKey == rhs.mKey);
+  }
+  bool operator!= (const basic_iterator& rhs) const {
+    return !(*this == rhs);
+  }
+
+private:
+  friend class VanEmdeBoasMap;
+  template <typename> friend class basic_iterator;
+
+  basic_iterator(Key key, bool atEnd, const VanEmdeBoasMap* owner)
+    : mKey(key), mAtEnd(atEnd), mOwner(owner) {}
+
+  /* Moves to where an iterator over the keys points. */
+  void step(typename key_tree::const_iterator where) {
+    mAtEnd = where == mOwner->mKeys.end();
+    if (!mAtEnd) mKey = *where;
+  }
+
+  /* The key the iterator is at, unless it's past the end. */
+  Key mKey;
+  bool mAtEnd;
+  const VanEmdeBoasMap* mOwner;
+};
+
+/**** Implementation of VanEmdeBoasMap ****/
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::VanEmdeBoasMap() {}
+
+/* Copies copy both halves; the table copies its entries wholesale rather
+ * than a key at a time.
+ */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::VanEmdeBoasMap(const VanEmdeBoasMap& other)
+  : mKeys(other.mKeys), mEntries(other.mEntries) {}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::VanEmdeBoasMap(VanEmdeBoasMap&& other) noexcept
+  : mKeys(std::move(other.mKeys)), mEntries(std::move(other.mEntries)) {}
+
+/* Assignment is done by copy-and-swap, or move-and-swap. */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>&
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::operator= (const VanEmdeBoasMap& other) {
+  VanEmdeBoasMap copy(other);
+  swap(copy);
+  return *this;
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>&
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::operator= (VanEmdeBoasMap&& other) noexcept {
+  VanEmdeBoasMap moved(std::move(other));
+  swap(moved);
+  return *this;
+}
+
+/* Every key fits in the universe if the universe fills the key type. */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+bool VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::inUniverse(Key key) {
+  return UniverseBits >= sizeof(Key) * CHAR_BIT ||
+         (uint64_t(key) >> (UniverseBits % 64)) == 0;
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+template <typename Iterator, typename Map>
+Iterator VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::wrap(typename key_tree::const_iterator where,
+                                                                           Map* owner) {
+  return where == owner->mKeys.end()? Iterator(Key(), true, owner) :
+                                      Iterator(*where, false, owner);
+}
+
+/* The iteration functions all go through the tree of keys. */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::begin() {
+  return wrap<iterator>(mKeys.begin(), this);
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::end() {
+  return iterator(Key(), true, this);
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::const_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::begin() const {
+  return wrap<const_iterator>(mKeys.begin(), this);
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::const_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::end() const {
+  return const_iterator(Key(), true, this);
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::reverse_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::rbegin() {
+  return reverse_iterator(end());
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::reverse_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::rend() {
+  return reverse_iterator(begin());
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::const_reverse_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::rbegin() const {
+  return const_reverse_iterator(end());
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::const_reverse_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::rend() const {
+  return const_reverse_iterator(begin());
+}
+
+/* Lookups go straight to the table. */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::find(Key key) {
+  return contains(key)? iterator(key, false, this) : end();
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::const_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::find(Key key) const {
+  return contains(key)? const_iterator(key, false, this) : end();
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+bool VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::contains(Key key) const {
+  return mEntries.find(key) != NULL;
+}
+
+/* Neighbors come from the tree. */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::predecessor(Key key) {
+  return wrap<iterator>(mKeys.predecessor(key), this);
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::successor(Key key) {
+  return wrap<iterator>(mKeys.successor(key), this);
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::const_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::predecessor(Key key) const {
+  return wrap<const_iterator>(mKeys.predecessor(key), this);
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::const_iterator
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::successor(Key key) const {
+  return wrap<const_iterator>(mKeys.successor(key), this);
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+Value& VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::operator[] (Key key) {
+  value_type* entry = mEntries.find(key);
+  return entry != NULL? entry->second : emplace(key).first->second;
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+Value& VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::at(Key key) {
+  value_type* entry = mEntries.find(key);
+  if (entry == NULL)
+    throw std::out_of_range("VanEmdeBoasMap::at: key not found.");
+  return entry->second;
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+const Value& VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::at(Key key) const {
+  const value_type* entry = mEntries.find(key);
+  if (entry == NULL)
+    throw std::out_of_range("VanEmdeBoasMap::at: key not found.");
+  return entry->second;
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+std::pair<typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::iterator, bool>
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::insert(Key key,
+                                                                    const Value& value) {
+  return emplace(key, value);
+}
+
+/* A new entry goes into the table first, since making its value is what's
+ * most likely to throw, and then its key goes into the tree.  If that
+ * throws, the entry comes back out, so the two never disagree.
+ */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+template <typename... Args>
+std::pair<typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::iterator, bool>
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::emplace(Key key,
+                                                                     Args&&... args) {
+  if (!inUniverse(key))
+    throw std::out_of_range("VanEmdeBoasMap::emplace: key outside universe.");
+  if (contains(key)) return std::make_pair(iterator(key, false, this), false);
+
+  mEntries.emplace(key, std::forward<Args>(args)...);
+  try {
+    mKeys.insert(key);
+  } catch (...) {
+    mEntries.erase(key);
+    throw;
+  }
+  return std::make_pair(iterator(key, false, this), true);
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+template <typename V>
+std::pair<typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::iterator, bool>
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::insert_or_assign(Key key,
+                                                                              V&& value) {
+  value_type* entry = mEntries.find(key);
+  if (entry == NULL) return emplace(key, std::forward<V>(value));
+
+  entry->second = std::forward<V>(value);
+  return std::make_pair(iterator(key, false, this), false);
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+bool VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::erase(Key key) {
+  if (!contains(key)) return false;
+  mKeys.erase(key);
+  mEntries.erase(key);
+  return true;
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+bool VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::erase(const_iterator where) {
+  return !where.mAtEnd && erase(where.mKey);
+}
+
+/* for_each unpacks the words of keys the tree hands over and looks up
+ * each one's entry.
+ */
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+template <typename Function>
+void VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::for_each(Function fn) {
+  mKeys.for_each_in_range(Key(0), Key(~Key(0)), [&](Key key) {
+    fn(key, mEntries.find(key)->second);
+  });
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+template <typename Function>
+void VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::for_each(Function fn) const {
+  mKeys.for_each_in_range(Key(0), Key(~Key(0)), [&](Key key) {
+    fn(key, static_cast<const Value&>(mEntries.find(key)->second));
+  });
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+size_t VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::size() const {
+  return mKeys.size();
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+bool VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::empty() const {
+  return mKeys.empty();
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+void VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::clear() {
+  key_tree().swap(mKeys);
+  mEntries.clear();
+}
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+void VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::swap(VanEmdeBoasMap& other) {
+  mKeys.swap(other.mKeys);
+  mEntries.swap(other.mEntries);
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+const typename VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::key_tree&
+VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::keys() const {
+  return mKeys;
+}
+
+template <typename Value, typename Key, size_t UniverseBits, typename Values,
+          typename Clusters>
+size_t VanEmdeBoasMap<Value, Key, UniverseBits, Values, Clusters>::memory_usage() const {
+  return mKeys.memory_usage().total() + mEntries.memoryUsage();
+}
+
+#endif // VANEMDEBOASMAP_H
@@ -0,0 +1,432 @@
+/**
+ * @headerfile VanEmdeBoasMultiset.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief A vEB-tree that counts how many times each key has been inserted
+ */
+
+#ifndef VANEMDEBOASMULTISET_H
+#define VANEMDEBOASMULTISET_H
+
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t
+#include <cstdint>     // For uint64_t
+#include <limits>      // For numeric_limits
+#include <stdexcept>   // For out_of_range, overflow_error
+#include <type_traits> // For conditional, is_integral, is_unsigned
+#include <utility>     // For move, swap
+#include "VanEmdeBoasMap.h"
+#include "VanEmdeBoasTree.h"
+
+/**
+ * A class representing a multiset of unsigned integers: a vEB-tree of the
+ * distinct keys, along with a count of how many copies of each there are.
+ * The counts live in a table from the Values policies of VanEmdeBoasMap, so
+ * over 16-bit keys they're a flat array indexed by key, and over wider keys
+ * a hash table.  The tree holds exactly the keys whose count is nonzero, and
+ * it's only touched when a count goes from zero to nonzero or back.  Adding
+ * or removing a copy of a key that stays in the multiset is one lookup in
+ * the table and an increment or decrement, and successor and predecessor
+ * never see keys whose count has dropped to zero, since they're no longer
+ * in the tree.
+ *
+ * Iteration, like successor and predecessor, is over the distinct keys, in
+ * sorted order; count gives how many copies of each there are.
+ */
+template <typename Key = unsigned short,
+          size_t UniverseBits = sizeof(Key) * CHAR_BIT,
+          typename Count = size_t,
+          typename Values = typename std::conditional<(UniverseBits <= 16),
+                                                      DenseValues,
+                                                      HashedValues>::type,
+          typename Clusters = typename std::conditional<(UniverseBits > 32),
+                                                        HashedClusters,
+                                                        DenseClusters>::type>
+class VanEmdeBoasMultiset {
+  static_assert(std::is_integral<Count>::value && std::is_unsigned<Count>::value,
+                "Count must be an unsigned integer type.");
+public:
+  /* Standard container typedefs. */
+  typedef Key         key_type;
+  typedef Key         value_type;
+  typedef Count       count_type;
+  typedef std::size_t size_type;
+
+  /* The tree holding the distinct keys. */
+  typedef VanEmdeBoasTree<Key, UniverseBits, Clusters> key_tree;
+
+  /**
+   * Types: const_iterator, const_reverse_iterator
+   * --------------------------------------------------------------------------
+   * Types that visit each distinct key once, in increasing or decreasing
+   * order.  They're the key tree's own iterators.
+   */
+  typedef typename key_tree::const_iterator         const_iterator;
+  typedef typename key_tree::const_reverse_iterator const_reverse_iterator;
+
+  /**
+   * Constructor: VanEmdeBoasMultiset();
+   * Usage: VanEmdeBoasMultiset<uint32_t> hits;
+   * --------------------------------------------------------------------------
+   * Constructs a new, empty multiset.
+   */
+  VanEmdeBoasMultiset();
+
+  /**
+   * Copy and move functions.
+   * Usage: VanEmdeBoasMultiset<uint32_t> copy = hits;
+   * --------------------------------------------------------------------------
+   * Copying copies every key and count; moving hands them over, leaving the
+   * source empty.
+   */
+  VanEmdeBoasMultiset(const VanEmdeBoasMultiset& other);
+  VanEmdeBoasMultiset(VanEmdeBoasMultiset&& other) noexcept;
+  VanEmdeBoasMultiset& operator= (const VanEmdeBoasMultiset& other);
+  VanEmdeBoasMultiset& operator= (VanEmdeBoasMultiset&& other) noexcept;
+
+  /**
+   * const_iterator begin() const;
+   * const_iterator end() const;
+   * const_reverse_iterator rbegin() const;
+   * const_reverse_iterator rend() const;
+   * Usage: for (Key key : hits) cout << key << ": " << hits.count(key) << endl;
+   * --------------------------------------------------------------------------
+   * Return ranges of iterators over the distinct keys, in increasing or
+   * decreasing order.
+   */
+  const_iterator begin() const;
+  const_iterator end() const;
+  const_reverse_iterator rbegin() const;
+  const_reverse_iterator rend() const;
+
+  /**
+   * Count insert(Key key, Count copies = 1);
+   * Usage: if (hits.insert(client) > kLimit) reject(client);
+   * --------------------------------------------------------------------------
+   * Adds the given number of copies of the key and returns how many there
+   * are now.  Only the first copy of a key touches the tree.  Throws
+   * std::out_of_range if the key lies outside the universe, and
+   * std::overflow_error if the key's count wouldn't fit in a Count or the
+   * total size in a size_t, in either case leaving the multiset unchanged.
+   */
+  Count insert(Key key, Count copies = 1);
+
+  /**
+   * Count erase(Key key, Count copies = 1);
+   * Count erase_all(Key key);
+   * Usage: hits.erase(client);
+   * --------------------------------------------------------------------------
+   * erase removes up to the given number of copies of the key, and
+   * erase_all removes every copy.  Both return how many copies they
+   * removed.  Only removing the last copy of a key touches the tree.
+   */
+  Count erase(Key key, Count copies = 1);
+  Count erase_all(Key key);
+
+  /**
+   * Count count(Key key) const;
+   * bool contains(Key key) const;
+   * Usage: if (hits.count(client) > kLimit) reject(client);
+   * --------------------------------------------------------------------------
+   * count returns how many copies of the key there are, and contains
+   * whether there are any.  Neither looks at the tree.
+   */
+  Count count(Key key) const;
+  bool contains(Key key) const;
+
+  /**
+   * const_iterator predecessor(Key key) const;
+   * const_iterator successor(Key key) const;
+   * Usage: auto next = hits.successor(client);
+   * --------------------------------------------------------------------------
+   * Return an iterator to the largest key strictly less than the given one,
+   * or the smallest strictly greater, with at least one copy, or end() if
+   * there's no such key.
+   */
+  const_iterator predecessor(Key key) const;
+  const_iterator successor(Key key) const;
+
+  /**
+   * template <typename Function> void for_each(Function fn) const;
+   * Usage: hits.for_each([&](Key key, Count copies) { ... });
+   * --------------------------------------------------------------------------
+   * Calls fn(key, copies) on every distinct key in sorted order, walking
+   * the tree a word of keys at a time.
+   */
+  template <typename Function> void for_each(Function fn) const;
+
+  /**
+   * size_t size() const;
+   * size_t distinct_size() const;
+   * bool empty() const;
+   * Usage: double mean = double(hits.size()) / hits.distinct_size();
+   * --------------------------------------------------------------------------
+   * size returns the total number of copies of all the keys, as for
+   * std::multiset, and distinct_size the number of distinct keys.  empty
+   * reports whether there are none.
+   */
+  size_t size() const;
+  size_t distinct_size() const;
+  bool empty() const;
+
+  /**
+   * void clear();
+   * void swap(VanEmdeBoasMultiset& other);
+   * Usage: hits.clear();  hits.swap(otherHits);
+   * --------------------------------------------------------------------------
+   * clear removes every key, and swap exchanges the contents of two
+   * multisets.
+   */
+  void clear();
+  void swap(VanEmdeBoasMultiset& other);
+
+  /**
+   * const key_tree& keys() const;
+   * Usage: size_t clients = hits.keys().count_in_range(0, 1023);
+   * --------------------------------------------------------------------------
+   * Returns the tree of distinct keys, for the set queries the multiset
+   * doesn't repeat.
+   */
+  const key_tree& keys() const;
+
+  /**
+   * size_t memory_usage() const;
+   * Usage: std::cout << hits.memory_usage() << " bytes" << std::endl;
+   * --------------------------------------------------------------------------
+   * Returns the number of bytes the multiset holds on the heap, for the tree
+   * and the counts together.
+   */
+  size_t memory_usage() const;
+
+private:
+  typedef typename Values::template Table<Key, Count, UniverseBits> Table;
+
+  /* The distinct keys, their counts, and the sum of the counts. */
+  key_tree mKeys;
+  Table mCounts;
+  size_t mSize;
+
+  /* Helper function to report whether a key is in the universe. */
+  static bool inUniverse(Key key);
+
+  /* Helper function to drop a key whose count has reached zero. */
+  void dropKey(Key key);
+};
+
+/**** Implementation of VanEmdeBoasMultiset ****/
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::VanEmdeBoasMultiset()
+  : mSize(0) {}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::VanEmdeBoasMultiset(const VanEmdeBoasMultiset& other)
+  : mKeys(other.mKeys), mCounts(other.mCounts), mSize(other.mSize) {}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::VanEmdeBoasMultiset(VanEmdeBoasMultiset&& other) noexcept
+  : mKeys(std::move(other.mKeys)), mCounts(std::move(other.mCounts)), mSize(other.mSize) {
+  other.mSize = 0;
+}
+
+/* Assignment is done by copy-and-swap, or move-and-swap. */
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>&
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::operator= (const VanEmdeBoasMultiset& other) {
+  VanEmdeBoasMultiset copy(other);
+  swap(copy);
+  return *this;
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>&
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::operator= (VanEmdeBoasMultiset&& other) noexcept {
+  VanEmdeBoasMultiset moved(std::move(other));
+  swap(moved);
+  return *this;
+}
+
+/* Every key fits in the universe if the universe fills the key type. */
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+bool VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::inUniverse(Key key) {
+  return UniverseBits >= sizeof(Key) * CHAR_BIT ||
+         (uint64_t(key) >> (UniverseBits % 64)) == 0;
+}
+
+/* Iteration is the tree's. */
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::const_iterator
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::begin() const {
+  return mKeys.begin();
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::const_iterator
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::end() const {
+  return mKeys.end();
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::const_reverse_iterator
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::rbegin() const {
+  return mKeys.rbegin();
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::const_reverse_iterator
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::rend() const {
+  return mKeys.rend();
+}
+
+/* A key already present just has its count bumped.  A new key's count goes
+ * into the table first and its key into the tree after, and if the tree
+ * throws, the count comes back out.
+ */
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+Count VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::insert(Key key,
+                                                                              Count copies) {
+  if (!inUniverse(key))
+    throw std::out_of_range("VanEmdeBoasMultiset::insert: key outside universe.");
+  if (copies > std::numeric_limits<size_t>::max() - mSize)
+    throw std::overflow_error("VanEmdeBoasMultiset::insert: size overflow.");
+
+  typename Table::Entry* entry = mCounts.find(key);
+  if (entry != NULL) {
+    if (copies > std::numeric_limits<Count>::max() - entry->second)
+      throw std::overflow_error("VanEmdeBoasMultiset::insert: count overflow.");
+    entry->second += copies;
+    mSize += copies;
+    return entry->second;
+  }
+
+  if (copies == 0) return 0;
+  mCounts.emplace(key, copies);
+  try {
+    mKeys.insert(key);
+  } catch (...) {
+    mCounts.erase(key);
+    throw;
+  }
+  mSize += copies;
+  return copies;
+}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+Count VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::erase(Key key,
+                                                                             Count copies) {
+  typename Table::Entry* entry = mCounts.find(key);
+  if (entry == NULL) return 0;
+
+  if (copies < entry->second) {
+    entry->second -= copies;
+    mSize -= copies;
+    return copies;
+  }
+
+  const Count removed = entry->second;
+  dropKey(key);
+  return removed;
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+Count VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::erase_all(Key key) {
+  return erase(key, std::numeric_limits<Count>::max());
+}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+void VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::dropKey(Key key) {
+  mSize -= mCounts.find(key)->second;
+  mKeys.erase(key);
+  mCounts.erase(key);
+}
+
+/* Lookups go straight to the table. */
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+Count VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::count(Key key) const {
+  const typename Table::Entry* entry = mCounts.find(key);
+  return entry == NULL? 0 : entry->second;
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+bool VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::contains(Key key) const {
+  return mCounts.find(key) != NULL;
+}
+
+/* Neighbors come from the tree, which holds only keys with copies. */
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::const_iterator
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::predecessor(Key key) const {
+  return mKeys.predecessor(key);
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+typename VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::const_iterator
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::successor(Key key) const {
+  return mKeys.successor(key);
+}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+template <typename Function>
+void VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::for_each(Function fn) const {
+  mKeys.for_each_in_range(Key(0), Key(~Key(0)), [&](Key key) {
+    fn(key, static_cast<Count>(mCounts.find(key)->second));
+  });
+}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+size_t VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::size() const {
+  return mSize;
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+size_t VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::distinct_size() const {
+  return mKeys.size();
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+bool VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::empty() const {
+  return mKeys.empty();
+}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+void VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::clear() {
+  key_tree().swap(mKeys);
+  mCounts.clear();
+  mSize = 0;
+}
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+void VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::swap(VanEmdeBoasMultiset& other) {
+  mKeys.swap(other.mKeys);
+  mCounts.swap(other.mCounts);
+  std::swap(mSize, other.mSize);
+}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+const typename VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::key_tree&
+VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::keys() const {
+  return mKeys;
+}
+
+template <typename Key, size_t UniverseBits, typename Count, typename Values,
+          typename Clusters>
+size_t VanEmdeBoasMultiset<Key, UniverseBits, Count, Values, Clusters>::memory_usage() const {
+  return mKeys.memory_usage().total() + mCounts.memoryUsage();
+}
+
+#endif // VANEMDEBOASMULTISET_H
@@ -0,0 +1,391 @@
+/**
+ * @headerfile VanEmdeBoasStats.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Opt-in counters and latency histograms for VanEmdeBoasTree.h
+ */
+
+#ifndef VANEMDEBOASSTATS_H
+#define VANEMDEBOASSTATS_H
+
+/* Define VANEMDEBOAS_STATS to 1, in every translation unit including the
+ * library's, to turn the counters on.  Otherwise the hooks in the tree
+ * compile to nothing.
+ */
+#ifndef VANEMDEBOAS_STATS
+#define VANEMDEBOAS_STATS 0
+#endif
+
+#include <algorithm> // For max
+#include <atomic>    // For atomic
+#include <chrono>    // For steady_clock
+#include <cstddef>   // For size_t
+#include <cstdint>   // For uint64_t
+#include <mutex>     // For mutex, lock_guard
+#include <string>    // For string, to_string
+#include <vector>    // For vector
+
+/**
+ * A report of what the VanEmdeBoasTrees in a program have been doing.
+ *
+ * With VANEMDEBOAS_STATS on, each thread keeps its own counters, which only
+ * it writes, so counting takes no locks or atomic read-modify-writes.  For
+ * each public operation, the counters hold the number of calls, the number
+ * of recursive steps they took in all (one per tree, summary, or bitvector
+ * visited), the most steps any one call took, and a histogram of latencies
+ * sampled from one call in kSampleInterval.  Alongside those, they count
+ * the times an operation recursed into a summary, the times it reached a
+ * bitvector, and the bytes of nodes and bitvectors allocated and freed.
+ * Steps are counted for the outermost operation only, so that, say, erasing
+ * through an iterator counts once.
+ *
+ * collect adds up the counters of every thread, including ones that have
+ * exited, and since subtracts an earlier report from a later one to see
+ * what happened in between.  With VANEMDEBOAS_STATS off, collect returns
+ * all zeros and the tree carries no trace of the counters.
+ */
+struct VanEmdeBoasStats {
+  /* Whether the counters were compiled in. */
+  static const bool kEnabled = VANEMDEBOAS_STATS != 0;
+
+  /* The operations that are counted. */
+  enum Operation {
+    kInsert, kErase, kFind, kSuccessor, kPredecessor, kRank, kSelect,
+    kNumOperations
+  };
+
+  /* The events that are counted across all operations. */
+  enum Event {
+    kSummaryRecursions, kLeafHits, kBytesAllocated, kBytesFreed,
+    kNumEvents
+  };
+
+  /* Latencies are sampled from one call in kSampleInterval on each thread.
+   * Bucket i of a histogram counts samples taking from 2^i up to 2^(i+1)
+   * nanoseconds, except that the first bucket also counts anything faster
+   * and the last anything slower.
+   */
+  static const uint64_t kSampleInterval = 64;
+  static const size_t kNumBuckets = 32;
+
+  /* The counters themselves. */
+  uint64_t mCalls[kNumOperations];
+  uint64_t mSteps[kNumOperations];
+  uint64_t mMaxSteps[kNumOperations];
+  uint64_t mLatency[kNumOperations][kNumBuckets];
+  uint64_t mEvents[kNumEvents];
+
+  /**
+   * Constructor: VanEmdeBoasStats();
+   * Usage: VanEmdeBoasStats none;
+   * --------------------------------------------------------------------------
+   * Constructs a report with every counter at zero.
+   */
+  VanEmdeBoasStats();
+
+  /**
+   * static VanEmdeBoasStats collect();
+   * VanEmdeBoasStats since(const VanEmdeBoasStats& earlier) const;
+   * Usage: VanEmdeBoasStats before = VanEmdeBoasStats::collect();
+   *        ...
+   *        VanEmdeBoasStats delta = VanEmdeBoasStats::collect().since(before);
+   * --------------------------------------------------------------------------
+   * collect adds up the counters of every thread so far.  Threads still
+   * running may be partway through an operation, so their counts can be a
+   * call or so behind.  since returns the difference between this report and
+   * an earlier one, except for the most steps, which can't be taken apart
+   * and are kept from this report.
+   */
+  static VanEmdeBoasStats collect();
+  VanEmdeBoasStats since(const VanEmdeBoasStats& earlier) const;
+
+  /**
+   * std::string toJson() const;
+   * Usage: std::cerr << VanEmdeBoasStats::collect().toJson() << std::endl;
+   * --------------------------------------------------------------------------
+   * Returns the report as a JSON object, with an object for each operation
+   * holding its calls, steps, most steps, and latency histogram, followed
+   * by the events and the sampling interval.
+   */
+  std::string toJson() const;
+
+  /**
+   * static const char* name(Operation operation);
+   * static const char* name(Event event);
+   * Usage: std::cout << VanEmdeBoasStats::name(VanEmdeBoasStats::kInsert);
+   * --------------------------------------------------------------------------
+   * Return the names used for operations and events in the JSON.
+   */
+  static const char* name(Operation operation);
+  static const char* name(Event event);
+
+  /**
+   * Class: Scope
+   * Usage: VanEmdeBoasStats::Scope scope(VanEmdeBoasStats::kInsert);
+   * --------------------------------------------------------------------------
+   * The hooks the tree uses, by way of the macros below.  A Scope counts an
+   * operation from its construction to its destruction.  visit counts a step
+   * into a nonempty tree, and a leaf hit if it's a bitvector, and count and
+   * add count events, all on this thread.
+   */
+  class Scope {
+  public:
+    explicit Scope(Operation operation);
+    ~Scope();
+
+    static void visit(bool isLeaf);
+    static void count(Event event);
+    static void add(Event event, uint64_t amount);
+
+  private:
+    Operation mOperation;
+    bool mOutermost;
+    bool mSampled;
+    std::chrono::steady_clock::time_point mStart;
+
+    Scope(const Scope&) = delete;
+    Scope& operator= (const Scope&) = delete;
+  };
+
+private:
+  /* A thread's counters, which are atomic only so that collect may read
+   * them; the thread itself updates them with plain loads and stores.  Each
+   * set registers itself when its thread first counts anything, and folds
+   * its counts into the retired totals when the thread exits.
+   */
+  struct ThreadCounters {
+    std::atomic<uint64_t> mCalls[kNumOperations];
+    std::atomic<uint64_t> mSteps[kNumOperations];
+    std::atomic<uint64_t> mMaxSteps[kNumOperations];
+    std::atomic<uint64_t> mLatency[kNumOperations][kNumBuckets];
+    std::atomic<uint64_t> mEvents[kNumEvents];
+
+    /* State of the operation underway, which only this thread reads. */
+    size_t mNesting;
+    uint64_t mCurrentSteps;
+    uint64_t mUntilSample;
+
+    ThreadCounters();
+    ~ThreadCounters();
+    void addTo(VanEmdeBoasStats& stats) const;
+  };
+
+  /* Every thread's counters, and the totals of threads that have exited. */
+  struct Registry;
+
+  static Registry& registry();
+  static ThreadCounters& local();
+
+  /* Adds an amount to a counter only this thread writes. */
+  static void bump(std::atomic<uint64_t>& counter, uint64_t amount);
+};
+
+/* The hooks placed in the tree.  Each names the operation or event as an
+ * enumerator of VanEmdeBoasStats.
+ */
+#if VANEMDEBOAS_STATS
+#define VANEMDEBOAS_STATS_SCOPE(operation) \
+  VanEmdeBoasStats::Scope vanEmdeBoasStatsScope(VanEmdeBoasStats::operation)
+#define VANEMDEBOAS_STATS_VISIT(isLeaf) VanEmdeBoasStats::Scope::visit(isLeaf)
+#define VANEMDEBOAS_STATS_COUNT(event) \
+  VanEmdeBoasStats::Scope::count(VanEmdeBoasStats::event)
+#define VANEMDEBOAS_STATS_ADD(event, amount) \
+  VanEmdeBoasStats::Scope::add(VanEmdeBoasStats::event, (amount))
+#else
+#define VANEMDEBOAS_STATS_SCOPE(operation) ((void)0)
+#define VANEMDEBOAS_STATS_VISIT(isLeaf) ((void)0)
+#define VANEMDEBOAS_STATS_COUNT(event) ((void)0)
+#define VANEMDEBOAS_STATS_ADD(event, amount) ((void)0)
+#endif
+
+/**** Implementation of VanEmdeBoasStats ****/
+
+struct VanEmdeBoasStats::Registry {
+  std::mutex mMutex;
+  std::vector<ThreadCounters*> mThreads;
+  VanEmdeBoasStats mRetired;
+};
+
+inline VanEmdeBoasStats::VanEmdeBoasStats() {
+  std::fill(mCalls, mCalls + kNumOperations, uint64_t(0));
+  std::fill(mSteps, mSteps + kNumOperations, uint64_t(0));
+  std::fill(mMaxSteps, mMaxSteps + kNumOperations, uint64_t(0));
+  std::fill(&mLatency[0][0], &mLatency[0][0] + kNumOperations * kNumBuckets,
+            uint64_t(0));
+  std::fill(mEvents, mEvents + kNumEvents, uint64_t(0));
+}
+
+inline VanEmdeBoasStats VanEmdeBoasStats::collect() {
+  VanEmdeBoasStats result;
+  if (!kEnabled) return result;
+
+  Registry& all = registry();
+  std::lock_guard<std::mutex> lock(all.mMutex);
+  result = all.mRetired;
+  for (size_t i = 0; i < all.mThreads.size(); ++i)
+    all.mThreads[i]->addTo(result);
+  return result;
+}
+
+inline VanEmdeBoasStats VanEmdeBoasStats::since(const VanEmdeBoasStats& earlier) const {
+  VanEmdeBoasStats result = *this;
+  for (size_t op = 0; op < kNumOperations; ++op) {
+    result.mCalls[op] -= earlier.mCalls[op];
+    result.mSteps[op] -= earlier.mSteps[op];
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket)
+      result.mLatency[op][bucket] -= earlier.mLatency[op][bucket];
+  }
+  for (size_t event = 0; event < kNumEvents; ++event)
+    result.mEvents[event] -= earlier.mEvents[event];
+  return result;
+}
+
+inline std::string VanEmdeBoasStats::toJson() const {
+  std::string result = "{\"operations\":{";
+  for (size_t op = 0; op < kNumOperations; ++op) {
+    if (op != 0) result += ',';
+    result += '"';
+    result += name(Operation(op));
+    result += "\":{\"calls\":" + std::to_string(mCalls[op]) +
+              ",\"steps\":" + std::to_string(mSteps[op]) +
+              ",\"max_steps\":" + std::to_string(mMaxSteps[op]) +
+              ",\"latency_ns_log2\":[";
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+      if (bucket != 0) result += ',';
+      result += std::to_string(mLatency[op][bucket]);
+    }
+    result += "]}";
+  }
+  result += '}';
+  for (size_t event = 0; event < kNumEvents; ++event) {
+    result += ",\"";
+    result += name(Event(event));
+    result += "\":" + std::to_string(mEvents[event]);
+  }
+  result += ",\"sample_interval\":" + std::to_string(kSampleInterval) + '}';
+  return result;
+}
+
+inline const char* VanEmdeBoasStats::name(Operation operation) {
+  static const char* const kNames[kNumOperations] = {
+    "insert", "erase", "find", "successor", "predecessor", "rank", "select"
+  };
+  return kNames[operation];
+}
+inline const char* VanEmdeBoasStats::name(Event event) {
+  static const char* const kNames[kNumEvents] = {
+    "summary_recursions", "leaf_hits", "bytes_allocated", "bytes_freed"
+  };
+  return kNames[event];
+}
+
+/* Only the outermost scope on a thread counts.  It starts the step count
+ * afresh and, if it's this thread's turn to sample, reads the clock.
+ */
+inline VanEmdeBoasStats::Scope::Scope(Operation operation)
+  : mOperation(operation), mOutermost(false), mSampled(false) {
+  ThreadCounters& counters = local();
+  if (counters.mNesting++ != 0) return;
+
+  mOutermost = true;
+  counters.mCurrentSteps = 0;
+  if (--counters.mUntilSample == 0) {
+    counters.mUntilSample = kSampleInterval;
+    mSampled = true;
+    mStart = std::chrono::steady_clock::now();
+  }
+}
+inline VanEmdeBoasStats::Scope::~Scope() {
+  ThreadCounters& counters = local();
+  --counters.mNesting;
+  if (!mOutermost) return;
+
+  bump(counters.mCalls[mOperation], 1);
+  bump(counters.mSteps[mOperation], counters.mCurrentSteps);
+  if (counters.mCurrentSteps > counters.mMaxSteps[mOperation].load(std::memory_order_relaxed))
+    counters.mMaxSteps[mOperation].store(counters.mCurrentSteps, std::memory_order_relaxed);
+
+  if (mSampled) {
+    const uint64_t nanoseconds = uint64_t(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - mStart).count());
+    size_t bucket = 0;
+    while (bucket + 1 < kNumBuckets && (nanoseconds >> (bucket + 1)) != 0) ++bucket;
+    bump(counters.mLatency[mOperation][bucket], 1);
+  }
+}
+
+inline void VanEmdeBoasStats::Scope::visit(bool isLeaf) {
+  ThreadCounters& counters = local();
+  ++counters.mCurrentSteps;
+  if (isLeaf) bump(counters.mEvents[kLeafHits], 1);
+}
+inline void VanEmdeBoasStats::Scope::count(Event event) {
+  bump(local().mEvents[event], 1);
+}
+inline void VanEmdeBoasStats::Scope::add(Event event, uint64_t amount) {
+  bump(local().mEvents[event], amount);
+}
+
+inline VanEmdeBoasStats::ThreadCounters::ThreadCounters()
+  : mNesting(0), mCurrentSteps(0), mUntilSample(kSampleInterval) {
+  for (size_t op = 0; op < kNumOperations; ++op) {
+    mCalls[op].store(0, std::memory_order_relaxed);
+    mSteps[op].store(0, std::memory_order_relaxed);
+    mMaxSteps[op].store(0, std::memory_order_relaxed);
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket)
+      mLatency[op][bucket].store(0, std::memory_order_relaxed);
+  }
+  for (size_t event = 0; event < kNumEvents; ++event)
+    mEvents[event].store(0, std::memory_order_relaxed);
+
+  Registry& all = registry();
+  std::lock_guard<std::mutex> lock(all.mMutex);
+  all.mThreads.push_back(this);
+}
+inline VanEmdeBoasStats::ThreadCounters::~ThreadCounters() {
+  Registry& all = registry();
+  std::lock_guard<std::mutex> lock(all.mMutex);
+  addTo(all.mRetired);
+  all.mThreads.erase(std::find(all.mThreads.begin(), all.mThreads.end(), this));
+}
+
+inline void VanEmdeBoasStats::ThreadCounters::addTo(VanEmdeBoasStats& stats) const {
+  for (size_t op = 0; op < kNumOperations; ++op) {
+    stats.mCalls[op] += mCalls[op].load(std::memory_order_relaxed);
+    stats.mSteps[op] += mSteps[op].load(std::memory_order_relaxed);
+    stats.mMaxSteps[op] = std::max(stats.mMaxSteps[op],
+                                   mMaxSteps[op].load(std::memory_order_relaxed));
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket)
+      stats.mLatency[op][bucket] += mLatency[op][bucket].load(std::memory_order_relaxed);
+  }
+  for (size_t event = 0; event < kNumEvents; ++event)
+    stats.mEvents[event] += mEvents[event].load(std::memory_order_relaxed);
+}
+
+/* The registry is never destroyed, so that threads exiting during static
+ * destruction can still fold in their counts.
+ */
+inline VanEmdeBoasStats::Registry& VanEmdeBoasStats::registry() {
+  static Registry* const result = new Registry;
+  return *result;
+}
+/* The counters themselves need constructing and registering, which every
+ * access to them would check for, so hooks go through a plain pointer to
+ * them that's set the first time.
+ */
+inline VanEmdeBoasStats::ThreadCounters& VanEmdeBoasStats::local() {
+  thread_local ThreadCounters* cached = NULL;
+  if (cached == NULL) {
+    thread_local ThreadCounters counters;
+    cached = &counters;
+  }
+  return *cached;
+}
+
+inline void VanEmdeBoasStats::bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+  counter.store(counter.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+}
+
+#endif // VANEMDEBOASSTATS_H
@@ -8,23 +8,106 @@
 #ifndef VANEMDEBOASTREE_H
 #define VANEMDEBOASTREE_H
 
-#include <utility>  // For pair
-#include <iterator> // For iterator, bidirectional_iterator_tag, reverse_iterator
-#include <climits>  // For CHAR_BIT, ULONG_MAX
+#include <utility>     // For pair, move
+#include <iterator>    // For iterator, bidirectional_iterator_tag, reverse_iterator
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t
+#include <algorithm>   // For min, max, unique, is_sorted
+#include <stdexcept>   // For out_of_range, runtime_error
+#include <vector>      // For vector
+#include <type_traits> // For is_integral, is_unsigned, conditional, integral_constant
+#include <cstdint>     // For uint64_t
+#include <cstring>     // For memcpy
+#include <atomic>      // For atomic
+#include <exception>   // For exception_ptr, current_exception, rethrow_exception
+#include <mutex>       // For mutex, lock_guard
+#include <thread>      // For thread
+#include <istream>     // For istream
+#include <ostream>     // For ostream
+#include "VanEmdeBoasBits.h"
+#include "VanEmdeBoasClusters.h"
+#include "VanEmdeBoasFile.h"
+#include "VanEmdeBoasStats.h"
+#include "FrozenVanEmdeBoasTree.h"
 
 /**
- * A class representing a vEB-tree of unsigned shorts.
+ * A class representing a vEB-tree of unsigned integers.
+ *
+ * The tree is parameterized over the type of the keys it stores and over the
+ * width of the universe, in bits.  A VanEmdeBoasTree<Key, UniverseBits> can
+ * hold any value in the range {0, 1, ..., 2^UniverseBits - 1}.  By default,
+ * the universe is every value that can be represented by a Key, so that
+ * VanEmdeBoasTree<> is a tree of unsigned shorts, VanEmdeBoasTree<uint32_t>
+ * is a tree of 32-bit keys, etc.  The universe width need not be even; when
+ * it's odd the upper half of each key gets the extra bit.
+ *
+ * The Clusters parameter picks how each node stores its pointers to smaller
+ * trees; see VanEmdeBoasClusters.h.  DenseClusters uses a flat array and is
+ * the default for universes of up to 32 bits, while HashedClusters uses a
+ * hash table holding only the nonempty clusters, for O(n) space, and is the
+ * default for anything wider.  BoundedClusters is DenseClusters plus a copy
+ * of each cluster's min and max in its parent, which trades memory for fewer
+ * cache misses in successor and predecessor queries.  In universes of up to
+ * 32 bits, wrapping a policy in CountedClusters also keeps the number of
+ * keys in each cluster, which makes rank and select fast at a small cost to
+ * every insertion and deletion, and wrapping DenseClusters or
+ * BoundedClusters in AllocatedClusters takes every node from an allocator
+ * of your choosing instead of the global heap.
+ *
+ * The LeafBits parameter is the width at which the recursion stops and a
+ * subtree is stored as a plain bitvector instead.  Wider leaves mean fewer
+ * levels to walk but more words to scan in each leaf; the default of eight
+ * bits makes each leaf four 64-bit words and takes a level off of every
+ * universe whose width is a power of two.
+ *
+ * Building with VANEMDEBOAS_STATS defined to 1 counts calls, recursion,
+ * and allocation, and samples latencies, in every tree; see
+ * VanEmdeBoasStats.h.  Otherwise the counting compiles away entirely.
  */
+template <typename Key = unsigned short,
+          size_t UniverseBits = sizeof(Key) * CHAR_BIT,
+          typename Clusters = typename std::conditional<(UniverseBits > 32),
+                                                        HashedClusters,
+                                                        DenseClusters>::type,
+          size_t LeafBits = 8>
 class VanEmdeBoasTree {
+  static_assert(std::is_integral<Key>::value && std::is_unsigned<Key>::value,
+                "VanEmdeBoasTree keys must be unsigned integers.");
+  static_assert(UniverseBits > 0 && UniverseBits <= sizeof(Key) * CHAR_BIT,
+                "VanEmdeBoasTree universe must fit in the key type.");
+  static_assert(LeafBits > 0 && LeafBits <= 12,
+                "VanEmdeBoasTree leaves must be between 1 and 12 bits wide.");
+  static_assert(!Clusters::kStoresCounts || UniverseBits <= 32,
+                "CountedClusters keeps a count for every possible cluster, "
+                "so it only supports universes of up to 32 bits.");
+
 public:
+  /* Standard container typedefs. */
+  typedef Key         key_type;
+  typedef Key         value_type;
+  typedef std::size_t size_type;
+  typedef typename Clusters::Storage storage_type;
+
   /**
    * Constructor: VanEmdeBoasTree();
-   * Usage: VanEmdeBoasTree myTree;
+   * Usage: VanEmdeBoasTree<> myTree;
    * --------------------------------------------------------------------------
    * Constructs a new, empty vEB-tree.
    */
   VanEmdeBoasTree();
 
+  /**
+   * Constructor: explicit VanEmdeBoasTree(const storage_type& storage);
+   * Usage: VanEmdeBoasTree<uint32_t, 32, AllocatedClusters<DenseClusters, Alloc> >
+   *          myTree(Alloc(&arena));
+   * --------------------------------------------------------------------------
+   * Constructs a new, empty vEB-tree that allocates from a copy of the given
+   * storage, which must not hold a tree.  This is how a tree using
+   * AllocatedClusters is given its allocator, which converts to its
+   * storage; see VanEmdeBoasClusters.h.
+   */
+  explicit VanEmdeBoasTree(const storage_type& storage);
+
   /* Destructor: ~VanEmdeBoasTree();
    * Usage: (implicit)
    * --------------------------------------------------------------------------
@@ -35,14 +118,52 @@ public:
   /**
    * Copy functions: VanEmdeBoasTree(const VanEmdeBoasTree& other);
    *                 VanEmdeBoasTree& operator= (const VanEmdeBoasTree& other);
-   * Usage: VanEmdeBoasTree one = two;
+   * Usage: VanEmdeBoasTree<> one = two;
    *        one = two;
    * --------------------------------------------------------------------------
    * Sets this VanEmdeBoasTree to be a deep-copy of some other vEB-tree.
+   * Large trees on the heap are copied, and destroyed, with the clusters of
+   * the root spread across one thread per core.
    */
   VanEmdeBoasTree(const VanEmdeBoasTree& other);
   VanEmdeBoasTree& operator= (const VanEmdeBoasTree& other);
 
+  /**
+   * Move functions: VanEmdeBoasTree(VanEmdeBoasTree&& other) noexcept;
+   *                 VanEmdeBoasTree& operator= (VanEmdeBoasTree&& other) noexcept;
+   * Usage: VanEmdeBoasTree<> one = std::move(two);
+   *        one = std::move(two);
+   * --------------------------------------------------------------------------
+   * Sets this VanEmdeBoasTree to hold the contents of some other vEB-tree by
+   * taking over its structure, without copying or allocating anything.  The
+   * other tree is left empty and can go on being used.
+   */
+  VanEmdeBoasTree(VanEmdeBoasTree&& other) noexcept;
+  VanEmdeBoasTree& operator= (VanEmdeBoasTree&& other) noexcept;
+
+  /**
+   * Range functions: template <typename InputIterator>
+   *                  VanEmdeBoasTree(InputIterator begin, InputIterator end);
+   *                  template <typename InputIterator>
+   *                  void assign(InputIterator begin, InputIterator end);
+   * Usage: VanEmdeBoasTree<> tree(keys.begin(), keys.end());
+   *        tree.assign(keys.begin(), keys.end());
+   * --------------------------------------------------------------------------
+   * Sets this vEB-tree to hold exactly the values in the range [begin, end).
+   * Rather than inserting the values one at a time, the tree is built
+   * bottom-up from the sorted values, visiting each value once per level of
+   * the tree with none of the work insert does to keep the tree balanced.
+   * The range may be in any order and may contain duplicates; if it isn't
+   * sorted, it's sorted first.  Large trees on the heap are built with the
+   * clusters of the root spread across one thread per core.
+   * If any value lies outside the universe of the tree, throws
+   * std::out_of_range and leaves the tree unchanged.
+   */
+  template <typename InputIterator>
+  VanEmdeBoasTree(InputIterator begin, InputIterator end);
+  template <typename InputIterator>
+  void assign(InputIterator begin, InputIterator end);
+
   /**
    * bool empty() const;
    * Usage: if (tree.empty()) { ... }
@@ -70,7 +191,7 @@ public:
   /**
    * const_iterator begin() const;
    * const_iterator end() const;
-   * Usage: for (VanEmdeBoasTree::const_iterator itr = tree.begin();
+   * Usage: for (VanEmdeBoasTree<>::const_iterator itr = tree.begin();
    *             itr != tree.end(); ++itr) { ... }
    * --------------------------------------------------------------------------
    * Returns a range of iterators delineating the full contents of this
@@ -90,7 +211,7 @@ public:
   /**
    * const_reverse_iterator rbegin() const;
    * const_reverse_iterator rend() const;
-   * Usage: for (VanEmdeBoasTree::const_reverse_iterator itr = tree.rbegin();
+   * Usage: for (VanEmdeBoasTree<>::const_reverse_iterator itr = tree.rbegin();
    *             itr != tree.rend(); ++itr) { ... }
    * --------------------------------------------------------------------------
    * Returns a range of iterators delineating the full contents of this
@@ -100,18 +221,18 @@ public:
   const_reverse_iterator rend() const;
 
   /**
-   * const_iterator find(unsigned short value) const;
+   * const_iterator find(Key value) const;
    * Usage: if (tree.find(137) != tree.end()) { ... }
    * --------------------------------------------------------------------------
    * Returns an iterator to the element in the tree with the specified value,
    * or end() as a sentinel if one does not exist.
    */
-  const_iterator find(unsigned short value) const;
+  const_iterator find(Key value) const;
 
   /**
-   * const_iterator predecessor(unsigned short value) const;
-   * const_iterator successor(unsigned short value) const;
-   * Usage: VanEmdeBoasTree::const_iterator itr = tree.predecessor(137);
+   * const_iterator predecessor(Key value) const;
+   * const_iterator successor(Key value) const;
+   * Usage: VanEmdeBoasTree<>::const_iterator itr = tree.predecessor(137);
    *        if (itr != end()) cout << *itr << endl;
    * --------------------------------------------------------------------------
    * predecessor returns an iterator to the first element in the tree whose
@@ -120,22 +241,78 @@ public:
    * whose key is strictly greater than the specified value (or end() if one
    * does not exist).
    */
-  const_iterator predecessor(unsigned short value) const;
-  const_iterator successor(unsigned short value) const;
+  const_iterator predecessor(Key value) const;
+  const_iterator successor(Key value) const;
+
+  /**
+   * template <typename Function>
+   * void for_each_in_range(Key lo, Key hi, Function fn) const;
+   * size_t count_in_range(Key lo, Key hi) const;
+   * Usage: tree.for_each_in_range(100, 200, [&](Key key) { ... });
+   *        size_t inRange = tree.count_in_range(100, 200);
+   * --------------------------------------------------------------------------
+   * for_each_in_range invokes fn on every element of the tree from lo to hi,
+   * inclusive, in sorted order.  count_in_range returns how many such
+   * elements there are.  Both walk the part of the tree overlapping the
+   * range once, rather than calling successor for each element, and scan
+   * the bitvectors at the bottom of the tree a 64-bit word at a time, so
+   * dense ranges go by at close to the speed of reading memory.  fn must
+   * not modify the tree.  If lo is greater than hi, the range is empty.
+   */
+  template <typename Function>
+  void for_each_in_range(Key lo, Key hi, Function fn) const;
+  size_t count_in_range(Key lo, Key hi) const;
+
+  /**
+   * Type: range_view
+   * range_view range(Key lo, Key hi) const;
+   * Usage: for (Key key: tree.range(100, 200)) { ... }
+   * --------------------------------------------------------------------------
+   * A type representing the elements of the tree from lo to hi, inclusive,
+   * which can be visited in sorted order with its forward iterators.  Rather
+   * than calling successor, the iterators remember the path from the root
+   * to the current element, so each step follows that path back down
+   * instead of looking each cluster up again.  The view and its iterators
+   * may only be used while the tree is unchanged.
+   */
+  class range_view;
+  range_view range(Key lo, Key hi) const;
+
+  /**
+   * size_t rank(Key value) const;
+   * const_iterator select(size_t index) const;
+   * Usage: size_t below = tree.rank(137);
+   *        VanEmdeBoasTree<>::const_iterator median = tree.select(tree.size() / 2);
+   * --------------------------------------------------------------------------
+   * rank returns how many elements of the tree are strictly less than the
+   * specified value.  select returns an iterator to the element that has
+   * exactly index elements less than it, or end() if index is at least
+   * size(), so that select(rank(x)) finds x whenever x is in the tree.
+   *
+   * With a policy that keeps the number of keys in each cluster (see
+   * CountedClusters), both add up a run of those counts at each level on
+   * the way down and finish with a popcount in a single bitvector, taking
+   * time proportional to the number of clusters per node rather than the
+   * number of elements.  With any other policy, rank is count_in_range and
+   * select steps through range, both of which take linear time.
+   */
+  size_t rank(Key value) const;
+  const_iterator select(size_t index) const;
 
   /**
-   * std::pair<const_iterator, bool> insert(unsigned short value);
+   * std::pair<const_iterator, bool> insert(Key value);
    * Usage: tree.insert(137);
    * --------------------------------------------------------------------------
    * Inserts the specified value into the vEB tree.  If the value did not
    * exist in the tree prior to the call, the return value is true paired with
    * an iterator to the element.  Otherwise, the return value is false paired
-   * with an iterator to the value.
+   * with an iterator to the value.  If the value lies outside the universe of
+   * the tree, throws std::out_of_range.
    */
-  std::pair<const_iterator, bool> insert(unsigned short value);
+  std::pair<const_iterator, bool> insert(Key value);
 
   /**
-   * bool erase(unsigned short value);
+   * bool erase(Key value);
    * bool erase(const_iterator where);
    * Usage: tree.erase(137);  tree.erase(tree.begin());
    * --------------------------------------------------------------------------
@@ -143,9 +320,191 @@ public:
    * the specified const_iterator) from the vEB tree, returning whether the
    * element existed and was removed (true) or not.
    */
-  bool erase(unsigned short value);
+  bool erase(Key value);
   bool erase(const_iterator where);
 
+  /**
+   * bool insert_and_neighbors(Key value, const_iterator& predecessor,
+   *                           const_iterator& successor);
+   * bool erase_and_successor(Key value, const_iterator& successor);
+   * Usage: if (tree.insert_and_neighbors(137, prev, next)) { ... }
+   *        tree.erase_and_successor(137, next);
+   * --------------------------------------------------------------------------
+   * insert and erase, but also finding the neighbors of the value along the
+   * way: insert_and_neighbors sets predecessor and successor to the largest
+   * element less than the value and the smallest element greater than it,
+   * and erase_and_successor sets successor to the smallest element greater
+   * than the value.  Either is end() if there's no such element.  Each
+   * returns whether the tree changed, and finds the neighbors whether it
+   * did or not.  The neighbors mostly come from the mins and maxes met on
+   * the way down, or from the summary when the value lands in an empty
+   * cluster, so each of these costs about one descent instead of the three
+   * that calling insert or erase followed by predecessor and successor
+   * would take.  As with insert, insert_and_neighbors throws
+   * std::out_of_range if the value lies outside the universe.
+   */
+  bool insert_and_neighbors(Key value, const_iterator& predecessor,
+                            const_iterator& successor);
+  bool erase_and_successor(Key value, const_iterator& successor);
+
+  /**
+   * bool pop_min(Key& result);
+   * bool pop_max(Key& result);
+   * Usage: Key next;
+   *        while (queue.pop_min(next)) { ... }
+   * --------------------------------------------------------------------------
+   * Remove the smallest or largest element of the tree, returning whether
+   * the tree had any elements and, if so, writing the element into result.
+   * These let the tree serve as a priority queue, and are cheaper than
+   * erase(begin()): the element being removed is always the min or max of
+   * every tree on the way down, so there's nothing to compare, and each
+   * level just pulls the next one up out of its first or last cluster.
+   */
+  bool pop_min(Key& result);
+  bool pop_max(Key& result);
+
+  /**
+   * template <typename OutputIterator>
+   * OutputIterator extract_if_le(Key bound, OutputIterator out);
+   * Usage: tree.extract_if_le(now, std::back_inserter(expired));
+   * --------------------------------------------------------------------------
+   * Removes every element no greater than bound, writing each to out in
+   * increasing order, and returns out past the last one written.  This is
+   * one pass over the tree: the clusters that lie wholly at or below the
+   * bound are read off and freed whole, with no per-element erasing, so
+   * draining k elements costs about O(k) plus one descent.
+   */
+  template <typename OutputIterator>
+  OutputIterator extract_if_le(Key bound, OutputIterator out);
+
+  /**
+   * size_t insert_batch(const Key* keys, size_t count, uint64_t* results = NULL);
+   * size_t erase_batch(const Key* keys, size_t count, uint64_t* results = NULL);
+   * size_t contains_batch(const Key* keys, size_t count,
+   *                       uint64_t* results = NULL) const;
+   * Usage: tree.insert_batch(&keys[0], keys.size());
+   *        std::vector<uint64_t> found((keys.size() + 63) / 64);
+   *        tree.contains_batch(&keys[0], keys.size(), &found[0]);
+   * --------------------------------------------------------------------------
+   * Inserts, erases, or looks up each of the count keys beginning at keys,
+   * returning how many were inserted, erased, or found.  Rather than walking
+   * from the root once per key, each of these sorts the keys and walks the
+   * tree once for the whole batch, visiting each cluster only once no matter
+   * how many of the keys land in it.  They're fastest if the keys are
+   * already sorted.
+   *
+   * If results is non-NULL, it must point at (count + 63) / 64 words, which
+   * are filled in as a bitmask: bit i % 64 of word i / 64 is set if keys[i]
+   * was inserted, erased, or found.  The results are exactly as if the keys
+   * had been processed one at a time in order, so if a key appears more than
+   * once, only its first appearance is reported as inserted or erased.
+   *
+   * As with insert, if any key lies outside the universe of the tree,
+   * insert_batch throws std::out_of_range and leaves the tree unchanged.
+   * Elsewhere, such keys are simply never erased or found.
+   */
+  size_t insert_batch(const Key* keys, size_t count, uint64_t* results = NULL);
+  size_t erase_batch(const Key* keys, size_t count, uint64_t* results = NULL);
+  size_t contains_batch(const Key* keys, size_t count,
+                        uint64_t* results = NULL) const;
+
+  /**
+   * void set_union(const VanEmdeBoasTree& other);
+   * void set_intersection(const VanEmdeBoasTree& other);
+   * void set_difference(const VanEmdeBoasTree& other);
+   * void set_symmetric_difference(const VanEmdeBoasTree& other);
+   * Usage: tree.set_union(otherTree);
+   * --------------------------------------------------------------------------
+   * Replaces the contents of this vEB-tree with its union, intersection,
+   * difference, or symmetric difference with some other vEB-tree of the same
+   * type.  The two trees are walked in lockstep rather than one element at a
+   * time: clusters that can't contribute anything are skipped by combining
+   * the summaries first, the bitvectors at the bottom are combined a whole
+   * word at a time, and the min and max of each node are then worked out
+   * from the clusters beneath it.  The time taken is proportional to the
+   * parts of the two trees that overlap the result, and not to the number
+   * of elements.  As with assign, the result is built separately and swapped
+   * in, so the tree is unchanged if anything goes wrong.  See also the free
+   * functions of the same names below, which leave both trees alone.
+   */
+  void set_union(const VanEmdeBoasTree& other);
+  void set_intersection(const VanEmdeBoasTree& other);
+  void set_difference(const VanEmdeBoasTree& other);
+  void set_symmetric_difference(const VanEmdeBoasTree& other);
+
+  /**
+   * void save(std::ostream& out) const;
+   * void load(std::istream& in);
+   * Usage: tree.save(out);  tree.load(in);
+   * --------------------------------------------------------------------------
+   * save writes the elements of this vEB-tree to a binary stream in the
+   * format described in VanEmdeBoasFile.h, which takes about 40 bytes for
+   * every run of 256 values with anything in it, and load replaces the
+   * contents of this vEB-tree with a tree saved that way.  load builds the
+   * tree bottom-up, as assign does, rather than inserting one element at a
+   * time.  A saved tree can also be queried straight off the disk, with no
+   * loading at all, through MappedVanEmdeBoasTree.  Both functions throw
+   * std::runtime_error if the stream fails, and load does if the stream
+   * doesn't hold a tree over the same universe, in which case the tree is
+   * left unchanged.
+   */
+  void save(std::ostream& out) const;
+  void load(std::istream& in);
+
+  /**
+   * struct MemoryUsage;
+   * MemoryUsage memory_usage() const;
+   * Usage: std::cout << tree.memory_usage().total() << " bytes" << std::endl;
+   * --------------------------------------------------------------------------
+   * Reports how many bytes this vEB-tree holds on the heap, broken down by
+   * what they're used for.  nodes counts the nodes that hold clusters,
+   * along with their bounds and counts if the Clusters policy keeps them,
+   * and leaves the bitvectors at the bottom.  summaries counts every node
+   * and bitvector of the summary trees.  slack is whatever is held but not
+   * used: slots in cluster tables with no cluster in them, rounding by the
+   * storage, and the unused part of preallocated storage.  The three other
+   * counts leave slack out, so total() is their sum.  Takes time
+   * proportional to the size of the tree.
+   */
+  struct MemoryUsage {
+    size_t nodes;
+    size_t leaves;
+    size_t summaries;
+    size_t slack;
+
+    size_t total() const {
+      return nodes + leaves + summaries + slack;
+    }
+  };
+  MemoryUsage memory_usage() const;
+
+  /**
+   * void shrink_to_fit();
+   * Usage: tree.shrink_to_fit();
+   * --------------------------------------------------------------------------
+   * Rebuilds this vEB-tree so that each of its cluster tables is sized for
+   * the clusters it holds now.  Only hash tables (see HashedClusters) ever
+   * have room to give back, since they grow as clusters are added but only
+   * shrink once they're mostly empty; other tables have a slot for every
+   * cluster however many there are.  Does nothing with preallocated
+   * storage.  Takes time proportional to the size of the tree.
+   */
+  void shrink_to_fit();
+
+  /**
+   * FrozenVanEmdeBoasTree<Key, UniverseBits> freeze() const;
+   * Usage: FrozenVanEmdeBoasTree<uint32_t> frozen = tree.freeze();
+   * --------------------------------------------------------------------------
+   * Returns a compact, read-only copy of this vEB-tree, with the same
+   * queries, that packs the nonempty parts of every level into a single
+   * buffer.  For sparse sets with dense cluster tables that's a small
+   * fraction of the memory the tree itself holds, though a tree with
+   * HashedClusters over a wide universe is about as compact already; see
+   * FrozenVanEmdeBoasTree.h.  This tree is left alone, and may be destroyed
+   * once the copy is made.
+   */
+  FrozenVanEmdeBoasTree<Key, UniverseBits> freeze() const;
+
   /**
    * void swap(VanEmdeBoasTree& rhs);
    * Usage: tree.swap(otherTree);
@@ -155,127 +514,580 @@ public:
    */
   void swap(VanEmdeBoasTree& rhs);
 
+  /**
+   * void release() noexcept;
+   * Usage: tree.release();
+   * --------------------------------------------------------------------------
+   * Empties this vEB-tree without freeing its nodes one at a time, for trees
+   * whose memory is about to be thrown away as a whole, such as those using
+   * AllocatedClusters over a monotonic arena.  The nodes are simply
+   * forgotten, so on the heap this leaks them, and dropping a tree this way
+   * takes O(1) time instead of a walk over the whole tree.  A tree with
+   * ArenaClusters frees its block, which it owns, as usual.
+   */
+  void release() noexcept;
+
 private:
   /* A type representing a vEB-tree structure.  It stores the min and max
-   * elements at the current level of the tree, an array of pointers to smaller
+   * elements at the current level of the tree, a table of pointers to smaller
    * vEB trees, and a pointer to a summary vEB tree.
    *
    * This vEB-tree implementation uses two major optimizations.  First, rather
    * than storing the complete tree structure, once the number of bits in
    * consideration becomes sufficiently small (say, such that the values are
-   * only four bits long), we bottom out and use a bit array instead of the
+   * only eight bits long), we bottom out and use a bit array instead of the
    * standard implementation.  This saves an enormous amount of overhead, since
    * a bit array is substantially more compact than all of the necessary
-   * pointers to sublevels.
+   * pointers to sublevels.  The bit array is made of 64-bit words, so finding
+   * the smallest, largest, next, or previous set bit in it takes a handful of
+   * bit-scan instructions rather than a loop over every bit.
    *
    * Second, because each vEB-tree node stores a fixed-sized array whose length
    * varies from level to level, we design the structure intending to store the
    * pointers to subtrees beyond the end of the struct by overallocating space
    * for it.  This is a standard optimization that avoids a lot of unnecessary
-   * pointer indirections.
+   * pointer indirections.  (With HashedClusters the table is a small header
+   * pointing at a separate hash table instead, and no overallocation is
+   * needed.)
+   *
+   * Third, nothing is allocated until it's needed.  An empty tree of any
+   * size is represented by a NULL pointer, so a Node only exists once some
+   * value has been inserted into it and is freed as soon as its last value
+   * is erased.  The same goes for its summary and for each of its children,
+   * which start out NULL and come and go as clusters become nonempty and
+   * empty.  This means the memory used by the tree tracks the number of
+   * elements actually stored rather than the size of the universe.
    *
-   * This struct's layout is very brittle.  The position of the the first array
-   * element must be the very last member, since the overallocated memory needs
-   * to be flush against the array itself.
+   * Where that memory comes from is up to the Storage of the Clusters
+   * policy.  Usually every node is its own heap allocation, but with
+   * ArenaClusters they're all carved out of a single preallocated block,
+   * and with AllocatedClusters they come from a user-supplied allocator.
+   *
+   * This struct's layout is very brittle.  The cluster table must be the
+   * very last member, since the overallocated memory needs to be flush
+   * against the array inside of it.
    */
-  struct Node {
-    /* The min and max values here. */
-    unsigned short mMin, mMax;
+  typedef typename Clusters::Pointer Pointer;
+  typedef typename Clusters::Storage Storage;
 
-    /* Whether either of these values are set. */
-    bool mIsEmpty;
+  struct Node {
+    /* The min and max values here.  Since empty trees are never allocated,
+     * these are always set.
+     */
+    Key mMin, mMax;
 
-    /* A pointer to the summary structure.  This is typed as a void* because
-     * at a certain point, this pointer will not point at a Node, but rather
-     * at a block of raw memory acting as a bitvector.
+    /* A pointer to the summary structure, or NULL if every child is empty.
+     * This converts to a void* because at a certain point, this pointer will
+     * not point at a Node, but rather at a block of raw memory acting as a
+     * bitvector.
      */
-    void* mSummary;
+    Pointer mSummary;
 
-    /* An array of one element, representing the first of (possibly) many
-     * pointers to subtrees.  This MUST be the last element of the struct!
-     * We use a void* here because this might actually be pointing at a bit
-     * array, rather than another Node.
+    /* The table of pointers to subtrees, indexed by the upper bits of a
+     * value.  A subtree that's empty is NULL.  This MUST be the last element
+     * of the struct!  The table hands back void*s because they might
+     * actually be pointing at bit arrays, rather than other Nodes.
      */
-    void* mChildren[1];
+    typename Clusters::Table mChildren;
 
-    /* Operator new overallocates the node to ensure space exists for the Node
-     * pointers.  The argument to this function is the number of extra pointers
-     * that should be allocated.
+    /* Operator new overallocates the node to ensure space exists for the
+     * cluster table.  The arguments to this function are the number of extra
+     * bytes the table needs and the storage to allocate from.  Nodes are
+     * freed with freeNode rather than delete, since that needs to know
+     * their size.
      */
-    void* operator new (size_t size, size_t numPointers);
+    void* operator new (size_t size, size_t extraBytes, Storage& storage);
 
-    /* Operator delete only needed in case the constructor throws.  There is
-     * no constructor, so this is technically not needed, but in the interests
-     * of forward-thinking we provide it anyway.
+    /* Operator delete matching operator new, only needed in case the
+     * constructor throws.  There is no constructor, so this is technically
+     * not needed, but in the interests of forward-thinking we provide it
+     * anyway.
      */
-    void operator delete (void* memory, size_t numBits);
+    void operator delete (void* memory, size_t extraBytes, Storage& storage);
   };
 
-  /* A pointer to the root vEB-tree node. */
-  void* mRoot;
+  /* The storage holding every node of the tree, along with a pointer to the
+   * root vEB-tree node, or NULL if the tree is empty.
+   */
+  Storage mStorage;
 
   /* A cache of the size of the tree. */
   size_t mSize;
 
-  /* Internally, this class uses size_t's to represent "either a valid unsigned
-   * short or a sentinel indicating that nothing exists."  Thiss constant
-   * represents the "not actually a value" term.
+  /* A utility constant holding the number of bits before the Node
+   * representation switches from a standard vEB-tree structure to a
+   * bitvector.  This is the LeafBits parameter; see the class comment.
+   */
+  static const size_t kBitvectorSize = LeafBits;
+
+  /* Trees of at least this many values are built, cloned, and destroyed with
+   * the clusters of the root spread across threads, as long as their
+   * storage can be allocated from concurrently; an arena hands out its
+   * memory one block at a time, and a custom allocator may not be safe to
+   * share.  Below this, starting the threads costs more than they save.
    */
-  static const size_t kNil = ULONG_MAX;
+  static const size_t kParallelThreshold = size_t(1) << 16;
 
-  /* Make const_iterator a friend so it can access internal structure. */
+  /* Make the iterators friends so they can access internal structure. */
   friend class const_iterator;
+  friend class range_view;
+
+  /* Make the free set operations friends so they can build their results. */
+  template <typename K, size_t U, typename C, size_t L>
+  friend VanEmdeBoasTree<K, U, C, L> set_union(const VanEmdeBoasTree<K, U, C, L>&,
+                                               const VanEmdeBoasTree<K, U, C, L>&);
+  template <typename K, size_t U, typename C, size_t L>
+  friend VanEmdeBoasTree<K, U, C, L> set_intersection(const VanEmdeBoasTree<K, U, C, L>&,
+                                                      const VanEmdeBoasTree<K, U, C, L>&);
+  template <typename K, size_t U, typename C, size_t L>
+  friend VanEmdeBoasTree<K, U, C, L> set_difference(const VanEmdeBoasTree<K, U, C, L>&,
+                                                    const VanEmdeBoasTree<K, U, C, L>&);
+  template <typename K, size_t U, typename C, size_t L>
+  friend VanEmdeBoasTree<K, U, C, L> set_symmetric_difference(const VanEmdeBoasTree<K, U, C, L>&,
+                                                              const VanEmdeBoasTree<K, U, C, L>&);
+
+  /* Helper functions to split a numBits-bit value into its upper and lower
+   * halves and to glue those halves back together.  When numBits is odd, the
+   * upper half gets the extra bit.
+   */
+  static size_t lowHalf(size_t numBits);
+  static size_t highHalf(size_t numBits);
+  static Key lowerBits(Key value, size_t numBits);
+  static Key upperBits(Key value, size_t numBits);
+  static Key compose(Key upper, Key lower, size_t numBits);
+
+  /* Compile-time versions of lowHalf and highHalf, giving the number of bits
+   * in the clusters and summary of a NumBits-bit tree.  The recursive helpers
+   * that walk the tree take their number of bits as a template argument, so
+   * each level of the tree gets its own copy of the code with the bit counts
+   * and the bitvector check folded into constants.  A bitvector has no
+   * clusters or summary, and there these just hand back NumBits so that the
+   * dead recursive calls in the bitvector's copy don't spawn any more levels.
+   */
+  template <size_t NumBits> struct Split {
+    static const size_t kLow  = NumBits <= LeafBits? NumBits : NumBits / 2;
+    static const size_t kHigh = NumBits <= LeafBits? NumBits : NumBits - NumBits / 2;
+  };
+
+  /* The number of levels on the way from the root of a NumBits-bit tree
+   * down through its clusters to a bitvector, counting both ends.
+   */
+  template <size_t NumBits, bool IsBitvector = (NumBits <= LeafBits)>
+  struct Depth {
+    static const size_t kValue = 1 + Depth<Split<NumBits>::kLow>::kValue;
+  };
+  template <size_t NumBits> struct Depth<NumBits, true> {
+    static const size_t kValue = 1;
+  };
+
+  /* Helper function to report whether a value lies in the tree's universe. */
+  static bool inUniverse(Key value);
+
+  /* Helper function to return just the low numBits bits of a value. */
+  static Key truncate(Key value, size_t numBits);
+
+  /* A key in a batch operation, tagged with its position in the batch so
+   * that the results can be reported in the caller's order.
+   */
+  struct BatchEntry {
+    Key mKey;
+    size_t mIndex;
+  };
+
+  /* Helper functions to read the key out of an element of a list being
+   * sorted or built into a tree, which is either a plain key or an entry of
+   * a batch.
+   */
+  static Key keyOf(Key value);
+  static Key keyOf(const BatchEntry& entry);
+
+  /* Helper function to fill an empty vEB-tree with the values in the range
+   * [begin, end), in any order and with duplicates, bottom-up; see assign.
+   */
+  template <typename InputIterator>
+  void build(InputIterator begin, InputIterator end);
+
+  /* Helper function returning storage that holds no tree but allocates the
+   * same way as this tree's, for building a tree to swap in.
+   */
+  Storage freshStorage() const;
+
+  /* Helper function to construct a vEB-tree of the specified number of bits
+   * holding just the specified value.  Because this might just return a bit
+   * array, the function returns a void*.
+   */
+  static void* createTree(Key value, size_t numBits, Storage& storage);
+
+  /* Helper function to compute how many bytes a node of a tree of the
+   * specified number of bits takes up, including its cluster table and, for
+   * policies that store them, the bounds and counts of its clusters.
+   */
+  static size_t nodeBytes(size_t numBits);
+
+  /* Helper functions for policies that store the bounds of each cluster in
+   * its parent (see BoundedClusters).  The bounds are a bitmap of which
+   * clusters are nonempty, followed by an array of the clusters' mins and
+   * maxes, all living just past the node's cluster table.  Each min sits
+   * next to its max, since a query that wants one usually wants the other.
+   * These functions give how many bytes that takes for a node of the
+   * specified number of bits, which is zero for other policies, and find
+   * each of the pieces.  The bounds of an empty cluster are garbage.
+   */
+  struct Bounds {
+    Key mMin, mMax;
+  };
+  static size_t boundsBytes(size_t numBits);
+  static uint64_t* nonemptyClusters(Node* node, size_t numBits);
+  static Bounds* clusterBounds(Node* node, size_t numBits);
+
+  /* Helper functions to record the bounds of a cluster that has just been
+   * built or changed, either given the bounds outright or by looking at the
+   * cluster itself, which may have become empty.  Both do nothing for
+   * policies that don't store bounds.
+   */
+  static void setBounds(Node* node, size_t numBits, Key index, Key min,
+                        Key max);
+  template <size_t NumBits> static void updateBounds(Node* node, Key index);
+
+  /* Helper functions for policies that store the number of keys in each
+   * cluster in its parent (see CountedClusters).  The counts are an array
+   * with an entry per cluster, preceded by the sum of each block of
+   * kCountsPerBlock consecutive counts so that long runs of counts can be
+   * added up a block at a time.  They live just past the bounds if there
+   * are any, or else past the table, and the count of an empty cluster is
+   * zero.  These functions give how many bytes that takes for a node of the
+   * specified number of bits, which is zero for other policies, and find
+   * the two arrays.
+   */
+  static const size_t kCountsPerBlock = 64;
+  static size_t countsBytes(size_t numBits);
+  static size_t* blockCounts(Node* node, size_t numBits);
+  static Key* clusterCounts(Node* node, size_t numBits);
+
+  /* Helper functions to record the count of a cluster that has just gained
+   * or lost a key, that has just been built with a known number of keys, or
+   * that has changed in some other way, in which case the cluster is asked
+   * for its count.  All of them do nothing for policies that don't store
+   * counts.
+   */
+  static void adjustCount(Node* node, size_t numBits, Key index, bool added);
+  static void setCount(Node* node, size_t numBits, Key index, Key count);
+  template <size_t NumBits> static void updateCount(Node* node, Key index);
+
+  /* Helper function to count the keys in a vEB-tree of the specified number
+   * of bits.  For nodes, this adds up their counts, so it may only be called
+   * for policies that store them.
+   */
+  template <size_t NumBits> static size_t treeCount(void* root);
+
+  /* Helper functions for rank and select on a tree of NumBits bits holding
+   * count values, for policies that store counts.  recRank returns how many
+   * values in the tree are less than the specified one, and recSelect
+   * returns the value with index values below it, which must exist.  Both
+   * descend into a single cluster per level.
+   */
+  template <size_t NumBits>
+  static size_t recRank(Key value, void* root, size_t count);
+  template <size_t NumBits>
+  static Key recSelect(size_t index, void* root, size_t count);
+
+  /* Helper functions for recRank and recSelect on a node of the specified
+   * number of bits whose clusters hold total values in all.  countBefore
+   * returns how many of those values are in the clusters before the one
+   * with the specified index.  findCluster returns the index of the cluster
+   * holding the value with index values before it, and turns index into
+   * the position of that value within its cluster.
+   */
+  static size_t countBefore(Node* node, size_t numBits, Key index,
+                            size_t total);
+  static Key findCluster(Node* node, size_t numBits, size_t& index,
+                         size_t total);
+
+  /* Helper functions to allocate and free a bare node or bitvector for a tree
+   * of the specified number of bits.
+   */
+  static Node* allocateNode(size_t numBits, Storage& storage);
+  static void freeNode(Node* node, size_t numBits, Storage& storage);
+  static uint64_t* allocateBitvector(size_t numBits, Storage& storage);
+  static void freeBitvector(uint64_t* bitvector, size_t numBits,
+                            Storage& storage);
+
+  /* Helper function to compute how many bytes of storage a vEB-tree of the
+   * specified number of bits would occupy if every one of its clusters were
+   * nonempty.  This is an upper bound on the space the tree can ever need,
+   * and is used to size preallocated storage.
+   */
+  static size_t maxTreeBytes(size_t numBits);
+
+  /* Helper function to recursively build a vEB-tree of the specified number
+   * of bits holding the given values, which must be sorted and distinct.
+   * Only the low numBits bits of each value are looked at, so the values can
+   * be passed down to the clusters without stripping off their upper bits.
+   * If parallel is set, the top-level clusters are built on separate
+   * threads.
+   */
+  template <typename Value>
+  static void* recBuildTree(const Value* values, size_t count, size_t numBits,
+                            Storage& storage, bool parallel = false);
+
+  /* Helper function reporting whether a tree of the specified size should be
+   * built, cloned, or destroyed in parallel; see kParallelThreshold.
+   */
+  static bool runsInParallel(size_t size);
+
+  /* Helper function to call fn(i) for each i below count, spreading the
+   * calls across as many threads as there are cores, counting the calling
+   * thread.  Each thread takes the next i as soon as it's done with the
+   * last, so uneven calls still balance out.  If any call throws, the
+   * others still run, and the first exception is rethrown once they're
+   * done.
+   */
+  template <typename Function>
+  static void parallelFor(size_t count, Function fn);
+
+  /* Helper function to stably sort a nonempty list of values in the
+   * universe.
+   */
+  template <typename Value> static void sortValues(std::vector<Value>& values);
+
+  /* Helper function to find where the run of values starting at start and
+   * sharing the same upper bits ends, looking no further than stop.
+   */
+  template <typename Value>
+  static size_t runEnd(const Value* values, size_t start, size_t stop,
+                       size_t numBits);
+
+  /* Helper function to turn a batch of keys into a list of entries sorted by
+   * key, leaving out any keys outside the universe and dropping all but the
+   * first appearance of each key if asked to.
+   */
+  static std::vector<BatchEntry> sortBatch(const Key* keys, size_t count,
+                                           bool distinct);
+
+  /* Helper functions to carry out a batch operation on a tree of NumBits
+   * bits, given the entries sorted by key, setting the bit in marks for each
+   * entry that was inserted, erased, or found.  The entries for insertion
+   * and erasure must be distinct, and marks may be NULL if the results
+   * aren't needed.  Only the low NumBits bits of each key are looked at, as
+   * with recBuildTree.
+   */
+  template <size_t NumBits>
+  static void recInsertBatch(const BatchEntry* entries, size_t count,
+                             Pointer& root, Storage& storage, uint64_t* marks);
+  template <size_t NumBits>
+  static void recEraseBatch(const BatchEntry* entries, size_t count,
+                            Pointer& root, Storage& storage, uint64_t* marks);
+  template <size_t NumBits>
+  static void recContainsBatch(const BatchEntry* entries, size_t count,
+                               void* root, uint64_t* marks);
+
+  /* Helper function to set the bit for an entry in a batch's marks. */
+  static void mark(uint64_t* marks, const BatchEntry& entry);
+
+  /* The set operations, and a helper function to build a tree holding the
+   * result of one of them on a pair of trees, as with the set_ functions.
+   */
+  enum SetOperation {
+    kUnion, kIntersection, kDifference, kSymmetricDifference
+  };
+  template <SetOperation Op>
+  static VanEmdeBoasTree combine(const VanEmdeBoasTree& lhs,
+                                 const VanEmdeBoasTree& rhs);
+
+  /* Helper function reporting whether a value belongs in the result of a set
+   * operation given whether it's in each of the two trees, and the same thing
+   * for whole words of a bitvector at once.
+   */
+  template <SetOperation Op> static bool keeps(bool inLhs, bool inRhs);
+  template <SetOperation Op> static uint64_t keeps(uint64_t lhs, uint64_t rhs);
+
+  /* Helper function to recursively build the result of a set operation on
+   * two trees of NumBits bits into result, which must start out empty.  The
+   * result is built in place, rather than handed back, so that it can be
+   * stored as an offset in its storage.
+   */
+  template <size_t NumBits, SetOperation Op>
+  static void recSetOperation(void* lhs, void* rhs, Pointer& result,
+                              Storage& storage);
+
+  /* Helper functions to remove the smallest or largest value from the
+   * clusters of a node of NumBits bits, updating the summary and bounds as
+   * needed.  The node's own min and max are left alone.  These return
+   * whether there was any such value and, if so, write it into result.
+   */
+  template <size_t NumBits>
+  static bool popClusterMin(Node* node, Storage& storage, Key& result);
+  template <size_t NumBits>
+  static bool popClusterMax(Node* node, Storage& storage, Key& result);
+
+  /* Helper functions to remove and return the smallest or largest value of
+   * a nonempty tree of NumBits bits.  The root is passed by reference so
+   * that a tree that becomes empty can be freed and reset to NULL.
+   */
+  template <size_t NumBits>
+  static void recPopMin(Pointer& root, Storage& storage, Key& result);
+  template <size_t NumBits>
+  static void recPopMax(Pointer& root, Storage& storage, Key& result);
 
-  /* Helper function to recursively construct a vEB-tree to hold the specified
-   * number of bits.  Because this might just return a bit array, the function
-   * returns a void*.
+  /* Helper function to recursively remove every value no greater than bound
+   * from a tree of NumBits bits, handing them to the visitor in sorted order
+   * as recVisitRange does, with base added.  As with recVisitRange, this
+   * hands off to one of two overloads, since each level of the summary is
+   * drained with a visitor of a new type.
    */
-  static void* recCreateTree(size_t numBits);
+  template <size_t NumBits, typename Visitor>
+  static void recExtractPrefix(Key bound, Pointer& root, Storage& storage,
+                               Key base, Visitor& visitor);
+  template <size_t NumBits, typename Visitor>
+  static void extractPrefix(Key bound, Pointer& root, Storage& storage,
+                            Key base, Visitor& visitor,
+                            std::true_type isBitvector);
+  template <size_t NumBits, typename Visitor>
+  static void extractPrefix(Key bound, Pointer& root, Storage& storage,
+                            Key base, Visitor& visitor,
+                            std::false_type isBitvector);
 
   /* Helper function to recursively clone a vEB-tree holding the specified
-   * number of bits.
+   * number of bits into the given storage.  If parallel is set, the
+   * top-level clusters are cloned on separate threads.
    */
-  static void* recCloneTree(void* root, size_t numBits);
+  static void* recCloneTree(void* root, size_t numBits, Storage& storage,
+                            bool parallel = false);
 
   /* Helper function to recursively destroy a vEB-tree of the specified number
-   * of bits.
+   * of bits.  If parallel is set, the top-level clusters are destroyed on
+   * separate threads.
+   */
+  static void recDeleteTree(void* root, size_t numBits, Storage& storage,
+                            bool parallel = false);
+
+  /* Helper function to recursively add up the memory held by a vEB-tree of
+   * the specified number of bits, counting all of it as summary if
+   * inSummary is set.
    */
-  static void recDeleteTree(void* root, size_t numBits);
+  static void recMemoryUsage(void* root, size_t numBits, bool inSummary,
+                             MemoryUsage& usage);
 
-  /* Helper function to recursively search the tree for a value, reporting
-   * whether or not it exists.
+  /* Helper function to recursively search a tree of NumBits bits for a
+   * value, reporting whether or not it exists.
    */
-  static bool recFindElement(unsigned short value, void* root, size_t numBits);
+  template <size_t NumBits>
+  static bool recFindElement(Key value, void* root);
 
   /* Helper function to recursively insert an entry into the tree, reporting
-   * whether the value was added (true) or already existed (false).
+   * whether the value was added (true) or already existed (false).  The root
+   * is passed by reference so that an empty (NULL) tree can be allocated.
+   */
+  template <size_t NumBits>
+  static bool recInsertElement(Key value, Pointer& root, Storage& storage);
+
+  /* Helper function to recursively insert an entry into the tree, as
+   * recInsertElement does, while finding its predecessor and successor in
+   * the tree.  Each flag says whether there is one, and if so the value
+   * beside it holds it.
+   */
+  struct Neighbors {
+    Key  mPredecessor, mSuccessor;
+    bool mHasPredecessor, mHasSuccessor;
+  };
+  template <size_t NumBits>
+  static bool recInsertNeighbors(Key value, Pointer& root, Storage& storage,
+                                 Neighbors& neighbors);
+
+  /* Helper functions for the above, finding the element of a node just
+   * before or after the cluster with the given index, which is the max or
+   * min of the nearest nonempty cluster on that side, or failing that the
+   * min or max of the node itself.  Also, helper functions giving the min
+   * or max of a nonempty cluster of a node as an element of the node.
    */
-  static bool recInsertElement(unsigned short value, void* root, size_t numBits);
+  template <size_t NumBits> static Key previousInNode(Node* node, Key index);
+  template <size_t NumBits> static Key nextInNode(Node* node, Key index);
+  template <size_t NumBits> static Key clusterMin(Node* node, Key index);
+  template <size_t NumBits> static Key clusterMax(Node* node, Key index);
+
+  /* Helper function to recursively delete an entry from the tree, as
+   * recEraseElement does, while finding its successor in the tree.  Returns
+   * whether the entry was erased, and sets hasSuccessor to whether it has a
+   * successor, which if so is stored in successor.
+   */
+  template <size_t NumBits>
+  static bool recEraseSuccessor(Key value, Pointer& root, Storage& storage,
+                                Key& successor, bool& hasSuccessor);
 
   /* Helper function to recursively delete an entry from the tree, reporting
-   * whether it already existed.
+   * whether it already existed.  The root is passed by reference so that a
+   * tree that becomes empty can be freed and reset to NULL.
+   */
+  template <size_t NumBits>
+  static bool recEraseElement(Key value, Pointer& root, Storage& storage);
+
+  /* Helper function to return the largest or smallest elements of a vEB-tree.
+   * Since every Key might be a legal value, there's no value left over to act
+   * as a sentinel; instead, these functions return whether the tree had any
+   * elements and, if so, write the answer into result.
    */
-  static bool recEraseElement(unsigned short value, void* root, size_t numBits);
+  template <size_t NumBits> static bool treeMax(void* root, Key& result);
+  template <size_t NumBits> static bool treeMin(void* root, Key& result);
 
-  /* Helper function to return the largest or smallest elements of a vEB-tree,
-   * handing back the sentinel if the tree is empty.
+  /* Helper function to find the successor or predecessor of a given entry in
+   * the tree.  As with treeMin and treeMax, these functions return whether
+   * such an entry exists and write it into result if so.
    */
-  static size_t treeMax(void* root, size_t numBits);
-  static size_t treeMin(void* root, size_t numBits);
+  template <size_t NumBits>
+  static bool recSuccessor(Key value, void* root, Key& result);
+  template <size_t NumBits>
+  static bool recPredecessor(Key value, void* root, Key& result);
 
-  /* Helper function to return whether a tree is empty. */
-  static bool isTreeEmpty(void* root, size_t numBits);
+  /* Helper function to visit every value from lo to hi, inclusive, in a tree
+   * of NumBits bits, in sorted order.  The values are handed to the visitor
+   * a word at a time, as visitor(first, bits), meaning that first + i is in
+   * the tree for each set bit i of bits.  base is added to every value, so
+   * a cluster can report its values as they appear in the whole tree.
+   */
+  template <size_t NumBits, typename Visitor>
+  static void recVisitRange(void* root, Key lo, Key hi, Key base,
+                            Visitor& visitor);
+
+  /* Helper functions for recVisitRange that visit a range of a nonempty
+   * bitvector or node.  They're picked between by overloading rather than
+   * with an if, since each level of a node's summary is visited with a
+   * visitor of a new type, and the bitvector's copy of the node code would
+   * otherwise go on instantiating summaries of summaries forever.
+   */
+  template <size_t NumBits, typename Visitor>
+  static void visitRange(void* root, Key lo, Key hi, Key base,
+                         Visitor& visitor, std::true_type isBitvector);
+  template <size_t NumBits, typename Visitor>
+  static void visitRange(void* root, Key lo, Key hi, Key base,
+                         Visitor& visitor, std::false_type isBitvector);
+
+  /* Helper functions for range_view's iterators, which keep track of a path
+   * down through the tree: path[0] is the root of a NumBits-bit tree and,
+   * unless the current value is that tree's min or max, path[1] onwards is
+   * the path through the cluster holding it.  recSeek finds the smallest
+   * value at least as large as the given one, and recNext finds the value
+   * after the current one, following the path rather than the tables.  Both
+   * return whether there is such a value, writing it into result and
+   * updating the path if so.
+   */
+  template <size_t NumBits>
+  static bool recSeek(Key value, void* root, void** path, Key& result);
+  template <size_t NumBits>
+  static bool recNext(Key value, void** path, Key& result);
 
-  /* Helper function to return the successor or predecessor of a given entry in
-   * the tree, or the sentinel if none exists.
+  /* Helper function for recSeek and recNext to step the path from a node
+   * into its cluster at the specified index, which must be nonempty, and
+   * report the smallest value in that cluster.
    */
-  static size_t recSuccessor(unsigned short value, void* root, size_t numBits);
-  static size_t recPredecessor(unsigned short value, void* root, size_t numBits);
+  template <size_t NumBits>
+  static void enterCluster(Node* node, Key index, void** path, Key& result);
 };
 
 /* Definition of the const_iterator type. */
-class VanEmdeBoasTree::const_iterator:
-  public std::iterator<std::bidirectional_iterator_tag, const unsigned short> {
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+class VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator:
+  public std::iterator<std::bidirectional_iterator_tag, const Key,
+                       std::ptrdiff_t, const Key*, const Key> {
 public:
   /* Default constructor creates a garbage const_iterator. */
   const_iterator();
@@ -287,10 +1099,11 @@ public:
   const const_iterator operator-- (int);
 
   /* Pointer dereference.  No arrow is defined because the iterator visits
-   * unsigned shorts.  Since the values are immutable, we hand back a value
-   * rather than a reference.
+   * integers.  Since the values are immutable, we hand back a value rather
+   * than a reference; the reference type above is declared accordingly so
+   * that std::reverse_iterator doesn't bind a reference to a temporary.
    */
-  const unsigned short operator* () const;
+  const Key operator* () const;
 
   /* Equality and disequality testing. */
   bool operator== (const const_iterator& rhs) const;
@@ -298,20 +1111,3525 @@ public:
 
 private:
   /* Make VanEmdeBoasTree a friend of this class so it can invoke the private
-   * constructor.
+   * constructors.
    */
   friend class VanEmdeBoasTree;
 
   /* Constructor creates an iterator that starts off at the specified value. */
-  const_iterator(size_t valueOrSentinel, const VanEmdeBoasTree* owner);
+  const_iterator(Key value, const VanEmdeBoasTree* owner);
+
+  /* Constructor creates an iterator one step past the end of the owner. */
+  explicit const_iterator(const VanEmdeBoasTree* owner);
+
+  /* Internally, the iterator works by maintaining the value currently being
+   * iterated over, along with a flag indicating whether the iterator is one
+   * step past the end of the tree.  The ++ and -- operators just call
+   * predecessor and successor on the owner tree to move to the previous and
+   * next values.
+   */
+  Key mCurr;
+  bool mAtEnd;
+  const VanEmdeBoasTree* mOwner;
+};
+
+/* Definition of the range_view type. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+class VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view {
+public:
+  /* The iterators over a range, which can only move forwards. */
+  class const_iterator;
+  typedef const_iterator iterator;
+
+  /* The range as a sequence of iterators. */
+  const_iterator begin() const;
+  const_iterator end() const;
+
+private:
+  /* Make VanEmdeBoasTree a friend of this class so it can invoke the private
+   * constructor.
+   */
+  friend class VanEmdeBoasTree;
+
+  /* Constructor creates a view of the values of owner from lo to hi. */
+  range_view(Key lo, Key hi, const VanEmdeBoasTree* owner);
+
+  /* The bounds of the range, clipped to the universe, and the tree. */
+  Key mLo, mHi;
+  const VanEmdeBoasTree* mOwner;
+};
+
+/* Definition of the range_view::const_iterator type. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+class VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator:
+  public std::iterator<std::forward_iterator_tag, const Key,
+                       std::ptrdiff_t, const Key*, const Key> {
+public:
+  /* Default constructor creates a garbage const_iterator. */
+  const_iterator();
+
+  /* Forwards motion. */
+  const_iterator& operator++ ();
+  const const_iterator operator++ (int);
+
+  /* Pointer dereference, which hands back a value for the same reasons as
+   * VanEmdeBoasTree::const_iterator.
+   */
+  const Key operator* () const;
+
+  /* Equality and disequality testing. */
+  bool operator== (const const_iterator& rhs) const;
+  bool operator!= (const const_iterator& rhs) const;
 
-  /* Internally, the iterator works by maintaining a size_t containing either
-   * the value currently being iterated over, or kNil as a sentinel.  The ++
-   * and -- operators just call predecessor and successor on the owner tree to
-   * move to the previous and next values.
+private:
+  /* Make range_view a friend of this class so it can invoke the private
+   * constructors.
+   */
+  friend class range_view;
+
+  /* Constructor creates an iterator at the first value of the owner that's
+   * at least lo, stopping once the values pass hi.
+   */
+  const_iterator(Key lo, Key hi, const VanEmdeBoasTree* owner);
+
+  /* Constructor creates an iterator one step past the end of a range. */
+  explicit const_iterator(const VanEmdeBoasTree* owner);
+
+  /* Internally, the iterator keeps track of the current value and the last
+   * value in the range, a flag indicating whether it has run off the end of
+   * the range, and the path through the tree to the current value, with
+   * one entry per level of the tree; see recNext.
    */
-  size_t mCurr;
+  Key mCurr, mHi;
+  bool mAtEnd;
   const VanEmdeBoasTree* mOwner;
+  void* mPath[Depth<UniverseBits>::kValue];
 };
 
+/**
+ * template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+ * VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+ * set_union(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+ *           const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs);
+ * (and likewise for set_intersection, set_difference and
+ * set_symmetric_difference)
+ * Usage: VanEmdeBoasTree<> both = set_intersection(one, two);
+ * ----------------------------------------------------------------------------
+ * Returns a new vEB-tree holding the union, intersection, difference, or
+ * symmetric difference of two vEB-trees of the same type, computed as with
+ * the member functions of the same names.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+set_union(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+          const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs);
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+set_intersection(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+                 const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs);
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+set_difference(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+               const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs);
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+set_symmetric_difference(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+                         const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs);
+
+/* * * * * Implementation Below This Point * * * * */
+
+/**** Utility functions ****/
+
+/* Functions which, given a number of bits, return how many of them belong to
+ * the lower and upper halves of a value, respectively.  The lower half gets
+ * floor(numBits / 2) bits and the upper half gets whatever's left over.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::lowHalf(size_t numBits) {
+  return numBits / 2;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::highHalf(size_t numBits) {
+  return numBits - numBits / 2;
+}
+
+/* Function which, given a value and a number of bits, returns the lower half
+ * of those bits.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::lowerBits(Key value, size_t numBits) {
+  /* To recover the lower bits, we'll compute 2^(numBits/2) - 1.  This value's
+   * binary representation is 00..0011..11, where the number of ones is given
+   * by numBits / 2.  We can then AND this with the original value to get the
+   * result.
+   */
+  return value & static_cast<Key>((Key(1) << lowHalf(numBits)) - 1);
+}
+
+/* Function which, given a value and a number of bits, returns the upper half
+ * of those bits.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::upperBits(Key value, size_t numBits) {
+  /* This is given by the original number shifted down numBits / 2 positions. */
+  return static_cast<Key>(value >> lowHalf(numBits));
+}
+
+/* Function which, given the upper and lower halves of a numBits-bit value,
+ * returns that value.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::compose(Key upper, Key lower,
+                                                                    size_t numBits) {
+  return static_cast<Key>((upper << lowHalf(numBits)) | lower);
+}
+
+/* A value is in the universe if it has no bits set at or above position
+ * UniverseBits.  We check the full-width case separately, since shifting by
+ * the width of the type is undefined.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::inUniverse(Key value) {
+  if (UniverseBits == sizeof(Key) * CHAR_BIT) return true;
+  return (value >> (UniverseBits % (sizeof(Key) * CHAR_BIT))) == 0;
+}
+
+/* Truncating a value masks off everything but its low numBits bits.  Shifting
+ * by the width of the type is undefined, so asking for every bit just hands
+ * back the value.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::truncate(Key value, size_t numBits) {
+  if (numBits >= sizeof(Key) * CHAR_BIT) return value;
+  return value & static_cast<Key>((Key(1) << numBits) - 1);
+}
+
+/* Keys are their own keys; batch entries carry theirs around with them. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::keyOf(Key value) {
+  return value;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::keyOf(const BatchEntry& entry) {
+  return entry.mKey;
+}
+
+/**** Implementation of Node. ****/
+
+/* operator new takes in a number of extra bytes, then overallocates space
+ * for them from the storage.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void* VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::Node::operator new(size_t size,
+                                                                                 size_t extraBytes,
+                                                                                 Storage& storage) {
+  return storage.allocate(size + extraBytes);
+}
+
+/* operator delete doesn't do anything fancy; it just hands the memory back
+ * to the storage.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::Node::operator delete(void* memory,
+                                                                                   size_t extraBytes,
+                                                                                   Storage& storage) {
+  storage.deallocate(memory, sizeof(Node) + extraBytes);
+}
+
+/**** Implementation of const_iterator ****/
+
+/* Default constructor sets the iterator to the sentinel. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::const_iterator() {
+  mCurr = Key();
+  mAtEnd = true;
+
+  /* No one owns this iterator. */
+  mOwner = NULL;
+}
+
+/* Parameterized constructor sets the current value to the indicated value. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::const_iterator(Key value,
+                                                                                       const VanEmdeBoasTree* owner) {
+  mCurr = value;
+  mAtEnd = false;
+  mOwner = owner;
+}
+
+/* End constructor sets the iterator to the sentinel for the owner. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::const_iterator(const VanEmdeBoasTree* owner) {
+  mCurr = Key();
+  mAtEnd = true;
+  mOwner = owner;
+}
+
+/* Equality checks for equality of the underlying value and tree.  All
+ * iterators past the end of a given tree compare equal regardless of mCurr.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::operator== (const const_iterator& rhs) const {
+  return mOwner == rhs.mOwner && mAtEnd == rhs.mAtEnd &&
+         (mAtEnd || mCurr == rhs.mCurr);
+}
+
+/* Disequality implemented in terms of equality. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::operator!= (const const_iterator& rhs) const {
+  return !(*this == rhs);
+}
+
+/* Pointer dereference just hands back the stored value.  Note that if we are
+ * at the sentinel this hands back something pretty much random, but that's
+ * okay because the clients should't be dereferencing it in the first place.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+const Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::operator* () const {
+  return mCurr;
+}
+
+/* Advance operator works by updating this iterator to the successor of the
+ * current value.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator&
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::operator ++() {
+  /* Ask the owner for the successor. */
+  *this = mOwner->successor(mCurr);
+  return *this;
+}
+
+/* Postfix ++ implemented in terms of prefix ++. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+const typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::operator++ (int) {
+  const_iterator result = *this; // Cache value...
+  ++*this;                       // ... advance ...
+  return result;                 // ... and return cached value.
+}
+
+/* Retreat operator works by updating this iterator to be the predecessor of
+ * the current value.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator&
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::operator --() {
+  /* Special case: If we are one step past the end of the range, we are still
+   * allowed to back up.  This gives an iterator to the maximum element of the
+   * tree.
+   */
+  if (mAtEnd) {
+    mAtEnd = !VanEmdeBoasTree::template treeMax<UniverseBits>(mOwner->mStorage.root(),
+                                                              mCurr);
+  }
+  /* Otherwise, just ask the owner for the predecessor. */
+  else {
+    *this = mOwner->predecessor(mCurr);
+  }
+  return *this;
+}
+
+/* Postfix -- implemented in terms of prefix --. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+const typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator::operator-- (int) {
+  const_iterator result = *this; // Cache value...
+  --*this;                       // ... back up ...
+  return result;                 // ... and return cached value.
+}
+
+/**** Implementation of range_view ****/
+
+/* Constructor stores the bounds, clipping hi to the universe.  A lo outside
+ * the universe leaves nothing in the range, which begin deals with.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::range_view(Key lo, Key hi,
+                                                                               const VanEmdeBoasTree* owner) {
+  mLo = lo;
+  mHi = inUniverse(hi)? hi : truncate(~Key(0), UniverseBits);
+  mOwner = owner;
+}
+
+/* begin seeks to the first value in the range, if there is one. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::begin() const {
+  if (mLo > mHi) return end();
+  return const_iterator(mLo, mHi, mOwner);
+}
+
+/* end is the sentinel for the owner. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::end() const {
+  return const_iterator(mOwner);
+}
+
+/**** Implementation of range_view::const_iterator ****/
+
+/* Default constructor sets the iterator to the sentinel. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator::const_iterator() {
+  mCurr = mHi = Key();
+  mAtEnd = true;
+
+  /* No one owns this iterator. */
+  mOwner = NULL;
+}
+
+/* Seeking constructor walks down from the root to the first value at least
+ * as large as lo, recording the path as it goes.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator::const_iterator(Key lo, Key hi,
+                                                                                                   const VanEmdeBoasTree* owner) {
+  mCurr = Key();
+  mHi = hi;
+  mOwner = owner;
+  mAtEnd = !inUniverse(lo) ||
+           !VanEmdeBoasTree::template recSeek<UniverseBits>(lo, owner->mStorage.root(),
+                                                            mPath, mCurr) ||
+           mCurr > mHi;
+}
+
+/* End constructor sets the iterator to the sentinel for the owner. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator::const_iterator(const VanEmdeBoasTree* owner) {
+  mCurr = mHi = Key();
+  mAtEnd = true;
+  mOwner = owner;
+}
+
+/* Equality works as it does for VanEmdeBoasTree::const_iterator. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator::operator== (const const_iterator& rhs) const {
+  return mOwner == rhs.mOwner && mAtEnd == rhs.mAtEnd &&
+         (mAtEnd || mCurr == rhs.mCurr);
+}
+
+/* Disequality implemented in terms of equality. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator::operator!= (const const_iterator& rhs) const {
+  return !(*this == rhs);
+}
+
+/* Pointer dereference just hands back the stored value. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+const Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator::operator* () const {
+  return mCurr;
+}
+
+/* Advance operator follows the path to the next value, and runs off the end
+ * once there isn't one or it's past the end of the range.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator&
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator::operator ++() {
+  Key next = Key();
+  if (VanEmdeBoasTree::template recNext<UniverseBits>(mCurr, mPath, next) &&
+      next <= mHi)
+    mCurr = next;
+  else
+    mAtEnd = true;
+  return *this;
+}
+
+/* Postfix ++ implemented in terms of prefix ++. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+const typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view::const_iterator::operator++ (int) {
+  const_iterator result = *this; // Cache value...
+  ++*this;                       // ... advance ...
+  return result;                 // ... and return cached value.
+}
+
+/**** Implementation of VanEmdeBoasTree interface. */
+
+/* Constructor creates an empty tree.  Since structure is only allocated as
+ * values are inserted, there's nothing to build yet.  Preallocated storage
+ * works out how much memory the tree could ever need, and grabs it all at
+ * once when the first value goes in.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::VanEmdeBoasTree()
+  : mStorage(Storage::kPreallocated? maxTreeBytes(UniverseBits) : 0) {
+  /* Initially, the tree is empty. */
+  mSize = 0;
+}
+
+/* Constructing from storage just takes a copy of it, which for the storage
+ * policies is always empty.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::VanEmdeBoasTree(const storage_type& storage)
+  : mStorage(storage) {
+  mSize = 0;
+}
+
+/* Copy constructor recursively clones the other tree.  Preallocated storage
+ * copies itself wholesale, so there's nothing to clone in that case.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::VanEmdeBoasTree(const VanEmdeBoasTree& other)
+  : mStorage(other.mStorage) {
+  /* Copy size information. */
+  mSize = other.mSize;
+
+  /* Recursively clone the other tree. */
+  if (!Storage::kPreallocated)
+    mStorage.root() = recCloneTree(other.mStorage.root(), UniverseBits,
+                                   mStorage, runsInParallel(mSize));
+}
+
+/* Move constructor takes the other tree's storage, root and all, leaving it
+ * with empty storage of its own.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::VanEmdeBoasTree(VanEmdeBoasTree&& other) noexcept
+  : mStorage(std::move(other.mStorage)) {
+  mSize = other.mSize;
+  other.mSize = 0;
+}
+
+/* The range constructor builds the tree into empty storage. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename InputIterator>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::VanEmdeBoasTree(InputIterator begin,
+                                                                        InputIterator end)
+  : mStorage(Storage::kPreallocated? maxTreeBytes(UniverseBits) : 0) {
+  mSize = 0;
+  build(begin, end);
+}
+
+/* Building gathers the values up, sorts them if they aren't sorted already,
+ * and builds the tree from them in one go.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename InputIterator>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::build(InputIterator begin,
+                                                                   InputIterator end) {
+  std::vector<Key> values(begin, end);
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (!inUniverse(values[i]))
+      throw std::out_of_range("VanEmdeBoasTree: value outside universe.");
+  }
+
+  /* Sort the values and strip out duplicates. */
+  if (!std::is_sorted(values.begin(), values.end()))
+    sortValues(values);
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+
+  mSize = values.size();
+  mStorage.root() = recBuildTree(values.data(), values.size(), UniverseBits,
+                                 mStorage, runsInParallel(mSize));
+}
+
+/* assign builds a new tree and swaps it in, so that the tree is untouched if
+ * anything goes wrong.  The new tree allocates the same way this one does.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename InputIterator>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::assign(InputIterator begin,
+                                                                    InputIterator end) {
+  VanEmdeBoasTree built(freshStorage());
+  built.build(begin, end);
+  swap(built);
+}
+
+/* Destructor recursively deletes the tree structure.  Preallocated storage
+ * frees everything at once when it's destroyed, so in that case there's no
+ * need to walk the tree.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::~VanEmdeBoasTree() {
+  if (!Storage::kPreallocated)
+    recDeleteTree(mStorage.root(), UniverseBits, mStorage,
+                  runsInParallel(mSize));
+}
+
+/* Assignment operator implemented using copy-and-swap. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>&
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::operator= (const VanEmdeBoasTree& other) {
+  VanEmdeBoasTree copy = other;
+  swap(copy);
+  return *this;
+}
+
+/* Move assignment moves the other tree into a temporary and swaps it in, so
+ * that the old contents are freed when the temporary goes away.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>&
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::operator= (VanEmdeBoasTree&& other) noexcept {
+  VanEmdeBoasTree moved(std::move(other));
+  swap(moved);
+  return *this;
+}
+
+/* begin returns a const_iterator to the smallest value in the tree. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::begin() const {
+  Key min = Key();
+  return treeMin<UniverseBits>(mStorage.root(), min)?
+           const_iterator(min, this) : end();
+}
+
+/* end returns a const_iterator to the sentinel value. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::end() const {
+  return const_iterator(this);
+}
+
+/* Reverse begin and end functions just wrap up end and begin, respectively. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_reverse_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::rbegin() const {
+  return const_reverse_iterator(end());
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_reverse_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::rend() const {
+  return const_reverse_iterator(begin());
+}
+
+/* size hands back the cached size. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::size() const {
+  return mSize;
+}
+
+/* empty reports whether the size is zero. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::empty() const {
+  return size() == 0;
+}
+
+/* find recursively searches the tree for the specified value.  If it's found,
+ * the function returns a valid iterator that wraps the value.  Otherwise, it
+ * returns end() as a sentinel.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::find(Key value) const {
+  VANEMDEBOAS_STATS_SCOPE(kFind);
+  if (!inUniverse(value)) return end();
+  return recFindElement<UniverseBits>(value, mStorage.root())?
+           const_iterator(value, this) : end();
+}
+
+/* insert recursively inserts a value into the tree, returning an iterator to
+ * it and flagging whether or not it was found.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+std::pair<typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator, bool>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::insert(Key value) {
+  VANEMDEBOAS_STATS_SCOPE(kInsert);
+
+  /* Values outside the universe have nowhere to go. */
+  if (!inUniverse(value))
+    throw std::out_of_range("VanEmdeBoasTree::insert: value outside universe.");
+
+  /* Recursively insert the element into the tree. */
+  const bool didInsert = recInsertElement<UniverseBits>(value, mStorage.root(),
+                                                        mStorage);
+
+  /* If the value was inserted, bump up the total number of elements we store
+   * in the tree.
+   */
+  if (didInsert) ++mSize;
+
+  /* Hand back a pair of an iterator to the value and whether it was added. */
+  return std::make_pair(const_iterator(value, this), didInsert);
+}
+
+/* Erasing an element just forwards the call to the recursive delete procedure. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::erase(Key value) {
+  VANEMDEBOAS_STATS_SCOPE(kErase);
+
+  /* Values outside the universe can't be in the tree, and an empty tree
+   * has nothing to erase.  Checking for the latter up front keeps erasing
+   * from an empty tree from allocating storage it doesn't need.
+   */
+  if (!inUniverse(value) || empty()) return false;
+
+  /* Wipe the element from the tree. */
+  const bool result = recEraseElement<UniverseBits>(value, mStorage.root(),
+                                                    mStorage);
+
+  /* If something was removed, drop our effective size. */
+  if (result) --mSize;
+
+  return result;
+}
+
+/* Erasing an iterator just recovers the underlying value from the iterator
+ * and uses it as a target for erasure.  The end iterator doesn't refer to
+ * anything, so erasing it removes nothing.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::erase(const_iterator where) {
+  return !where.mAtEnd && erase(where.mCurr);
+}
+
+/* The fused operations are insert and erase with the neighbors found by the
+ * recursion turned into iterators.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::insert_and_neighbors(Key value,
+                                                                                  const_iterator& predecessor,
+                                                                                  const_iterator& successor) {
+  VANEMDEBOAS_STATS_SCOPE(kInsert);
+  if (!inUniverse(value))
+    throw std::out_of_range("VanEmdeBoasTree::insert_and_neighbors: value outside universe.");
+
+  Neighbors neighbors = Neighbors();
+  const bool didInsert = recInsertNeighbors<UniverseBits>(value, mStorage.root(),
+                                                          mStorage, neighbors);
+  if (didInsert) ++mSize;
+
+  predecessor = neighbors.mHasPredecessor?
+                  const_iterator(neighbors.mPredecessor, this) : end();
+  successor = neighbors.mHasSuccessor?
+                const_iterator(neighbors.mSuccessor, this) : end();
+  return didInsert;
+}
+
+/* Values outside the universe come after everything in the tree, so they
+ * have no successor, just as with successor itself.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::erase_and_successor(Key value,
+                                                                                 const_iterator& successor) {
+  VANEMDEBOAS_STATS_SCOPE(kErase);
+  successor = end();
+  if (!inUniverse(value) || empty()) return false;
+
+  Key next;
+  bool hasNext;
+  const bool result = recEraseSuccessor<UniverseBits>(value, mStorage.root(),
+                                                      mStorage, next, hasNext);
+  if (result) --mSize;
+  if (hasNext) successor = const_iterator(next, this);
+  return result;
+}
+
+/* Popping just hands off to the recursion once it's known that there's
+ * something to pop.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::pop_min(Key& result) {
+  VANEMDEBOAS_STATS_SCOPE(kErase);
+  if (empty()) return false;
+
+  recPopMin<UniverseBits>(mStorage.root(), mStorage, result);
+  --mSize;
+  return true;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::pop_max(Key& result) {
+  VANEMDEBOAS_STATS_SCOPE(kErase);
+  if (empty()) return false;
+
+  recPopMax<UniverseBits>(mStorage.root(), mStorage, result);
+  --mSize;
+  return true;
+}
+
+/* Extracting unpacks each word of values handed to the visitor, counting
+ * them as it goes.  A bound beyond the universe takes everything.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename OutputIterator>
+OutputIterator VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::extract_if_le(Key bound,
+                                                                                     OutputIterator out) {
+  VANEMDEBOAS_STATS_SCOPE(kErase);
+  if (empty()) return out;
+  if (!inUniverse(bound)) bound = truncate(~Key(0), UniverseBits);
+
+  size_t count = 0;
+  auto visitor = [&](Key first, uint64_t bits) {
+    for (; bits != 0; bits &= bits - 1, ++count)
+      *out++ = static_cast<Key>(first + VanEmdeBoasBits::lowestSetBit(bits));
+  };
+  recExtractPrefix<UniverseBits>(bound, mStorage.root(), mStorage, Key(0),
+                                 visitor);
+  mSize -= count;
+  return out;
+}
+
+/* The batch operations sort the batch, run it through the tree all at once,
+ * and then count up and hand back the results.  Keys outside the universe
+ * are dealt with up front: insert_batch refuses them, while sortBatch sets
+ * them aside for the others, since their upper bits would otherwise be lost
+ * as the batch makes its way down the tree.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::insert_batch(const Key* keys,
+                                                                            size_t count,
+                                                                            uint64_t* results) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!inUniverse(keys[i]))
+      throw std::out_of_range("VanEmdeBoasTree::insert_batch: value outside universe.");
+  }
+
+  std::vector<BatchEntry> entries = sortBatch(keys, count, true);
+  std::vector<uint64_t> marks((count + VanEmdeBoasBits::kWordBits - 1) /
+                              VanEmdeBoasBits::kWordBits);
+  recInsertBatch<UniverseBits>(entries.data(), entries.size(), mStorage.root(),
+                               mStorage, marks.data());
+
+  size_t inserted = 0;
+  for (size_t i = 0; i < marks.size(); ++i)
+    inserted += VanEmdeBoasBits::popCount(marks[i]);
+  if (results != NULL) std::copy(marks.begin(), marks.end(), results);
+
+  mSize += inserted;
+  return inserted;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::erase_batch(const Key* keys,
+                                                                           size_t count,
+                                                                           uint64_t* results) {
+  std::vector<BatchEntry> entries = sortBatch(keys, count, true);
+
+  std::vector<uint64_t> marks((count + VanEmdeBoasBits::kWordBits - 1) /
+                              VanEmdeBoasBits::kWordBits);
+  if (!empty())
+    recEraseBatch<UniverseBits>(entries.data(), entries.size(), mStorage.root(),
+                                mStorage, marks.data());
+
+  size_t erased = 0;
+  for (size_t i = 0; i < marks.size(); ++i)
+    erased += VanEmdeBoasBits::popCount(marks[i]);
+  if (results != NULL) std::copy(marks.begin(), marks.end(), results);
+
+  mSize -= erased;
+  return erased;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::contains_batch(const Key* keys,
+                                                                              size_t count,
+                                                                              uint64_t* results) const {
+  std::vector<BatchEntry> entries = sortBatch(keys, count, false);
+
+  std::vector<uint64_t> marks((count + VanEmdeBoasBits::kWordBits - 1) /
+                              VanEmdeBoasBits::kWordBits);
+  recContainsBatch<UniverseBits>(entries.data(), entries.size(), mStorage.root(),
+                                 marks.data());
+
+  size_t found = 0;
+  for (size_t i = 0; i < marks.size(); ++i)
+    found += VanEmdeBoasBits::popCount(marks[i]);
+  if (results != NULL) std::copy(marks.begin(), marks.end(), results);
+
+  return found;
+}
+
+/* successor and predecessor just wrap the result of the recursive calls.
+ * Values beyond the universe have no successor, and their predecessor is the
+ * largest value in the tree.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::successor(Key value) const {
+  VANEMDEBOAS_STATS_SCOPE(kSuccessor);
+  Key result;
+  if (!inUniverse(value)) return end();
+  return recSuccessor<UniverseBits>(value, mStorage.root(), result)?
+           const_iterator(result, this) : end();
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::predecessor(Key value) const {
+  VANEMDEBOAS_STATS_SCOPE(kPredecessor);
+  Key result;
+  if (!inUniverse(value)) return --end();
+  return recPredecessor<UniverseBits>(value, mStorage.root(), result)?
+           const_iterator(result, this) : end();
+}
+
+/* The range functions clip the range to the universe and then visit it a
+ * word at a time, either unpacking each word into values for the caller or
+ * just counting its bits.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename Function>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::for_each_in_range(Key lo, Key hi,
+                                                                               Function fn) const {
+  if (!inUniverse(lo)) return;
+  if (!inUniverse(hi)) hi = truncate(~Key(0), UniverseBits);
+  if (lo > hi) return;
+
+  auto visitor = [&](Key first, uint64_t bits) {
+    for (; bits != 0; bits &= bits - 1)
+      fn(static_cast<Key>(first + VanEmdeBoasBits::lowestSetBit(bits)));
+  };
+  recVisitRange<UniverseBits>(mStorage.root(), lo, hi, Key(0), visitor);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::count_in_range(Key lo,
+                                                                              Key hi) const {
+  if (!inUniverse(lo)) return 0;
+  if (!inUniverse(hi)) hi = truncate(~Key(0), UniverseBits);
+  if (lo > hi) return 0;
+
+  size_t count = 0;
+  auto visitor = [&](Key, uint64_t bits) {
+    count += VanEmdeBoasBits::popCount(bits);
+  };
+  recVisitRange<UniverseBits>(mStorage.root(), lo, hi, Key(0), visitor);
+  return count;
+}
+
+/* range just wraps the bounds in a view. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range_view
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::range(Key lo, Key hi) const {
+  return range_view(lo, hi, this);
+}
+
+/* rank and select walk the counts if there are any, and otherwise fall back
+ * on the range functions.  Every element is less than a value beyond the
+ * universe.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::rank(Key value) const {
+  VANEMDEBOAS_STATS_SCOPE(kRank);
+  if (!inUniverse(value)) return size();
+  if (!Clusters::kStoresCounts) return value == 0? 0 : count_in_range(0, value - 1);
+  return recRank<UniverseBits>(value, mStorage.root(), size());
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::const_iterator
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::select(size_t index) const {
+  VANEMDEBOAS_STATS_SCOPE(kSelect);
+  if (index >= size()) return end();
+  if (Clusters::kStoresCounts)
+    return const_iterator(recSelect<UniverseBits>(index, mStorage.root(), size()),
+                          this);
+
+  range_view all = range(0, truncate(~Key(0), UniverseBits));
+  typename range_view::const_iterator itr = all.begin();
+  for (; index != 0; --index) ++itr;
+  return const_iterator(*itr, this);
+}
+
+/* The set operations build the result as a new tree and swap it in. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::set_union(const VanEmdeBoasTree& other) {
+  VanEmdeBoasTree result = combine<kUnion>(*this, other);
+  swap(result);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::set_intersection(const VanEmdeBoasTree& other) {
+  VanEmdeBoasTree result = combine<kIntersection>(*this, other);
+  swap(result);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::set_difference(const VanEmdeBoasTree& other) {
+  VanEmdeBoasTree result = combine<kDifference>(*this, other);
+  swap(result);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::set_symmetric_difference(const VanEmdeBoasTree& other) {
+  VanEmdeBoasTree result = combine<kSymmetricDifference>(*this, other);
+  swap(result);
+}
+
+/* The elements go out in order straight from the iterators.  Coming back,
+ * the file is decoded into a sorted vector, which assign builds from
+ * without sorting it again.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::save(std::ostream& out) const {
+  VanEmdeBoasFile::write(out, UniverseBits, begin(), end());
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::load(std::istream& in) {
+  const std::vector<uint64_t> bytes = VanEmdeBoasFile::read(in);
+  const VanEmdeBoasFile::View view(bytes.data(), bytes.size() * sizeof(uint64_t),
+                                   UniverseBits);
+
+  std::vector<Key> values;
+  values.reserve(size_t(view.size()));
+  view.forEach([&](uint64_t value) { values.push_back(Key(value)); });
+  assign(values.begin(), values.end());
+}
+
+/* Preallocated storage is sized by the tree; other storage is copied, which
+ * leaves the copy empty.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::Storage
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::freshStorage() const {
+  if (Storage::kPreallocated) return Storage(maxTreeBytes(UniverseBits));
+  return Storage(mStorage);
+}
+
+/* Releasing just forgets the root.  Preallocated storage owns its block,
+ * so instead it's swapped out for fresh storage and freed.  Looking at the
+ * root through a const reference keeps an arena from allocating its block
+ * just to be asked.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::release() noexcept {
+  if (Storage::kPreallocated) {
+    VanEmdeBoasTree empty;
+    swap(empty);
+    return;
+  }
+  if (static_cast<const Storage&>(mStorage).root() != NULL)
+    mStorage.root() = NULL;
+  mSize = 0;
+}
+
+/* The nodes add up their own memory.  Preallocated storage holds its whole
+ * block however much of it they use, so the rest of the block is slack.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::MemoryUsage
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::memory_usage() const {
+  MemoryUsage result = { 0, 0, 0, 0 };
+  recMemoryUsage(mStorage.root(), UniverseBits, false, result);
+  if (Storage::kPreallocated && mStorage.capacity() > result.total())
+    result.slack += mStorage.capacity() - result.total();
+  return result;
+}
+
+/* Copying a tree builds each table from scratch, so the copy's tables are
+ * only as big as they need to be.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::shrink_to_fit() {
+  if (Storage::kPreallocated) return;
+  VanEmdeBoasTree copy(*this);
+  swap(copy);
+}
+
+/* The elements go out in order straight from the iterators, as with save. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+FrozenVanEmdeBoasTree<Key, UniverseBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::freeze() const {
+  return FrozenVanEmdeBoasTree<Key, UniverseBits>(begin(), end());
+}
+
+/* swap simply exchanges data members with the other tree. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::swap(VanEmdeBoasTree& other) {
+  std::swap(mSize, other.mSize);
+  mStorage.swap(other.mStorage);
+}
+
+/* The free set operations just hand back the combined tree. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+set_union(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+          const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs) {
+  typedef VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits> Tree;
+  return Tree::template combine<Tree::kUnion>(lhs, rhs);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+set_intersection(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+                 const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs) {
+  typedef VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits> Tree;
+  return Tree::template combine<Tree::kIntersection>(lhs, rhs);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+set_difference(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+               const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs) {
+  typedef VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits> Tree;
+  return Tree::template combine<Tree::kDifference>(lhs, rhs);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+set_symmetric_difference(const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& lhs,
+                         const VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>& rhs) {
+  typedef VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits> Tree;
+  return Tree::template combine<Tree::kSymmetricDifference>(lhs, rhs);
+}
+
+/**** Implementation of private helper functions for VanEmdeBoasTree ****/
+
+/* A node is the Node struct, followed by the rest of its table of
+ * 2^(upper half of bits) clusters, followed by the bounds and then the
+ * counts of those clusters if there are any.  The bounds start on an
+ * eight-byte boundary so that the bitmap's words are aligned.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::nodeBytes(size_t numBits) {
+  const size_t tableEnd = sizeof(Node) +
+                          Clusters::Table::extraSize(highHalf(numBits));
+  if (!Clusters::kStoresBounds && !Clusters::kStoresCounts) return tableEnd;
+  return ((tableEnd + 7) & ~size_t(7)) + boundsBytes(numBits) +
+         countsBytes(numBits);
+}
+
+/* The bounds take a bit per cluster for the bitmap, rounded up to whole
+ * words, plus a min and a max per cluster, padded out to a whole word so
+ * that anything after them is aligned too.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::boundsBytes(size_t numBits) {
+  if (!Clusters::kStoresBounds) return 0;
+  return (VanEmdeBoasBits::numWords(highHalf(numBits)) * sizeof(uint64_t) +
+          (size_t(1) << highHalf(numBits)) * sizeof(Bounds) + 7) & ~size_t(7);
+}
+
+/* The pieces of the bounds are found by stepping past everything before
+ * them.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+uint64_t* VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::nonemptyClusters(Node* node,
+                                                                                   size_t numBits) {
+  return reinterpret_cast<uint64_t*>(reinterpret_cast<char*>(node) +
+                                     nodeBytes(numBits) - boundsBytes(numBits) -
+                                     countsBytes(numBits));
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::Bounds*
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::clusterBounds(Node* node,
+                                                                      size_t numBits) {
+  return reinterpret_cast<Bounds*>(nonemptyClusters(node, numBits) +
+                                   VanEmdeBoasBits::numWords(highHalf(numBits)));
+}
+
+/* Setting the bounds of a cluster marks it nonempty and records its min and
+ * max.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::setBounds(Node* node,
+                                                                       size_t numBits,
+                                                                       Key index,
+                                                                       Key min,
+                                                                       Key max) {
+  if (!Clusters::kStoresBounds) return;
+  VanEmdeBoasBits::set(nonemptyClusters(node, numBits), index);
+  Bounds& bounds = clusterBounds(node, numBits)[index];
+  bounds.mMin = min;
+  bounds.mMax = max;
+}
+
+/* Updating the bounds of a cluster asks the cluster for them, or marks it
+ * empty if it's gone.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::updateBounds(Node* node,
+                                                                          Key index) {
+  if (!Clusters::kStoresBounds) return;
+
+  void* cluster = node->mChildren.get(index);
+  Key min = Key(), max = Key();
+  if (!treeMin<Split<NumBits>::kLow>(cluster, min)) {
+    VanEmdeBoasBits::clear(nonemptyClusters(node, NumBits), index);
+    return;
+  }
+  treeMax<Split<NumBits>::kLow>(cluster, max);
+  setBounds(node, NumBits, index, min, max);
+}
+
+/* The counts take a key per cluster, which is always enough, since a
+ * cluster holds at most 2^(lower half of bits) keys, but a block of them may
+ * hold more than that, so the block sums are full words.  They come first so
+ * that they're aligned, and the whole lot is padded to a whole number of
+ * words.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::countsBytes(size_t numBits) {
+  if (!Clusters::kStoresCounts) return 0;
+  const size_t numClusters = size_t(1) << highHalf(numBits);
+  const size_t numBlocks = (numClusters + kCountsPerBlock - 1) / kCountsPerBlock;
+  return (numBlocks * sizeof(size_t) + numClusters * sizeof(Key) + 7) & ~size_t(7);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t* VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::blockCounts(Node* node,
+                                                                            size_t numBits) {
+  return reinterpret_cast<size_t*>(reinterpret_cast<char*>(node) +
+                                   nodeBytes(numBits) - countsBytes(numBits));
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+Key* VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::clusterCounts(Node* node,
+                                                                           size_t numBits) {
+  const size_t numClusters = size_t(1) << highHalf(numBits);
+  return reinterpret_cast<Key*>(blockCounts(node, numBits) +
+                                (numClusters + kCountsPerBlock - 1) / kCountsPerBlock);
+}
+
+/* Counts that change by one key, or to a known number of keys, are written
+ * directly, and otherwise the cluster is counted.  Either way the block sum
+ * changes by as much as the count did.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::adjustCount(Node* node,
+                                                                         size_t numBits,
+                                                                         Key index,
+                                                                         bool added) {
+  if (!Clusters::kStoresCounts) return;
+  Key& count = clusterCounts(node, numBits)[index];
+  size_t& block = blockCounts(node, numBits)[index / kCountsPerBlock];
+  if (added) {
+    ++count;
+    ++block;
+  } else {
+    --count;
+    --block;
+  }
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::setCount(Node* node,
+                                                                      size_t numBits,
+                                                                      Key index,
+                                                                      Key count) {
+  if (!Clusters::kStoresCounts) return;
+  Key& old = clusterCounts(node, numBits)[index];
+  size_t& block = blockCounts(node, numBits)[index / kCountsPerBlock];
+  block = block - old + count;
+  old = count;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::updateCount(Node* node,
+                                                                         Key index) {
+  if (!Clusters::kStoresCounts) return;
+  setCount(node, NumBits, index,
+           Key(treeCount<Split<NumBits>::kLow>(node->mChildren.get(index))));
+}
+
+/* A bitvector's count is its number of set bits.  A node holds its min and,
+ * if different, its max, plus everything in its clusters, which the block
+ * sums add up to.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::treeCount(void* root) {
+  if (root == NULL) return 0;
+
+  if (NumBits <= kBitvectorSize)
+    return VanEmdeBoasBits::countBelow(static_cast<uint64_t*>(root),
+                                       size_t(1) << NumBits);
+
+  Node* node = static_cast<Node*>(root);
+  const size_t* blocks = blockCounts(node, NumBits);
+  const size_t numClusters = size_t(1) << Split<NumBits>::kHigh;
+  size_t result = node->mMin == node->mMax? 1 : 2;
+  for (size_t i = 0; i < (numClusters + kCountsPerBlock - 1) / kCountsPerBlock; ++i)
+    result += blocks[i];
+  return result;
+}
+
+/* Ranking a value in a bitvector counts the bits below it.  In a node, the
+ * values below it are the min, everything in the clusters before its own,
+ * and whatever is below it in its own cluster.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recRank(Key value,
+                                                                       void* root,
+                                                                       size_t count) {
+  if (root == NULL) return 0;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  if (NumBits <= kBitvectorSize)
+    return VanEmdeBoasBits::countBelow(static_cast<uint64_t*>(root), value);
+
+  /* Values at or below the min have nothing below them, and values above the
+   * max have everything below them.  Anything else lies in a node whose min
+   * and max differ, so the clusters hold count - 2 values.
+   */
+  Node* node = static_cast<Node*>(root);
+  if (value <= node->mMin) return 0;
+  if (value > node->mMax) return count;
+
+  const Key index = upperBits(value, NumBits);
+  return 1 + countBefore(node, NumBits, index, count - 2) +
+         recRank<Split<NumBits>::kLow>(lowerBits(value, NumBits),
+                                       node->mChildren.get(index),
+                                       clusterCounts(node, NumBits)[index]);
+}
+
+/* Selecting from a node is the other way around: after checking the min and
+ * max, find the cluster holding the value we're after and select from that.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recSelect(size_t index,
+                                                                      void* root,
+                                                                      size_t count) {
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+  if (NumBits <= kBitvectorSize)
+    return Key(VanEmdeBoasBits::select(static_cast<uint64_t*>(root), index));
+
+  Node* node = static_cast<Node*>(root);
+  if (index == 0) return node->mMin;
+  if (index == count - 1) return node->mMax;
+
+  index -= 1;
+  const Key cluster = findCluster(node, NumBits, index, count - 2);
+  const Key low = recSelect<Split<NumBits>::kLow>(index,
+                                                  node->mChildren.get(cluster),
+                                                  clusterCounts(node, NumBits)[cluster]);
+  return compose(cluster, low, NumBits);
+}
+
+/* Both of these add up whole blocks as far as they can and then single
+ * counts within a block, working from whichever end of the node is closer
+ * and, when working from the top, subtracting from the total.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::countBefore(Node* node,
+                                                                           size_t numBits,
+                                                                           Key index,
+                                                                           size_t total) {
+  const size_t* blocks = blockCounts(node, numBits);
+  const Key* counts = clusterCounts(node, numBits);
+  const size_t numClusters = size_t(1) << highHalf(numBits);
+  const size_t numBlocks = (numClusters + kCountsPerBlock - 1) / kCountsPerBlock;
+  const size_t block = index / kCountsPerBlock;
+
+  size_t result = 0;
+  if (index < numClusters / 2) {
+    for (size_t i = 0; i < block; ++i)
+      result += blocks[i];
+    for (size_t i = block * kCountsPerBlock; i < index; ++i)
+      result += counts[i];
+    return result;
+  }
+
+  for (size_t i = block + 1; i < numBlocks; ++i)
+    result += blocks[i];
+  for (size_t i = index; i < std::min((block + 1) * kCountsPerBlock, numClusters); ++i)
+    result += counts[i];
+  return total - result;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::findCluster(Node* node,
+                                                                        size_t numBits,
+                                                                        size_t& index,
+                                                                        size_t total) {
+  const size_t* blocks = blockCounts(node, numBits);
+  const Key* counts = clusterCounts(node, numBits);
+  const size_t numClusters = size_t(1) << highHalf(numBits);
+
+  if (index < total / 2) {
+    size_t block = 0;
+    for (; index >= blocks[block]; ++block)
+      index -= blocks[block];
+
+    size_t cluster = block * kCountsPerBlock;
+    for (; index >= counts[cluster]; ++cluster)
+      index -= counts[cluster];
+    return Key(cluster);
+  }
+
+  /* From the top, count how many values come after the one we want. */
+  size_t after = total - 1 - index;
+  size_t block = (numClusters + kCountsPerBlock - 1) / kCountsPerBlock - 1;
+  for (; after >= blocks[block]; --block)
+    after -= blocks[block];
+
+  size_t cluster = std::min((block + 1) * kCountsPerBlock, numClusters) - 1;
+  for (; after >= counts[cluster]; --cluster)
+    after -= counts[cluster];
+  index = counts[cluster] - 1 - after;
+  return Key(cluster);
+}
+
+/* Allocating a node means allocating enough space for the node, its table,
+ * and its bounds and counts, which start out with every cluster empty.
+ * Freeing it hands back that same amount of space.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::Node*
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::allocateNode(size_t numBits,
+                                                                     Storage& storage) {
+  Node* result = new (nodeBytes(numBits) - sizeof(Node), storage) Node;
+  VANEMDEBOAS_STATS_ADD(kBytesAllocated, nodeBytes(numBits));
+  if (Clusters::kStoresBounds) {
+    uint64_t* nonempty = nonemptyClusters(result, numBits);
+    std::fill(nonempty, nonempty + VanEmdeBoasBits::numWords(highHalf(numBits)),
+              uint64_t(0));
+  }
+  if (Clusters::kStoresCounts) {
+    const size_t numClusters = size_t(1) << highHalf(numBits);
+    size_t* blocks = blockCounts(result, numBits);
+    std::fill(blocks, blocks + (numClusters + kCountsPerBlock - 1) / kCountsPerBlock,
+              size_t(0));
+    Key* counts = clusterCounts(result, numBits);
+    std::fill(counts, counts + numClusters, Key(0));
+  }
+  return result;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::freeNode(Node* node,
+                                                                      size_t numBits,
+                                                                      Storage& storage) {
+  storage.deallocate(node, nodeBytes(numBits));
+  VANEMDEBOAS_STATS_ADD(kBytesFreed, nodeBytes(numBits));
+}
+
+/* Bitvectors are arrays of words, which start out cleared. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+uint64_t* VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::allocateBitvector(size_t numBits,
+                                                                                    Storage& storage) {
+  const size_t numWords = VanEmdeBoasBits::numWords(numBits);
+  uint64_t* result =
+    static_cast<uint64_t*>(storage.allocate(numWords * sizeof(uint64_t)));
+  VANEMDEBOAS_STATS_ADD(kBytesAllocated, numWords * sizeof(uint64_t));
+  std::fill(result, result + numWords, uint64_t(0));
+  return result;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::freeBitvector(uint64_t* bitvector,
+                                                                           size_t numBits,
+                                                                           Storage& storage) {
+  storage.deallocate(bitvector,
+                     VanEmdeBoasBits::numWords(numBits) * sizeof(uint64_t));
+  VANEMDEBOAS_STATS_ADD(kBytesFreed,
+                        VanEmdeBoasBits::numWords(numBits) * sizeof(uint64_t));
+}
+
+/* The largest a tree can get is a node plus a full summary plus a full tree
+ * for every cluster, bottoming out at a bitvector.  Each piece is rounded up
+ * the same way the storage rounds its blocks.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::maxTreeBytes(size_t numBits) {
+  if (numBits <= kBitvectorSize)
+    return Storage::blockSize(VanEmdeBoasBits::numWords(numBits) *
+                              sizeof(uint64_t));
+
+  return Storage::blockSize(nodeBytes(numBits)) +
+         maxTreeBytes(highHalf(numBits)) +
+         (size_t(1) << highHalf(numBits)) * maxTreeBytes(lowHalf(numBits));
+}
+
+/* To create a tree holding a single value, we look at the number of remaining
+ * bits.  If it's sufficiently small, we use a bitvector with just that bit
+ * set.  Otherwise, we create a new Node whose min and max are that value and
+ * which has no summary or children yet.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void* VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::createTree(Key value,
+                                                                         size_t numBits,
+                                                                         Storage& storage) {
+  /* If we're below the cutoff, allocate a new bitvector with the bit for this
+   * value set.
+   */
+  if (numBits <= kBitvectorSize) {
+    uint64_t* result = allocateBitvector(numBits, storage);
+    VanEmdeBoasBits::set(result, value);
+    return result;
+  }
+
+  /* Otherwise, allocate a node and fill the fields in. */
+  Node* result = allocateNode(numBits, storage);
+
+  /* The value is both the min and the max, and everything else is empty. */
+  result->mMin = result->mMax = value;
+  result->mSummary = NULL;
+  result->mChildren.init(highHalf(numBits));
+
+  return result;
+}
+
+/* Since every value fits in UniverseBits bits, a radix sort a byte at a time
+ * takes only a few linear passes, which is much faster than a comparison
+ * sort for the large ranges this is meant for.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename Value>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::sortValues(std::vector<Value>& values) {
+  const size_t kNumBytes = size_t(1) << CHAR_BIT;
+  const size_t kByteMask = kNumBytes - 1;
+  std::vector<Value> buffer(values.size());
+
+  for (size_t shift = 0; shift < UniverseBits; shift += CHAR_BIT) {
+    /* Count how many values have each byte in this position, offset by one
+     * so the counts can be turned into starting positions in place.
+     */
+    size_t starts[kNumBytes + 1] = { 0 };
+    for (size_t i = 0; i < values.size(); ++i)
+      ++starts[((keyOf(values[i]) >> shift) & kByteMask) + 1];
+
+    /* If every value has the same byte here, this pass wouldn't move
+     * anything.
+     */
+    if (starts[((keyOf(values[0]) >> shift) & kByteMask) + 1] == values.size())
+      continue;
+
+    for (size_t i = 1; i <= kNumBytes; ++i)
+      starts[i] += starts[i - 1];
+
+    /* Scatter the values into place, stably, then make that the new order. */
+    for (size_t i = 0; i < values.size(); ++i)
+      buffer[starts[(keyOf(values[i]) >> shift) & kByteMask]++] = values[i];
+    values.swap(buffer);
+  }
+}
+
+/* Building a tree from sorted values works from the bottom up.  The first
+ * and last values become the min and max, just as if they'd been inserted,
+ * and everything in between splits into runs sharing the same upper bits.
+ * Each run becomes a cluster, built recursively from its values, and the
+ * upper bits of the runs, which are themselves sorted and distinct, make up
+ * the summary.  In parallel, the runs are handed out to threads, which build
+ * the clusters into a list; only this thread touches the node itself.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename Value>
+void* VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recBuildTree(const Value* values,
+                                                                           size_t count,
+                                                                           size_t numBits,
+                                                                           Storage& storage,
+                                                                           bool parallel) {
+  /* An empty range builds an empty tree. */
+  if (count == 0) return NULL;
+
+  /* If we're below the cutoff, the tree is a bitvector with each value's bit
+   * set.  Only the low numBits bits of each value matter at this level.
+   */
+  if (numBits <= kBitvectorSize) {
+    uint64_t* result = allocateBitvector(numBits, storage);
+    for (size_t i = 0; i < count; ++i)
+      VanEmdeBoasBits::set(result, truncate(keyOf(values[i]), numBits));
+    return result;
+  }
+
+  /* Otherwise, allocate a node whose min and max are the extreme values. */
+  Node* result = allocateNode(numBits, storage);
+  result->mMin = truncate(keyOf(values[0]), numBits);
+  result->mMax = truncate(keyOf(values[count - 1]), numBits);
+  result->mSummary = NULL;
+  result->mChildren.init(highHalf(numBits));
+
+  /* Find the runs of the remaining values that share the same upper bits,
+   * recording the index and start of each.  The end of the last run is the
+   * max, which goes in no cluster.
+   */
+  std::vector<Key> indices;
+  std::vector<size_t> starts;
+  for (size_t i = 1; i + 1 < count; i = runEnd(values, i, count - 1, numBits)) {
+    indices.push_back(upperBits(truncate(keyOf(values[i]), numBits), numBits));
+    starts.push_back(i);
+  }
+  starts.push_back(count - 1);
+
+  /* Build a cluster out of each run, letting the table know up front how
+   * many there are.  The bounds of each cluster are the ends of its run,
+   * and its count is the run's length.
+   */
+  result->mChildren.reserve(highHalf(numBits), indices.size());
+  if (parallel) {
+    std::vector<void*> clusters(indices.size());
+    parallelFor(indices.size(), [&](size_t i) {
+      clusters[i] = recBuildTree(values + starts[i], starts[i + 1] - starts[i],
+                                 lowHalf(numBits), storage);
+    });
+    for (size_t i = 0; i < indices.size(); ++i)
+      result->mChildren.slot(indices[i]) = clusters[i];
+  } else {
+    for (size_t i = 0; i < indices.size(); ++i)
+      result->mChildren.slot(indices[i]) =
+        recBuildTree(values + starts[i], starts[i + 1] - starts[i],
+                     lowHalf(numBits), storage);
+  }
+  for (size_t i = 0; i < indices.size(); ++i) {
+    setBounds(result, numBits, indices[i],
+              truncate(keyOf(values[starts[i]]), lowHalf(numBits)),
+              truncate(keyOf(values[starts[i + 1] - 1]), lowHalf(numBits)));
+    setCount(result, numBits, indices[i], Key(starts[i + 1] - starts[i]));
+  }
+
+  /* Build the summary out of the indices of the nonempty clusters. */
+  result->mSummary = recBuildTree(indices.data(), indices.size(),
+                                  highHalf(numBits), storage);
+  return result;
+}
+
+/* Only some storage can be allocated from several threads at once. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::runsInParallel(size_t size) {
+  return Storage::kConcurrent && size >= kParallelThreshold;
+}
+
+/* The calling thread works alongside the others, so on a single core no
+ * threads are started at all.  If a thread can't be started, the ones that
+ * were pick up its share.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename Function>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::parallelFor(size_t count,
+                                                                        Function fn) {
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  auto work = [&] {
+    for (size_t i; (i = next.fetch_add(1)) < count; ) {
+      try {
+        fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) error = std::current_exception();
+      }
+    }
+  };
+
+  const size_t numThreads = std::min<size_t>(count, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  try {
+    for (size_t i = 1; i < numThreads; ++i)
+      threads.emplace_back(work);
+  } catch (...) {
+    /* Fall through with however many threads we have. */
+  }
+
+  work();
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  if (error) std::rethrow_exception(error);
+}
+
+/* A run continues for as long as the values' upper bits stay the same. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename Value>
+size_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::runEnd(const Value* values,
+                                                                      size_t start,
+                                                                      size_t stop,
+                                                                      size_t numBits) {
+  const Key index = upperBits(truncate(keyOf(values[start]), numBits), numBits);
+  size_t end = start + 1;
+  while (end < stop &&
+         upperBits(truncate(keyOf(values[end]), numBits), numBits) == index)
+    ++end;
+  return end;
+}
+
+/* Sorting a batch tags each key with its position, then sorts the entries
+ * stably by key, so that among equal keys the first appearance comes first.
+ * Keys outside the universe have to go first, since sortValues only looks
+ * at the bits inside it.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+std::vector<typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::BatchEntry>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::sortBatch(const Key* keys, size_t count,
+                                                                  bool distinct) {
+  std::vector<BatchEntry> entries;
+  entries.reserve(count);
+  bool sorted = true;
+  for (size_t i = 0; i < count; ++i) {
+    if (!inUniverse(keys[i])) continue;
+    if (!entries.empty() && keys[i] < entries.back().mKey) sorted = false;
+
+    BatchEntry entry;
+    entry.mKey = keys[i];
+    entry.mIndex = i;
+    entries.push_back(entry);
+  }
+  if (!sorted) sortValues(entries);
+
+  /* Drop repeated keys if asked to, keeping only the first of each. */
+  if (distinct) {
+    size_t size = 0;
+    for (size_t i = 0; i < entries.size(); ++i)
+      if (size == 0 || entries[i].mKey != entries[size - 1].mKey)
+        entries[size++] = entries[i];
+    entries.resize(size);
+  }
+  return entries;
+}
+
+/* Marking an entry sets the bit for its position in the batch. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::mark(uint64_t* marks,
+                                                                  const BatchEntry& entry) {
+  if (marks != NULL) VanEmdeBoasBits::set(marks, entry.mIndex);
+}
+
+/* Inserting a batch relies on the fact that the shape of a vEB-tree depends
+ * only on the values in it.  Once the batch is merged in, the node's min and
+ * max are the smallest and largest of its old ones and the new ones, and
+ * everything else, including any old min or max that got displaced, belongs
+ * in the clusters.  So we fix up the min and max first, push the displaced
+ * values down individually, and then hand each run of new values sharing
+ * the same upper bits to the cluster they belong in, all at once.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recInsertBatch(const BatchEntry* entries,
+                                                                            size_t count,
+                                                                            Pointer& root,
+                                                                            Storage& storage,
+                                                                            uint64_t* marks) {
+  /* Read the root once; it may be stored as an offset. */
+  void* tree = root;
+
+  /* Nothing to insert means nothing to do. */
+  if (count == 0) return;
+
+  /* If this tree is empty, every value is new, and we can build the tree
+   * straight from them.
+   */
+  if (tree == NULL) {
+    root = recBuildTree(entries, count, NumBits, storage);
+    for (size_t i = 0; i < count; ++i)
+      mark(marks, entries[i]);
+    return;
+  }
+
+  /* If we're dealing with a bitvector, just set each bit that isn't already
+   * set.
+   */
+  if (NumBits <= kBitvectorSize) {
+    uint64_t* bitvector = static_cast<uint64_t*>(tree);
+    for (size_t i = 0; i < count; ++i) {
+      const Key value = truncate(entries[i].mKey, NumBits);
+      if (!VanEmdeBoasBits::test(bitvector, value)) {
+        VanEmdeBoasBits::set(bitvector, value);
+        mark(marks, entries[i]);
+      }
+    }
+    return;
+  }
+
+  /* Otherwise, what we have here is a real node.  Work out its new min and
+   * max.  A value in the batch that becomes one of them is new, since it's
+   * beyond the old min or max.
+   */
+  Node* node = static_cast<Node*>(tree);
+  const Key oldMin = node->mMin, oldMax = node->mMax;
+  const Key first = truncate(entries[0].mKey, NumBits);
+  const Key last  = truncate(entries[count - 1].mKey, NumBits);
+
+  size_t lo = 0, hi = count;
+  if (first < oldMin) {
+    node->mMin = first;
+    mark(marks, entries[0]);
+    lo = 1;
+  } else if (first == oldMin) {
+    lo = 1;
+  }
+  if (last > oldMax) {
+    node->mMax = last;
+    mark(marks, entries[count - 1]);
+    hi = count - 1;
+  } else if (last == oldMax) {
+    hi = count - 1;
+  }
+
+  /* Push any old min or max that's no longer the min or max down into its
+   * cluster, adding the cluster to the summary if it was empty.
+   */
+  const Key displaced[] = { oldMin, oldMax };
+  for (size_t i = 0; i < (oldMin == oldMax? 1 : 2); ++i) {
+    const Key value = displaced[i];
+    if (value == node->mMin || value == node->mMax) continue;
+
+    const Key nextTree = upperBits(value, NumBits);
+    if (node->mChildren.get(nextTree) == NULL)
+      recInsertElement<Split<NumBits>::kHigh>(nextTree, node->mSummary,
+                                              storage);
+    recInsertElement<Split<NumBits>::kLow>(lowerBits(value, NumBits),
+                                           node->mChildren.slot(nextTree),
+                                           storage);
+    updateBounds<NumBits>(node, nextTree);
+    adjustCount(node, NumBits, nextTree, true);
+  }
+
+  /* Everything else in the batch lies strictly between the min and max, and
+   * goes into the clusters.  A value that matches a displaced min or max was
+   * already in the tree, and since those were just pushed down, the cluster
+   * will report that it's already there.  Clusters that were empty go into
+   * the summary afterwards, all together.
+   */
+  std::vector<BatchEntry> newClusters;
+  for (size_t start = lo, end; start < hi; start = end) {
+    end = runEnd(entries, start, hi, NumBits);
+
+    BatchEntry index;
+    index.mKey = upperBits(truncate(entries[start].mKey, NumBits), NumBits);
+    index.mIndex = 0;
+    if (node->mChildren.get(index.mKey) == NULL)
+      newClusters.push_back(index);
+
+    recInsertBatch<Split<NumBits>::kLow>(entries + start, end - start,
+                                         node->mChildren.slot(index.mKey),
+                                         storage, marks);
+    updateBounds<NumBits>(node, index.mKey);
+    updateCount<NumBits>(node, index.mKey);
+  }
+  recInsertBatch<Split<NumBits>::kHigh>(newClusters.data(), newClusters.size(),
+                                        node->mSummary, storage, NULL);
+}
+
+/* Erasing a batch works the other way around.  Values strictly between the
+ * min and max are erased from their clusters a run at a time, and any
+ * clusters that empty out are erased from the summary all together.  Only
+ * then do we erase the min and max, if they're in the batch, since that
+ * needs the clusters to be up to date to find their replacements.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recEraseBatch(const BatchEntry* entries,
+                                                                           size_t count,
+                                                                           Pointer& root,
+                                                                           Storage& storage,
+                                                                           uint64_t* marks) {
+  /* Read the root once; it may be stored as an offset. */
+  void* tree = root;
+
+  /* If there's nothing to erase or nothing to erase it from, we're done. */
+  if (count == 0 || tree == NULL) return;
+
+  /* If we're in bitvector mode, clear each bit that's set, then free the
+   * bitvector if that emptied it.
+   */
+  if (NumBits <= kBitvectorSize) {
+    uint64_t* bitvector = static_cast<uint64_t*>(tree);
+    for (size_t i = 0; i < count; ++i) {
+      const Key value = truncate(entries[i].mKey, NumBits);
+      if (VanEmdeBoasBits::test(bitvector, value)) {
+        VanEmdeBoasBits::clear(bitvector, value);
+        mark(marks, entries[i]);
+      }
+    }
+    if (VanEmdeBoasBits::none(bitvector, VanEmdeBoasBits::numWords(NumBits))) {
+      freeBitvector(bitvector, NumBits, storage);
+      root = NULL;
+    }
+    return;
+  }
+
+  /* Otherwise, this is a real node.  Skip past the values no greater than
+   * the min and no less than the max, noting whether we hit either.
+   */
+  Node* node = static_cast<Node*>(tree);
+  const Key min = node->mMin, max = node->mMax;
+
+  size_t lo = 0, hi = count;
+  const BatchEntry* minEntry = NULL;
+  const BatchEntry* maxEntry = NULL;
+  for (; lo < hi && truncate(entries[lo].mKey, NumBits) <= min; ++lo)
+    if (truncate(entries[lo].mKey, NumBits) == min) minEntry = &entries[lo];
+  for (; hi > lo && truncate(entries[hi - 1].mKey, NumBits) >= max; --hi)
+    if (truncate(entries[hi - 1].mKey, NumBits) == max) maxEntry = &entries[hi - 1];
+
+  /* Erase everything in between from the clusters. */
+  std::vector<BatchEntry> emptiedClusters;
+  for (size_t start = lo, end; start < hi; start = end) {
+    end = runEnd(entries, start, hi, NumBits);
+
+    BatchEntry index;
+    index.mKey = upperBits(truncate(entries[start].mKey, NumBits), NumBits);
+    index.mIndex = 0;
+    if (node->mChildren.get(index.mKey) == NULL) continue;
+
+    recEraseBatch<Split<NumBits>::kLow>(entries + start, end - start,
+                                        node->mChildren.slot(index.mKey),
+                                        storage, marks);
+    updateBounds<NumBits>(node, index.mKey);
+    updateCount<NumBits>(node, index.mKey);
+    if (node->mChildren.get(index.mKey) == NULL) {
+      node->mChildren.release(index.mKey);
+      emptiedClusters.push_back(index);
+    }
+  }
+  recEraseBatch<Split<NumBits>::kHigh>(emptiedClusters.data(),
+                                       emptiedClusters.size(), node->mSummary,
+                                       storage, NULL);
+
+  /* Finally, erase the min and max.  If they were the same value, erasing
+   * the one erases the other.
+   */
+  if (minEntry != NULL) {
+    recEraseElement<NumBits>(min, root, storage);
+    mark(marks, *minEntry);
+  }
+  if (maxEntry != NULL && max != min) {
+    recEraseElement<NumBits>(max, root, storage);
+    mark(marks, *maxEntry);
+  }
+}
+
+/* Looking up a batch checks each value against the min and max and hands the
+ * rest to their clusters a run at a time.  Unlike the others, the batch may
+ * contain repeated values here; each copy just gets looked up.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recContainsBatch(const BatchEntry* entries,
+                                                                              size_t count,
+                                                                              void* root,
+                                                                              uint64_t* marks) {
+  /* An empty tree contains nothing. */
+  if (root == NULL) return;
+
+  /* A bitvector just needs each bit tested. */
+  if (NumBits <= kBitvectorSize) {
+    const uint64_t* bitvector = static_cast<uint64_t*>(root);
+    for (size_t i = 0; i < count; ++i)
+      if (VanEmdeBoasBits::test(bitvector, truncate(entries[i].mKey, NumBits)))
+        mark(marks, entries[i]);
+    return;
+  }
+
+  /* Otherwise, this is a real node.  Values matching the min or max are
+   * here, values outside of them aren't, and the rest get looked up in
+   * their clusters.
+   */
+  Node* node = static_cast<Node*>(root);
+  size_t lo = 0, hi = count;
+  for (; lo < hi && truncate(entries[lo].mKey, NumBits) <= node->mMin; ++lo)
+    if (truncate(entries[lo].mKey, NumBits) == node->mMin) mark(marks, entries[lo]);
+  for (; hi > lo && truncate(entries[hi - 1].mKey, NumBits) >= node->mMax; --hi)
+    if (truncate(entries[hi - 1].mKey, NumBits) == node->mMax) mark(marks, entries[hi - 1]);
+
+  for (size_t start = lo, end; start < hi; start = end) {
+    end = runEnd(entries, start, hi, NumBits);
+    const Key index = upperBits(truncate(entries[start].mKey, NumBits),
+                                NumBits);
+    recContainsBatch<Split<NumBits>::kLow>(entries + start, end - start,
+                                           node->mChildren.get(index), marks);
+  }
+}
+
+/* Recursively destroying a tree involves scanning over that tree's pointers
+ * and freeing them.  In parallel, the subtrees are gathered into a list
+ * first, so that the threads never look at the table.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recDeleteTree(void* root,
+                                                                           size_t numBits,
+                                                                           Storage& storage,
+                                                                           bool parallel) {
+  /* Empty trees have nothing to free. */
+  if (root == NULL) return;
+
+  /* If the number of bits is below the cutoff, deallocate the bitvector that
+   * we allocated.
+   */
+  if (numBits <= kBitvectorSize) {
+    freeBitvector(static_cast<uint64_t*>(root), numBits, storage);
+    return;
+  }
+
+  /* Otherwise, this is a node and we need to free its fields. */
+  Node* node = static_cast<Node*>(root);
+
+  /* Deallocate the summary structure.  If there isn't one, every cluster
+   * is empty, and there's no need to scan the table for subtrees.
+   */
+  void* summary = node->mSummary;
+  recDeleteTree(summary, highHalf(numBits), storage);
+
+  /* Wipe out the subtrees, then the table that held them. */
+  if (summary != NULL && parallel) {
+    std::vector<void*> clusters;
+    node->mChildren.forEach(highHalf(numBits), [&](size_t, void* child) {
+      clusters.push_back(child);
+    });
+    parallelFor(clusters.size(), [&](size_t i) {
+      recDeleteTree(clusters[i], lowHalf(numBits), storage);
+    });
+  } else if (summary != NULL) {
+    node->mChildren.forEach(highHalf(numBits), [&](size_t, void* child) {
+      recDeleteTree(child, lowHalf(numBits), storage);
+    });
+  }
+  node->mChildren.destroy(highHalf(numBits));
+
+  /* Finally, free the node itself. */
+  freeNode(node, numBits, storage);
+}
+
+/* Recursively scanning for an element involves descending into the proper
+ * tree looking for the value in question.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recFindElement(Key value, void* root) {
+  /* If this tree is empty, the element can't be here. */
+  if (root == NULL) return false;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  /* If the number of bits is low enough that we're looking at a bitvector,
+   * just test whether the appropriate bit is set.
+   */
+  if (NumBits <= kBitvectorSize)
+    return VanEmdeBoasBits::test(static_cast<uint64_t*>(root), value);
+
+  /* Otherwise, this is a real node. */
+  Node* node = static_cast<Node*>(root);
+
+  /* Check if this value is the min or max. */
+  if (value == node->mMin || value == node->mMax) return true;
+
+  /* If it's neither of these, descend into the proper subtree looking for the
+   * lower half of the bits.
+   */
+  return recFindElement<Split<NumBits>::kLow>(lowerBits(value, NumBits),
+                                              node->mChildren.get(upperBits(value, NumBits)));
+}
+
+/* Inserting an element walks down the tree, putting the proper value in the
+ * proper place and updating the summary structure.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recInsertElement(Key value,
+                                                                              Pointer& root,
+                                                                              Storage& storage) {
+  /* Read the root once; it may be stored as an offset. */
+  void* tree = root;
+
+  /* If this tree is empty, then we insert the value by creating a tree that
+   * holds it as the only value.
+   */
+  if (tree == NULL) {
+    root = createTree(value, NumBits, storage);
+
+    /* We added something, since nothing was initially here. */
+    return true;
+  }
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  /* Next, if we're dealing with a bitvector implementation, just set the
+   * appropriate bit.
+   */
+  if (NumBits <= kBitvectorSize) {
+    /* Get a handle to the words of the bitvector. */
+    uint64_t* bitvector = static_cast<uint64_t*>(tree);
+
+    /* If the bit at the proper position is already set, return false to
+     * signal that we didn't insert anything.
+     */
+    if (VanEmdeBoasBits::test(bitvector, value)) return false;
+
+    /* Set the bit at position value. */
+    VanEmdeBoasBits::set(bitvector, value);
+    return true;
+  }
+
+  /* Otherwise, what we have here is a real node. */
+  Node* node = static_cast<Node*>(tree);
+
+  /* If the value matches either the min or the max, we're done. */
+  if (value == node->mMin || value == node->mMax)
+    return false;
+
+  /* Otherwise, if both the min and max are the same value, then the node has
+   * only one value and the new one will become either the min or the max.
+   */
+  if (node->mMin == node->mMax) {
+    const Key min = std::min(node->mMin, value);
+    const Key max = std::max(node->mMax, value);
+    node->mMin = min;
+    node->mMax = max;
+    return true;
+  }
+
+  /* Otherwise, we are dealing with a node that already has a min and max set,
+   * where neither of those values matches the value we're inserting.  In this
+   * case, we will do one of three things:
+   *
+   * 1. Fall in the range (min, max), and be inserted into some subtree.
+   * 2. Be less than the min, displacing the min and inserting it into some
+   *    subtree.
+   * 3. Be greater than the max, displacing the max and inserting it into some
+   *    subtree.
+   *
+   * To unify the cases, we'll update the min and max appropriately before
+   * recursively inserting the value further down into the tree.
+   */
+  if (value < node->mMin)
+    std::swap(value, node->mMin);
+  if (value > node->mMax)
+    std::swap(value, node->mMax);
+
+  /* This next step is tricky.  When inserting this next value recursively, we
+   * will descend into one of the subtrees.  If it's empty, then we will add
+   * the upper bits to the summary tree to indicate that the tree is no longer
+   * empty.  If not, then it's already in the summary.  The reason for doing
+   * this somewhat tricky check is to get the runtime working better.  Since
+   * inserting into an empty tree is fast (it just allocates a singleton tree
+   * and returns), of the two necessary recursive calls (one for the upper
+   * and one for the lower), one call runs in O(1).  The other call runs
+   * normally, and so the recurrence relation for the runtime only requires
+   * one recursive call.
+   */
+  Key nextTree = upperBits(value, NumBits);
+  if (node->mChildren.get(nextTree) == NULL) {
+    VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+    recInsertElement<Split<NumBits>::kHigh>(nextTree, node->mSummary, storage);
+  }
+
+  /* In either case, recursively insert the value into the proper subtree.
+   * This might immediately return, but it's still necessary.
+   */
+  const bool result =
+    recInsertElement<Split<NumBits>::kLow>(lowerBits(value, NumBits),
+                                           node->mChildren.slot(nextTree),
+                                           storage);
+  updateBounds<NumBits>(node, nextTree);
+  if (result) adjustCount(node, NumBits, nextTree, true);
+  return result;
+}
+
+/* Inserting while finding the neighbors works out at each node whichever
+ * neighbors it can from the node's min and max, and leaves the insertion
+ * itself to recInsertElement, which does the same checks again before
+ * recursing.  A value strictly between the min and max goes into a cluster.
+ * If the cluster is empty, the insertion into the summary, which has to
+ * happen anyway, finds the nonempty clusters on either side, whose max and
+ * min are the neighbors.  Otherwise the neighbors are found in the cluster
+ * as the value goes into it, and if there's nothing on one side of the
+ * value there, the summary is asked for the next cluster over.  That only
+ * happens when the value is beyond the min or max of the cluster, which is
+ * answered without recursing any further, so the whole thing still takes
+ * O(lg lg U).
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recInsertNeighbors(Key value,
+                                                                                Pointer& root,
+                                                                                Storage& storage,
+                                                                                Neighbors& neighbors) {
+  neighbors.mHasPredecessor = neighbors.mHasSuccessor = false;
+
+  /* Read the root once; it may be stored as an offset.  An empty tree has
+   * no neighbors to find.
+   */
+  void* tree = root;
+  if (tree == NULL) return recInsertElement<NumBits>(value, root, storage);
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  /* In a bitvector, the neighbors are the nearest set bits on either side. */
+  if (NumBits <= kBitvectorSize) {
+    uint64_t* bitvector = static_cast<uint64_t*>(tree);
+    size_t index;
+    if (value != 0 &&
+        VanEmdeBoasBits::findLast(bitvector, size_t(value) - 1, index)) {
+      neighbors.mHasPredecessor = true;
+      neighbors.mPredecessor = static_cast<Key>(index);
+    }
+    if (VanEmdeBoasBits::findFirst(bitvector, VanEmdeBoasBits::numWords(NumBits),
+                                   size_t(value) + 1, index)) {
+      neighbors.mHasSuccessor = true;
+      neighbors.mSuccessor = static_cast<Key>(index);
+    }
+    return recInsertElement<NumBits>(value, root, storage);
+  }
+
+  /* Otherwise, this is a real node.  If the value is already here as its
+   * min or max, nothing changes and its neighbors are found the usual way.
+   */
+  Node* node = static_cast<Node*>(tree);
+  if (value == node->mMin || value == node->mMax) {
+    neighbors.mHasPredecessor =
+      recPredecessor<NumBits>(value, tree, neighbors.mPredecessor);
+    neighbors.mHasSuccessor =
+      recSuccessor<NumBits>(value, tree, neighbors.mSuccessor);
+    return false;
+  }
+
+  /* A value beyond the min or max has it as its only neighbor, and goes on
+   * to replace it.
+   */
+  if (value < node->mMin) {
+    neighbors.mHasSuccessor = true;
+    neighbors.mSuccessor = node->mMin;
+    return recInsertElement<NumBits>(value, root, storage);
+  }
+  if (value > node->mMax) {
+    neighbors.mHasPredecessor = true;
+    neighbors.mPredecessor = node->mMax;
+    return recInsertElement<NumBits>(value, root, storage);
+  }
+
+  /* Otherwise the value falls strictly between the min and max, and so
+   * goes into a cluster, with neighbors on both sides.
+   */
+  const Key index = upperBits(value, NumBits);
+  const Key lower = lowerBits(value, NumBits);
+  neighbors.mHasPredecessor = neighbors.mHasSuccessor = true;
+
+  /* If the cluster is empty, its neighbors in the summary lead to the
+   * value's, and the value then starts off a cluster of its own.
+   */
+  if (node->mChildren.get(index) == NULL) {
+    Neighbors clusters;
+    VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+    recInsertNeighbors<Split<NumBits>::kHigh>(index, node->mSummary, storage,
+                                              clusters);
+    neighbors.mPredecessor = clusters.mHasPredecessor?
+      clusterMax<NumBits>(node, clusters.mPredecessor) : node->mMin;
+    neighbors.mSuccessor = clusters.mHasSuccessor?
+      clusterMin<NumBits>(node, clusters.mSuccessor) : node->mMax;
+
+    recInsertElement<Split<NumBits>::kLow>(lower, node->mChildren.slot(index),
+                                           storage);
+    updateBounds<NumBits>(node, index);
+    adjustCount(node, NumBits, index, true);
+    return true;
+  }
+
+  /* Otherwise look for the neighbors in the cluster as the value goes in,
+   * and past the ends of the cluster for any that aren't there.
+   */
+  Neighbors inCluster;
+  const bool result =
+    recInsertNeighbors<Split<NumBits>::kLow>(lower, node->mChildren.slot(index),
+                                             storage, inCluster);
+  updateBounds<NumBits>(node, index);
+  if (result) adjustCount(node, NumBits, index, true);
+
+  neighbors.mPredecessor = inCluster.mHasPredecessor?
+    compose(index, inCluster.mPredecessor, NumBits) :
+    previousInNode<NumBits>(node, index);
+  neighbors.mSuccessor = inCluster.mHasSuccessor?
+    compose(index, inCluster.mSuccessor, NumBits) :
+    nextInNode<NumBits>(node, index);
+  return result;
+}
+
+/* The neighbors of a cluster come from the summary, and then it's the max
+ * or min of the cluster found that's wanted.  Neither cluster needs to be
+ * the one being looked past, so these can be used in the middle of a
+ * change to it.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::previousInNode(Node* node,
+                                                                           Key index) {
+  Key previous;
+  if (!recPredecessor<Split<NumBits>::kHigh>(index, node->mSummary, previous))
+    return node->mMin;
+  return clusterMax<NumBits>(node, previous);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::nextInNode(Node* node,
+                                                                       Key index) {
+  Key next;
+  if (!recSuccessor<Split<NumBits>::kHigh>(index, node->mSummary, next))
+    return node->mMax;
+  return clusterMin<NumBits>(node, next);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::clusterMin(Node* node,
+                                                                       Key index) {
+  Key result = 0;
+  treeMin<Split<NumBits>::kLow>(node->mChildren.get(index), result);
+  return compose(index, result, NumBits);
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+Key VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::clusterMax(Node* node,
+                                                                       Key index) {
+  Key result = 0;
+  treeMax<Split<NumBits>::kLow>(node->mChildren.get(index), result);
+  return compose(index, result, NumBits);
+}
+
+/* Obtaining the maximum or minimum value from a tree depends on whether the
+ * tree is a bitvector or not.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::treeMax(void* root,
+                                                                     Key& result) {
+  /* An empty tree has no maximum value. */
+  if (root == NULL) return false;
+
+  /* If the tree is a bitvector, scan backwards from the largest bit index,
+   * 2^NumBits - 1, for the highest set bit.
+   */
+  if (NumBits <= kBitvectorSize) {
+    size_t index;
+    if (!VanEmdeBoasBits::findLast(static_cast<uint64_t*>(root),
+                                   (size_t(1) << NumBits) - 1, index))
+      return false;
+
+    result = static_cast<Key>(index);
+    return true;
+  }
+
+  /* Otherwise what we're looking at is a real node, and its maximum is the
+   * node's stated maximum.
+   */
+  result = static_cast<Node*>(root)->mMax;
+  return true;
+}
+
+/* The case for the minimum is symmetric. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::treeMin(void* root,
+                                                                     Key& result) {
+  /* An empty tree has no minimum value. */
+  if (root == NULL) return false;
+
+  /* If the tree is a bitvector, scan forwards from zero for the lowest set
+   * bit.
+   */
+  if (NumBits <= kBitvectorSize) {
+    size_t index;
+    if (!VanEmdeBoasBits::findFirst(static_cast<uint64_t*>(root),
+                                    VanEmdeBoasBits::numWords(NumBits), 0,
+                                    index))
+      return false;
+
+    result = static_cast<Key>(index);
+    return true;
+  }
+
+  /* Otherwise what we're looking at is a real node, and its minimum is the
+   * node's stated minimum.
+   */
+  result = static_cast<Node*>(root)->mMin;
+  return true;
+}
+
+/* Deleting an element is tricky and depends on what type of object we're
+ * deleting from.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recEraseElement(Key value,
+                                                                             Pointer& root,
+                                                                             Storage& storage) {
+  /* Read the root once; it may be stored as an offset. */
+  void* tree = root;
+
+  /* If this tree has nothing in it, then we've failed to remove anything. */
+  if (tree == NULL) return false;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  /* If we're in bitvector mode, just clear the appropriate bit. */
+  if (NumBits <= kBitvectorSize) {
+    /* Get a handle on the bitvector itself. */
+    uint64_t* bitvector = static_cast<uint64_t*>(tree);
+
+    /* If the bit is not yet set, report that we didn't remove anything. */
+    if (!VanEmdeBoasBits::test(bitvector, value))
+      return false;
+
+    /* Otherwise, clear the bit.  If that was the last bit, the bitvector is
+     * no longer needed.
+     */
+    VanEmdeBoasBits::clear(bitvector, value);
+    if (VanEmdeBoasBits::none(bitvector, VanEmdeBoasBits::numWords(NumBits))) {
+      freeBitvector(bitvector, NumBits, storage);
+      root = NULL;
+    }
+    return true;
+  }
+
+  /* Otherwise, this is a real node. */
+  Node* node = static_cast<Node*>(tree);
+
+  /* If its min equals its max, then there's only one element left. */
+  if (node->mMin == node->mMax) {
+    /* If this doesn't match our element, we failed to remove it. */
+    if (node->mMin != value) return false;
+
+    /* Otherwise we just removed the only element from this node, so it can
+     * be freed.  It has no children or summary, since those only exist when
+     * the node holds at least three values.
+     */
+    node->mChildren.destroy(highHalf(NumBits));
+    freeNode(node, NumBits, storage);
+    root = NULL;
+    return true;
+  }
+
+  /* If the value we're trying to erase is the min or max value, things get
+   * tricky.  We need to replace the min or max with the min or max value of
+   * the remaining elements.  These two cases are symmetric.
+   */
+  if (value == node->mMin) {
+    /* The new min is the smallest value in the clusters, which has to come
+     * out of them.  If all the clusters are empty, then we just copy over
+     * the maximum value and are done.
+     */
+    Key min = Key();
+    node->mMin = popClusterMin<NumBits>(node, storage, min)? min : node->mMax;
+    return true;
+  }
+
+  /* Similar logic for deleting the max. */
+  if (value == node->mMax) {
+    Key max = Key();
+    node->mMax = popClusterMax<NumBits>(node, storage, max)? max : node->mMin;
+    return true;
+  }
+
+  /* Otherwise, the value isn't the max or min, so we just continue deleting
+   * the value from the proper subtree.  If that subtree is empty, the value
+   * can't be there.
+   */
+  const Key treeOffset = upperBits(value, NumBits);
+  if (node->mChildren.get(treeOffset) == NULL) return false;
+
+  bool result = recEraseElement<Split<NumBits>::kLow>(lowerBits(value, NumBits),
+                                                      node->mChildren.slot(treeOffset),
+                                                      storage);
+  updateBounds<NumBits>(node, treeOffset);
+  if (result) adjustCount(node, NumBits, treeOffset, false);
+
+  /* Check whether this emptied the tree.  If so, remove that tree from the
+   * summary.
+   */
+  if (node->mChildren.get(treeOffset) == NULL) {
+    node->mChildren.release(treeOffset);
+    VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+    recEraseElement<Split<NumBits>::kHigh>(treeOffset, node->mSummary,
+                                           storage);
+  }
+
+  return result;
+}
+
+/* Erasing while finding the successor works the same way as inserting while
+ * finding the neighbors.  Erasing a value doesn't change which elements are
+ * above it, so the successor can be found before or after the erasure,
+ * whichever is convenient.  It's the new min of a node whose min was
+ * erased, or else it's in the value's cluster or the next one over.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recEraseSuccessor(Key value,
+                                                                               Pointer& root,
+                                                                               Storage& storage,
+                                                                               Key& successor,
+                                                                               bool& hasSuccessor) {
+  hasSuccessor = false;
+
+  /* Read the root once; it may be stored as an offset. */
+  void* tree = root;
+  if (tree == NULL) return false;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  /* In a bitvector, the successor is the next set bit, which has to be
+   * found before the bitvector can be freed.
+   */
+  if (NumBits <= kBitvectorSize) {
+    size_t index;
+    hasSuccessor = VanEmdeBoasBits::findFirst(static_cast<uint64_t*>(tree),
+                                              VanEmdeBoasBits::numWords(NumBits),
+                                              size_t(value) + 1, index);
+    if (hasSuccessor) successor = static_cast<Key>(index);
+    return recEraseElement<NumBits>(value, root, storage);
+  }
+
+  /* Otherwise, this is a real node.  Nothing below its min is in it, and
+   * nothing is above its max.
+   */
+  Node* node = static_cast<Node*>(tree);
+  if (value < node->mMin) {
+    hasSuccessor = true;
+    successor = node->mMin;
+    return false;
+  }
+  if (value >= node->mMax)
+    return recEraseElement<NumBits>(value, root, storage);
+
+  /* Erasing the min promotes the next element to be the new min, which is
+   * then the successor.  The node still holds its max, so it isn't freed.
+   */
+  hasSuccessor = true;
+  if (value == node->mMin) {
+    recEraseElement<NumBits>(value, root, storage);
+    successor = node->mMin;
+    return true;
+  }
+
+  /* Otherwise the value, if it's here at all, is in a cluster.  If that
+   * cluster is empty, the successor is in the next one over.
+   */
+  const Key index = upperBits(value, NumBits);
+  if (node->mChildren.get(index) == NULL) {
+    successor = nextInNode<NumBits>(node, index);
+    return false;
+  }
+
+  /* Otherwise erase the value from the cluster, finding its successor there
+   * if there is one, just as recEraseElement does.  The next cluster over
+   * is still there to look in if there isn't.
+   */
+  Key next = 0;
+  bool hasNext;
+  const bool result =
+    recEraseSuccessor<Split<NumBits>::kLow>(lowerBits(value, NumBits),
+                                            node->mChildren.slot(index),
+                                            storage, next, hasNext);
+  updateBounds<NumBits>(node, index);
+  if (result) adjustCount(node, NumBits, index, false);
+
+  if (node->mChildren.get(index) == NULL) {
+    node->mChildren.release(index);
+    VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+    recEraseElement<Split<NumBits>::kHigh>(index, node->mSummary, storage);
+  }
+
+  successor = hasNext? compose(index, next, NumBits) :
+                       nextInNode<NumBits>(node, index);
+  return result;
+}
+
+/* Querying for a successor just tries to bound what tree to search in. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recSuccessor(Key value, void* root,
+                                                                          Key& result) {
+  /* If this tree is empty, the value has no successor. */
+  if (root == NULL)
+    return false;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  /* If the tree is a bitvector, our search for a successor just involves
+   * scanning the bits.
+   */
+  if (NumBits <= kBitvectorSize) {
+    /* Starting right after the bit for this value, scan forward through the
+     * bitvector for the first nonzero bit.
+     */
+    size_t index;
+    if (!VanEmdeBoasBits::findFirst(static_cast<uint64_t*>(root),
+                                    VanEmdeBoasBits::numWords(NumBits),
+                                    size_t(value) + 1, index))
+      return false;
+
+    result = static_cast<Key>(index);
+    return true;
+  }
+
+  /* Otherwise, this must be a real node. */
+  Node* node = static_cast<Node*>(root);
+
+  /* If the value is less than the min, its successor is the min. */
+  if (value < node->mMin) {
+    result = node->mMin;
+    return true;
+  }
+
+  /* If the value is at least as large as the max, it has no successor. */
+  if (value >= node->mMax)
+    return false;
+
+  /* If neither of these cases hold, then the value is contained somewhere in
+   * a subtree, and the successor is either in that subtree or in some later
+   * one.
+   */
+  const Key subtree = upperBits(value, NumBits);
+
+  /* If the bounds of the clusters are stored here, we can tell which
+   * cluster holds the successor, and usually what it is, without looking
+   * at any cluster.
+   */
+  if (Clusters::kStoresBounds) {
+    const uint64_t* nonempty = nonemptyClusters(node, NumBits);
+    const Bounds* bounds = clusterBounds(node, NumBits);
+    const Key lowerValue = lowerBits(value, NumBits);
+
+    /* If this value's subtree has anything larger than it, the successor is
+     * in there.  It's the subtree's min if the value is below that, and
+     * otherwise we have to go looking.
+     */
+    if (VanEmdeBoasBits::test(nonempty, subtree) &&
+        lowerValue < bounds[subtree].mMax) {
+      Key lower = bounds[subtree].mMin;
+      if (lowerValue >= lower)
+        recSuccessor<Split<NumBits>::kLow>(lowerValue,
+                                           node->mChildren.get(subtree), lower);
+      result = compose(subtree, lower, NumBits);
+      return true;
+    }
+
+    /* Otherwise, it's the min of the next nonempty subtree.  Look for that
+     * subtree among the ones sharing a word of the bitmap with this one
+     * first, and only ask the summary if none of them are nonempty.  If
+     * there is no next subtree, the successor is the max.
+     */
+    const size_t from = size_t(subtree) + 1;
+    size_t next;
+    const bool nearby =
+      from % VanEmdeBoasBits::kWordBits != 0 &&
+      VanEmdeBoasBits::findFirst(nonempty, from / VanEmdeBoasBits::kWordBits + 1,
+                                 from, next);
+    if (!nearby) {
+      Key nextTree;
+      VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+      if (!recSuccessor<Split<NumBits>::kHigh>(subtree, node->mSummary,
+                                               nextTree)) {
+        result = node->mMax;
+        return true;
+      }
+      next = nextTree;
+    }
+    result = compose(Key(next), bounds[next].mMin, NumBits);
+    return true;
+  }
+
+  void* child = node->mChildren.get(subtree);
+  Key lower;
+
+  /* If the subtree is a bitvector, a single masked scan over it either finds
+   * the successor or shows that it isn't there, so we just try it.
+   */
+  if (lowHalf(NumBits) <= kBitvectorSize) {
+    if (recSuccessor<Split<NumBits>::kLow>(lowerBits(value, NumBits), child,
+                                           lower)) {
+      result = compose(subtree, lower, NumBits);
+      return true;
+    }
+  }
+  /* Otherwise, see what the largest value of that subtree is.  If our value
+   * is smaller, the subtree containing the value is correct, and so we can
+   * descend into it to get the result.
+   */
+  else {
+    Key subtreeMax;
+    if (treeMax<Split<NumBits>::kLow>(child, subtreeMax) &&
+        lowerBits(value, NumBits) < subtreeMax) {
+      recSuccessor<Split<NumBits>::kLow>(lowerBits(value, NumBits), child,
+                                         lower);
+      result = compose(subtree, lower, NumBits);
+      return true;
+    }
+  }
+
+  /* If we got here, that tree is empty or holds nothing larger than our
+   * value, and so the successor is given by the smallest value of the next
+   * available tree.  Ask the summary tree for the smallest tree beyond this
+   * value's subtree that is nonempty.  If there is no next tree, then the
+   * successor must be the tree's maximum value.
+   */
+  Key nextTree;
+  VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+  if (!recSuccessor<Split<NumBits>::kHigh>(subtree, node->mSummary,
+                                           nextTree)) {
+    result = node->mMax;
+    return true;
+  }
+
+  /* Otherwise, it's the smallest value of that subtree.  Of course, we need
+   * to take care to reconstitute the value we're returning.  (The summary
+   * guarantees the subtree is nonempty; min is initialized only because the
+   * optimizer can't see that.)
+   */
+  Key min = Key();
+  treeMin<Split<NumBits>::kLow>(node->mChildren.get(nextTree), min);
+  result = compose(nextTree, min, NumBits);
+  return true;
+}
+
+/* Predecessor search is symmetric. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recPredecessor(Key value, void* root,
+                                                                            Key& result) {
+  /* If this tree is empty, the value has no predecessor. */
+  if (root == NULL)
+    return false;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  /* If the tree is a bitvector, our search for a predecessor just involves
+   * scanning the bits.
+   */
+  if (NumBits <= kBitvectorSize) {
+    /* Starting right before the bit for this value, scan backward through
+     * the bitvector for the first nonzero bit.
+     */
+    size_t index;
+    if (value == 0 ||
+        !VanEmdeBoasBits::findLast(static_cast<uint64_t*>(root),
+                                   size_t(value) - 1, index))
+      return false;
+
+    result = static_cast<Key>(index);
+    return true;
+  }
+
+  /* Otherwise, this must be a real node. */
+  Node* node = static_cast<Node*>(root);
+
+  /* If the value is above the max, its predecessor is the max. */
+  if (value > node->mMax) {
+    result = node->mMax;
+    return true;
+  }
+
+  /* If the value is no greater than the min, it has no predecessor. */
+  if (value <= node->mMin)
+    return false;
+
+  /* If neither of these cases hold, then the value is contained somewhere in
+   * a subtree, and the predecessor is either in that subtree or in some
+   * earlier one.
+   */
+  const Key subtree = upperBits(value, NumBits);
+
+  /* As with recSuccessor, if the bounds of the clusters are stored here, we
+   * can usually find the predecessor without looking at any cluster.
+   */
+  if (Clusters::kStoresBounds) {
+    const uint64_t* nonempty = nonemptyClusters(node, NumBits);
+    const Bounds* bounds = clusterBounds(node, NumBits);
+    const Key lowerValue = lowerBits(value, NumBits);
+
+    /* If this value's subtree has anything smaller than it, the predecessor
+     * is in there.
+     */
+    if (VanEmdeBoasBits::test(nonempty, subtree) &&
+        lowerValue > bounds[subtree].mMin) {
+      Key lower = bounds[subtree].mMax;
+      if (lowerValue <= lower)
+        recPredecessor<Split<NumBits>::kLow>(lowerValue,
+                                             node->mChildren.get(subtree),
+                                             lower);
+      result = compose(subtree, lower, NumBits);
+      return true;
+    }
+
+    /* Otherwise, it's the max of the previous nonempty subtree, which we
+     * look for in this word of the bitmap before asking the summary.  If
+     * there is no previous subtree, the predecessor is the min.
+     */
+    const size_t word = subtree / VanEmdeBoasBits::kWordBits;
+    size_t prev;
+    const bool nearby =
+      subtree % VanEmdeBoasBits::kWordBits != 0 &&
+      VanEmdeBoasBits::findLast(nonempty + word,
+                                subtree % VanEmdeBoasBits::kWordBits - 1, prev);
+    if (nearby) {
+      prev += word * VanEmdeBoasBits::kWordBits;
+    } else {
+      Key prevTree;
+      VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+      if (!recPredecessor<Split<NumBits>::kHigh>(subtree, node->mSummary,
+                                                 prevTree)) {
+        result = node->mMin;
+        return true;
+      }
+      prev = prevTree;
+    }
+    result = compose(Key(prev), bounds[prev].mMax, NumBits);
+    return true;
+  }
+
+  void* child = node->mChildren.get(subtree);
+  Key lower;
+
+  /* If the subtree is a bitvector, a single masked scan over it either finds
+   * the predecessor or shows that it isn't there, so we just try it.
+   */
+  if (lowHalf(NumBits) <= kBitvectorSize) {
+    if (recPredecessor<Split<NumBits>::kLow>(lowerBits(value, NumBits), child,
+                                             lower)) {
+      result = compose(subtree, lower, NumBits);
+      return true;
+    }
+  }
+  /* Otherwise, see what the smallest value of that subtree is.  If our value
+   * is larger, the subtree containing the value is correct, and so we can
+   * descend into it to get the result.
+   */
+  else {
+    Key subtreeMin;
+    if (treeMin<Split<NumBits>::kLow>(child, subtreeMin) &&
+        lowerBits(value, NumBits) > subtreeMin) {
+      recPredecessor<Split<NumBits>::kLow>(lowerBits(value, NumBits), child,
+                                           lower);
+      result = compose(subtree, lower, NumBits);
+      return true;
+    }
+  }
+
+  /* If we got here, that tree is empty or holds nothing smaller than our
+   * value, and so the predecessor is given by the largest value of the
+   * largest nonempty tree before it.  Ask the summary tree for the largest
+   * tree before this value's subtree that is nonempty.  If there is no such
+   * tree, then the predecessor must be the tree's minimum value.
+   */
+  Key prevTree;
+  VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+  if (!recPredecessor<Split<NumBits>::kHigh>(subtree, node->mSummary,
+                                             prevTree)) {
+    result = node->mMin;
+    return true;
+  }
+
+  /* Otherwise, it's the maximum value of that subtree.  Of course, we need
+   * to take care to reconstitute the value we're returning.  (The summary
+   * guarantees the subtree is nonempty; max is initialized only because the
+   * optimizer can't see that.)
+   */
+  Key max = Key();
+  treeMax<Split<NumBits>::kLow>(node->mChildren.get(prevTree), max);
+  result = compose(prevTree, max, NumBits);
+  return true;
+}
+
+/* Visiting a range of a tree does nothing if the tree is empty, and hands
+ * off to whichever of the two visitRanges below fits the tree otherwise.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits, typename Visitor>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recVisitRange(void* root,
+                                                                           Key lo, Key hi,
+                                                                           Key base,
+                                                                           Visitor& visitor) {
+  /* An empty tree has nothing to visit. */
+  if (root == NULL) return;
+
+  visitRange<NumBits>(root, lo, hi, base, visitor,
+                      std::integral_constant<bool, (NumBits <= LeafBits)>());
+}
+
+/* Visiting a range of a bitvector just scans its words. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits, typename Visitor>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::visitRange(void* root,
+                                                                        Key lo, Key hi,
+                                                                        Key base,
+                                                                        Visitor& visitor,
+                                                                        std::true_type) {
+  VanEmdeBoasBits::forEachWord(static_cast<uint64_t*>(root), lo, hi,
+                               [&](size_t first, uint64_t bits) {
+    visitor(static_cast<Key>(base + first), bits);
+  });
+}
+
+/* Visiting a range of a node visits its min, the clusters the range
+ * overlaps, and its max, in that order.  The nonempty clusters in the range
+ * are found either from the bitmap, if there is one, or by visiting the same
+ * range of the summary.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits, typename Visitor>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::visitRange(void* root,
+                                                                        Key lo, Key hi,
+                                                                        Key base,
+                                                                        Visitor& visitor,
+                                                                        std::false_type) {
+  /* If the range misses the node's values entirely, there's nothing to do. */
+  Node* node = static_cast<Node*>(root);
+  if (hi < node->mMin || lo > node->mMax) return;
+
+  if (lo <= node->mMin)
+    visitor(static_cast<Key>(base + node->mMin), uint64_t(1));
+  if (node->mMin == node->mMax) return;
+
+  /* Each cluster the range overlaps gets visited over the part of its range
+   * that's in bounds.  Only the first and last of them can be cut short.
+   */
+  const Key loTree = upperBits(lo, NumBits), hiTree = upperBits(hi, NumBits);
+  const Key lowMax = static_cast<Key>((Key(1) << lowHalf(NumBits)) - 1);
+  auto visitTree = [&](Key index) {
+    recVisitRange<Split<NumBits>::kLow>(node->mChildren.get(index),
+                                        index == loTree? lowerBits(lo, NumBits) : Key(0),
+                                        index == hiTree? lowerBits(hi, NumBits) : lowMax,
+                                        static_cast<Key>(base + compose(index, 0, NumBits)),
+                                        visitor);
+  };
+  auto visitTrees = [&](Key first, uint64_t bits) {
+    for (; bits != 0; bits &= bits - 1)
+      visitTree(static_cast<Key>(first + VanEmdeBoasBits::lowestSetBit(bits)));
+  };
+
+  /* If the range lies within one cluster, there's no need to ask which
+   * clusters are nonempty.
+   */
+  if (loTree == hiTree)
+    visitTree(loTree);
+  else if (Clusters::kStoresBounds)
+    VanEmdeBoasBits::forEachWord(nonemptyClusters(node, NumBits), loTree, hiTree,
+                                 [&](size_t first, uint64_t bits) {
+      visitTrees(static_cast<Key>(first), bits);
+    });
+  else
+    recVisitRange<Split<NumBits>::kHigh>(node->mSummary, loTree, hiTree, Key(0),
+                                         visitTrees);
+
+  if (hi >= node->mMax)
+    visitor(static_cast<Key>(base + node->mMax), uint64_t(1));
+}
+
+/* Seeking works much like finding a successor, except that it's looking for
+ * a value no smaller than the given one, and it notes down each tree it
+ * descends into along the way.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recSeek(Key value, void* root,
+                                                                     void** path,
+                                                                     Key& result) {
+  /* An empty tree has nothing to find. */
+  if (root == NULL) return false;
+  path[0] = root;
+
+  /* A bitvector is scanned forward from the value's own bit. */
+  if (NumBits <= kBitvectorSize) {
+    size_t index;
+    if (!VanEmdeBoasBits::findFirst(static_cast<uint64_t*>(root),
+                                    VanEmdeBoasBits::numWords(NumBits),
+                                    size_t(value), index))
+      return false;
+
+    result = static_cast<Key>(index);
+    return true;
+  }
+
+  /* Otherwise, this is a real node.  Values up to the min seek to the min,
+   * and those after the max find nothing.
+   */
+  Node* node = static_cast<Node*>(root);
+  if (value <= node->mMin) {
+    result = node->mMin;
+    return true;
+  }
+  if (value > node->mMax) return false;
+
+  /* Otherwise, the answer is in the value's own cluster if anything there is
+   * large enough, and is the min of the next nonempty cluster if not.  If
+   * there's no next cluster, it's the max.
+   */
+  const Key subtree = upperBits(value, NumBits);
+  Key lower;
+  if (recSeek<Split<NumBits>::kLow>(lowerBits(value, NumBits),
+                                    node->mChildren.get(subtree), path + 1,
+                                    lower)) {
+    result = compose(subtree, lower, NumBits);
+    return true;
+  }
+
+  Key nextTree;
+  if (!recSuccessor<Split<NumBits>::kHigh>(subtree, node->mSummary, nextTree)) {
+    result = node->mMax;
+    return true;
+  }
+  enterCluster<NumBits>(node, nextTree, path, result);
+  return true;
+}
+
+/* Stepping to the next value follows the path down to the bottom and then
+ * works back up, moving on to the next cluster at the first level whose
+ * current cluster is used up.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recNext(Key value, void** path,
+                                                                     Key& result) {
+  /* A bitvector is scanned forward from just after the value's bit. */
+  if (NumBits <= kBitvectorSize) {
+    size_t index;
+    if (!VanEmdeBoasBits::findFirst(static_cast<uint64_t*>(path[0]),
+                                    VanEmdeBoasBits::numWords(NumBits),
+                                    size_t(value) + 1, index))
+      return false;
+
+    result = static_cast<Key>(index);
+    return true;
+  }
+
+  /* Otherwise, this is a real node.  Nothing here comes after the max.  The
+   * min is followed by the first cluster, or by the max if every cluster is
+   * empty.
+   */
+  Node* node = static_cast<Node*>(path[0]);
+  if (value == node->mMax) return false;
+  if (value == node->mMin) {
+    Key firstTree;
+    if (!treeMin<Split<NumBits>::kHigh>(node->mSummary, firstTree)) {
+      result = node->mMax;
+      return true;
+    }
+    enterCluster<NumBits>(node, firstTree, path, result);
+    return true;
+  }
+
+  /* Anything else lives in a cluster, which is where the path leads next.
+   * The value after it is later in that cluster, in the next nonempty
+   * cluster, or failing that the max.
+   */
+  const Key subtree = upperBits(value, NumBits);
+  Key lower;
+  if (recNext<Split<NumBits>::kLow>(lowerBits(value, NumBits), path + 1,
+                                    lower)) {
+    result = compose(subtree, lower, NumBits);
+    return true;
+  }
+
+  Key nextTree;
+  if (!recSuccessor<Split<NumBits>::kHigh>(subtree, node->mSummary, nextTree)) {
+    result = node->mMax;
+    return true;
+  }
+  enterCluster<NumBits>(node, nextTree, path, result);
+  return true;
+}
+
+/* Entering a cluster puts it next on the path.  Its min is in the cluster
+ * itself, so the path doesn't need to go any deeper.  (min is initialized
+ * only because the optimizer can't see that the cluster is nonempty.)
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::enterCluster(Node* node,
+                                                                          Key index,
+                                                                          void** path,
+                                                                          Key& result) {
+  void* child = node->mChildren.get(index);
+  path[1] = child;
+
+  Key min = Key();
+  treeMin<Split<NumBits>::kLow>(child, min);
+  result = compose(index, min, NumBits);
+}
+
+/* Combining two trees builds the result straight into a new tree's storage.
+ * Working out the size as we go would mean tracking every fix-up to every
+ * min and max on the way back up, so it's simpler to count the result
+ * afterwards, a word at a time.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::SetOperation Op>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>
+VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::combine(const VanEmdeBoasTree& lhs,
+                                                                const VanEmdeBoasTree& rhs) {
+  VanEmdeBoasTree result(lhs.freshStorage());
+  if (lhs.empty() && rhs.empty()) return result;
+
+  recSetOperation<UniverseBits, Op>(lhs.mStorage.root(), rhs.mStorage.root(),
+                                    result.mStorage.root(), result.mStorage);
+  result.mSize = result.count_in_range(0, truncate(~Key(0), UniverseBits));
+  return result;
+}
+
+/* A value is in the result of a set operation according to the usual
+ * definitions, which work just as well on whole words of bits.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::SetOperation Op>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::keeps(bool inLhs, bool inRhs) {
+  switch (Op) {
+  case kUnion:               return inLhs || inRhs;
+  case kIntersection:        return inLhs && inRhs;
+  case kDifference:          return inLhs && !inRhs;
+  case kSymmetricDifference: return inLhs != inRhs;
+  }
+  return false;
+}
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::SetOperation Op>
+uint64_t VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::keeps(uint64_t lhs, uint64_t rhs) {
+  switch (Op) {
+  case kUnion:               return lhs | rhs;
+  case kIntersection:        return lhs & rhs;
+  case kDifference:          return lhs & ~rhs;
+  case kSymmetricDifference: return lhs ^ rhs;
+  }
+  return 0;
+}
+
+/* Combining two trees relies on the fact that each value other than a node's
+ * min and max lives in the cluster given by its upper bits, in either tree.
+ * So apart from the (at most four) mins and maxes of the two nodes, the
+ * result's clusters are just the results of combining the matching pairs of
+ * clusters, and only the clusters the summaries say might be nonempty in the
+ * result need looking at.  Once those are built, the smallest and largest
+ * values in them move up to become the new node's min and max, and then the
+ * old mins and maxes are each put in or taken out according to whether they
+ * belong in the result.
+ *
+ * At the bottom, the bitvectors are combined a word at a time, in a simple
+ * loop the compiler is free to vectorize.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits, typename VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::SetOperation Op>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recSetOperation(void* lhs, void* rhs,
+                                                                            Pointer& result,
+                                                                            Storage& storage) {
+  /* If either tree is empty, the result is either the other tree or empty,
+   * depending on whether the operation keeps the values only in one tree.
+   */
+  if (lhs == NULL || rhs == NULL) {
+    if (lhs != NULL && keeps<Op>(true, false))
+      result = recCloneTree(lhs, NumBits, storage);
+    else if (rhs != NULL && keeps<Op>(false, true))
+      result = recCloneTree(rhs, NumBits, storage);
+    return;
+  }
+
+  /* Bitvectors are combined a word at a time, and thrown away if nothing is
+   * left.
+   */
+  if (NumBits <= kBitvectorSize) {
+    const size_t numWords = VanEmdeBoasBits::numWords(NumBits);
+    const uint64_t* lhsWords = static_cast<uint64_t*>(lhs);
+    const uint64_t* rhsWords = static_cast<uint64_t*>(rhs);
+    uint64_t* words = allocateBitvector(NumBits, storage);
+    for (size_t i = 0; i < numWords; ++i)
+      words[i] = keeps<Op>(lhsWords[i], rhsWords[i]);
+
+    if (VanEmdeBoasBits::none(words, numWords))
+      freeBitvector(words, NumBits, storage);
+    else
+      result = words;
+    return;
+  }
+
+  /* Otherwise, these are real nodes.  A cluster of the result can only be
+   * nonempty if the matching clusters of the two trees are nonempty in the
+   * right combination, which for every operation but difference is the same
+   * operation on the summaries; for difference, it's any nonempty cluster
+   * of the left tree.  Union covers both trees for symmetric difference.
+   */
+  Node* lhsNode = static_cast<Node*>(lhs);
+  Node* rhsNode = static_cast<Node*>(rhs);
+  Node* node = allocateNode(NumBits, storage);
+  node->mSummary = NULL;
+  node->mChildren.init(highHalf(NumBits));
+  result = node;
+
+  if (Op == kDifference)
+    node->mSummary = recCloneTree(lhsNode->mSummary, highHalf(NumBits), storage);
+  else
+    recSetOperation<Split<NumBits>::kHigh, Op == kIntersection? kIntersection : kUnion>(
+      lhsNode->mSummary, rhsNode->mSummary, node->mSummary, storage);
+
+  std::vector<Key> indices;
+  auto collect = [&](Key first, uint64_t bits) {
+    for (; bits != 0; bits &= bits - 1)
+      indices.push_back(static_cast<Key>(first + VanEmdeBoasBits::lowestSetBit(bits)));
+  };
+  recVisitRange<Split<NumBits>::kHigh>(node->mSummary, Key(0),
+                                       truncate(~Key(0), highHalf(NumBits)),
+                                       Key(0), collect);
+
+  /* Combine each of those pairs of clusters, striking the ones that come out
+   * empty from the summary afterwards.
+   */
+  node->mChildren.reserve(highHalf(NumBits), indices.size());
+  std::vector<Key> emptied;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const Key index = indices[i];
+    recSetOperation<Split<NumBits>::kLow, Op>(lhsNode->mChildren.get(index),
+                                              rhsNode->mChildren.get(index),
+                                              node->mChildren.slot(index), storage);
+    if (node->mChildren.get(index) == NULL) {
+      node->mChildren.release(index);
+      emptied.push_back(index);
+    } else {
+      updateBounds<NumBits>(node, index);
+      updateCount<NumBits>(node, index);
+    }
+  }
+  for (size_t i = 0; i < emptied.size(); ++i)
+    recEraseElement<Split<NumBits>::kHigh>(emptied[i], node->mSummary, storage);
+
+  /* Move the smallest and largest values in the clusters up into the node.
+   * If the clusters came out empty, so is the node, at least until the old
+   * mins and maxes are put back.
+   */
+  Key min = Key(), max = Key();
+  if (popClusterMin<NumBits>(node, storage, min)) {
+    if (!popClusterMax<NumBits>(node, storage, max)) max = min;
+    node->mMin = min;
+    node->mMax = max;
+  } else {
+    node->mChildren.destroy(highHalf(NumBits));
+    freeNode(node, NumBits, storage);
+    result = NULL;
+  }
+
+  /* Finally, each of the old mins and maxes goes in the result if it
+   * belongs there and comes out if it doesn't.  The clusters have already
+   * taken care of every other value.
+   */
+  const Key candidates[] = {
+    lhsNode->mMin, lhsNode->mMax, rhsNode->mMin, rhsNode->mMax
+  };
+  for (size_t i = 0; i < 4; ++i) {
+    const Key value = candidates[i];
+    if (std::find(candidates, candidates + i, value) != candidates + i) continue;
+
+    if (keeps<Op>(recFindElement<NumBits>(value, lhs),
+                  recFindElement<NumBits>(value, rhs)))
+      recInsertElement<NumBits>(value, result, storage);
+    else
+      recEraseElement<NumBits>(value, result, storage);
+  }
+}
+
+/* Popping the smallest value out of the clusters means asking the summary
+ * for the first nonempty cluster and popping that cluster's min.  If that
+ * empties the cluster, it has to come out of the summary too, where it's
+ * the min.  The cluster's slot is looked up just once, since in a hash
+ * table that's most of the work at each level.  We know that if the cluster is now empty, the first recursive
+ * call ran in O(1), so at most one of the two recursive calls takes any
+ * real time.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::popClusterMin(Node* node,
+                                                                           Storage& storage,
+                                                                           Key& result) {
+  Key treeOffset;
+  if (!treeMin<Split<NumBits>::kHigh>(node->mSummary, treeOffset))
+    return false;
+
+  Key min = Key();
+  Pointer& cluster = node->mChildren.slot(treeOffset);
+  recPopMin<Split<NumBits>::kLow>(cluster, storage, min);
+  updateBounds<NumBits>(node, treeOffset);
+  adjustCount(node, NumBits, treeOffset, false);
+
+  if (static_cast<void*>(cluster) == NULL) {
+    node->mChildren.release(treeOffset);
+    VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+    recPopMin<Split<NumBits>::kHigh>(node->mSummary, storage, treeOffset);
+  }
+
+  /* Reconstitute the whole value from the cluster and its offset. */
+  result = compose(treeOffset, min, NumBits);
+  return true;
+}
+
+/* Popping the largest value is symmetric. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+bool VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::popClusterMax(Node* node,
+                                                                           Storage& storage,
+                                                                           Key& result) {
+  Key treeOffset;
+  if (!treeMax<Split<NumBits>::kHigh>(node->mSummary, treeOffset))
+    return false;
+
+  Key max = Key();
+  Pointer& cluster = node->mChildren.slot(treeOffset);
+  recPopMax<Split<NumBits>::kLow>(cluster, storage, max);
+  updateBounds<NumBits>(node, treeOffset);
+  adjustCount(node, NumBits, treeOffset, false);
+
+  if (static_cast<void*>(cluster) == NULL) {
+    node->mChildren.release(treeOffset);
+    VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+    recPopMax<Split<NumBits>::kHigh>(node->mSummary, storage, treeOffset);
+  }
+
+  result = compose(treeOffset, max, NumBits);
+  return true;
+}
+
+/* Popping the min of a bitvector clears its first set bit.  Everything
+ * before that bit is already clear, so only the words from there on need
+ * checking to see whether the bitvector is now empty.  In a node, the min
+ * comes out, and the smallest value in the clusters takes its place, just
+ * as in recEraseElement.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recPopMin(Pointer& root,
+                                                                       Storage& storage,
+                                                                       Key& result) {
+  void* tree = root;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  if (NumBits <= kBitvectorSize) {
+    uint64_t* bitvector = static_cast<uint64_t*>(tree);
+    const size_t numWords = VanEmdeBoasBits::numWords(NumBits);
+    size_t index = 0;
+    VanEmdeBoasBits::findFirst(bitvector, numWords, 0, index);
+    VanEmdeBoasBits::clear(bitvector, index);
+    result = static_cast<Key>(index);
+
+    const size_t word = index / VanEmdeBoasBits::kWordBits;
+    if (VanEmdeBoasBits::none(bitvector + word, numWords - word)) {
+      freeBitvector(bitvector, NumBits, storage);
+      root = NULL;
+    }
+    return;
+  }
+
+  Node* node = static_cast<Node*>(tree);
+  result = node->mMin;
+  if (node->mMin == node->mMax) {
+    node->mChildren.destroy(highHalf(NumBits));
+    freeNode(node, NumBits, storage);
+    root = NULL;
+    return;
+  }
+
+  Key min = Key();
+  node->mMin = popClusterMin<NumBits>(node, storage, min)? min : node->mMax;
+}
+
+/* Popping the max is symmetric. */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recPopMax(Pointer& root,
+                                                                       Storage& storage,
+                                                                       Key& result) {
+  void* tree = root;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  if (NumBits <= kBitvectorSize) {
+    uint64_t* bitvector = static_cast<uint64_t*>(tree);
+    size_t index = 0;
+    VanEmdeBoasBits::findLast(bitvector, (size_t(1) << NumBits) - 1, index);
+    VanEmdeBoasBits::clear(bitvector, index);
+    result = static_cast<Key>(index);
+
+    if (VanEmdeBoasBits::none(bitvector, index / VanEmdeBoasBits::kWordBits + 1)) {
+      freeBitvector(bitvector, NumBits, storage);
+      root = NULL;
+    }
+    return;
+  }
+
+  Node* node = static_cast<Node*>(tree);
+  result = node->mMax;
+  if (node->mMin == node->mMax) {
+    node->mChildren.destroy(highHalf(NumBits));
+    freeNode(node, NumBits, storage);
+    root = NULL;
+    return;
+  }
+
+  Key max = Key();
+  node->mMax = popClusterMax<NumBits>(node, storage, max)? max : node->mMin;
+}
+
+/* Extracting a prefix of an empty tree does nothing, and otherwise hands
+ * off to whichever of the two extractPrefixes below fits the tree.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits, typename Visitor>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recExtractPrefix(Key bound,
+                                                                              Pointer& root,
+                                                                              Storage& storage,
+                                                                              Key base,
+                                                                              Visitor& visitor) {
+  if (static_cast<void*>(root) == NULL) return;
+  VANEMDEBOAS_STATS_VISIT(NumBits <= kBitvectorSize);
+
+  extractPrefix<NumBits>(bound, root, storage, base, visitor,
+                         std::integral_constant<bool, (NumBits <= LeafBits)>());
+}
+
+/* A bitvector hands over its words up to the bound and then clears them,
+ * unless it's handing over all of them, in which case it's just freed.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits, typename Visitor>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::extractPrefix(Key bound,
+                                                                           Pointer& root,
+                                                                           Storage& storage,
+                                                                           Key base,
+                                                                           Visitor& visitor,
+                                                                           std::true_type) {
+  uint64_t* bitvector = static_cast<uint64_t*>(static_cast<void*>(root));
+  VanEmdeBoasBits::forEachWord(bitvector, 0, bound, [&](size_t first, uint64_t bits) {
+    visitor(static_cast<Key>(base + first), bits);
+  });
+
+  if (bound != truncate(~Key(0), NumBits)) {
+    VanEmdeBoasBits::clearThrough(bitvector, bound);
+    if (!VanEmdeBoasBits::none(bitvector, VanEmdeBoasBits::numWords(NumBits)))
+      return;
+  }
+  freeBitvector(bitvector, NumBits, storage);
+  root = NULL;
+}
+
+/* A node's min is always in the prefix, if anything is, and so are all the
+ * clusters before the one holding the bound.  Those are found by extracting
+ * the matching prefix of the summary, and each is drained whole, with the
+ * bound set to its last value.  If the max is in the prefix too, that's
+ * every cluster, and then the node itself goes.  Otherwise what's left is a
+ * prefix of the bound's own cluster, and then the smallest value left in
+ * the clusters replaces the min.  Draining through the summary rather than
+ * with recDeleteTree means that only the nonempty clusters are looked at,
+ * rather than every slot of the table.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+template <size_t NumBits, typename Visitor>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::extractPrefix(Key bound,
+                                                                           Pointer& root,
+                                                                           Storage& storage,
+                                                                           Key base,
+                                                                           Visitor& visitor,
+                                                                           std::false_type) {
+  Node* node = static_cast<Node*>(static_cast<void*>(root));
+  if (bound < node->mMin) return;
+
+  visitor(static_cast<Key>(base + node->mMin), uint64_t(1));
+
+  /* Drain the clusters before the bound's own, or all of them if the max
+   * is in range.
+   */
+  const bool takesAll = bound >= node->mMax;
+  const Key boundTree = takesAll? Key(Key(1) << highHalf(NumBits)) :
+                                  upperBits(bound, NumBits);
+  const Key lowMax = static_cast<Key>((Key(1) << lowHalf(NumBits)) - 1);
+  auto drainTrees = [&](Key first, uint64_t bits) {
+    for (; bits != 0; bits &= bits - 1) {
+      const Key index = static_cast<Key>(first + VanEmdeBoasBits::lowestSetBit(bits));
+      recExtractPrefix<Split<NumBits>::kLow>(lowMax, node->mChildren.slot(index),
+                                             storage,
+                                             static_cast<Key>(base + compose(index, 0, NumBits)),
+                                             visitor);
+      node->mChildren.release(index);
+      updateBounds<NumBits>(node, index);
+      updateCount<NumBits>(node, index);
+    }
+  };
+  if (boundTree != 0) {
+    VANEMDEBOAS_STATS_COUNT(kSummaryRecursions);
+    recExtractPrefix<Split<NumBits>::kHigh>(static_cast<Key>(boundTree - 1),
+                                            node->mSummary, storage, Key(0),
+                                            drainTrees);
+  }
+
+  /* If that was everything, the max goes last, and the node with it. */
+  if (takesAll) {
+    if (node->mMax != node->mMin)
+      visitor(static_cast<Key>(base + node->mMax), uint64_t(1));
+    node->mChildren.destroy(highHalf(NumBits));
+    freeNode(node, NumBits, storage);
+    root = NULL;
+    return;
+  }
+
+  /* Otherwise take whatever part of the bound's own cluster is in range.
+   * If that empties the cluster, it's now the first one in the summary.
+   */
+  if (node->mChildren.get(boundTree) != NULL) {
+    Pointer& cluster = node->mChildren.slot(boundTree);
+    recExtractPrefix<Split<NumBits>::kLow>(lowerBits(bound, NumBits), cluster,
+                                           storage,
+                                           static_cast<Key>(base + compose(boundTree, 0, NumBits)),
+                                           visitor);
+    updateBounds<NumBits>(node, boundTree);
+    updateCount<NumBits>(node, boundTree);
+    if (static_cast<void*>(cluster) == NULL) {
+      node->mChildren.release(boundTree);
+      Key index;
+      recPopMin<Split<NumBits>::kHigh>(node->mSummary, storage, index);
+    }
+  }
+
+  /* The max is beyond the bound, so the node isn't empty yet. */
+  Key min = Key();
+  node->mMin = popClusterMin<NumBits>(node, storage, min)? min : node->mMax;
+}
+
+/* Each node and bitvector is counted at the size the storage actually
+ * handed out for it.  A node's own slots with no cluster in them are slack,
+ * as are any the table keeps outside of the node.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recMemoryUsage(void* root,
+                                                                            size_t numBits,
+                                                                            bool inSummary,
+                                                                            MemoryUsage& usage) {
+  /* Empty trees take up no space. */
+  if (root == NULL) return;
+
+  /* A bitvector is all leaf, apart from rounding. */
+  if (numBits <= kBitvectorSize) {
+    const size_t bytes = VanEmdeBoasBits::numWords(numBits) * sizeof(uint64_t);
+    (inSummary? usage.summaries : usage.leaves) += bytes;
+    usage.slack += Storage::blockSize(bytes) - bytes;
+    return;
+  }
+
+  /* Otherwise this is a node, whose table may have memory of its own. */
+  Node* node = static_cast<Node*>(root);
+  const typename Clusters::Table& children = node->mChildren;
+  const size_t unused = children.unusedBytes(highHalf(numBits));
+  const size_t bytes = nodeBytes(numBits) +
+                       children.outsideBytes(highHalf(numBits));
+  (inSummary? usage.summaries : usage.nodes) += bytes - unused;
+  usage.slack += unused + Storage::blockSize(nodeBytes(numBits)) -
+                 nodeBytes(numBits);
+
+  recMemoryUsage(node->mSummary, highHalf(numBits), true, usage);
+  children.forEach(highHalf(numBits), [&](size_t, void* child) {
+    recMemoryUsage(child, lowHalf(numBits), inSummary, usage);
+  });
+}
+
+/* Recursively cloning the tree involves cloning subtrees.  In parallel, the
+ * subtrees are gathered into a list, cloned by the threads into a second
+ * list, and only then put into the new table.
+ */
+template <typename Key, size_t UniverseBits, typename Clusters, size_t LeafBits>
+void* VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>::recCloneTree(void* root,
+                                                                           size_t numBits,
+                                                                           Storage& storage,
+                                                                           bool parallel) {
+  /* Empty trees clone to empty trees. */
+  if (root == NULL) return NULL;
+
+  /* If we are using a bitvector, we need to copy its words. */
+  if (numBits <= kBitvectorSize) {
+    uint64_t* result = allocateBitvector(numBits, storage);
+    std::memcpy(result, root,
+                VanEmdeBoasBits::numWords(numBits) * sizeof(uint64_t));
+    return result;
+  }
+
+  /* Otherwise this is a node. */
+  Node* node = static_cast<Node*>(root);
+
+  /* Otherwise, allocate a node and fill the fields in. */
+  Node* result = allocateNode(numBits, storage);
+
+  /* Copy over the min and max. */
+  result->mMax = node->mMax;
+  result->mMin = node->mMin;
+
+  /* Copy the summary tree. */
+  result->mSummary = recCloneTree(node->mSummary, highHalf(numBits), storage);
+
+  /* Copy each subtree. */
+  typename Clusters::Table& children = result->mChildren;
+  children.init(highHalf(numBits));
+  if (parallel) {
+    std::vector<size_t> indices;
+    std::vector<void*> clusters;
+    node->mChildren.forEach(highHalf(numBits), [&](size_t index, void* child) {
+      indices.push_back(index);
+      clusters.push_back(child);
+    });
+    parallelFor(clusters.size(), [&](size_t i) {
+      clusters[i] = recCloneTree(clusters[i], lowHalf(numBits), storage);
+    });
+    children.reserve(highHalf(numBits), clusters.size());
+    for (size_t i = 0; i < clusters.size(); ++i)
+      children.slot(indices[i]) = clusters[i];
+  } else {
+    node->mChildren.forEach(highHalf(numBits), [&](size_t index, void* child) {
+      children.slot(index) = recCloneTree(child, lowHalf(numBits), storage);
+    });
+  }
+
+  /* The bounds and counts of the clusters are the same as before. */
+  std::memcpy(nonemptyClusters(result, numBits),
+              nonemptyClusters(node, numBits),
+              boundsBytes(numBits) + countsBytes(numBits));
+
+  return result;
+}
+
 #endif // VANEMDEBOASTREE_H
@@ -3,7 +3,7 @@ QT -= gui
 TEMPLATE = lib
 DEFINES += VANEMDEBOASTREE_LIBRARY
 
-CONFIG += c++11
+CONFIG += c++11 thread
 
 # The following define makes your compiler emit warnings if you use
 # any Qt feature that has been marked deprecated (the exact warnings
@@ -16,10 +16,33 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Uncomment to count operations and sample their latencies; see
+# VanEmdeBoasStats.h.  Anything linking against the library must then be
+# built with the same define.
+#DEFINES += VANEMDEBOAS_STATS=1
+
+# The vectorized bit-scanning kernels are picked at run time, so no -m flags
+# are needed and the library runs on any processor of the target
+# architecture.  Uncomment to build only the portable kernels; see
+# VanEmdeBoasKernels.h.
+#DEFINES += VANEMDEBOAS_NO_SIMD
+
 SOURCES += \
     VanEmdeBoasTree.cpp
 
 HEADERS += \
+    ConcurrentVanEmdeBoasTree.h \
+    FrozenVanEmdeBoasTree.h \
+    MappedVanEmdeBoasTree.h \
+    PersistentVanEmdeBoasTree.h \
+    ShardedVanEmdeBoasTree.h \
+    VanEmdeBoasBits.h \
+    VanEmdeBoasClusters.h \
+    VanEmdeBoasFile.h \
+    VanEmdeBoasKernels.h \
+    VanEmdeBoasMap.h \
+    VanEmdeBoasMultiset.h \
+    VanEmdeBoasStats.h \
     VanEmdeBoasTree.h
 
 # Default rules for deployment.
@@ -0,0 +1,188 @@
+/**
+ * @file ConcurrentBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Multithreaded benchmarks of ConcurrentVanEmdeBoasTree.
+ *
+ * Runs one shared tree of clustered 32-bit keys under 1 to 64 threads, with
+ * three mixes of operations: all lookups (a find and a successor per step),
+ * mostly lookups with one step in ten erasing and reinserting a key, and
+ * all erases and reinsertions.  Each thread writes to its own range of
+ * keys, so threads mostly write to different bitvectors and any contention
+ * comes from the tree rather than the workload.  ConcurrentVanEmdeBoasTree
+ * is run with both of its summary policies, and compared against a
+ * ShardedVanEmdeBoasTree with 64 shards and a VanEmdeBoasTree behind a
+ * single mutex.
+ * Benchmarks are named concurrent/mix/container/threads:N, and report wall
+ * time and total throughput across threads, so
+ *
+ *   ./benchmarks --benchmark_filter='concurrent/read-mostly/'
+ *
+ * shows how the read-mostly mix scales for both containers.  Scaling is
+ * only meaningful up to the number of cores on the machine.
+ */
+
+#include "ConcurrentVanEmdeBoasTree.h"
+#include "ShardedVanEmdeBoasTree.h"
+#include "VanEmdeBoasTree.h"
+#include "Workloads.h"
+#include <algorithm> // For sort
+#include <benchmark/benchmark.h>
+#include <mutex>     // For mutex, lock_guard
+#include <string>    // For string
+#include <vector>    // For vector
+
+namespace {
+  typedef uint32_t Key;
+
+  /* The number of keys in the shared tree. */
+  const size_t kNumKeys = 1 << 16;
+
+  /* The number of steps each thread takes per iteration. */
+  const size_t kStepsPerIteration = 256;
+
+  /* The workload is built once and shared by every benchmark. */
+  const Workload<Key>& sharedWorkload() {
+    static const Workload<Key> workload =
+      makeWorkload<Key>(kClustered, 32, kNumKeys);
+    return workload;
+  }
+
+  /* The same keys in sorted order, so that each thread can own a range. */
+  const std::vector<Key>& sortedKeys() {
+    static const std::vector<Key> keys = [] {
+      std::vector<Key> result = sharedWorkload().keys;
+      std::sort(result.begin(), result.end());
+      return result;
+    }();
+    return keys;
+  }
+
+  /* Adapters giving the containers the same interface. */
+  template <typename Summaries> class ConcurrentSet {
+  public:
+    void insert(Key key)                       { mTree.insert(key); }
+    void erase(Key key)                        { mTree.erase(key); }
+    bool contains(Key key) const               { return mTree.contains(key); }
+    bool successor(Key key, Key& result) const { return mTree.successor(key, result); }
+
+  private:
+    ConcurrentVanEmdeBoasTree<Key, 32, Summaries> mTree;
+  };
+
+  class ShardedSet {
+  public:
+    void insert(Key key)                       { mTree.insert(key); }
+    void erase(Key key)                        { mTree.erase(key); }
+    bool contains(Key key) const               { return mTree.contains(key); }
+    bool successor(Key key, Key& result) const { return mTree.successor(key, result); }
+
+  private:
+    ShardedVanEmdeBoasTree<Key, 32, 6> mTree;
+  };
+
+  class LockedSet {
+  public:
+    void insert(Key key) {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mTree.insert(key);
+    }
+    void erase(Key key) {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mTree.erase(key);
+    }
+    bool contains(Key key) const {
+      std::lock_guard<std::mutex> lock(mMutex);
+      return mTree.find(key) != mTree.end();
+    }
+    bool successor(Key key, Key& result) const {
+      std::lock_guard<std::mutex> lock(mMutex);
+      VanEmdeBoasTree<Key>::const_iterator next = mTree.successor(key);
+      if (next == mTree.end()) return false;
+      result = *next;
+      return true;
+    }
+
+  private:
+    mutable std::mutex mMutex;
+    VanEmdeBoasTree<Key> mTree;
+  };
+
+  /* Runs writePercent% write steps and the rest read steps against a shared
+   * container.  The first thread builds the container before the timed loop
+   * and frees it afterwards; Google Benchmark holds every thread at the
+   * start and end of the loop, so the others never see it half-built.
+   * Of n threads, thread t writes only to the t-th n-th of the keys in
+   * sorted order, erasing and reinserting each in turn, so that the set
+   * holds the same keys after every write step.
+   */
+  template <typename Set>
+  void benchMix(benchmark::State& state, size_t writePercent) {
+    static Set* set;
+    const Workload<Key>& workload = sharedWorkload();
+    if (state.thread_index() == 0) {
+      set = new Set;
+      for (size_t i = 0; i < workload.keys.size(); ++i)
+        set->insert(workload.keys[i]);
+    }
+
+    const std::vector<Key>& keys = sortedKeys();
+    const size_t numThreads = size_t(state.threads());
+    const size_t thread = size_t(state.thread_index());
+    const size_t firstKey = thread * keys.size() / numThreads;
+    const size_t lastKey = (thread + 1) * keys.size() / numThreads;
+    size_t probe = thread * kNumProbes / numThreads;
+    size_t key = firstKey;
+    size_t step = 0;
+    Key found = 0;
+
+    for (auto _ : state) {
+      for (size_t i = 0; i < kStepsPerIteration; ++i, ++step) {
+        if (step % 100 < writePercent) {
+          set->erase(keys[key]);
+          set->insert(keys[key]);
+          if (++key == lastKey) key = firstKey;
+        } else {
+          const Key value = workload.probes[probe];
+          benchmark::DoNotOptimize(set->contains(value));
+          benchmark::DoNotOptimize(set->successor(value, found));
+          if (++probe == workload.probes.size()) probe = 0;
+        }
+      }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(kStepsPerIteration));
+
+    if (state.thread_index() == 0) delete set;
+  }
+
+  /* Registers one mix for every container. */
+  void registerMix(const char* mixName, size_t writePercent) {
+    const struct {
+      const char* name;
+      void (*function)(benchmark::State&, size_t);
+    } kSets[] = {
+      { "concurrent",           benchMix<ConcurrentSet<LockedSummaries> >   },
+      { "concurrent-lock-free", benchMix<ConcurrentSet<LockFreeSummaries> > },
+      { "sharded",              benchMix<ShardedSet>                        },
+      { "locked-veb",           benchMix<LockedSet>                         },
+    };
+
+    for (size_t i = 0; i < sizeof(kSets) / sizeof(kSets[0]); ++i) {
+      const std::string name = std::string("concurrent/") + mixName + '/' +
+                               kSets[i].name;
+      benchmark::RegisterBenchmark(name.c_str(), kSets[i].function, writePercent)
+        ->ThreadRange(1, 64)
+        ->UseRealTime();
+    }
+  }
+
+  /* Registers everything before benchmark_main runs. */
+  const struct Registrar {
+    Registrar() {
+      registerMix("read-only", 0);
+      registerMix("read-mostly", 10);
+      registerMix("write-only", 100);
+    }
+  } kRegistrar;
+}
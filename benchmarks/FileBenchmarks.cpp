@@ -0,0 +1,147 @@
+/**
+ * @file FileBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Benchmarks of getting a saved tree back at startup.
+ *
+ * Compares three ways to get at a set of clustered 32-bit keys saved to
+ * disk: reading the keys and inserting them one at a time, loading a tree
+ * saved with VanEmdeBoasTree::save, and mapping that file with
+ * MappedVanEmdeBoasTree.  Each startup benchmark also answers one successor
+ * query, so that mapping pays for touching the file at least once.  The
+ * successor benchmarks then compare queries on the mapped file with queries
+ * on a loaded tree.  Benchmarks are named file/operation/container/keys, so
+ *
+ *   ./benchmarks --benchmark_filter='file/startup/'
+ *
+ * shows how startup time grows with the number of keys for each approach.
+ * The files are written to the working directory and are in the page cache
+ * when read, so the times leave out the disk itself.
+ */
+
+#include "MappedVanEmdeBoasTree.h"
+#include "VanEmdeBoasTree.h"
+#include "Workloads.h"
+#include <benchmark/benchmark.h>
+#include <cstdio>    // For remove
+#include <fstream>   // For ifstream, ofstream
+#include <string>    // For string, to_string
+
+namespace {
+  typedef uint32_t Key;
+  typedef VanEmdeBoasTree<Key> Tree;
+
+  /* Writes a workload's keys to two files, once as a raw array and once as
+   * a saved tree, and removes them again when done.
+   */
+  class SavedFiles {
+  public:
+    explicit SavedFiles(const Workload<Key>& workload)
+      : mKeysPath("veb-keys-" + std::to_string(workload.keys.size()) + ".bin"),
+        mTreePath("veb-tree-" + std::to_string(workload.keys.size()) + ".veb") {
+      std::ofstream keys(mKeysPath.c_str(), std::ios::binary);
+      keys.write(reinterpret_cast<const char*>(workload.keys.data()),
+                 std::streamsize(workload.keys.size() * sizeof(Key)));
+
+      const Tree tree(workload.keys.begin(), workload.keys.end());
+      std::ofstream saved(mTreePath.c_str(), std::ios::binary);
+      tree.save(saved);
+    }
+    ~SavedFiles() {
+      std::remove(mKeysPath.c_str());
+      std::remove(mTreePath.c_str());
+    }
+
+    const std::string& keysPath() const { return mKeysPath; }
+    const std::string& treePath() const { return mTreePath; }
+
+  private:
+    std::string mKeysPath;
+    std::string mTreePath;
+  };
+
+  /* Reads the raw keys back and inserts them one at a time. */
+  void benchReinsert(benchmark::State& state, const Workload<Key>* workload) {
+    const SavedFiles files(*workload);
+    for (auto _ : state) {
+      std::ifstream in(files.keysPath().c_str(), std::ios::binary);
+      Tree tree;
+      Key key;
+      while (in.read(reinterpret_cast<char*>(&key), sizeof(key)))
+        tree.insert(key);
+      benchmark::DoNotOptimize(tree.successor(workload->probes[0]));
+    }
+  }
+
+  /* Loads the saved tree. */
+  void benchLoad(benchmark::State& state, const Workload<Key>* workload) {
+    const SavedFiles files(*workload);
+    for (auto _ : state) {
+      std::ifstream in(files.treePath().c_str(), std::ios::binary);
+      Tree tree;
+      tree.load(in);
+      benchmark::DoNotOptimize(tree.successor(workload->probes[0]));
+    }
+  }
+
+  /* Maps the saved tree. */
+  void benchMap(benchmark::State& state, const Workload<Key>* workload) {
+    const SavedFiles files(*workload);
+    for (auto _ : state) {
+      const MappedVanEmdeBoasTree<Key> tree(files.treePath());
+      Key next;
+      benchmark::DoNotOptimize(tree.successor(workload->probes[0], next));
+    }
+  }
+
+  /* Successor queries on a mapped file and on a loaded tree. */
+  void benchMappedSuccessor(benchmark::State& state, const Workload<Key>* workload) {
+    const SavedFiles files(*workload);
+    const MappedVanEmdeBoasTree<Key> tree(files.treePath());
+    for (auto _ : state) {
+      for (size_t i = 0; i < workload->probes.size(); ++i) {
+        Key next;
+        benchmark::DoNotOptimize(tree.successor(workload->probes[i], next));
+      }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->probes.size()));
+  }
+  void benchLoadedSuccessor(benchmark::State& state, const Workload<Key>* workload) {
+    const Tree tree(workload->keys.begin(), workload->keys.end());
+    for (auto _ : state) {
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        benchmark::DoNotOptimize(tree.successor(workload->probes[i]));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->probes.size()));
+  }
+
+  /* Registers everything before benchmark_main runs.  The workloads live as
+   * long as the program does.
+   */
+  const struct Registrar {
+    Registrar() {
+      const struct {
+        const char* name;
+        void (*function)(benchmark::State&, const Workload<Key>*);
+      } kBenchmarks[] = {
+        { "startup/reinsert",     benchReinsert        },
+        { "startup/load",         benchLoad            },
+        { "startup/map",          benchMap             },
+        { "successor/mapped",     benchMappedSuccessor },
+        { "successor/loaded",     benchLoadedSuccessor },
+      };
+
+      for (size_t numKeys = size_t(1) << 12; numKeys <= size_t(1) << 20; numKeys <<= 4) {
+        const Workload<Key>* workload =
+          new Workload<Key>(makeWorkload<Key>(kClustered, 32, numKeys));
+        for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); ++i) {
+          const std::string name = std::string("file/") + kBenchmarks[i].name +
+                                   '/' + std::to_string(numKeys);
+          benchmark::RegisterBenchmark(name.c_str(), kBenchmarks[i].function, workload);
+        }
+      }
+    }
+  } kRegistrar;
+}
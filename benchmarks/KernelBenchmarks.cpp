@@ -0,0 +1,137 @@
+/**
+ * @file KernelBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Benchmarks of the bitvector scanning kernels.
+ *
+ * Each benchmark runs one kernel over bitvectors of a given number of words,
+ * the sizes of leaves from 9 to 12 bits wide and of a 16-bit cluster
+ * bitmap.  The scans look for a single set bit at a random position, so
+ * that they cover half the vector on average, and the counts count every
+ * bit of a random vector.  Every set of kernels the processor supports is
+ * run, along with "inline", the word-at-a-time loop VanEmdeBoasBits uses
+ * below kMinWords words, called directly rather than through a pointer.
+ * Benchmarks are named kernels/operation/kernels/words, so
+ *
+ *   ./benchmarks --benchmark_filter='kernels/first/'
+ *
+ * compares every set of kernels' forward scans.
+ */
+
+#include "VanEmdeBoasKernels.h"
+#include <benchmark/benchmark.h>
+#include <cstddef> // For size_t
+#include <cstdint> // For uint64_t
+#include <random>  // For mt19937_64
+#include <sstream> // For ostringstream
+#include <vector>  // For vector
+
+namespace {
+  using VanEmdeBoasKernels::Kernels;
+
+  /* The number of vectors each benchmark cycles through. */
+  const size_t kNumVectors = 64;
+
+  /* The kernels called directly, so the compiler can inline them. */
+  const Kernels kInline = {
+    "inline",
+    &VanEmdeBoasKernels::portable::firstNonzero,
+    &VanEmdeBoasKernels::portable::lastNonzero,
+    &VanEmdeBoasKernels::portable::popCount
+  };
+
+  /* kNumVectors vectors of the given length, back to back, each with one
+   * random bit set, or with every word random.
+   */
+  std::vector<uint64_t> makeVectors(size_t numWords, bool full) {
+    std::mt19937_64 generator(137);
+    std::vector<uint64_t> result(kNumVectors * numWords);
+    for (size_t i = 0; i < kNumVectors; ++i) {
+      if (full) {
+        for (size_t j = 0; j < numWords; ++j) result[i * numWords + j] = generator();
+      } else {
+        const size_t bit = generator() % (numWords * 64);
+        result[i * numWords + bit / 64] = uint64_t(1) << (bit % 64);
+      }
+    }
+    return result;
+  }
+
+  enum Operation {
+    kFirst, kLast, kCount
+  };
+
+  template <Operation Op, bool Inline>
+  void benchKernel(benchmark::State& state, const Kernels* kernels, size_t numWords) {
+    const std::vector<uint64_t> vectors = makeVectors(numWords, Op == kCount);
+    for (auto _ : state) {
+      for (size_t i = 0; i < kNumVectors; ++i) {
+        const uint64_t* words = vectors.data() + i * numWords;
+        if (Inline) {
+          if (Op == kFirst) benchmark::DoNotOptimize(VanEmdeBoasKernels::portable::firstNonzero(words, numWords));
+          if (Op == kLast)  benchmark::DoNotOptimize(VanEmdeBoasKernels::portable::lastNonzero(words, numWords));
+          if (Op == kCount) benchmark::DoNotOptimize(VanEmdeBoasKernels::portable::popCount(words, numWords));
+        } else {
+          if (Op == kFirst) benchmark::DoNotOptimize(kernels->firstNonzero(words, numWords));
+          if (Op == kLast)  benchmark::DoNotOptimize(kernels->lastNonzero(words, numWords));
+          if (Op == kCount) benchmark::DoNotOptimize(kernels->popCount(words, numWords));
+        }
+      }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(kNumVectors));
+    state.SetBytesProcessed(int64_t(state.iterations()) *
+                            int64_t(kNumVectors * numWords * sizeof(uint64_t)));
+  }
+
+  /* The kernels this processor can run. */
+  std::vector<const Kernels*> supportedKernels() {
+    std::vector<const Kernels*> result;
+    result.push_back(&VanEmdeBoasKernels::portable::kernels());
+#if defined(VANEMDEBOAS_X86_KERNELS)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt"))
+      result.push_back(&VanEmdeBoasKernels::popcnt::kernels());
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+      result.push_back(&VanEmdeBoasKernels::avx2::kernels());
+    if (__builtin_cpu_supports("avx512f"))
+      result.push_back(&VanEmdeBoasKernels::avx512::kernels());
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+      result.push_back(&VanEmdeBoasKernels::avx512::kernelsWithPopcnt());
+#elif defined(VANEMDEBOAS_NEON_KERNELS)
+    result.push_back(&VanEmdeBoasKernels::neon::kernels());
+#endif
+    return result;
+  }
+
+  /* Registers everything before benchmark_main runs. */
+  const struct Registrar {
+    Registrar() {
+      typedef void (*Benchmark)(benchmark::State&, const Kernels*, size_t);
+      const struct {
+        const char* name;
+        Benchmark inlined;
+        Benchmark called;
+      } kBenchmarks[] = {
+        { "first", benchKernel<kFirst, true>, benchKernel<kFirst, false> },
+        { "last",  benchKernel<kLast, true>,  benchKernel<kLast, false>  },
+        { "count", benchKernel<kCount, true>, benchKernel<kCount, false> },
+      };
+      const size_t kWords[] = { 8, 16, 32, 64, 1024 };
+
+      std::vector<const Kernels*> kernels = supportedKernels();
+      kernels.insert(kernels.begin(), &kInline);
+      for (size_t b = 0; b < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); ++b) {
+        for (size_t k = 0; k < kernels.size(); ++k) {
+          for (size_t w = 0; w < sizeof(kWords) / sizeof(kWords[0]); ++w) {
+            std::ostringstream name;
+            name << "kernels/" << kBenchmarks[b].name << '/' << kernels[k]->name
+                 << '/' << kWords[w];
+            benchmark::RegisterBenchmark(name.str().c_str(),
+                                         k == 0? kBenchmarks[b].inlined : kBenchmarks[b].called,
+                                         kernels[k], kWords[w]);
+          }
+        }
+      }
+    }
+  } kRegistrar;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file MapBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Benchmarks of VanEmdeBoasMap against the usual ways to map keys.
+ *
+ * Each workload's keys are mapped to 64-bit values, and every map is asked
+ * for the value of each probe, for the entry after each probe, and for
+ * every entry in order.  The maps are VanEmdeBoasMap, std::map, and a tree
+ * of keys kept beside a std::unordered_map of values, which is what a
+ * VanEmdeBoasMap replaces.  Over 16-bit keys the map keeps its values in a
+ * DenseValues array, and over 32-bit keys in a HashedValues table.
+ * Benchmarks are named map/operation/map/universe/distribution/keys, so
+ *
+ *   ./benchmarks --benchmark_filter='map/successor/'
+ *
+ * compares every map's successor queries over every workload.
+ */
+
+#include "VanEmdeBoasMap.h"
+#include "VanEmdeBoasTree.h"
+#include "Workloads.h"
+#include <benchmark/benchmark.h>
+#include <cstdint>       // For uint32_t, uint64_t
+#include <map>           // For map
+#include <memory>        // For shared_ptr
+#include <sstream>       // For ostringstream
+#include <unordered_map> // For unordered_map
+
+namespace {
+  /* The maps, behind a common find/successor/forEach interface.  find and
+   * successor return a pointer to the value, or NULL if there's none.
+   */
+  template <typename Key> class VebMap {
+  public:
+    void insert(Key key, uint64_t value) { mMap.insert(key, value); }
+    const uint64_t* find(Key key) const {
+      auto itr = mMap.find(key);
+      return itr == mMap.end()? NULL : &itr->second;
+    }
+    const uint64_t* successor(Key key) const {
+      auto itr = mMap.successor(key);
+      return itr == mMap.end()? NULL : &itr->second;
+    }
+    template <typename Function> void forEach(Function fn) const {
+      mMap.for_each([&](Key key, const uint64_t& value) { fn(key, value); });
+    }
+  private:
+    VanEmdeBoasMap<uint64_t, Key> mMap;
+  };
+  template <typename Key> class StdMap {
+  public:
+    void insert(Key key, uint64_t value) { mMap.insert(std::make_pair(key, value)); }
+    const uint64_t* find(Key key) const {
+      auto itr = mMap.find(key);
+      return itr == mMap.end()? NULL : &itr->second;
+    }
+    const uint64_t* successor(Key key) const {
+      auto itr = mMap.upper_bound(key);
+      return itr == mMap.end()? NULL : &itr->second;
+    }
+    template <typename Function> void forEach(Function fn) const {
+      for (auto& entry : mMap) fn(entry.first, entry.second);
+    }
+  private:
+    std::map<Key, uint64_t> mMap;
+  };
+  template <typename Key> class TreeAndHash {
+  public:
+    void insert(Key key, uint64_t value) {
+      mKeys.insert(key);
+      mValues.insert(std::make_pair(key, value));
+    }
+    const uint64_t* find(Key key) const {
+      auto itr = mValues.find(key);
+      return itr == mValues.end()? NULL : &itr->second;
+    }
+    const uint64_t* successor(Key key) const {
+      auto itr = mKeys.successor(key);
+      return itr == mKeys.end()? NULL : &mValues.find(*itr)->second;
+    }
+    template <typename Function> void forEach(Function fn) const {
+      mKeys.for_each_in_range(Key(0), Key(~Key(0)), [&](Key key) {
+        fn(key, mValues.find(key)->second);
+      });
+    }
+  private:
+    VanEmdeBoasTree<Key> mKeys;
+    std::unordered_map<Key, uint64_t> mValues;
+  };
+
+  template <typename Map, typename Key>
+  std::shared_ptr<const Map> makeMap(const Workload<Key>& workload) {
+    std::shared_ptr<Map> map = std::make_shared<Map>();
+    for (size_t i = 0; i < workload.keys.size(); ++i)
+      map->insert(workload.keys[i], uint64_t(workload.keys[i]) * 3);
+    return map;
+  }
+
+  /* Looks up every probe. */
+  template <typename Map, typename Key>
+  void benchFind(benchmark::State& state,
+                 std::shared_ptr<const Workload<Key> > workload) {
+    const std::shared_ptr<const Map> map = makeMap<Map>(*workload);
+    for (auto _ : state) {
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        benchmark::DoNotOptimize(map->find(workload->probes[i]));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->probes.size()));
+  }
+
+  /* Finds the entry after every probe. */
+  template <typename Map, typename Key>
+  void benchSuccessor(benchmark::State& state,
+                      std::shared_ptr<const Workload<Key> > workload) {
+    const std::shared_ptr<const Map> map = makeMap<Map>(*workload);
+    for (auto _ : state) {
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        benchmark::DoNotOptimize(map->successor(workload->probes[i]));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->probes.size()));
+  }
+
+  /* Sums every entry in key order. */
+  template <typename Map, typename Key>
+  void benchIterate(benchmark::State& state,
+                    std::shared_ptr<const Workload<Key> > workload) {
+    const std::shared_ptr<const Map> map = makeMap<Map>(*workload);
+    for (auto _ : state) {
+      uint64_t sum = 0;
+      map->forEach([&](Key key, uint64_t value) { sum += key ^ value; });
+      benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->keys.size()));
+  }
+
+  /* Registers every benchmark over workloads of one key type. */
+  template <typename Key> void registerAll(size_t universeBits) {
+    typedef void (*Benchmark)(benchmark::State&,
+                              std::shared_ptr<const Workload<Key> >);
+    const struct {
+      const char* name;
+      Benchmark function;
+    } kBenchmarks[] = {
+      { "find/veb_map",             benchFind<VebMap<Key> >            },
+      { "find/std_map",             benchFind<StdMap<Key> >            },
+      { "find/veb_unordered",       benchFind<TreeAndHash<Key> >       },
+      { "successor/veb_map",        benchSuccessor<VebMap<Key> >       },
+      { "successor/std_map",        benchSuccessor<StdMap<Key> >       },
+      { "successor/veb_unordered",  benchSuccessor<TreeAndHash<Key> >  },
+      { "iterate/veb_map",          benchIterate<VebMap<Key> >         },
+      { "iterate/std_map",          benchIterate<StdMap<Key> >         },
+      { "iterate/veb_unordered",    benchIterate<TreeAndHash<Key> >    },
+    };
+
+    for (size_t d = 0; d < sizeof(kDistributions) / sizeof(kDistributions[0]); ++d) {
+      std::shared_ptr<const Workload<Key> > workload =
+        std::make_shared<Workload<Key> >(
+          makeWorkload<Key>(kDistributions[d], universeBits, size_t(1) << 14));
+      for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); ++i) {
+        std::ostringstream name;
+        name << "map/" << kBenchmarks[i].name
+             << "/u" << workload->universeBits
+             << '/' << distributionName(workload->distribution)
+             << '/' << workload->keys.size();
+        benchmark::RegisterBenchmark(name.str().c_str(), kBenchmarks[i].function,
+                                     workload);
+      }
+    }
+  }
+
+  /* Registers everything before benchmark_main runs. */
+  const struct Registrar {
+    Registrar() {
+      registerAll<unsigned short>(16);
+      registerAll<uint32_t>(32);
+    }
+  } kRegistrar;
+}
@@ -0,0 +1,216 @@
+/**
+ * @file MultisetBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Benchmarks of VanEmdeBoasMultiset against the usual ways to count
+ *        keys.
+ *
+ * Each workload's keys go in with between one and four copies apiece, and
+ * every multiset is asked for the count of each probe and the key after
+ * each probe, has a copy of each probe added and taken away again, and is
+ * walked in order with every count.  The multisets are VanEmdeBoasMultiset,
+ * std::multiset, which keeps a node per copy, and a std::map of counts.
+ * Over 16-bit keys the multiset keeps its counts in a DenseValues array,
+ * and over 32-bit keys in a HashedValues table.  Benchmarks are named
+ * multiset/operation/multiset/universe/distribution/keys, so
+ *
+ *   ./benchmarks --benchmark_filter='multiset/churn/'
+ *
+ * compares every multiset's inserts and erases over every workload.
+ */
+
+#include "VanEmdeBoasMultiset.h"
+#include "Workloads.h"
+#include <benchmark/benchmark.h>
+#include <cstddef>  // For size_t
+#include <cstdint>  // For uint32_t, uint64_t
+#include <iterator> // For distance
+#include <map>      // For map
+#include <memory>   // For shared_ptr
+#include <set>      // For multiset
+#include <sstream>  // For ostringstream
+
+namespace {
+  /* The multisets, behind a common interface.  successor returns whether
+   * there's a larger key, writing it into result.
+   */
+  template <typename Key> class VebMultiset {
+  public:
+    void insert(Key key, size_t copies) { mSet.insert(key, copies); }
+    void erase(Key key) { mSet.erase(key); }
+    size_t count(Key key) const { return mSet.count(key); }
+    bool successor(Key key, Key& result) const {
+      auto itr = mSet.successor(key);
+      if (itr == mSet.end()) return false;
+      result = *itr;
+      return true;
+    }
+    template <typename Function> void forEach(Function fn) const {
+      mSet.for_each([&](Key key, size_t copies) { fn(key, copies); });
+    }
+  private:
+    VanEmdeBoasMultiset<Key> mSet;
+  };
+  template <typename Key> class StdMultiset {
+  public:
+    void insert(Key key, size_t copies) {
+      for (size_t i = 0; i < copies; ++i) mSet.insert(key);
+    }
+    void erase(Key key) {
+      auto itr = mSet.find(key);
+      if (itr != mSet.end()) mSet.erase(itr);
+    }
+    size_t count(Key key) const { return mSet.count(key); }
+    bool successor(Key key, Key& result) const {
+      auto itr = mSet.upper_bound(key);
+      if (itr == mSet.end()) return false;
+      result = *itr;
+      return true;
+    }
+    template <typename Function> void forEach(Function fn) const {
+      for (auto itr = mSet.begin(); itr != mSet.end(); ) {
+        auto next = mSet.upper_bound(*itr);
+        fn(*itr, size_t(std::distance(itr, next)));
+        itr = next;
+      }
+    }
+  private:
+    std::multiset<Key> mSet;
+  };
+  template <typename Key> class StdMapOfCounts {
+  public:
+    void insert(Key key, size_t copies) { mCounts[key] += copies; }
+    void erase(Key key) {
+      auto itr = mCounts.find(key);
+      if (itr != mCounts.end() && --itr->second == 0) mCounts.erase(itr);
+    }
+    size_t count(Key key) const {
+      auto itr = mCounts.find(key);
+      return itr == mCounts.end()? 0 : itr->second;
+    }
+    bool successor(Key key, Key& result) const {
+      auto itr = mCounts.upper_bound(key);
+      if (itr == mCounts.end()) return false;
+      result = itr->first;
+      return true;
+    }
+    template <typename Function> void forEach(Function fn) const {
+      for (auto& entry : mCounts) fn(entry.first, entry.second);
+    }
+  private:
+    std::map<Key, size_t> mCounts;
+  };
+
+  template <typename Multiset, typename Key>
+  std::shared_ptr<Multiset> makeMultiset(const Workload<Key>& workload) {
+    std::shared_ptr<Multiset> multiset = std::make_shared<Multiset>();
+    for (size_t i = 0; i < workload.keys.size(); ++i)
+      multiset->insert(workload.keys[i], 1 + i % 4);
+    return multiset;
+  }
+
+  /* Counts every probe. */
+  template <typename Multiset, typename Key>
+  void benchCount(benchmark::State& state,
+                  std::shared_ptr<const Workload<Key> > workload) {
+    const std::shared_ptr<const Multiset> multiset = makeMultiset<Multiset>(*workload);
+    for (auto _ : state) {
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        benchmark::DoNotOptimize(multiset->count(workload->probes[i]));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->probes.size()));
+  }
+
+  /* Finds the key after every probe. */
+  template <typename Multiset, typename Key>
+  void benchSuccessor(benchmark::State& state,
+                      std::shared_ptr<const Workload<Key> > workload) {
+    const std::shared_ptr<const Multiset> multiset = makeMultiset<Multiset>(*workload);
+    for (auto _ : state) {
+      Key result = 0;
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        benchmark::DoNotOptimize(multiset->successor(workload->probes[i], result));
+      benchmark::DoNotOptimize(result);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->probes.size()));
+  }
+
+  /* Adds a copy of every probe, then takes each away again, so that keys
+   * already present only change count and the rest come and go.
+   */
+  template <typename Multiset, typename Key>
+  void benchChurn(benchmark::State& state,
+                  std::shared_ptr<const Workload<Key> > workload) {
+    const std::shared_ptr<Multiset> multiset = makeMultiset<Multiset>(*workload);
+    for (auto _ : state) {
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        multiset->insert(workload->probes[i], 1);
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        multiset->erase(workload->probes[i]);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(2 * workload->probes.size()));
+  }
+
+  /* Sums every key and count in key order. */
+  template <typename Multiset, typename Key>
+  void benchIterate(benchmark::State& state,
+                    std::shared_ptr<const Workload<Key> > workload) {
+    const std::shared_ptr<const Multiset> multiset = makeMultiset<Multiset>(*workload);
+    for (auto _ : state) {
+      uint64_t sum = 0;
+      multiset->forEach([&](Key key, size_t copies) { sum += key * copies; });
+      benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->keys.size()));
+  }
+
+  /* Registers every benchmark over workloads of one key type. */
+  template <typename Key> void registerAll(size_t universeBits) {
+    typedef void (*Benchmark)(benchmark::State&,
+                              std::shared_ptr<const Workload<Key> >);
+    const struct {
+      const char* name;
+      Benchmark function;
+    } kBenchmarks[] = {
+      { "count/veb_multiset",      benchCount<VebMultiset<Key> >        },
+      { "count/std_multiset",      benchCount<StdMultiset<Key> >        },
+      { "count/std_map",           benchCount<StdMapOfCounts<Key> >     },
+      { "successor/veb_multiset",  benchSuccessor<VebMultiset<Key> >    },
+      { "successor/std_multiset",  benchSuccessor<StdMultiset<Key> >    },
+      { "successor/std_map",       benchSuccessor<StdMapOfCounts<Key> > },
+      { "churn/veb_multiset",      benchChurn<VebMultiset<Key> >        },
+      { "churn/std_multiset",      benchChurn<StdMultiset<Key> >        },
+      { "churn/std_map",           benchChurn<StdMapOfCounts<Key> >     },
+      { "iterate/veb_multiset",    benchIterate<VebMultiset<Key> >      },
+      { "iterate/std_multiset",    benchIterate<StdMultiset<Key> >      },
+      { "iterate/std_map",         benchIterate<StdMapOfCounts<Key> >   },
+    };
+
+    for (size_t d = 0; d < sizeof(kDistributions) / sizeof(kDistributions[0]); ++d) {
+      std::shared_ptr<const Workload<Key> > workload =
+        std::make_shared<Workload<Key> >(
+          makeWorkload<Key>(kDistributions[d], universeBits, size_t(1) << 14));
+      for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); ++i) {
+        std::ostringstream name;
+        name << "multiset/" << kBenchmarks[i].name
+             << "/u" << workload->universeBits
+             << '/' << distributionName(workload->distribution)
+             << '/' << workload->keys.size();
+        benchmark::RegisterBenchmark(name.str().c_str(), kBenchmarks[i].function,
+                                     workload);
+      }
+    }
+  }
+
+  /* Registers everything before benchmark_main runs. */
+  const struct Registrar {
+    Registrar() {
+      registerAll<unsigned short>(16);
+      registerAll<uint32_t>(32);
+    }
+  } kRegistrar;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file NeighborBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Benchmarks of changing a tree and finding the neighbors of the change.
+ *
+ * An interval scheduler inserts a key and then needs the keys on either side
+ * of it, and a slot allocator erases a key and then needs the next one.
+ * These benchmarks do each of those for every key of a workload, either
+ * with insert_and_neighbors and erase_and_successor, which find the
+ * neighbors on the way down, or with insert or erase followed by separate
+ * queries.  Benchmarks are named neighbors/operation/approach/universe/
+ * distribution/keys, so
+ *
+ *   ./benchmarks --benchmark_filter='neighbors/insert/'
+ *
+ * compares the two approaches to inserting over every workload.
+ */
+
+#include "VanEmdeBoasTree.h"
+#include "Workloads.h"
+#include <benchmark/benchmark.h>
+#include <memory>  // For shared_ptr
+#include <sstream> // For ostringstream
+
+namespace {
+  typedef uint32_t Key;
+  typedef VanEmdeBoasTree<Key> Tree;
+
+  /* Inserts every key into an empty tree, finding its neighbors each time. */
+  template <bool Fused>
+  void benchInsert(benchmark::State& state,
+                   std::shared_ptr<const Workload<Key> > workload) {
+    for (auto _ : state) {
+      Tree* tree = new Tree;
+      for (size_t i = 0; i < workload->keys.size(); ++i) {
+        Tree::const_iterator predecessor, successor;
+        if (Fused) {
+          tree->insert_and_neighbors(workload->keys[i], predecessor, successor);
+        } else {
+          tree->insert(workload->keys[i]);
+          predecessor = tree->predecessor(workload->keys[i]);
+          successor = tree->successor(workload->keys[i]);
+        }
+        benchmark::DoNotOptimize(predecessor);
+        benchmark::DoNotOptimize(successor);
+      }
+
+      /* Don't charge the destructor to insertion. */
+      state.PauseTiming();
+      delete tree;
+      state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->keys.size()));
+  }
+
+  /* Erases every key from a full tree, finding its successor each time. */
+  template <bool Fused>
+  void benchErase(benchmark::State& state,
+                  std::shared_ptr<const Workload<Key> > workload) {
+    const Tree full(workload->keys.begin(), workload->keys.end());
+    for (auto _ : state) {
+      state.PauseTiming();
+      Tree tree = full;
+      state.ResumeTiming();
+
+      for (size_t i = 0; i < workload->keys.size(); ++i) {
+        Tree::const_iterator successor;
+        if (Fused) {
+          tree.erase_and_successor(workload->keys[i], successor);
+        } else {
+          tree.erase(workload->keys[i]);
+          successor = tree.successor(workload->keys[i]);
+        }
+        benchmark::DoNotOptimize(successor);
+      }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(workload->keys.size()));
+  }
+
+  /* Registers everything before benchmark_main runs. */
+  const struct Registrar {
+    Registrar() {
+      typedef void (*Benchmark)(benchmark::State&,
+                                std::shared_ptr<const Workload<Key> >);
+      const struct {
+        const char* name;
+        Benchmark function;
+      } kBenchmarks[] = {
+        { "insert/fused",    benchInsert<true>  },
+        { "insert/separate", benchInsert<false> },
+        { "erase/fused",     benchErase<true>   },
+        { "erase/separate",  benchErase<false>  },
+      };
+
+      for (size_t d = 0; d < sizeof(kDistributions) / sizeof(kDistributions[0]); ++d) {
+        std::shared_ptr<const Workload<Key> > workload =
+          std::make_shared<Workload<Key> >(
+            makeWorkload<Key>(kDistributions[d], 32, size_t(1) << 16));
+        for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); ++i) {
+          std::ostringstream name;
+          name << "neighbors/" << kBenchmarks[i].name
+               << "/u" << workload->universeBits
+               << '/' << distributionName(workload->distribution)
+               << '/' << workload->keys.size();
+          benchmark::RegisterBenchmark(name.str().c_str(), kBenchmarks[i].function,
+                                       workload);
+        }
+      }
+    }
+  } kRegistrar;
+}
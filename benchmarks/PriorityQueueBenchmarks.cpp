@@ -0,0 +1,277 @@
+/**
+ * @file PriorityQueueBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Benchmarks of the tree used as a monotone priority queue.
+ *
+ * Three workloads, each run against the tree and the usual alternatives:
+ *
+ *   dijkstra: a queue of kQueueSize keys, each step popping the smallest and
+ *             pushing it back plus a random 16-bit edge weight, as Dijkstra's
+ *             algorithm does with lazy deletion.
+ *   drain:    kSteps keys, popped one at a time until the queue is empty.
+ *   timers:   kQueueSize timers, each tick advancing the clock and expiring
+ *             every timer that's due, then re-arming each one a random
+ *             16-bit delay later.
+ *
+ * The queues are std::priority_queue, a radix heap, and the tree popped
+ * either with pop_min or the way it had to be done before, by erasing
+ * begin().  The timers also drain the tree with extract_if_le.  Since the
+ * tree is a set, every key carries a distinct tag in its low kTagBits bits,
+ * below the distance or deadline, and the other queues get the same keys.
+ * Benchmarks are named pq/workload/queue, so
+ *
+ *   ./benchmarks --benchmark_filter='pq/timers/'
+ *
+ * compares every queue on the timers.
+ */
+
+#include "VanEmdeBoasTree.h"
+#include <benchmark/benchmark.h>
+#include <cstddef>    // For size_t
+#include <cstdint>    // For uint64_t
+#include <functional> // For greater
+#include <iterator>   // For back_inserter
+#include <queue>      // For priority_queue
+#include <random>     // For mt19937_64, uniform_int_distribution
+#include <string>     // For string
+#include <vector>     // For vector
+
+namespace {
+  /* Distances and deadlines stay under 2^32 over kSteps steps of at most
+   * 2^16 each, and the tags under 2^kTagBits, so 56 bits hold every key.
+   */
+  const size_t kTagBits   = 24;
+  const size_t kQueueSize = 4096;
+  const size_t kSteps     = 65536;
+  const size_t kTickSize  = 64;
+
+  typedef VanEmdeBoasTree<uint64_t, 32 + kTagBits> Tree;
+
+  /* A radix heap holds keys no smaller than the last one popped, in buckets
+   * by the highest bit in which they differ from it.  Popping from an empty
+   * bucket 0 redistributes the next nonempty bucket around its min, which
+   * sends each key to a lower bucket, so each key moves at most 64 times.
+   */
+  class RadixHeap {
+  public:
+    RadixHeap() : mLast(0), mSize(0) {}
+
+    void push(uint64_t key) {
+      mBuckets[bucket(key)].push_back(key);
+      ++mSize;
+    }
+    uint64_t top() {
+      if (mBuckets[0].empty()) refill();
+      return mBuckets[0].back();
+    }
+    void pop() {
+      if (mBuckets[0].empty()) refill();
+      mBuckets[0].pop_back();
+      --mSize;
+    }
+    bool empty() const {
+      return mSize == 0;
+    }
+
+  private:
+    uint64_t mLast;
+    size_t mSize;
+    std::vector<uint64_t> mBuckets[65];
+
+    size_t bucket(uint64_t key) const {
+      return key == mLast? 0 : 64 - __builtin_clzll(key ^ mLast);
+    }
+    void refill() {
+      size_t i = 1;
+      while (mBuckets[i].empty()) ++i;
+      mLast = mBuckets[i][0];
+      for (size_t j = 1; j < mBuckets[i].size(); ++j)
+        if (mBuckets[i][j] < mLast) mLast = mBuckets[i][j];
+      for (size_t j = 0; j < mBuckets[i].size(); ++j)
+        mBuckets[bucket(mBuckets[i][j])].push_back(mBuckets[i][j]);
+      mBuckets[i].clear();
+    }
+  };
+
+  /* The queues, behind a common push/top/pop interface. */
+  class TreePopMin {
+  public:
+    void push(uint64_t key) { mTree.insert(key); }
+    uint64_t top() const { return *mTree.begin(); }
+    uint64_t pop() { uint64_t key; mTree.pop_min(key); return key; }
+    bool empty() const { return mTree.empty(); }
+    Tree& tree() { return mTree; }
+  private:
+    Tree mTree;
+  };
+  class TreeEraseBegin {
+  public:
+    void push(uint64_t key) { mTree.insert(key); }
+    uint64_t top() const { return *mTree.begin(); }
+    uint64_t pop() {
+      const uint64_t key = *mTree.begin();
+      mTree.erase(mTree.begin());
+      return key;
+    }
+    bool empty() const { return mTree.empty(); }
+  private:
+    Tree mTree;
+  };
+  class StdQueue {
+  public:
+    void push(uint64_t key) { mQueue.push(key); }
+    uint64_t top() const { return mQueue.top(); }
+    uint64_t pop() { const uint64_t key = mQueue.top(); mQueue.pop(); return key; }
+    bool empty() const { return mQueue.empty(); }
+  private:
+    std::priority_queue<uint64_t, std::vector<uint64_t>,
+                        std::greater<uint64_t> > mQueue;
+  };
+  class RadixQueue {
+  public:
+    void push(uint64_t key) { mHeap.push(key); }
+    uint64_t top() { return mHeap.top(); }
+    uint64_t pop() { const uint64_t key = mHeap.top(); mHeap.pop(); return key; }
+    bool empty() const { return mHeap.empty(); }
+  private:
+    RadixHeap mHeap;
+  };
+
+  /* The random weights and delays, the same for every queue. */
+  const std::vector<uint64_t>& randomSteps() {
+    static const std::vector<uint64_t> steps = [] {
+      std::mt19937_64 generator(137);
+      std::uniform_int_distribution<uint64_t> step(1, 65535);
+      std::vector<uint64_t> result(kQueueSize + kSteps);
+      for (size_t i = 0; i < result.size(); ++i) result[i] = step(generator);
+      return result;
+    }();
+    return steps;
+  }
+  uint64_t makeKey(uint64_t priority, size_t tag) {
+    return (priority << kTagBits) | tag;
+  }
+
+  /* Fills a queue with kQueueSize keys, one per tag. */
+  template <typename Queue> void fill(Queue& queue) {
+    const std::vector<uint64_t>& steps = randomSteps();
+    for (size_t i = 0; i < kQueueSize; ++i) queue.push(makeKey(steps[i], i));
+  }
+
+  /* Dijkstra pops the closest key and pushes a farther one in its place. */
+  template <typename Queue>
+  void benchDijkstra(benchmark::State& state) {
+    const std::vector<uint64_t>& steps = randomSteps();
+    for (auto _ : state) {
+      state.PauseTiming();
+      Queue* queue = new Queue;
+      fill(*queue);
+      state.ResumeTiming();
+
+      for (size_t i = 0; i < kSteps; ++i) {
+        const uint64_t distance = queue->pop() >> kTagBits;
+        queue->push(makeKey(distance + steps[kQueueSize + i], kQueueSize + i));
+      }
+
+      state.PauseTiming();
+      delete queue;
+      state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(kSteps));
+  }
+
+  /* Draining pops every key of a queue of kSteps keys in order, with no
+   * pushes to hide the cost of popping.
+   */
+  template <typename Queue>
+  void benchDrain(benchmark::State& state) {
+    const std::vector<uint64_t>& steps = randomSteps();
+    for (auto _ : state) {
+      state.PauseTiming();
+      Queue* queue = new Queue;
+      for (size_t i = 0; i < kSteps; ++i) queue->push(makeKey(steps[i], i));
+      state.ResumeTiming();
+
+      while (!queue->empty()) benchmark::DoNotOptimize(queue->pop());
+
+      state.PauseTiming();
+      delete queue;
+      state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(kSteps));
+  }
+
+  /* Only the tree can drain every due timer at once. */
+  template <typename Queue>
+  void extractDue(Queue&, uint64_t, std::vector<uint64_t>&) {}
+  void extractDue(TreePopMin& queue, uint64_t due, std::vector<uint64_t>& expired) {
+    queue.tree().extract_if_le(due, std::back_inserter(expired));
+  }
+
+  /* The timers expire everything due by the end of each tick, one at a
+   * time or, with Extract, all at once, and then re-arm them.
+   */
+  template <typename Queue, bool Extract>
+  void benchTimers(benchmark::State& state) {
+    const std::vector<uint64_t>& steps = randomSteps();
+    std::vector<uint64_t> expired;
+    size_t processed = 0;
+    for (auto _ : state) {
+      state.PauseTiming();
+      Queue* queue = new Queue;
+      fill(*queue);
+      state.ResumeTiming();
+
+      uint64_t now = 0;
+      for (size_t i = 0; i < kSteps; ) {
+        now += kTickSize;
+        const uint64_t due = makeKey(now, (size_t(1) << kTagBits) - 1);
+        expired.clear();
+        if (Extract) {
+          extractDue(*queue, due, expired);
+        } else {
+          while (!queue->empty() && queue->top() <= due)
+            expired.push_back(queue->pop());
+        }
+        for (size_t j = 0; j < expired.size() && i < kSteps; ++j, ++i)
+          queue->push(makeKey(now + steps[kQueueSize + i], kQueueSize + i));
+        processed += expired.size();
+      }
+
+      state.PauseTiming();
+      delete queue;
+      state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(processed));
+  }
+
+  /* Registers everything before benchmark_main runs. */
+  const struct Registrar {
+    Registrar() {
+      const struct {
+        const char* name;
+        void (*function)(benchmark::State&);
+      } kBenchmarks[] = {
+        { "dijkstra/veb_pop_min",        benchDijkstra<TreePopMin>            },
+        { "dijkstra/veb_erase_begin",    benchDijkstra<TreeEraseBegin>        },
+        { "dijkstra/std_priority_queue", benchDijkstra<StdQueue>              },
+        { "dijkstra/radix_heap",         benchDijkstra<RadixQueue>            },
+        { "drain/veb_pop_min",           benchDrain<TreePopMin>               },
+        { "drain/veb_erase_begin",       benchDrain<TreeEraseBegin>           },
+        { "drain/std_priority_queue",    benchDrain<StdQueue>                 },
+        { "drain/radix_heap",            benchDrain<RadixQueue>               },
+        { "timers/veb_extract_if_le",    benchTimers<TreePopMin, true>        },
+        { "timers/veb_pop_min",          benchTimers<TreePopMin, false>       },
+        { "timers/veb_erase_begin",      benchTimers<TreeEraseBegin, false>   },
+        { "timers/std_priority_queue",   benchTimers<StdQueue, false>         },
+        { "timers/radix_heap",           benchTimers<RadixQueue, false>       },
+      };
+
+      for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); ++i) {
+        const std::string name = std::string("pq/") + kBenchmarks[i].name;
+        benchmark::RegisterBenchmark(name.c_str(), kBenchmarks[i].function);
+      }
+    }
+  } kRegistrar;
+}
@@ -0,0 +1,416 @@
+/**
+ * @file SetBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Benchmarks of VanEmdeBoasTree against other ordered sets.
+ *
+ * Measures insert, erase, find, successor, predecessor, full iteration,
+ * range scans, union, intersection, rank, select, construction (empty and
+ * from a range of keys), copy, and destruction for several VanEmdeBoasTree
+ * configurations
+ * alongside std::set, a sorted std::vector, and (for 16-bit keys) a flat
+ * std::bitset.  Each operation is
+ * run over dense, sparse, clustered, and adversarial key sets at several
+ * sizes.  Benchmarks are named operation/container/universe/distribution/keys,
+ * so, for example,
+ *
+ *   ./benchmarks --benchmark_filter='successor/.*\/u16/sparse'
+ *
+ * runs the successor benchmarks over sparse 16-bit key sets.  To record
+ * results for comparison across releases, add
+ *
+ *   --benchmark_out=results.json --benchmark_out_format=json
+ *
+ * The veb-bounded trees keep each cluster's min and max in its parent to
+ * save cache misses.  If Google Benchmark was built with libpfm, adding
+ *
+ *   --benchmark_perf_counters=CACHE-MISSES,CACHE-REFERENCES
+ *
+ * reports hardware cache misses per iteration alongside the timings, so
+ *
+ *   ./benchmarks --benchmark_filter='successor/veb(-bounded)?/' \
+ *                --benchmark_perf_counters=CACHE-MISSES
+ *
+ * compares the misses with and without the bounds.
+ *
+ * The veb-counted trees keep each cluster's number of keys in its parent, so
+ * that rank and select don't have to walk the keys; the other trees answer
+ * them with a range count or a walk.
+ */
+
+#include "VanEmdeBoasTree.h"
+#include "Workloads.h"
+#include <benchmark/benchmark.h>
+#include <memory>  // For shared_ptr
+#include <sstream> // For ostringstream
+
+namespace {
+  /* Builds a container holding every key of a workload. */
+  template <typename Set, typename Key>
+  void fill(Set& set, const Workload<Key>& workload) {
+    for (size_t i = 0; i < workload.keys.size(); ++i)
+      set.insert(workload.keys[i]);
+  }
+
+  /* Records how much work an iteration did and the shape of the workload. */
+  template <typename Key>
+  void report(benchmark::State& state, const Workload<Key>& workload,
+              size_t itemsPerIteration) {
+    state.SetItemsProcessed(int64_t(state.iterations()) *
+                            int64_t(itemsPerIteration));
+    state.counters["keys"] = double(workload.keys.size());
+    state.counters["fill"] = double(workload.keys.size()) /
+                             double(uint64_t(1) << workload.universeBits);
+  }
+
+  /**** The benchmarks themselves. ****/
+
+  /* Inserting every key into an empty container. */
+  template <typename Set, typename Key>
+  void benchInsert(benchmark::State& state,
+                   std::shared_ptr<const Workload<Key> > workload) {
+    for (auto _ : state) {
+      Set* set = new Set;
+      fill(*set, *workload);
+      benchmark::DoNotOptimize(set);
+
+      /* Don't charge the destructor to insertion. */
+      state.PauseTiming();
+      delete set;
+      state.ResumeTiming();
+    }
+    report(state, *workload, workload->keys.size());
+  }
+
+  /* Erasing every key from a full container, in insertion order. */
+  template <typename Set, typename Key>
+  void benchErase(benchmark::State& state,
+                  std::shared_ptr<const Workload<Key> > workload) {
+    Set full;
+    fill(full, *workload);
+
+    for (auto _ : state) {
+      state.PauseTiming();
+      Set set = full;
+      state.ResumeTiming();
+
+      for (size_t i = 0; i < workload->keys.size(); ++i)
+        set.erase(workload->keys[i]);
+      benchmark::DoNotOptimize(&set);
+    }
+    report(state, *workload, workload->keys.size());
+  }
+
+  /* Looking up random values, most of which usually aren't there. */
+  template <typename Set, typename Key>
+  void benchFind(benchmark::State& state,
+                 std::shared_ptr<const Workload<Key> > workload) {
+    Set set;
+    fill(set, *workload);
+
+    for (auto _ : state) {
+      size_t found = 0;
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        found += set.contains(workload->probes[i]);
+      benchmark::DoNotOptimize(found);
+    }
+    report(state, *workload, workload->probes.size());
+  }
+
+  /* Successor and predecessor queries for random values. */
+  template <typename Set, typename Key>
+  void benchSuccessor(benchmark::State& state,
+                      std::shared_ptr<const Workload<Key> > workload) {
+    Set set;
+    fill(set, *workload);
+
+    for (auto _ : state) {
+      Key result = Key();
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        set.successor(workload->probes[i], result);
+      benchmark::DoNotOptimize(result);
+    }
+    report(state, *workload, workload->probes.size());
+  }
+  template <typename Set, typename Key>
+  void benchPredecessor(benchmark::State& state,
+                        std::shared_ptr<const Workload<Key> > workload) {
+    Set set;
+    fill(set, *workload);
+
+    for (auto _ : state) {
+      Key result = Key();
+      for (size_t i = 0; i < workload->probes.size(); ++i)
+        set.predecessor(workload->probes[i], result);
+      benchmark::DoNotOptimize(result);
+    }
+    report(state, *workload, workload->probes.size());
+  }
+
+  /* Visiting every key in sorted order. */
+  template <typename Set, typename Key>
+  void benchIterate(benchmark::State& state,
+                    std::shared_ptr<const Workload<Key> > workload) {
+    Set set;
+    fill(set, *workload);
+
+    for (auto _ : state) {
+      uint64_t sum = 0;
+      set.forEach([&](Key key) { sum += key; });
+      benchmark::DoNotOptimize(sum);
+    }
+    report(state, *workload, workload->keys.size());
+  }
+
+  /* Visiting the keys between pairs of random probes, which covers half of
+   * the universe on average.
+   */
+  template <typename Set, typename Key>
+  void benchScan(benchmark::State& state,
+                 std::shared_ptr<const Workload<Key> > workload) {
+    Set set;
+    fill(set, *workload);
+
+    const size_t kNumRanges = 16;
+    for (auto _ : state) {
+      uint64_t sum = 0;
+      for (size_t i = 0; i < kNumRanges; ++i) {
+        const Key lo = std::min(workload->probes[2 * i], workload->probes[2 * i + 1]);
+        const Key hi = std::max(workload->probes[2 * i], workload->probes[2 * i + 1]);
+        set.forEachInRange(lo, hi, [&](Key key) { sum += key; });
+      }
+      benchmark::DoNotOptimize(sum);
+    }
+    report(state, *workload, kNumRanges);
+  }
+
+  /* Ranking random values, and selecting the keys at random indices.  Only
+   * some of the probes are used, since std::set takes linear time for both.
+   */
+  const size_t kNumRankProbes = 256;
+  template <typename Set, typename Key>
+  void benchRank(benchmark::State& state,
+                 std::shared_ptr<const Workload<Key> > workload) {
+    Set set;
+    fill(set, *workload);
+
+    for (auto _ : state) {
+      size_t sum = 0;
+      for (size_t i = 0; i < kNumRankProbes; ++i)
+        sum += set.rank(workload->probes[i]);
+      benchmark::DoNotOptimize(sum);
+    }
+    report(state, *workload, kNumRankProbes);
+  }
+  template <typename Set, typename Key>
+  void benchSelect(benchmark::State& state,
+                   std::shared_ptr<const Workload<Key> > workload) {
+    Set set;
+    fill(set, *workload);
+
+    for (auto _ : state) {
+      Key result = Key();
+      for (size_t i = 0; i < kNumRankProbes; ++i)
+        set.select(size_t(workload->probes[i]) % workload->keys.size(), result);
+      benchmark::DoNotOptimize(result);
+    }
+    report(state, *workload, kNumRankProbes);
+  }
+
+  /* Combining a full container with one holding the random probes. */
+  template <typename Set, typename Key>
+  void benchUnion(benchmark::State& state,
+                  std::shared_ptr<const Workload<Key> > workload) {
+    Set full, probes;
+    fill(full, *workload);
+    probes.assign(workload->probes);
+
+    for (auto _ : state) {
+      state.PauseTiming();
+      Set set = full;
+      state.ResumeTiming();
+
+      set.unite(probes);
+      benchmark::DoNotOptimize(&set);
+    }
+    report(state, *workload, workload->keys.size());
+  }
+  template <typename Set, typename Key>
+  void benchIntersection(benchmark::State& state,
+                         std::shared_ptr<const Workload<Key> > workload) {
+    Set full, probes;
+    fill(full, *workload);
+    probes.assign(workload->probes);
+
+    for (auto _ : state) {
+      state.PauseTiming();
+      Set set = full;
+      state.ResumeTiming();
+
+      set.intersect(probes);
+      benchmark::DoNotOptimize(&set);
+    }
+    report(state, *workload, workload->keys.size());
+  }
+
+  /* Constructing and destroying an empty container.  This only depends on
+   * the container, but is reported for each workload so that the results
+   * line up with the others.
+   */
+  template <typename Set, typename Key>
+  void benchConstruct(benchmark::State& state,
+                      std::shared_ptr<const Workload<Key> > workload) {
+    for (auto _ : state) {
+      Set set;
+      benchmark::DoNotOptimize(&set);
+    }
+    report(state, *workload, 1);
+  }
+
+  /* Building a full container from the unsorted keys all at once. */
+  template <typename Set, typename Key>
+  void benchBuild(benchmark::State& state,
+                  std::shared_ptr<const Workload<Key> > workload) {
+    for (auto _ : state) {
+      Set* set = new Set;
+      set->assign(workload->keys);
+      benchmark::DoNotOptimize(set);
+
+      /* Don't charge the destructor to building. */
+      state.PauseTiming();
+      delete set;
+      state.ResumeTiming();
+    }
+    report(state, *workload, workload->keys.size());
+  }
+
+  /* Deep-copying a full container. */
+  template <typename Set, typename Key>
+  void benchCopy(benchmark::State& state,
+                 std::shared_ptr<const Workload<Key> > workload) {
+    Set full;
+    fill(full, *workload);
+
+    for (auto _ : state) {
+      Set* copy = new Set(full);
+      benchmark::DoNotOptimize(copy);
+
+      /* Don't charge the destructor to copying. */
+      state.PauseTiming();
+      delete copy;
+      state.ResumeTiming();
+    }
+    report(state, *workload, workload->keys.size());
+  }
+
+  /* Destroying a full container. */
+  template <typename Set, typename Key>
+  void benchDestroy(benchmark::State& state,
+                    std::shared_ptr<const Workload<Key> > workload) {
+    Set full;
+    fill(full, *workload);
+
+    for (auto _ : state) {
+      state.PauseTiming();
+      Set* set = new Set(full);
+      state.ResumeTiming();
+
+      delete set;
+    }
+    report(state, *workload, workload->keys.size());
+  }
+
+  /**** Registration. ****/
+
+  /* Registers every benchmark for one container over one workload. */
+  template <typename Set, typename Key>
+  void registerSet(const char* setName,
+                   std::shared_ptr<const Workload<Key> > workload) {
+    typedef void (*Benchmark)(benchmark::State&,
+                              std::shared_ptr<const Workload<Key> >);
+    const struct {
+      const char* name;
+      Benchmark function;
+    } kBenchmarks[] = {
+      { "insert",       benchInsert<Set, Key>       },
+      { "erase",        benchErase<Set, Key>        },
+      { "find",         benchFind<Set, Key>         },
+      { "successor",    benchSuccessor<Set, Key>    },
+      { "predecessor",  benchPredecessor<Set, Key>  },
+      { "iterate",      benchIterate<Set, Key>      },
+      { "scan",         benchScan<Set, Key>         },
+      { "union",        benchUnion<Set, Key>        },
+      { "intersection", benchIntersection<Set, Key> },
+      { "rank",         benchRank<Set, Key>         },
+      { "select",       benchSelect<Set, Key>       },
+      { "construct",    benchConstruct<Set, Key>    },
+      { "build",        benchBuild<Set, Key>        },
+      { "copy",         benchCopy<Set, Key>         },
+      { "destroy",      benchDestroy<Set, Key>      },
+    };
+
+    for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); ++i) {
+      std::ostringstream name;
+      name << kBenchmarks[i].name << '/' << setName
+           << "/u" << workload->universeBits
+           << '/' << distributionName(workload->distribution)
+           << '/' << workload->keys.size();
+      benchmark::RegisterBenchmark(name.str().c_str(), kBenchmarks[i].function,
+                                   workload);
+    }
+  }
+
+  /* 16-bit keys, at fill ratios from very sparse to nearly full.  These are
+   * small enough to compare against a flat bitset.
+   */
+  void register16BitBenchmarks() {
+    typedef unsigned short Key;
+    const double kFills[] = { 0.01, 0.1, 0.5, 0.9 };
+
+    for (size_t d = 0; d < sizeof(kDistributions) / sizeof(kDistributions[0]); ++d) {
+      for (size_t f = 0; f < sizeof(kFills) / sizeof(kFills[0]); ++f) {
+        std::shared_ptr<const Workload<Key> > workload =
+          std::make_shared<Workload<Key> >(
+            makeWorkload<Key>(kDistributions[d], 16, size_t(kFills[f] * 65536)));
+
+        registerSet<TreeSet<VanEmdeBoasTree<Key> > >("veb", workload);
+        registerSet<TreeSet<VanEmdeBoasTree<Key, 16, HashedClusters> > >("veb-hashed", workload);
+        registerSet<TreeSet<VanEmdeBoasTree<Key, 16, ArenaClusters> > >("veb-arena", workload);
+        registerSet<TreeSet<VanEmdeBoasTree<Key, 16, BoundedClusters> > >("veb-bounded", workload);
+        registerSet<TreeSet<VanEmdeBoasTree<Key, 16, CountedClusters<DenseClusters> > > >("veb-counted", workload);
+        registerSet<StdSet<Key> >("std::set", workload);
+        registerSet<SortedVectorSet<Key> >("sorted-vector", workload);
+        registerSet<BitsetSet<Key, 16> >("std::bitset", workload);
+      }
+    }
+  }
+
+  /* 32-bit keys, which only ever fill a tiny fraction of the universe. */
+  void register32BitBenchmarks() {
+    typedef uint32_t Key;
+    const size_t kCounts[] = { 1 << 10, 1 << 16 };
+
+    for (size_t d = 0; d < sizeof(kDistributions) / sizeof(kDistributions[0]); ++d) {
+      for (size_t c = 0; c < sizeof(kCounts) / sizeof(kCounts[0]); ++c) {
+        std::shared_ptr<const Workload<Key> > workload =
+          std::make_shared<Workload<Key> >(
+            makeWorkload<Key>(kDistributions[d], 32, kCounts[c]));
+
+        registerSet<TreeSet<VanEmdeBoasTree<Key> > >("veb", workload);
+        registerSet<TreeSet<VanEmdeBoasTree<Key, 32, HashedClusters> > >("veb-hashed", workload);
+        registerSet<TreeSet<VanEmdeBoasTree<Key, 32, BoundedClusters> > >("veb-bounded", workload);
+        registerSet<TreeSet<VanEmdeBoasTree<Key, 32, CountedClusters<DenseClusters> > > >("veb-counted", workload);
+        registerSet<StdSet<Key> >("std::set", workload);
+        registerSet<SortedVectorSet<Key> >("sorted-vector", workload);
+      }
+    }
+  }
+
+  /* Registers everything before benchmark_main runs. */
+  const struct Registrar {
+    Registrar() {
+      register16BitBenchmarks();
+      register32BitBenchmarks();
+    }
+  } kRegistrar;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file SnapshotBenchmarks.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Benchmarks of taking snapshots of a tree that goes on changing.
+ *
+ * Each iteration takes a snapshot of a tree of 2^16 clustered keys, makes a
+ * number of writes to the live tree (each erasing a key and inserting it
+ * back), and then drops the snapshot, as a reader holding a consistent view
+ * for a while would.  PersistentVanEmdeBoasTree snapshots share the tree and
+ * copy only what the writes touch; VanEmdeBoasTree snapshots are deep
+ * copies.  Benchmarks are named snapshot/container/universe/writes:N, so
+ *
+ *   ./benchmarks --benchmark_filter='snapshot/.*\/u32'
+ *
+ * shows how the cost of a snapshot grows with the writes made under it over
+ * 32-bit keys.
+ */
+
+#include "PersistentVanEmdeBoasTree.h"
+#include "VanEmdeBoasTree.h"
+#include "Workloads.h"
+#include <benchmark/benchmark.h>
+#include <string>    // For string
+
+namespace {
+  /* The number of keys in the tree. */
+  const size_t kNumKeys = 1 << 16;
+
+  /* Takes a snapshot, makes writes to the live tree, and drops the snapshot,
+   * over and over.  The writes cycle through the keys, so the tree holds the
+   * same keys after every one.
+   */
+  template <typename Tree, typename Key, size_t UniverseBits>
+  void benchSnapshot(benchmark::State& state) {
+    static const Workload<Key> workload =
+      makeWorkload<Key>(kClustered, UniverseBits, kNumKeys);
+    const size_t numWrites = size_t(state.range(0));
+
+    Tree tree;
+    for (size_t i = 0; i < workload.keys.size(); ++i)
+      tree.insert(workload.keys[i]);
+
+    size_t next = 0;
+    for (auto _ : state) {
+      Tree* snapshot = new Tree(tree);
+      benchmark::DoNotOptimize(snapshot);
+      for (size_t i = 0; i < numWrites; ++i) {
+        tree.erase(workload.keys[next]);
+        tree.insert(workload.keys[next]);
+        if (++next == workload.keys.size()) next = 0;
+      }
+      delete snapshot;
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(numWrites));
+  }
+
+  /* Registers a benchmark over 1 to 4096 writes per snapshot. */
+  void registerSnapshot(const char* container, const char* universe,
+                        void (*function)(benchmark::State&)) {
+    const std::string name = std::string("snapshot/") + container + '/' + universe;
+    benchmark::RegisterBenchmark(name.c_str(), function)
+      ->ArgName("writes")
+      ->RangeMultiplier(8)
+      ->Range(1, 4096);
+  }
+
+  /* Registers everything before benchmark_main runs. */
+  const struct Registrar {
+    Registrar() {
+      registerSnapshot("persistent", "u16",
+                       benchSnapshot<PersistentVanEmdeBoasTree<unsigned short>,
+                                     unsigned short, 16>);
+      registerSnapshot("veb-copy", "u16",
+                       benchSnapshot<VanEmdeBoasTree<unsigned short>,
+                                     unsigned short, 16>);
+      registerSnapshot("persistent", "u32",
+                       benchSnapshot<PersistentVanEmdeBoasTree<uint32_t>,
+                                     uint32_t, 32>);
+      registerSnapshot("veb-copy", "u32",
+                       benchSnapshot<VanEmdeBoasTree<uint32_t>,
+                                     uint32_t, 32>);
+    }
+  } kRegistrar;
+}
@@ -0,0 +1,478 @@
+/**
+ * @headerfile Workloads.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Key sets and container adapters shared by the benchmarks.
+ */
+
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <algorithm>     // For shuffle, sort, unique, lower_bound, upper_bound,
+                         // set_union, set_intersection
+#include <bitset>        // For bitset
+#include <cstddef>       // For size_t
+#include <cstdint>       // For uint64_t
+#include <iterator>      // For inserter, back_inserter, distance, next
+#include <random>        // For mt19937_64, uniform_int_distribution
+#include <set>           // For set
+#include <string>        // For string
+#include <unordered_set> // For unordered_set
+#include <vector>        // For vector
+
+/**
+ * The shapes of key set the benchmarks are run over.
+ *
+ *   Dense:       one contiguous run of keys starting somewhere random.
+ *   Sparse:      keys drawn uniformly at random from the whole universe.
+ *   Clustered:   runs of kRunLength consecutive keys at random positions.
+ *   Adversarial: the bit-reversals of 0, 1, 2, ..., which spread the keys
+ *                over as many top-level clusters as possible and make each
+ *                insertion land far away from the one before it.
+ *
+ * Except for the adversarial set, whose order is the point, the keys are
+ * shuffled so that they're inserted in random order.
+ */
+enum Distribution {
+  kDense, kSparse, kClustered, kAdversarial
+};
+
+const Distribution kDistributions[] = {
+  kDense, kSparse, kClustered, kAdversarial
+};
+
+inline const char* distributionName(Distribution distribution) {
+  switch (distribution) {
+  case kDense:       return "dense";
+  case kSparse:      return "sparse";
+  case kClustered:   return "clustered";
+  case kAdversarial: return "adversarial";
+  }
+  return "unknown";
+}
+
+/* The length of each run in a clustered key set. */
+const size_t kRunLength = 64;
+
+/* The number of random probes each lookup benchmark makes per iteration. */
+const size_t kNumProbes = 4096;
+
+/* Every workload is generated from the same seed so runs are comparable. */
+const uint64_t kSeed = 137;
+
+/**
+ * A key set to benchmark over: the keys to insert, in insertion order, along
+ * with random probe values drawn from the whole universe (some of which are
+ * in the set and most of which usually aren't).
+ */
+template <typename Key> struct Workload {
+  size_t universeBits;
+  Distribution distribution;
+  std::vector<Key> keys;
+  std::vector<Key> probes;
+};
+
+/* Reverses the low numBits bits of value. */
+inline uint64_t reverseBits(uint64_t value, size_t numBits) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < numBits; ++i, value >>= 1)
+    result = (result << 1) | (value & 1);
+  return result;
+}
+
+/**
+ * Builds a workload of count distinct keys from a universe of universeBits
+ * bits.  count must be no more than the size of the universe.
+ */
+template <typename Key>
+Workload<Key> makeWorkload(Distribution distribution, size_t universeBits,
+                           size_t count) {
+  const uint64_t universeMax = universeBits == 64? ~uint64_t(0) :
+                               (uint64_t(1) << universeBits) - 1;
+  std::mt19937_64 generator(kSeed);
+  std::uniform_int_distribution<uint64_t> anyKey(0, universeMax);
+
+  Workload<Key> result;
+  result.universeBits = universeBits;
+  result.distribution = distribution;
+
+  switch (distribution) {
+  case kDense: {
+    const uint64_t start =
+      std::uniform_int_distribution<uint64_t>(0, universeMax - (count - 1))(generator);
+    for (size_t i = 0; i < count; ++i)
+      result.keys.push_back(Key(start + i));
+    break;
+  }
+
+  case kSparse: {
+    /* For small universes, shuffling the universe and taking a prefix is
+     * cheap and works at any fill ratio.  For big ones the set is never
+     * close to full, so we just draw keys until we have enough.
+     */
+    if (universeBits <= 24) {
+      std::vector<Key> universe;
+      for (uint64_t key = 0; key <= universeMax; ++key)
+        universe.push_back(Key(key));
+      std::shuffle(universe.begin(), universe.end(), generator);
+      result.keys.assign(universe.begin(), universe.begin() + count);
+    } else {
+      std::unordered_set<uint64_t> seen;
+      while (result.keys.size() < count) {
+        const uint64_t key = anyKey(generator);
+        if (seen.insert(key).second) result.keys.push_back(Key(key));
+      }
+    }
+    break;
+  }
+
+  case kClustered: {
+    std::unordered_set<uint64_t> seen;
+    while (result.keys.size() < count) {
+      const uint64_t start = anyKey(generator);
+      for (uint64_t key = start;
+           key - start < kRunLength && key <= universeMax &&
+           result.keys.size() < count; ++key) {
+        if (seen.insert(key).second) result.keys.push_back(Key(key));
+      }
+    }
+    break;
+  }
+
+  case kAdversarial:
+    for (size_t i = 0; i < count; ++i)
+      result.keys.push_back(Key(reverseBits(i, universeBits)));
+    break;
+  }
+
+  if (distribution != kAdversarial)
+    std::shuffle(result.keys.begin(), result.keys.end(), generator);
+
+  for (size_t i = 0; i < kNumProbes; ++i)
+    result.probes.push_back(Key(anyKey(generator)));
+
+  return result;
+}
+
+/**
+ * Each container we measure is wrapped in an adapter exposing the same
+ * handful of set operations, so that every benchmark can be written once:
+ *
+ *   void insert(Key key);
+ *   void erase(Key key);
+ *   bool contains(Key key) const;
+ *   bool successor(Key key, Key& result) const;
+ *   bool predecessor(Key key, Key& result) const;
+ *   template <typename Function> void forEach(Function fn) const;
+ *   template <typename Function>
+ *   void forEachInRange(Key lo, Key hi, Function fn) const;
+ *   void assign(const std::vector<Key>& keys);
+ *   void unite(const Set& other);
+ *   void intersect(const Set& other);
+ *   size_t rank(Key key) const;
+ *   bool select(size_t index, Key& result) const;
+ *
+ * assign replaces the contents with the given keys, in whatever way is
+ * fastest for that container.
+ * successor and predecessor are strict, as they are in VanEmdeBoasTree.
+ * forEachInRange visits the keys from lo to hi, inclusive, in sorted order.
+ * unite and intersect replace the contents with the union or intersection of
+ * the contents and those of another container of the same type.
+ * rank counts the keys less than key, and select finds the key with index
+ * keys less than it, returning false if there are too few keys.
+ */
+
+/* Adapter for any VanEmdeBoasTree. */
+template <typename Tree> class TreeSet {
+public:
+  typedef typename Tree::key_type Key;
+
+  void insert(Key key) {
+    mTree.insert(key);
+  }
+  void erase(Key key) {
+    mTree.erase(key);
+  }
+  bool contains(Key key) const {
+    return mTree.find(key) != mTree.end();
+  }
+  bool successor(Key key, Key& result) const {
+    typename Tree::const_iterator itr = mTree.successor(key);
+    if (itr == mTree.end()) return false;
+    result = *itr;
+    return true;
+  }
+  bool predecessor(Key key, Key& result) const {
+    typename Tree::const_iterator itr = mTree.predecessor(key);
+    if (itr == mTree.end()) return false;
+    result = *itr;
+    return true;
+  }
+  template <typename Function> void forEach(Function fn) const {
+    for (typename Tree::const_iterator itr = mTree.begin();
+         itr != mTree.end(); ++itr)
+      fn(*itr);
+  }
+  template <typename Function>
+  void forEachInRange(Key lo, Key hi, Function fn) const {
+    mTree.for_each_in_range(lo, hi, fn);
+  }
+  void assign(const std::vector<Key>& keys) {
+    mTree.assign(keys.begin(), keys.end());
+  }
+  void unite(const TreeSet& other) {
+    mTree.set_union(other.mTree);
+  }
+  void intersect(const TreeSet& other) {
+    mTree.set_intersection(other.mTree);
+  }
+  size_t rank(Key key) const {
+    return mTree.rank(key);
+  }
+  bool select(size_t index, Key& result) const {
+    typename Tree::const_iterator itr = mTree.select(index);
+    if (itr == mTree.end()) return false;
+    result = *itr;
+    return true;
+  }
+
+private:
+  Tree mTree;
+};
+
+/* Adapter for std::set. */
+template <typename Key> class StdSet {
+public:
+  void insert(Key key) {
+    mSet.insert(key);
+  }
+  void erase(Key key) {
+    mSet.erase(key);
+  }
+  bool contains(Key key) const {
+    return mSet.count(key) != 0;
+  }
+  bool successor(Key key, Key& result) const {
+    typename std::set<Key>::const_iterator itr = mSet.upper_bound(key);
+    if (itr == mSet.end()) return false;
+    result = *itr;
+    return true;
+  }
+  bool predecessor(Key key, Key& result) const {
+    typename std::set<Key>::const_iterator itr = mSet.lower_bound(key);
+    if (itr == mSet.begin()) return false;
+    result = *--itr;
+    return true;
+  }
+  template <typename Function> void forEach(Function fn) const {
+    for (typename std::set<Key>::const_iterator itr = mSet.begin();
+         itr != mSet.end(); ++itr)
+      fn(*itr);
+  }
+  template <typename Function>
+  void forEachInRange(Key lo, Key hi, Function fn) const {
+    for (typename std::set<Key>::const_iterator itr = mSet.lower_bound(lo);
+         itr != mSet.end() && *itr <= hi; ++itr)
+      fn(*itr);
+  }
+  void assign(const std::vector<Key>& keys) {
+    std::set<Key>(keys.begin(), keys.end()).swap(mSet);
+  }
+  void unite(const StdSet& other) {
+    mSet.insert(other.mSet.begin(), other.mSet.end());
+  }
+  void intersect(const StdSet& other) {
+    std::set<Key> result;
+    std::set_intersection(mSet.begin(), mSet.end(),
+                          other.mSet.begin(), other.mSet.end(),
+                          std::inserter(result, result.end()));
+    mSet.swap(result);
+  }
+  size_t rank(Key key) const {
+    return size_t(std::distance(mSet.begin(), mSet.lower_bound(key)));
+  }
+  bool select(size_t index, Key& result) const {
+    if (index >= mSet.size()) return false;
+    result = *std::next(mSet.begin(), index);
+    return true;
+  }
+
+private:
+  std::set<Key> mSet;
+};
+
+/* Adapter for a sorted std::vector searched with binary search. */
+template <typename Key> class SortedVectorSet {
+public:
+  void insert(Key key) {
+    typename std::vector<Key>::iterator itr =
+      std::lower_bound(mKeys.begin(), mKeys.end(), key);
+    if (itr == mKeys.end() || *itr != key) mKeys.insert(itr, key);
+  }
+  void erase(Key key) {
+    typename std::vector<Key>::iterator itr =
+      std::lower_bound(mKeys.begin(), mKeys.end(), key);
+    if (itr != mKeys.end() && *itr == key) mKeys.erase(itr);
+  }
+  bool contains(Key key) const {
+    return std::binary_search(mKeys.begin(), mKeys.end(), key);
+  }
+  bool successor(Key key, Key& result) const {
+    typename std::vector<Key>::const_iterator itr =
+      std::upper_bound(mKeys.begin(), mKeys.end(), key);
+    if (itr == mKeys.end()) return false;
+    result = *itr;
+    return true;
+  }
+  bool predecessor(Key key, Key& result) const {
+    typename std::vector<Key>::const_iterator itr =
+      std::lower_bound(mKeys.begin(), mKeys.end(), key);
+    if (itr == mKeys.begin()) return false;
+    result = *--itr;
+    return true;
+  }
+  template <typename Function> void forEach(Function fn) const {
+    for (size_t i = 0; i < mKeys.size(); ++i)
+      fn(mKeys[i]);
+  }
+  template <typename Function>
+  void forEachInRange(Key lo, Key hi, Function fn) const {
+    for (typename std::vector<Key>::const_iterator itr =
+           std::lower_bound(mKeys.begin(), mKeys.end(), lo);
+         itr != mKeys.end() && *itr <= hi; ++itr)
+      fn(*itr);
+  }
+  void assign(const std::vector<Key>& keys) {
+    mKeys = keys;
+    std::sort(mKeys.begin(), mKeys.end());
+    mKeys.erase(std::unique(mKeys.begin(), mKeys.end()), mKeys.end());
+  }
+  void unite(const SortedVectorSet& other) {
+    std::vector<Key> result;
+    std::set_union(mKeys.begin(), mKeys.end(),
+                   other.mKeys.begin(), other.mKeys.end(),
+                   std::back_inserter(result));
+    mKeys.swap(result);
+  }
+  void intersect(const SortedVectorSet& other) {
+    std::vector<Key> result;
+    std::set_intersection(mKeys.begin(), mKeys.end(),
+                          other.mKeys.begin(), other.mKeys.end(),
+                          std::back_inserter(result));
+    mKeys.swap(result);
+  }
+  size_t rank(Key key) const {
+    return size_t(std::lower_bound(mKeys.begin(), mKeys.end(), key) -
+                  mKeys.begin());
+  }
+  bool select(size_t index, Key& result) const {
+    if (index >= mKeys.size()) return false;
+    result = mKeys[index];
+    return true;
+  }
+
+private:
+  std::vector<Key> mKeys;
+};
+
+/**
+ * Adapter for a flat std::bitset over the whole universe, which only makes
+ * sense for small universes.  libstdc++ has word-at-a-time scans for finding
+ * the next set bit, which we use where available; there's nothing similar
+ * for the previous set bit, so predecessor walks back one bit at a time.
+ */
+template <typename Key, size_t UniverseBits> class BitsetSet {
+public:
+  void insert(Key key) {
+    mBits.set(key);
+  }
+  void erase(Key key) {
+    mBits.reset(key);
+  }
+  bool contains(Key key) const {
+    return mBits.test(key);
+  }
+  bool successor(Key key, Key& result) const {
+#ifdef __GLIBCXX__
+    const size_t next = mBits._Find_next(key);
+    if (next >= mBits.size()) return false;
+    result = Key(next);
+    return true;
+#else
+    for (size_t next = size_t(key) + 1; next < mBits.size(); ++next) {
+      if (mBits.test(next)) {
+        result = Key(next);
+        return true;
+      }
+    }
+    return false;
+#endif
+  }
+  bool predecessor(Key key, Key& result) const {
+    for (size_t prev = key; prev-- > 0; ) {
+      if (mBits.test(prev)) {
+        result = Key(prev);
+        return true;
+      }
+    }
+    return false;
+  }
+  template <typename Function> void forEach(Function fn) const {
+#ifdef __GLIBCXX__
+    for (size_t i = mBits._Find_first(); i < mBits.size();
+         i = mBits._Find_next(i))
+      fn(Key(i));
+#else
+    for (size_t i = 0; i < mBits.size(); ++i)
+      if (mBits.test(i)) fn(Key(i));
+#endif
+  }
+  template <typename Function>
+  void forEachInRange(Key lo, Key hi, Function fn) const {
+#ifdef __GLIBCXX__
+    for (size_t i = mBits.test(lo)? lo : mBits._Find_next(lo); i <= hi;
+         i = mBits._Find_next(i))
+      fn(Key(i));
+#else
+    for (size_t i = lo; i <= hi; ++i)
+      if (mBits.test(i)) fn(Key(i));
+#endif
+  }
+  void assign(const std::vector<Key>& keys) {
+    mBits.reset();
+    for (size_t i = 0; i < keys.size(); ++i)
+      mBits.set(keys[i]);
+  }
+  void unite(const BitsetSet& other) {
+    mBits |= other.mBits;
+  }
+  void intersect(const BitsetSet& other) {
+    mBits &= other.mBits;
+  }
+  size_t rank(Key key) const {
+    return (mBits << (mBits.size() - key)).count();
+  }
+  bool select(size_t index, Key& result) const {
+#ifdef __GLIBCXX__
+    size_t i = mBits._Find_first();
+    for (; i < mBits.size() && index != 0; --index)
+      i = mBits._Find_next(i);
+    if (i >= mBits.size()) return false;
+    result = Key(i);
+    return true;
+#else
+    for (size_t i = 0; i < mBits.size(); ++i) {
+      if (mBits.test(i) && index-- == 0) {
+        result = Key(i);
+        return true;
+      }
+    }
+    return false;
+#endif
+  }
+
+private:
+  std::bitset<(size_t(1) << UniverseBits)> mBits;
+};
+
+#endif // WORKLOADS_H
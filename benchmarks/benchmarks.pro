@@ -0,0 +1,28 @@
+QT -= gui core
+
+TEMPLATE = app
+TARGET = benchmarks
+CONFIG += c++11 console release
+CONFIG -= app_bundle qt
+
+# The tree is header-only, so the benchmarks just need to see the headers.
+INCLUDEPATH += ..
+
+# Google Benchmark, with its stock main().  Run with
+#   --benchmark_out=results.json --benchmark_out_format=json
+# to record results.
+LIBS += -lbenchmark_main -lbenchmark -lpthread
+
+SOURCES += \
+    ConcurrentBenchmarks.cpp \
+    FileBenchmarks.cpp \
+    KernelBenchmarks.cpp \
+    MapBenchmarks.cpp \
+    MultisetBenchmarks.cpp \
+    NeighborBenchmarks.cpp \
+    PriorityQueueBenchmarks.cpp \
+    SetBenchmarks.cpp \
+    SnapshotBenchmarks.cpp
+
+HEADERS += \
+    Workloads.h
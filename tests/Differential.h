@@ -0,0 +1,1420 @@
+/**
+ * @headerfile Differential.h
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Differential testing of every tree variant against std::set.
+ */
+
+#ifndef DIFFERENTIAL_H
+#define DIFFERENTIAL_H
+
+#include "ConcurrentVanEmdeBoasTree.h"
+#include "FrozenVanEmdeBoasTree.h"
+#include "MappedVanEmdeBoasTree.h"
+#include "PersistentVanEmdeBoasTree.h"
+#include "ShardedVanEmdeBoasTree.h"
+#include "VanEmdeBoasMap.h"
+#include "VanEmdeBoasMultiset.h"
+#include "VanEmdeBoasTree.h"
+#include <algorithm>   // For set_union, set_intersection, set_difference,
+                       // set_symmetric_difference, equal
+#include <climits>     // For CHAR_BIT
+#include <cstddef>     // For size_t
+#include <cstdint>     // For uint8_t, uint16_t, uint64_t
+#include <cstdio>      // For fprintf, fopen, fwrite, fclose
+#include <cstdlib>     // For abort
+#include <functional>  // For ref
+#include <limits>      // For numeric_limits
+#include <iterator>    // For back_inserter, inserter, distance
+#include <map>         // For map
+#include <memory>      // For allocator, shared_ptr
+#include <random>      // For mt19937
+#include <set>         // For set
+#include <sstream>     // For stringstream
+#include <stdexcept>   // For out_of_range, overflow_error, runtime_error
+#include <string>      // For string, to_string
+#include <thread>      // For thread
+#include <type_traits> // For integral_constant, true_type, false_type
+#include <utility>     // For move, pair
+#include <vector>      // For vector
+
+/**
+ * Every variant of the tree is run through the same sequence of operations
+ * as a std::set of its key type, and every answer it gives is checked
+ * against the set's.  The operations are decoded from a string of bytes,
+ * four per operation, so the same inputs drive libFuzzer (FuzzTarget.cpp),
+ * which searches for strings that break something, and PropertyTests.cpp,
+ * which feeds in random strings and replays saved ones.
+ *
+ * The first byte of each operation picks what to do from a table weighted
+ * toward inserting and erasing, and how to pick the key: the next two bytes
+ * as they are, folded into the bottom 256 or 4096 values so that one
+ * cluster fills up, near the previous key, or at the edge of a 256-key
+ * cluster.  The last byte is a second argument, such as the width of a
+ * range.  Variants with 32- or 64-bit keys spread each 16-bit key over
+ * their universe with widen.  Keys outside a variant's universe are left as
+ * they are, so that narrower variants also check that such keys are
+ * rejected.
+ *
+ * VanEmdeBoasMap and VanEmdeBoasMultiset are run the same way against a
+ * std::map, with the operations standing for their own; see MapVariant and
+ * MultisetVariant.
+ *
+ * On the first wrong answer, the failure is described on stderr, the input
+ * being run is written to differential-failure.bin for replaying, and the
+ * process aborts.
+ */
+namespace Differential {
+  /* The operations. */
+  enum Opcode {
+    kInsert, kErase, kContains, kSuccessor, kPredecessor, kEnds,
+    kInsertNeighbors, kEraseSuccessor, kPopMin, kPopMax, kRange, kExtract,
+    kRankSelect, kBatch, kSetOperation, kSnapshot, kCheckAll
+  };
+  inline const char* opcodeName(Opcode code) {
+    static const char* const kNames[] = {
+      "insert", "erase", "contains", "successor", "predecessor", "ends",
+      "insert_and_neighbors", "erase_and_successor", "pop_min", "pop_max",
+      "range", "extract_if_le", "rank/select", "batch", "set operation",
+      "snapshot", "check all"
+    };
+    return kNames[code];
+  }
+
+  /* The first byte's low five bits index this table. */
+  const Opcode kOpcodeTable[32] = {
+    kInsert, kInsert, kInsert, kInsert, kInsert, kInsert,
+    kErase, kErase, kErase, kErase,
+    kContains, kContains,
+    kSuccessor, kSuccessor, kSuccessor,
+    kPredecessor, kPredecessor, kPredecessor,
+    kEnds,
+    kInsertNeighbors, kInsertNeighbors,
+    kEraseSuccessor, kEraseSuccessor,
+    kPopMin, kPopMax, kRange, kExtract, kRankSelect, kBatch, kSetOperation,
+    kSnapshot, kCheckAll
+  };
+
+  /* The number of bytes each operation takes. */
+  const size_t kOpBytes = 4;
+
+  struct Op {
+    Opcode code;
+    uint16_t key;
+    uint8_t arg;
+  };
+
+  /* Turns a string of bytes into operations; any partial operation at the
+   * end is ignored.
+   */
+  class Decoder {
+  public:
+    Decoder(const uint8_t* data, size_t size)
+      : mData(data), mEnd(data + size - size % kOpBytes), mLast(0) {}
+
+    bool next(Op& op) {
+      if (mData == mEnd) return false;
+      const uint8_t mode = mData[0] >> 5;
+      uint16_t key = static_cast<uint16_t>(mData[1] | (mData[2] << 8));
+      op.code = kOpcodeTable[mData[0] & 31];
+      op.arg = mData[3];
+      mData += kOpBytes;
+
+      switch (mode) {
+      case 3: key &= 0xFF; break;
+      case 4: key &= 0xFFF; break;
+      case 5: key = static_cast<uint16_t>(mLast + int8_t(op.arg)); break;
+      case 6: key = static_cast<uint16_t>((op.arg & 1)? key | 0xFF : key & 0xFF00); break;
+      default: break;
+      }
+      op.key = mLast = key;
+      return true;
+    }
+
+  private:
+    const uint8_t* mData;
+    const uint8_t* mEnd;
+    uint16_t mLast;
+  };
+
+  /* Spreads a decoded key over a wider key type.  The top four bits pick one
+   * of sixteen prefixes, some beyond 40 bits and some sharing their low 32
+   * bits, the next four pick one of sixteen blocks 2^20 keys apart, and the
+   * bottom eight a key within a 256-key cluster.  So keys that are close
+   * before widening share long prefixes after it, while the rest are far
+   * apart.  Keys of 16 bits or fewer are left as they are.
+   */
+  template <typename Key> Key widen(uint16_t key) {
+    static const uint64_t kPrefixes[16] = {
+      0x0000000000000000, 0x0000000001000000, 0x00000000FF000000,
+      0x0000000080000000, 0x0000001234000000, 0x000000FFFE000000,
+      0x000000FFFF000000, 0x0000010000000000, 0x0000ABCD12000000,
+      0x0123456789000000, 0x4000000042000000, 0x7FFFFFFFFF000000,
+      0x8000000000000000, 0x80000000C3000000, 0xDEADBEEF5A000000,
+      0xFFFFFFFFFF000000
+    };
+    if (sizeof(Key) <= sizeof(uint16_t)) return static_cast<Key>(key);
+    return static_cast<Key>(kPrefixes[key >> 12] |
+                            (uint64_t((key >> 8) & 15) << 20) | (key & 0xFF));
+  }
+
+  /* The input being run, so a failure can save it. */
+  struct Input {
+    const uint8_t* data;
+    size_t size;
+  };
+  inline Input& currentInput() {
+    static Input input = { NULL, 0 };
+    return input;
+  }
+
+  /* Reports a wrong answer and stops. */
+  inline void fail(const char* variant, size_t index, const Op& op,
+                   const std::string& what) {
+    std::fprintf(stderr, "%s: operation %zu (%s %u, %u): %s\n", variant, index,
+                 opcodeName(op.code), unsigned(op.key), unsigned(op.arg),
+                 what.c_str());
+
+    const Input& input = currentInput();
+    if (input.data != NULL) {
+      if (FILE* file = std::fopen("differential-failure.bin", "wb")) {
+        std::fwrite(input.data, 1, input.size, file);
+        std::fclose(file);
+        std::fprintf(stderr, "Input saved to differential-failure.bin.\n");
+      }
+    }
+    std::abort();
+  }
+  inline std::string describe(bool found, uint64_t key) {
+    return found? std::to_string(key) : std::string("none");
+  }
+
+  /* What the reference says the answers should be. */
+  template <typename Key>
+  bool refSuccessor(const std::set<Key>& ref, Key key, Key& result) {
+    typename std::set<Key>::const_iterator itr = ref.upper_bound(key);
+    if (itr == ref.end()) return false;
+    result = *itr;
+    return true;
+  }
+  template <typename Key>
+  bool refPredecessor(const std::set<Key>& ref, Key key, Key& result) {
+    typename std::set<Key>::const_iterator itr = ref.lower_bound(key);
+    if (itr == ref.begin()) return false;
+    result = *--itr;
+    return true;
+  }
+
+  /* Checks a found-or-not answer against the expected one. */
+  class Checker {
+  public:
+    Checker(const char* variant) : mVariant(variant), mIndex(0), mOp() {}
+
+    void begin(size_t index, const Op& op) {
+      mIndex = index;
+      mOp = op;
+    }
+    void expect(bool condition, const std::string& what) const {
+      if (!condition) fail(mVariant, mIndex, mOp, what);
+    }
+    void expectKey(const char* what, bool expectedFound, uint64_t expected,
+                   bool found, uint64_t actual) const {
+      if (expectedFound != found || (found && expected != actual))
+        fail(mVariant, mIndex, mOp, std::string(what) + ": expected " +
+             describe(expectedFound, expected) + ", got " + describe(found, actual));
+    }
+    void expectSize(size_t expected, size_t actual) const {
+      if (expected != actual)
+        fail(mVariant, mIndex, mOp, "size: expected " + std::to_string(expected) +
+             ", got " + std::to_string(actual));
+    }
+
+  private:
+    const char* mVariant;
+    size_t mIndex;
+    Op mOp;
+  };
+
+  /* Whether a key lies in a universe of the given width. */
+  template <size_t UniverseBits, typename Key> bool inUniverse(Key key) {
+    const size_t kKeyBits = sizeof(Key) * CHAR_BIT;
+    return UniverseBits >= kKeyBits || (key >> (UniverseBits % kKeyBits)) == 0;
+  }
+
+  /**
+   * Runs the operations against a VanEmdeBoasTree, which supports all of
+   * them.  Checking everything also checks a copy, a frozen copy, and a
+   * saved copy both loaded and mapped, and that loading or mapping a
+   * corrupted copy fails safely.
+   */
+  template <typename Tree, size_t UniverseBits>
+  class TreeVariant {
+    typedef typename Tree::key_type Key;
+    typedef std::set<Key> Reference;
+
+  public:
+    static void run(const char* name, const uint8_t* data, size_t size) {
+      Tree tree;
+      Reference ref;
+      Checker check(name);
+      Decoder decoder(data, size);
+      Op op;
+      for (size_t index = 0; decoder.next(op); ++index) {
+        check.begin(index, op);
+        apply(tree, ref, op, check);
+        check.expectSize(ref.size(), tree.size());
+      }
+      checkAll(tree, ref, Key(0), check);
+    }
+
+    /* Runs the operations without checking them, for timing. */
+    static uint64_t time(const std::vector<Op>& ops) {
+      Tree tree;
+      uint64_t sum = 0;
+      for (size_t i = 0; i < ops.size(); ++i) {
+        const Key key = widen<Key>(ops[i].key);
+        if (!inUniverse<UniverseBits>(key)) continue;
+        switch (ops[i].code) {
+        case kInsert: sum += tree.insert(key).second; break;
+        case kErase: sum += tree.erase(key); break;
+        case kSuccessor: {
+          typename Tree::const_iterator itr = tree.successor(key);
+          sum += itr == tree.end()? 0 : *itr;
+          break;
+        }
+        case kPredecessor: {
+          typename Tree::const_iterator itr = tree.predecessor(key);
+          sum += itr == tree.end()? 0 : *itr;
+          break;
+        }
+        default: sum += tree.find(key) != tree.end(); break;
+        }
+      }
+      return sum;
+    }
+
+  private:
+    static void apply(Tree& tree, Reference& ref, const Op& op, Checker& check) {
+      const Key key = widen<Key>(op.key);
+      const bool valid = inUniverse<UniverseBits>(key);
+      typename Tree::const_iterator prev, next;
+      Key expected = 0;
+
+      switch (op.code) {
+      case kInsert:
+      case kSnapshot:
+        if (!valid) {
+          bool threw = false;
+          try { tree.insert(key); } catch (const std::out_of_range&) { threw = true; }
+          check.expect(threw, "insert outside the universe didn't throw");
+        } else {
+          const bool inserted = tree.insert(key).second;
+          check.expect(inserted == ref.insert(key).second, "insert result");
+        }
+        break;
+
+      case kErase:
+        check.expect(tree.erase(key) == (ref.erase(key) != 0), "erase result");
+        break;
+
+      case kContains:
+        check.expect((tree.find(key) != tree.end()) == (ref.count(key) != 0),
+                     "find result");
+        break;
+
+      case kSuccessor: {
+        next = tree.successor(key);
+        const bool found = refSuccessor(ref, key, expected);
+        check.expectKey("successor", found, expected, next != tree.end(),
+                        next != tree.end()? *next : Key(0));
+        break;
+      }
+
+      case kPredecessor: {
+        prev = tree.predecessor(key);
+        const bool found = refPredecessor(ref, key, expected);
+        check.expectKey("predecessor", found, expected, prev != tree.end(),
+                        prev != tree.end()? *prev : Key(0));
+        break;
+      }
+
+      case kEnds:
+        check.expect(tree.empty() == ref.empty(), "empty");
+        if (!ref.empty()) {
+          check.expectKey("min", true, *ref.begin(), true, *tree.begin());
+          check.expectKey("max", true, *ref.rbegin(), true, *tree.rbegin());
+        }
+        break;
+
+      case kInsertNeighbors: {
+        if (!valid) break;
+        const bool inserted = tree.insert_and_neighbors(key, prev, next);
+        check.expect(inserted == ref.insert(key).second, "insert_and_neighbors result");
+        bool found = refPredecessor(ref, key, expected);
+        check.expectKey("inserted predecessor", found, expected, prev != tree.end(),
+                        prev != tree.end()? *prev : Key(0));
+        found = refSuccessor(ref, key, expected);
+        check.expectKey("inserted successor", found, expected, next != tree.end(),
+                        next != tree.end()? *next : Key(0));
+        break;
+      }
+
+      case kEraseSuccessor: {
+        const bool erased = tree.erase_and_successor(key, next);
+        check.expect(erased == (ref.erase(key) != 0), "erase_and_successor result");
+        const bool found = refSuccessor(ref, key, expected);
+        check.expectKey("erased successor", found, expected, next != tree.end(),
+                        next != tree.end()? *next : Key(0));
+        break;
+      }
+
+      case kPopMin:
+      case kPopMax: {
+        Key popped = 0;
+        const bool found = op.code == kPopMin? tree.pop_min(popped) : tree.pop_max(popped);
+        const bool expectedFound = !ref.empty();
+        if (expectedFound) {
+          expected = op.code == kPopMin? *ref.begin() : *ref.rbegin();
+          ref.erase(expected);
+        }
+        check.expectKey(opcodeName(op.code), expectedFound, expected, found, popped);
+        break;
+      }
+
+      case kRange: {
+        const Key hi = static_cast<Key>(key + Key(op.arg) * Key(op.arg));
+        std::vector<Key> expectedKeys, actualKeys;
+        if (key <= hi)
+          expectedKeys.assign(ref.lower_bound(key), ref.upper_bound(hi));
+        tree.for_each_in_range(key, hi, [&](Key value) { actualKeys.push_back(value); });
+        check.expect(actualKeys == expectedKeys, "for_each_in_range keys");
+        check.expect(tree.count_in_range(key, hi) == expectedKeys.size(), "count_in_range");
+        break;
+      }
+
+      case kExtract: {
+        /* Take off about a sixteenth of the keys at a time. */
+        const Key bound = static_cast<Key>(key >> 4);
+        std::vector<Key> expectedKeys(ref.begin(), ref.upper_bound(bound));
+        std::vector<Key> actualKeys;
+        tree.extract_if_le(bound, std::back_inserter(actualKeys));
+        ref.erase(ref.begin(), ref.upper_bound(bound));
+        check.expect(actualKeys == expectedKeys, "extract_if_le keys");
+        break;
+      }
+
+      case kRankSelect: {
+        const size_t rank = size_t(std::distance(ref.begin(), ref.lower_bound(key)));
+        check.expect(tree.rank(key) == rank, "rank");
+        next = tree.select(rank);
+        const bool found = rank < ref.size();
+        check.expectKey("select", found, found? *ref.lower_bound(key) : Key(0),
+                        next != tree.end(), next != tree.end()? *next : Key(0));
+        break;
+      }
+
+      case kBatch: {
+        /* A strided run of keys, inserted, looked up, or erased at once. */
+        if (!valid) break;
+        std::vector<Key> keys;
+        const Key stride = static_cast<Key>(1 + (op.arg >> 4) * 37);
+        for (size_t i = 0; i <= size_t(op.arg & 15); ++i) {
+          const Key batchKey = static_cast<Key>(key + i * stride);
+          if (inUniverse<UniverseBits>(batchKey)) keys.push_back(batchKey);
+        }
+        std::vector<uint64_t> results((keys.size() + 63) / 64 + 1);
+        size_t expectedCount = 0, count = 0;
+        std::vector<bool> expectedBits;
+        for (size_t i = 0; i < keys.size(); ++i) {
+          bool hit;
+          switch (op.arg % 3) {
+          case 0:  hit = ref.insert(keys[i]).second; break;
+          case 1:  hit = ref.erase(keys[i]) != 0; break;
+          default: hit = ref.count(keys[i]) != 0; break;
+          }
+          expectedBits.push_back(hit);
+          expectedCount += hit;
+        }
+        switch (op.arg % 3) {
+        case 0:  count = tree.insert_batch(keys.data(), keys.size(), results.data()); break;
+        case 1:  count = tree.erase_batch(keys.data(), keys.size(), results.data()); break;
+        default: count = tree.contains_batch(keys.data(), keys.size(), results.data()); break;
+        }
+        check.expect(count == expectedCount, "batch count");
+        for (size_t i = 0; i < keys.size(); ++i)
+          check.expect(VanEmdeBoasBits::test(results.data(), i) == expectedBits[i],
+                       "batch result bit " + std::to_string(i));
+        break;
+      }
+
+      case kSetOperation: {
+        /* Combine with a small tree of keys near this one. */
+        Reference otherRef;
+        for (size_t i = 0; i < 16; ++i) {
+          const Key otherKey = static_cast<Key>(key + i * (1 + op.arg));
+          if (inUniverse<UniverseBits>(otherKey)) otherRef.insert(otherKey);
+        }
+        const Tree other(otherRef.begin(), otherRef.end());
+        Reference result;
+        switch (op.arg % 4) {
+        case 0:
+          tree.set_union(other);
+          std::set_union(ref.begin(), ref.end(), otherRef.begin(), otherRef.end(),
+                         std::inserter(result, result.end()));
+          break;
+        case 1:
+          tree.set_intersection(other);
+          std::set_intersection(ref.begin(), ref.end(), otherRef.begin(), otherRef.end(),
+                                std::inserter(result, result.end()));
+          break;
+        case 2:
+          tree.set_difference(other);
+          std::set_difference(ref.begin(), ref.end(), otherRef.begin(), otherRef.end(),
+                              std::inserter(result, result.end()));
+          break;
+        default:
+          tree.set_symmetric_difference(other);
+          std::set_symmetric_difference(ref.begin(), ref.end(),
+                                        otherRef.begin(), otherRef.end(),
+                                        std::inserter(result, result.end()));
+          break;
+        }
+        ref.swap(result);
+        check.expect(std::equal(ref.begin(), ref.end(), tree.begin()) &&
+                     ref.size() == tree.size(), "set operation result");
+        break;
+      }
+
+      case kCheckAll:
+        checkAll(tree, ref, key, check);
+        break;
+      }
+    }
+
+    /* Compares everything the tree and its copies hold with the reference,
+     * and asks each copy about the key.
+     */
+    static void checkAll(const Tree& tree, const Reference& ref, Key key,
+                         const Checker& check) {
+      check.expect(std::equal(ref.begin(), ref.end(), tree.begin()) &&
+                   ref.size() == tree.size(), "forward iteration");
+      check.expect(std::equal(ref.rbegin(), ref.rend(), tree.rbegin()),
+                   "reverse iteration");
+
+      const Tree copy(tree);
+      check.expect(std::equal(ref.begin(), ref.end(), copy.begin()) &&
+                   ref.size() == copy.size(), "copy");
+
+      const FrozenVanEmdeBoasTree<Key, UniverseBits> frozen = tree.freeze();
+      std::vector<Key> frozenKeys;
+      frozen.for_each([&](Key value) { frozenKeys.push_back(value); });
+      check.expect(std::equal(ref.begin(), ref.end(), frozenKeys.begin()) &&
+                   ref.size() == frozenKeys.size(), "frozen keys");
+      checkQueries("frozen", frozen, ref, key, check);
+
+      std::stringstream saved;
+      tree.save(saved);
+      const std::string bytes = saved.str();
+      Tree loaded;
+      loaded.load(saved);
+      check.expect(std::equal(ref.begin(), ref.end(), loaded.begin()) &&
+                   ref.size() == loaded.size(), "loaded keys");
+
+      /* A mapped tree needs its bytes aligned to eight. */
+      std::vector<uint64_t> aligned((bytes.size() + 7) / 8);
+      std::copy(bytes.begin(), bytes.end(), reinterpret_cast<char*>(aligned.data()));
+      const MappedVanEmdeBoasTree<Key, UniverseBits> mapped(aligned.data(), bytes.size());
+      check.expectSize(ref.size(), mapped.size());
+      checkQueries("mapped", mapped, ref, key, check);
+
+      checkCorrupted(bytes, uint64_t(key), check);
+    }
+
+    /* Flips one to three bits of a saved tree, picked by the seed.  Every
+     * bit of the format is checked, so with one bit flipped, load must
+     * throw.  With more, the flips may cancel out, so load may succeed, but
+     * then the tree must be a well-formed one.  Either way, a tree mapped
+     * onto the bytes may throw or answer wrongly, but mustn't read outside
+     * them, which the sanitizers check.
+     */
+    static void checkCorrupted(std::string bytes, uint64_t seed, const Checker& check) {
+      const size_t numFlips = 1 + seed % 3;
+      for (size_t i = 0; i < numFlips; ++i) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        const size_t bit = size_t(seed >> 16) % (bytes.size() * CHAR_BIT);
+        bytes[bit / CHAR_BIT] = char(bytes[bit / CHAR_BIT] ^ (1 << (bit % CHAR_BIT)));
+      }
+
+      std::stringstream corrupted(bytes);
+      Tree loaded;
+      bool threw = false;
+      try { loaded.load(corrupted); } catch (const std::runtime_error&) { threw = true; }
+      if (threw) {
+        check.expect(loaded.empty(), "corrupted load changed the tree");
+      } else {
+        check.expect(numFlips > 1, "load accepted a file with a bit flipped");
+        size_t count = 0;
+        for (typename Tree::const_iterator itr = loaded.begin(); itr != loaded.end(); ++itr)
+          ++count;
+        check.expect(count == loaded.size(), "corrupted load gave a malformed tree");
+      }
+
+      std::vector<uint64_t> aligned((bytes.size() + 7) / 8);
+      std::copy(bytes.begin(), bytes.end(), reinterpret_cast<char*>(aligned.data()));
+      try {
+        const MappedVanEmdeBoasTree<Key, UniverseBits> mapped(aligned.data(), bytes.size());
+        Key value = 0;
+        const Key probe = static_cast<Key>(seed);
+        mapped.contains(probe);
+        mapped.successor(probe, value);
+        mapped.predecessor(probe, value);
+        mapped.last(value);
+        bool found = mapped.first(value);
+        for (size_t steps = 0; found && steps < bytes.size() * CHAR_BIT; ++steps)
+          found = mapped.successor(value, value);
+      } catch (const std::runtime_error&) {
+      }
+    }
+
+    /* Checks the queries of a read-only tree with the wrapper interface. */
+    template <typename ReadOnly>
+    static void checkQueries(const std::string& what, const ReadOnly& tree,
+                             const Reference& ref, Key key, const Checker& check) {
+      Key expected = 0, actual = 0;
+      check.expect(tree.contains(key) == (ref.count(key) != 0), what + " contains");
+      bool expectedFound = refSuccessor(ref, key, expected);
+      bool found = tree.successor(key, actual);
+      check.expectKey((what + " successor").c_str(), expectedFound, expected, found, actual);
+      expectedFound = refPredecessor(ref, key, expected);
+      found = tree.predecessor(key, actual);
+      check.expectKey((what + " predecessor").c_str(), expectedFound, expected, found, actual);
+      found = tree.first(actual);
+      check.expectKey((what + " first").c_str(), !ref.empty(),
+                      ref.empty()? Key(0) : *ref.begin(), found, actual);
+      found = tree.last(actual);
+      check.expectKey((what + " last").c_str(), !ref.empty(),
+                      ref.empty()? Key(0) : *ref.rbegin(), found, actual);
+    }
+  };
+
+  /**
+   * Runs the operations against one of the trees with the smaller interface
+   * of insert, erase, contains, successor, predecessor, first, and last:
+   * ConcurrentVanEmdeBoasTree, ShardedVanEmdeBoasTree, and
+   * PersistentVanEmdeBoasTree.  The fused operations become plain inserts
+   * and erases, and the rest they don't have become lookups.
+   * If Snapshots is set, snapshot operations keep a copy of the tree along
+   * with a copy of the reference, and checking everything checks that each
+   * copy still holds what it did when it was taken.  The concurrent trees
+   * are only run from one thread here; see ThreadedVariant for several.
+   */
+  template <typename Tree, size_t UniverseBits, bool Snapshots>
+  class WrapperVariant {
+    typedef typename Tree::key_type Key;
+    typedef std::set<Key> Reference;
+
+  public:
+    static void run(const char* name, const uint8_t* data, size_t size) {
+      Tree tree;
+      Reference ref;
+      std::vector<Snapshot> snapshots;
+      Checker check(name);
+      Decoder decoder(data, size);
+      Op op;
+      for (size_t index = 0; decoder.next(op); ++index) {
+        check.begin(index, op);
+        apply(tree, ref, snapshots, op, check);
+        check.expectSize(ref.size(), tree.size());
+      }
+      checkAll(tree, ref, check);
+      for (size_t i = 0; i < snapshots.size(); ++i)
+        checkAll(*snapshots[i].tree, snapshots[i].ref, check);
+    }
+
+    /* Runs the operations without checking them, for timing. */
+    static uint64_t time(const std::vector<Op>& ops) {
+      Tree tree;
+      uint64_t sum = 0;
+      for (size_t i = 0; i < ops.size(); ++i) {
+        const Key key = widen<Key>(ops[i].key);
+        if (!inUniverse<UniverseBits>(key)) continue;
+        Key result = 0;
+        switch (ops[i].code) {
+        case kInsert: sum += tree.insert(key); break;
+        case kErase: sum += tree.erase(key); break;
+        case kSuccessor: sum += tree.successor(key, result)? result : 0; break;
+        case kPredecessor: sum += tree.predecessor(key, result)? result : 0; break;
+        default: sum += tree.contains(key); break;
+        }
+      }
+      return sum;
+    }
+
+  private:
+    struct Snapshot {
+      std::shared_ptr<Tree> tree;
+      Reference ref;
+    };
+
+    static void apply(Tree& tree, Reference& ref, std::vector<Snapshot>& snapshots,
+                      const Op& op, Checker& check) {
+      const Key key = widen<Key>(op.key);
+      Key expected = 0, actual = 0;
+
+      switch (op.code) {
+      case kInsert:
+      case kInsertNeighbors:
+        if (!inUniverse<UniverseBits>(key)) {
+          bool threw = false;
+          try { tree.insert(key); } catch (const std::out_of_range&) { threw = true; }
+          check.expect(threw, "insert outside the universe didn't throw");
+        } else {
+          check.expect(tree.insert(key) == ref.insert(key).second, "insert result");
+        }
+        break;
+
+      case kErase:
+      case kEraseSuccessor:
+        check.expect(tree.erase(key) == (ref.erase(key) != 0), "erase result");
+        break;
+
+      case kSuccessor: {
+        const bool expectedFound = refSuccessor(ref, key, expected);
+        const bool found = tree.successor(key, actual);
+        check.expectKey("successor", expectedFound, expected, found, actual);
+        break;
+      }
+
+      case kPredecessor: {
+        const bool expectedFound = refPredecessor(ref, key, expected);
+        const bool found = tree.predecessor(key, actual);
+        check.expectKey("predecessor", expectedFound, expected, found, actual);
+        break;
+      }
+
+      case kEnds: {
+        check.expect(tree.empty() == ref.empty(), "empty");
+        bool found = tree.first(actual);
+        check.expectKey("first", !ref.empty(), ref.empty()? Key(0) : *ref.begin(),
+                        found, actual);
+        found = tree.last(actual);
+        check.expectKey("last", !ref.empty(), ref.empty()? Key(0) : *ref.rbegin(),
+                        found, actual);
+        break;
+      }
+
+      case kSnapshot:
+        if (!takeSnapshot(tree, ref, snapshots, op.arg,
+                          std::integral_constant<bool, Snapshots>()))
+          check.expect(tree.contains(key) == (ref.count(key) != 0), "contains result");
+        break;
+
+      case kCheckAll:
+        checkAll(tree, ref, check);
+        for (size_t i = 0; i < snapshots.size(); ++i)
+          checkAll(*snapshots[i].tree, snapshots[i].ref, check);
+        break;
+
+      default:
+        check.expect(tree.contains(key) == (ref.count(key) != 0), "contains result");
+        break;
+      }
+    }
+
+    /* Keeps at most four snapshots, replacing them round-robin.  The trees
+     * that can't be copied do nothing.
+     */
+    static bool takeSnapshot(const Tree& tree, const Reference& ref,
+                             std::vector<Snapshot>& snapshots, uint8_t arg,
+                             std::true_type) {
+      Snapshot snapshot = { std::shared_ptr<Tree>(new Tree(tree)), ref };
+      if (snapshots.size() < 4)
+        snapshots.push_back(snapshot);
+      else
+        snapshots[arg % 4] = snapshot;
+      return true;
+    }
+    static bool takeSnapshot(const Tree&, const Reference&, std::vector<Snapshot>&,
+                             uint8_t, std::false_type) {
+      return false;
+    }
+
+    /* Walks the whole tree by successor, comparing it with the reference. */
+    static void checkAll(const Tree& tree, const Reference& ref, const Checker& check) {
+      Key actual = 0;
+      bool found = tree.first(actual);
+      for (typename Reference::const_iterator itr = ref.begin(); itr != ref.end(); ++itr) {
+        check.expectKey("walk", true, *itr, found, actual);
+        found = tree.successor(actual, actual);
+      }
+      check.expect(!found, "walk: extra key " + std::to_string(actual));
+    }
+  };
+
+  /**
+   * Runs the operations against a VanEmdeBoasMap from keys to strings, and
+   * checks it against a std::map.  Inserts go in by insert, operator[], or
+   * insert_or_assign, and erases by key or by an iterator from successor.
+   * Snapshots copy and move the map around and check every copy, and
+   * ranges step iterators both ways from a key.  The values are long enough
+   * to live on the heap, so entries that move when a table grows or shrinks
+   * are checked, and leak-checked, too.
+   */
+  template <typename Map, size_t UniverseBits>
+  class MapVariant {
+    typedef typename Map::key_type Key;
+    typedef std::map<Key, std::string> Reference;
+
+  public:
+    static void run(const char* name, const uint8_t* data, size_t size) {
+      Map map;
+      Reference ref;
+      Checker check(name);
+      Decoder decoder(data, size);
+      Op op;
+      for (size_t index = 0; decoder.next(op); ++index) {
+        check.begin(index, op);
+        apply(map, ref, op, check);
+        check.expectSize(ref.size(), map.size());
+      }
+      checkAll(map, ref, check);
+    }
+
+    /* Runs the operations without checking them, for timing. */
+    static uint64_t time(const std::vector<Op>& ops) {
+      Map map;
+      uint64_t sum = 0;
+      for (size_t i = 0; i < ops.size(); ++i) {
+        const Key key = widen<Key>(ops[i].key);
+        if (!inUniverse<UniverseBits>(key)) continue;
+        switch (ops[i].code) {
+        case kInsert: sum += map.insert(key, valueFor(ops[i])).second; break;
+        case kErase: sum += map.erase(key); break;
+        case kSuccessor: {
+          typename Map::const_iterator itr = map.successor(key);
+          sum += itr == map.end()? 0 : itr->second.size();
+          break;
+        }
+        case kPredecessor: {
+          typename Map::const_iterator itr = map.predecessor(key);
+          sum += itr == map.end()? 0 : itr->second.size();
+          break;
+        }
+        default: sum += map.contains(key); break;
+        }
+      }
+      return sum;
+    }
+
+  private:
+    /* A value too long for the small-string buffer, made from the argument. */
+    static std::string valueFor(const Op& op) {
+      return std::string(24 + op.arg % 16, char('a' + op.arg % 26));
+    }
+
+    static void apply(Map& map, Reference& ref, const Op& op, Checker& check) {
+      const Key key = widen<Key>(op.key);
+      const std::string value = valueFor(op);
+      typename Reference::const_iterator expected;
+      typename Map::const_iterator actual;
+
+      switch (op.code) {
+      case kInsert:
+      case kInsertNeighbors:
+      case kPopMin: {
+        if (!inUniverse<UniverseBits>(key)) {
+          bool threw = false;
+          try { map.insert(key, value); } catch (const std::out_of_range&) { threw = true; }
+          check.expect(threw, "insert outside the universe didn't throw");
+          break;
+        }
+        if (op.code == kInsertNeighbors) {
+          map[key] += value;
+          ref[key] += value;
+          break;
+        }
+        const std::pair<typename Map::iterator, bool> result =
+          op.code == kInsert? map.insert(key, value) : map.insert_or_assign(key, value);
+        const bool inserted = ref.count(key) == 0;
+        if (op.code == kInsert) ref.insert(std::make_pair(key, value));
+        else ref[key] = value;
+        check.expect(result.second == inserted, "insert result");
+        check.expect(result.first->first == key && result.first->second == ref[key],
+                     "inserted entry");
+        break;
+      }
+
+      case kErase:
+        check.expect(map.erase(key) == (ref.erase(key) != 0), "erase result");
+        break;
+
+      case kEraseSuccessor: {
+        expected = ref.upper_bound(key);
+        const bool erased = map.erase(map.successor(key));
+        check.expect(erased == (expected != ref.end()), "erase(iterator) result");
+        if (expected != ref.end()) ref.erase(expected);
+        break;
+      }
+
+      case kContains: {
+        expected = ref.find(key);
+        check.expect(map.contains(key) == (expected != ref.end()), "contains result");
+        bool threw = false;
+        try {
+          const std::string& found = map.at(key);
+          check.expect(expected != ref.end() && found == expected->second, "at value");
+        } catch (const std::out_of_range&) {
+          threw = true;
+        }
+        check.expect(threw == (expected == ref.end()), "at threw");
+        break;
+      }
+
+      case kSuccessor:
+      case kPredecessor:
+        if (op.code == kSuccessor) {
+          expected = ref.upper_bound(key);
+          actual = map.successor(key);
+        } else {
+          expected = ref.lower_bound(key);
+          expected = expected == ref.begin()? ref.end() : --expected;
+          actual = map.predecessor(key);
+        }
+        checkEntry(opcodeName(op.code), map, ref, expected, actual, check);
+        break;
+
+      case kEnds:
+        check.expect(map.empty() == ref.empty(), "empty");
+        if (!ref.empty()) {
+          checkEntry("first", map, ref, ref.begin(), map.begin(), check);
+          check.expect(map.rbegin()->first == ref.rbegin()->first &&
+                       map.rbegin()->second == ref.rbegin()->second, "last entry");
+        }
+        break;
+
+      case kRange: {
+        /* Step forward from the key's successor, then back past it. */
+        expected = ref.upper_bound(key);
+        actual = map.successor(key);
+        const size_t steps = op.arg % 8;
+        for (size_t i = 0; i < steps && expected != ref.end(); ++i, ++expected, ++actual)
+          checkEntry("forward step", map, ref, expected, actual, check);
+        checkEntry("forward step", map, ref, expected, actual, check);
+        for (size_t i = 0; i < 2 * steps && expected != ref.begin(); ++i) {
+          --expected;
+          --actual;
+          checkEntry("backward step", map, ref, expected, actual, check);
+        }
+        break;
+      }
+
+      case kSnapshot: {
+        Map copy(map);
+        checkAll(copy, ref, check);
+        Map moved(std::move(copy));
+        check.expect(copy.empty() && copy.begin() == copy.end(), "moved-from map");
+        copy = moved;
+        checkAll(copy, ref, check);
+        map = std::move(copy);
+        check.expect(copy.empty(), "moved-from map");
+        break;
+      }
+
+      case kCheckAll:
+        checkAll(map, ref, check);
+        break;
+
+      default:
+        check.expect(map.contains(key) == (ref.count(key) != 0), "contains result");
+        break;
+      }
+    }
+
+    /* Checks that an iterator is at the same entry as the reference's. */
+    static void checkEntry(const char* what, const Map& map, const Reference& ref,
+                           typename Reference::const_iterator expected,
+                           typename Map::const_iterator actual, const Checker& check) {
+      const bool found = actual != map.end();
+      check.expectKey(what, expected != ref.end(),
+                      expected != ref.end()? expected->first : Key(0),
+                      found, found? actual->first : Key(0));
+      if (found)
+        check.expect(actual->second == expected->second,
+                     std::string(what) + ": wrong value");
+    }
+
+    /* Walks the map forward, backward, and by for_each. */
+    static void checkAll(const Map& map, const Reference& ref, const Checker& check) {
+      check.expect(std::distance(map.begin(), map.end()) == std::ptrdiff_t(ref.size()),
+                   "forward walk length");
+      check.expect(std::equal(ref.begin(), ref.end(), map.begin()), "forward walk");
+      check.expect(std::distance(map.rbegin(), map.rend()) == std::ptrdiff_t(ref.size()),
+                   "backward walk length");
+      check.expect(std::equal(ref.rbegin(), ref.rend(), map.rbegin()), "backward walk");
+
+      typename Reference::const_iterator itr = ref.begin();
+      bool same = true;
+      map.for_each([&](Key key, const std::string& value) {
+        same = same && itr != ref.end() && itr->first == key && itr->second == value;
+        if (itr != ref.end()) ++itr;
+      });
+      check.expect(same && itr == ref.end(), "for_each");
+    }
+  };
+
+  /**
+   * Runs the operations against a VanEmdeBoasMultiset, and checks it
+   * against a std::map from each key to its count along with the total of
+   * the counts.  Inserts and erases take between zero and 255 copies, so
+   * they insert none, erase none, and erase more copies than there are, and
+   * an argument of 255 inserts as many copies as a Count holds, so that
+   * both a key's count and the total size overflow.  Whole keys go by
+   * erase_all.  Snapshots copy and move the multiset around and check every
+   * copy.
+   */
+  template <typename Multiset, size_t UniverseBits>
+  class MultisetVariant {
+    typedef typename Multiset::key_type Key;
+    typedef typename Multiset::count_type Count;
+
+    /* The counts, and their total. */
+    struct Reference {
+      std::map<Key, uint64_t> counts;
+      uint64_t size;
+    };
+
+  public:
+    static void run(const char* name, const uint8_t* data, size_t size) {
+      Multiset multiset;
+      Reference ref = { std::map<Key, uint64_t>(), 0 };
+      Checker check(name);
+      Decoder decoder(data, size);
+      Op op;
+      for (size_t index = 0; decoder.next(op); ++index) {
+        check.begin(index, op);
+        apply(multiset, ref, op, check);
+        check.expectSize(ref.size, multiset.size());
+        check.expectSize(ref.counts.size(), multiset.distinct_size());
+      }
+      checkAll(multiset, ref, check);
+    }
+
+    /* Runs the operations without checking them, for timing. */
+    static uint64_t time(const std::vector<Op>& ops) {
+      Multiset multiset;
+      uint64_t sum = 0;
+      for (size_t i = 0; i < ops.size(); ++i) {
+        const Key key = widen<Key>(ops[i].key);
+        if (!inUniverse<UniverseBits>(key)) continue;
+        switch (ops[i].code) {
+        case kInsert: sum += multiset.insert(key); break;
+        case kErase: sum += multiset.erase(key); break;
+        case kSuccessor: {
+          typename Multiset::const_iterator itr = multiset.successor(key);
+          sum += itr == multiset.end()? 0 : *itr;
+          break;
+        }
+        case kPredecessor: {
+          typename Multiset::const_iterator itr = multiset.predecessor(key);
+          sum += itr == multiset.end()? 0 : *itr;
+          break;
+        }
+        default: sum += multiset.count(key); break;
+        }
+      }
+      return sum;
+    }
+
+  private:
+    static uint64_t countOf(const Reference& ref, Key key) {
+      typename std::map<Key, uint64_t>::const_iterator itr = ref.counts.find(key);
+      return itr == ref.counts.end()? 0 : itr->second;
+    }
+
+    static void apply(Multiset& multiset, Reference& ref, const Op& op, Checker& check) {
+      const Key key = widen<Key>(op.key);
+      const uint64_t before = countOf(ref, key);
+
+      switch (op.code) {
+      case kInsert:
+      case kInsertNeighbors: {
+        const Count kMaxCount = std::numeric_limits<Count>::max();
+        const Count copies = op.code == kInsert? Count(op.arg % 4) :
+                             op.arg == 255? kMaxCount : Count(op.arg);
+        bool outOfRange = false, overflow = false;
+        Count result = 0;
+        try {
+          result = multiset.insert(key, copies);
+        } catch (const std::out_of_range&) {
+          outOfRange = true;
+        } catch (const std::overflow_error&) {
+          overflow = true;
+        }
+        if (!inUniverse<UniverseBits>(key)) {
+          check.expect(outOfRange, "insert outside the universe didn't throw");
+          break;
+        }
+        const bool expectOverflow =
+          copies > kMaxCount - before ||
+          copies > std::numeric_limits<size_t>::max() - ref.size;
+        check.expect(!outOfRange && overflow == expectOverflow, "insert overflow");
+        if (expectOverflow) break;
+        check.expectKey("insert count", true, before + copies, true, result);
+        if (before + copies != 0) ref.counts[key] = before + copies;
+        ref.size += copies;
+        break;
+      }
+
+      case kErase:
+      case kEraseSuccessor: {
+        const Count copies = Count(op.code == kErase? op.arg % 4 : op.arg);
+        const uint64_t removed = copies < before? copies : before;
+        check.expectKey("erase count", true, removed, true, multiset.erase(key, copies));
+        if (before - removed == 0) ref.counts.erase(key);
+        else ref.counts[key] = before - removed;
+        ref.size -= removed;
+        break;
+      }
+
+      case kPopMin:
+      case kPopMax:
+        check.expectKey("erase_all count", true, before, true, multiset.erase_all(key));
+        ref.counts.erase(key);
+        ref.size -= before;
+        break;
+
+      case kSuccessor:
+      case kPredecessor: {
+        typename std::map<Key, uint64_t>::const_iterator expected;
+        typename Multiset::const_iterator actual;
+        if (op.code == kSuccessor) {
+          expected = ref.counts.upper_bound(key);
+          actual = multiset.successor(key);
+        } else {
+          expected = ref.counts.lower_bound(key);
+          expected = expected == ref.counts.begin()? ref.counts.end() : --expected;
+          actual = multiset.predecessor(key);
+        }
+        check.expectKey(opcodeName(op.code), expected != ref.counts.end(),
+                        expected != ref.counts.end()? expected->first : Key(0),
+                        actual != multiset.end(),
+                        actual != multiset.end()? *actual : Key(0));
+        break;
+      }
+
+      case kEnds:
+        check.expect(multiset.empty() == ref.counts.empty(), "empty");
+        if (!ref.counts.empty()) {
+          check.expectKey("first", true, ref.counts.begin()->first, true, *multiset.begin());
+          check.expectKey("last", true, ref.counts.rbegin()->first, true, *multiset.rbegin());
+        }
+        break;
+
+      case kSnapshot: {
+        Multiset copy(multiset);
+        checkAll(copy, ref, check);
+        Multiset moved(std::move(copy));
+        check.expect(copy.empty() && copy.size() == 0, "moved-from multiset");
+        copy = moved;
+        checkAll(copy, ref, check);
+        multiset = std::move(copy);
+        check.expect(copy.empty() && copy.size() == 0, "moved-from multiset");
+        break;
+      }
+
+      case kCheckAll:
+        checkAll(multiset, ref, check);
+        break;
+
+      default:
+        check.expectKey("count", true, before, true, multiset.count(key));
+        check.expect(multiset.contains(key) == (before != 0), "contains result");
+        break;
+      }
+    }
+
+    /* Walks the keys forward and backward, and the counts by for_each. */
+    static void checkAll(const Multiset& multiset, const Reference& ref,
+                         const Checker& check) {
+      std::vector<Key> expectedKeys;
+      for (typename std::map<Key, uint64_t>::const_iterator itr = ref.counts.begin();
+           itr != ref.counts.end(); ++itr)
+        expectedKeys.push_back(itr->first);
+      check.expect(std::vector<Key>(multiset.begin(), multiset.end()) == expectedKeys,
+                   "forward walk");
+      check.expect(std::vector<Key>(multiset.rbegin(), multiset.rend()) ==
+                   std::vector<Key>(expectedKeys.rbegin(), expectedKeys.rend()),
+                   "backward walk");
+
+      typename std::map<Key, uint64_t>::const_iterator itr = ref.counts.begin();
+      bool same = true;
+      multiset.for_each([&](Key key, Count copies) {
+        same = same && itr != ref.counts.end() && itr->first == key &&
+               itr->second == copies;
+        if (itr != ref.counts.end()) ++itr;
+      });
+      check.expect(same && itr == ref.counts.end(), "for_each");
+      check.expectSize(ref.size, multiset.size());
+      check.expectSize(ref.counts.size(), multiset.distinct_size());
+    }
+  };
+
+  /**
+   * The variants, each with a function to check it against a string of
+   * bytes and a function to time it on a list of operations.
+   */
+  struct Variant {
+    const char* name;
+    void (*run)(const char* name, const uint8_t* data, size_t size);
+    uint64_t (*time)(const std::vector<Op>& ops);
+  };
+
+  template <typename Clusters, size_t LeafBits, size_t UniverseBits = 16,
+            typename Key = unsigned short>
+  struct Tree {
+    typedef TreeVariant<VanEmdeBoasTree<Key, UniverseBits, Clusters, LeafBits>,
+                        UniverseBits> type;
+  };
+  template <typename Tree, size_t UniverseBits, bool Snapshots = false>
+  struct Wrapper {
+    typedef WrapperVariant<Tree, UniverseBits, Snapshots> type;
+  };
+  template <typename Values, size_t UniverseBits = 16, typename Key = unsigned short>
+  struct Map {
+    typedef MapVariant<VanEmdeBoasMap<std::string, Key, UniverseBits, Values>,
+                       UniverseBits> type;
+  };
+  template <typename Values, typename Count = size_t, size_t UniverseBits = 16,
+            typename Key = unsigned short>
+  struct Multiset {
+    typedef MultisetVariant<VanEmdeBoasMultiset<Key, UniverseBits, Count, Values>,
+                            UniverseBits> type;
+  };
+
+  inline const std::vector<Variant>& variants() {
+    typedef unsigned short Key;
+    static const std::vector<Variant> kVariants = {
+      { "tree",              Tree<DenseClusters, 8>::type::run,
+                             Tree<DenseClusters, 8>::type::time },
+      { "tree/u15",          Tree<DenseClusters, 8, 15>::type::run,
+                             Tree<DenseClusters, 8, 15>::type::time },
+      { "tree/leaf4",        Tree<DenseClusters, 4>::type::run,
+                             Tree<DenseClusters, 4>::type::time },
+      { "tree/leaf6",        Tree<DenseClusters, 6>::type::run,
+                             Tree<DenseClusters, 6>::type::time },
+      { "tree/leaf12",       Tree<DenseClusters, 12>::type::run,
+                             Tree<DenseClusters, 12>::type::time },
+      { "tree/counted_u12_leaf12",
+                             Tree<CountedClusters<DenseClusters>, 12, 12>::type::run,
+                             Tree<CountedClusters<DenseClusters>, 12, 12>::type::time },
+      { "tree/arena",        Tree<ArenaClusters, 8>::type::run,
+                             Tree<ArenaClusters, 8>::type::time },
+      { "tree/bounded",      Tree<BoundedClusters, 8>::type::run,
+                             Tree<BoundedClusters, 8>::type::time },
+      { "tree/hashed",       Tree<HashedClusters, 8>::type::run,
+                             Tree<HashedClusters, 8>::type::time },
+      { "tree/counted",      Tree<CountedClusters<DenseClusters>, 8>::type::run,
+                             Tree<CountedClusters<DenseClusters>, 8>::type::time },
+      { "tree/counted_arena_leaf6",
+                             Tree<CountedClusters<ArenaClusters>, 6>::type::run,
+                             Tree<CountedClusters<ArenaClusters>, 6>::type::time },
+      { "tree/allocated",    Tree<AllocatedClusters<DenseClusters, std::allocator<char> >, 8>::type::run,
+                             Tree<AllocatedClusters<DenseClusters, std::allocator<char> >, 8>::type::time },
+      { "tree/u32",          Tree<DenseClusters, 8, 32, uint32_t>::type::run,
+                             Tree<DenseClusters, 8, 32, uint32_t>::type::time },
+      { "tree/u32_hashed",   Tree<HashedClusters, 8, 32, uint32_t>::type::run,
+                             Tree<HashedClusters, 8, 32, uint32_t>::type::time },
+      { "tree/u32_counted_hashed",
+                             Tree<CountedClusters<HashedClusters>, 8, 32, uint32_t>::type::run,
+                             Tree<CountedClusters<HashedClusters>, 8, 32, uint32_t>::type::time },
+      { "tree/u32_counted_bounded_leaf6",
+                             Tree<CountedClusters<BoundedClusters>, 6, 32, uint32_t>::type::run,
+                             Tree<CountedClusters<BoundedClusters>, 6, 32, uint32_t>::type::time },
+      { "tree/u64",          Tree<HashedClusters, 8, 64, uint64_t>::type::run,
+                             Tree<HashedClusters, 8, 64, uint64_t>::type::time },
+      { "tree/u64_leaf12",   Tree<HashedClusters, 12, 64, uint64_t>::type::run,
+                             Tree<HashedClusters, 12, 64, uint64_t>::type::time },
+      { "tree/u40",          Tree<HashedClusters, 8, 40, uint64_t>::type::run,
+                             Tree<HashedClusters, 8, 40, uint64_t>::type::time },
+      { "concurrent",        Wrapper<ConcurrentVanEmdeBoasTree<Key>, 16>::type::run,
+                             Wrapper<ConcurrentVanEmdeBoasTree<Key>, 16>::type::time },
+      { "concurrent/u15",    Wrapper<ConcurrentVanEmdeBoasTree<Key, 15>, 15>::type::run,
+                             Wrapper<ConcurrentVanEmdeBoasTree<Key, 15>, 15>::type::time },
+      { "concurrent/lock_free",
+                             Wrapper<ConcurrentVanEmdeBoasTree<Key, 16, LockFreeSummaries>, 16>::type::run,
+                             Wrapper<ConcurrentVanEmdeBoasTree<Key, 16, LockFreeSummaries>, 16>::type::time },
+      { "concurrent/u32",    Wrapper<ConcurrentVanEmdeBoasTree<uint32_t>, 32>::type::run,
+                             Wrapper<ConcurrentVanEmdeBoasTree<uint32_t>, 32>::type::time },
+      { "concurrent/u32_lock_free",
+                             Wrapper<ConcurrentVanEmdeBoasTree<uint32_t, 32, LockFreeSummaries>, 32>::type::run,
+                             Wrapper<ConcurrentVanEmdeBoasTree<uint32_t, 32, LockFreeSummaries>, 32>::type::time },
+      { "sharded",           Wrapper<ShardedVanEmdeBoasTree<Key>, 16>::type::run,
+                             Wrapper<ShardedVanEmdeBoasTree<Key>, 16>::type::time },
+      { "sharded/u32_shard6",
+                             Wrapper<ShardedVanEmdeBoasTree<uint32_t, 32, 6>, 32>::type::run,
+                             Wrapper<ShardedVanEmdeBoasTree<uint32_t, 32, 6>, 32>::type::time },
+      { "sharded/u64",       Wrapper<ShardedVanEmdeBoasTree<uint64_t>, 64>::type::run,
+                             Wrapper<ShardedVanEmdeBoasTree<uint64_t>, 64>::type::time },
+      { "persistent",        Wrapper<PersistentVanEmdeBoasTree<Key>, 16, true>::type::run,
+                             Wrapper<PersistentVanEmdeBoasTree<Key>, 16, true>::type::time },
+      { "persistent/u15",    Wrapper<PersistentVanEmdeBoasTree<Key, 15>, 15, true>::type::run,
+                             Wrapper<PersistentVanEmdeBoasTree<Key, 15>, 15, true>::type::time },
+      { "persistent/u32",    Wrapper<PersistentVanEmdeBoasTree<uint32_t>, 32, true>::type::run,
+                             Wrapper<PersistentVanEmdeBoasTree<uint32_t>, 32, true>::type::time },
+      { "map",               Map<DenseValues>::type::run,
+                             Map<DenseValues>::type::time },
+      { "map/u15",           Map<DenseValues, 15>::type::run,
+                             Map<DenseValues, 15>::type::time },
+      { "map/hashed",        Map<HashedValues>::type::run,
+                             Map<HashedValues>::type::time },
+      { "map/u32",           Map<HashedValues, 32, uint32_t>::type::run,
+                             Map<HashedValues, 32, uint32_t>::type::time },
+      { "map/u64",           Map<HashedValues, 64, uint64_t>::type::run,
+                             Map<HashedValues, 64, uint64_t>::type::time },
+      { "multiset",          Multiset<DenseValues>::type::run,
+                             Multiset<DenseValues>::type::time },
+      { "multiset/u15",      Multiset<DenseValues, size_t, 15>::type::run,
+                             Multiset<DenseValues, size_t, 15>::type::time },
+      { "multiset/u8_counts",
+                             Multiset<DenseValues, uint8_t>::type::run,
+                             Multiset<DenseValues, uint8_t>::type::time },
+      { "multiset/hashed_u8_counts",
+                             Multiset<HashedValues, uint8_t>::type::run,
+                             Multiset<HashedValues, uint8_t>::type::time },
+      { "multiset/u32",      Multiset<HashedValues, uint32_t, 32, uint32_t>::type::run,
+                             Multiset<HashedValues, uint32_t, 32, uint32_t>::type::time },
+      { "multiset/u64",      Multiset<HashedValues, size_t, 64, uint64_t>::type::run,
+                             Multiset<HashedValues, size_t, 64, uint64_t>::type::time },
+    };
+    return kVariants;
+  }
+
+  /**
+   * Runs threads on a tree at once, each inserting, erasing, and looking up
+   * keys of its own, which are the widened keys whose bottom two bits give
+   * the thread's number.  Each thread checks its inserts, erases, and
+   * lookups against a set of its own keys, since no other thread touches
+   * them, and checks that a successor or predecessor lies on the right side
+   * of the key asked about and, if it's one of the thread's own keys, is in
+   * its set.  If Exact is set, as for trees that never miss a key that was
+   * in the tree for the whole call, it also checks that no neighbor is
+   * further away than the thread's own nearest key.  Once every thread is
+   * done, a walk over the tree must find exactly the keys left in the sets.
+   */
+  template <typename Tree, bool Exact>
+  class ThreadedVariant {
+    typedef typename Tree::key_type Key;
+    typedef std::set<Key> Reference;
+
+  public:
+    static const size_t kNumThreads = 4;
+
+    static void run(const char* name, unsigned seed, size_t numOps) {
+      Tree tree;
+      std::vector<Reference> refs(kNumThreads);
+      std::vector<std::thread> threads;
+      for (size_t t = 0; t < kNumThreads; ++t)
+        threads.push_back(std::thread(work, name, std::ref(tree), std::ref(refs[t]),
+                                      t, seed + unsigned(t), numOps));
+      for (size_t t = 0; t < kNumThreads; ++t) threads[t].join();
+
+      Reference all;
+      for (size_t t = 0; t < kNumThreads; ++t) all.insert(refs[t].begin(), refs[t].end());
+      Key actual = 0;
+      bool found = tree.first(actual);
+      for (typename Reference::const_iterator itr = all.begin(); itr != all.end(); ++itr) {
+        if (!found || actual != *itr)
+          failThreaded(name, "walk: expected " + std::to_string(uint64_t(*itr)) +
+                       ", got " + describe(found, actual));
+        found = tree.successor(actual, actual);
+      }
+      if (found) failThreaded(name, "walk: extra key " + std::to_string(uint64_t(actual)));
+      if (tree.size() != all.size()) failThreaded(name, "size after the threads finished");
+    }
+
+  private:
+    static void work(const char* name, Tree& tree, Reference& ref, size_t thread,
+                     unsigned seed, size_t numOps) {
+      std::mt19937 generator(seed);
+      for (size_t i = 0; i < numOps; ++i) {
+        const uint32_t random = generator();
+        const Key key = static_cast<Key>((widen<Key>(uint16_t(random)) & ~Key(3)) | thread);
+        Key expected = 0, actual = 0;
+        switch ((random >> 16) % 6) {
+        case 0: case 1:
+          if (tree.insert(key) != ref.insert(key).second) failThreaded(name, "insert result");
+          break;
+        case 2:
+          if (tree.erase(key) != (ref.erase(key) != 0)) failThreaded(name, "erase result");
+          break;
+        case 3:
+          if (tree.contains(key) != (ref.count(key) != 0)) failThreaded(name, "contains result");
+          break;
+        case 4: {
+          const bool expectedFound = refSuccessor(ref, key, expected);
+          const bool found = tree.successor(key, actual);
+          checkNeighbor(name, "successor", ref, thread, found, actual > key,
+                        expectedFound, found && actual <= expected, actual);
+          break;
+        }
+        default: {
+          const bool expectedFound = refPredecessor(ref, key, expected);
+          const bool found = tree.predecessor(key, actual);
+          checkNeighbor(name, "predecessor", ref, thread, found, actual < key,
+                        expectedFound, found && actual >= expected, actual);
+          break;
+        }
+        }
+      }
+    }
+
+    static void checkNeighbor(const char* name, const char* what, const Reference& ref,
+                              size_t thread, bool found, bool rightSide,
+                              bool ownFound, bool notPastOwn, Key actual) {
+      if (found && !rightSide)
+        failThreaded(name, std::string(what) + " on the wrong side of the key");
+      if (found && (actual & 3) == thread && ref.count(actual) == 0)
+        failThreaded(name, std::string(what) + " returned an erased key");
+      if (Exact && ownFound && !notPastOwn)
+        failThreaded(name, std::string(what) + " skipped one of the thread's keys");
+    }
+
+    static void failThreaded(const char* name, const std::string& what) {
+      std::fprintf(stderr, "%s (threaded): %s\n", name, what.c_str());
+      std::abort();
+    }
+  };
+
+  /* The trees that are safe to use from several threads at once. */
+  struct ThreadedRun {
+    const char* name;
+    void (*run)(const char* name, unsigned seed, size_t numOps);
+  };
+  inline const std::vector<ThreadedRun>& threadedVariants() {
+    static const std::vector<ThreadedRun> kVariants = {
+      { "concurrent",        ThreadedVariant<ConcurrentVanEmdeBoasTree<unsigned short>, true>::run },
+      { "concurrent/lock_free",
+                             ThreadedVariant<ConcurrentVanEmdeBoasTree<unsigned short, 16,
+                                                                       LockFreeSummaries>, false>::run },
+      { "concurrent/u32",    ThreadedVariant<ConcurrentVanEmdeBoasTree<uint32_t>, true>::run },
+      { "concurrent/u32_lock_free",
+                             ThreadedVariant<ConcurrentVanEmdeBoasTree<uint32_t, 32,
+                                                                       LockFreeSummaries>, false>::run },
+      { "sharded",           ThreadedVariant<ShardedVanEmdeBoasTree<unsigned short>, true>::run },
+      { "sharded/u64",       ThreadedVariant<ShardedVanEmdeBoasTree<uint64_t>, true>::run },
+    };
+    return kVariants;
+  }
+
+  /* Checks every variant against a string of bytes. */
+  inline void runAll(const uint8_t* data, size_t size) {
+    Input& input = currentInput();
+    input.data = data;
+    input.size = size;
+    const std::vector<Variant>& all = variants();
+    for (size_t i = 0; i < all.size(); ++i) all[i].run(all[i].name, data, size);
+    input.data = NULL;
+  }
+}
+
+#endif // DIFFERENTIAL_H
@@ -0,0 +1,27 @@
+/**
+ * @file FuzzTarget.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief The differential tests as a libFuzzer target.
+ *
+ * libFuzzer needs clang, and isn't built by tests.pro.  Build and run with
+ *
+ *   clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -I.. \
+ *     FuzzTarget.cpp -o fuzz -lpthread
+ *   ./fuzz -max_len=4096 corpus/
+ *
+ * Every input is run against every variant in Differential.h.  Inputs that
+ * fail are written out by libFuzzer as well as to differential-failure.bin,
+ * and can be replayed without clang by
+ *
+ *   ./tests --replay crash-...
+ */
+
+#include "Differential.h"
+#include <cstddef> // For size_t
+#include <cstdint> // For uint8_t
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  Differential::runAll(data, size);
+  return 0;
+}
@@ -0,0 +1,183 @@
+/**
+ * @file PropertyTests.cpp
+ * @author: Richik Vivek Sen (rsen9@gatech.edu)
+ * @date 10/28/2019
+ * @brief Runs the differential tests on random inputs, replays saved ones,
+ *        and times every variant to catch slowdowns.
+ *
+ *   ./tests [--seed N] [--runs N] [--max-length BYTES] [--threaded-ops N]
+ *
+ * checks every variant in Differential.h against N random inputs of up to
+ * BYTES bytes each, four bytes to an operation, and stops at the first wrong
+ * answer.  The same seed gives the same inputs.  Then each tree that's safe
+ * to share runs ThreadedVariant, with every thread doing --threaded-ops
+ * operations (by default 20000; 0 skips it).  Build with -fsanitize=thread
+ * to check those runs for data races as well.
+ *
+ *   ./tests --replay FILE...
+ *
+ * runs saved inputs, such as differential-failure.bin or libFuzzer's crash
+ * files, against every variant.
+ *
+ *   ./tests --throughput [--ops N] [--save FILE] [--baseline FILE]
+ *           [--tolerance PERCENT]
+ *
+ * times every variant on the same N operations, a fixed mix of inserts,
+ * erases, lookups, and successor and predecessor queries, and prints each
+ * variant's millions of operations per second, best of five.  --save writes
+ * the rates to a file, and --baseline compares them with a saved file and
+ * fails if any variant is more than PERCENT (by default 10) percent slower.
+ * Baselines only mean something on the machine and build they came from.
+ */
+
+#include "Differential.h"
+#include <chrono>   // For steady_clock, duration
+#include <cstddef>  // For size_t
+#include <cstdint>  // For uint8_t, uint64_t
+#include <cstdio>   // For printf, fprintf
+#include <cstdlib>  // For strtoul, strtod
+#include <cstring>  // For strcmp
+#include <fstream>  // For ifstream, ofstream
+#include <iterator> // For istreambuf_iterator
+#include <map>      // For map
+#include <random>   // For mt19937
+#include <string>   // For string
+#include <vector>   // For vector
+
+namespace {
+  /* Checks every variant against random inputs. */
+  int runRandom(unsigned long seed, size_t runs, size_t maxLength, size_t threadedOps) {
+    std::mt19937 generator(seed);
+    std::vector<uint8_t> input;
+    for (size_t run = 0; run < runs; ++run) {
+      input.resize(generator() % (maxLength + 1));
+      for (size_t i = 0; i < input.size(); ++i) input[i] = uint8_t(generator());
+      Differential::runAll(input.data(), input.size());
+    }
+    std::printf("%zu random inputs passed on %zu variants (seed %lu).\n", runs,
+                Differential::variants().size(), seed);
+
+    if (threadedOps == 0) return 0;
+    const std::vector<Differential::ThreadedRun>& threaded = Differential::threadedVariants();
+    for (size_t i = 0; i < threaded.size(); ++i)
+      threaded[i].run(threaded[i].name, unsigned(seed), threadedOps);
+    std::printf("Threaded runs passed on %zu variants.\n", threaded.size());
+    return 0;
+  }
+
+  /* Checks every variant against saved inputs. */
+  int runReplay(const std::vector<std::string>& files) {
+    for (size_t i = 0; i < files.size(); ++i) {
+      std::ifstream file(files[i].c_str(), std::ios::binary);
+      if (!file) {
+        std::fprintf(stderr, "Can't open %s.\n", files[i].c_str());
+        return 1;
+      }
+      const std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)),
+                                       std::istreambuf_iterator<char>());
+      Differential::runAll(input.data(), input.size());
+      std::printf("%s passed.\n", files[i].c_str());
+    }
+    return 0;
+  }
+
+  /* Reads "name rate" lines. */
+  std::map<std::string, double> readRates(const std::string& path) {
+    std::map<std::string, double> rates;
+    std::ifstream file(path.c_str());
+    std::string name;
+    double rate;
+    while (file >> name >> rate) rates[name] = rate;
+    return rates;
+  }
+
+  /* Times every variant, and compares the rates with a baseline. */
+  int runThroughput(size_t numOps, const std::string& savePath,
+                    const std::string& baselinePath, double tolerance) {
+    std::mt19937 generator(137);
+    std::vector<uint8_t> bytes(numOps * Differential::kOpBytes);
+    for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = uint8_t(generator());
+    std::vector<Differential::Op> ops;
+    Differential::Decoder decoder(bytes.data(), bytes.size());
+    Differential::Op op;
+    while (decoder.next(op)) ops.push_back(op);
+
+    const std::map<std::string, double> baseline =
+      baselinePath.empty()? std::map<std::string, double>() : readRates(baselinePath);
+    if (!baselinePath.empty() && baseline.empty()) {
+      std::fprintf(stderr, "Can't read a baseline from %s.\n", baselinePath.c_str());
+      return 1;
+    }
+    std::ofstream save;
+    if (!savePath.empty()) save.open(savePath.c_str());
+
+    int status = 0;
+    const std::vector<Differential::Variant>& all = Differential::variants();
+    for (size_t v = 0; v < all.size(); ++v) {
+      double best = 0;
+      uint64_t checksum = 0;
+      for (int trial = 0; trial < 5; ++trial) {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        checksum += all[v].time(ops);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double rate = double(ops.size()) / elapsed.count() / 1e6;
+        if (rate > best) best = rate;
+      }
+
+      std::printf("%-32s %8.2f Mops/s", all[v].name, best);
+      std::map<std::string, double>::const_iterator itr = baseline.find(all[v].name);
+      if (itr != baseline.end()) {
+        const double change = (best / itr->second - 1) * 100;
+        const bool slower = change < -tolerance;
+        std::printf("  %+6.1f%%%s", change, slower? "  SLOWER" : "");
+        if (slower) status = 1;
+      }
+      std::printf("  (checksum %llu)\n", static_cast<unsigned long long>(checksum));
+      if (save) save << all[v].name << ' ' << best << '\n';
+    }
+
+    if (status != 0)
+      std::fprintf(stderr, "Some variants are more than %g%% slower than %s.\n",
+                   tolerance, baselinePath.c_str());
+    return status;
+  }
+
+  int usage() {
+    std::fprintf(stderr,
+                 "Usage: tests [--seed N] [--runs N] [--max-length BYTES] [--threaded-ops N]\n"
+                 "       tests --replay FILE...\n"
+                 "       tests --throughput [--ops N] [--save FILE] [--baseline FILE]\n"
+                 "                          [--tolerance PERCENT]\n");
+    return 2;
+  }
+}
+
+int main(int argc, char** argv) {
+  unsigned long seed = 137;
+  size_t runs = 200, maxLength = 4096, threadedOps = 20000, numOps = size_t(1) << 20;
+  bool replay = false, throughput = false;
+  std::string savePath, baselinePath;
+  double tolerance = 10;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool hasValue = i + 1 < argc;
+    if (std::strcmp(argv[i], "--replay") == 0) replay = true;
+    else if (std::strcmp(argv[i], "--throughput") == 0) throughput = true;
+    else if (std::strcmp(argv[i], "--seed") == 0 && hasValue) seed = std::strtoul(argv[++i], NULL, 10);
+    else if (std::strcmp(argv[i], "--runs") == 0 && hasValue) runs = std::strtoul(argv[++i], NULL, 10);
+    else if (std::strcmp(argv[i], "--max-length") == 0 && hasValue) maxLength = std::strtoul(argv[++i], NULL, 10);
+    else if (std::strcmp(argv[i], "--threaded-ops") == 0 && hasValue) threadedOps = std::strtoul(argv[++i], NULL, 10);
+    else if (std::strcmp(argv[i], "--ops") == 0 && hasValue) numOps = std::strtoul(argv[++i], NULL, 10);
+    else if (std::strcmp(argv[i], "--save") == 0 && hasValue) savePath = argv[++i];
+    else if (std::strcmp(argv[i], "--baseline") == 0 && hasValue) baselinePath = argv[++i];
+    else if (std::strcmp(argv[i], "--tolerance") == 0 && hasValue) tolerance = std::strtod(argv[++i], NULL);
+    else if (replay && argv[i][0] != '-') files.push_back(argv[i]);
+    else return usage();
+  }
+
+  if (replay && throughput) return usage();
+  if (replay) return runReplay(files);
+  if (throughput) return runThroughput(numOps, savePath, baselinePath, tolerance);
+  return runRandom(seed, runs, maxLength, threadedOps);
+}
@@ -0,0 +1,18 @@
+QT -= gui core
+
+TEMPLATE = app
+TARGET = tests
+CONFIG += c++11 console release
+CONFIG -= app_bundle qt
+
+# The tree is header-only, so the tests just need to see the headers.
+INCLUDEPATH += ..
+
+LIBS += -lpthread
+
+# FuzzTarget.cpp is built separately with clang; see the top of that file.
+SOURCES += \
+    PropertyTests.cpp
+
+HEADERS += \
+    Differential.h